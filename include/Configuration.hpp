@@ -13,6 +13,7 @@
 #include <boost/typeof/typeof.hpp>
 #include <unordered_map>
 #include <string>
+#include <vector>
 
 using namespace std;  
 using namespace boost::property_tree;
@@ -23,6 +24,9 @@ private:
 	unordered_map<uint16_t, string> id2ip;
 	unordered_map<string, uint16_t> ip2id;
 	int ServerCount;
+	vector<pair<string, uint16_t> > colocation; /* Root and spread of subtrees with metadata on parent node. */
+	string drainPath;                   /* Stage-out target, normally a directory on the parallel file system. */
+	uint64_t drainBandwidth;            /* MB/s per server, 0 for unlimited. */
 public:
 	Configuration();
 	~Configuration();
@@ -30,6 +34,9 @@ public:
 	uint16_t getIDbyIP(string ip);
 	unordered_map<uint16_t, string> getInstance();
 	int getServerCount();
+	vector<pair<string, uint16_t> > getColocation();
+	string getDrainPath();
+	uint64_t getDrainBandwidth();
 };
 
 #endif
\ No newline at end of file
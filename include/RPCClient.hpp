@@ -21,7 +21,7 @@ public:
 	~RPCClient();
 	RdmaSocket* getRdmaSocketInstance();
 	Configuration* getConfInstance();
-	bool RdmaCall(uint16_t DesNodeID, char *bufferSend, uint64_t lengthSend, char *bufferReceive, uint64_t lengthReceive);
+	bool RdmaCall(uint16_t DesNodeID, char *bufferSend, uint64_t lengthSend, char *bufferReceive, uint64_t lengthReceive, UniqueHash *hashPath = NULL);
 	uint64_t ContractSendBuffer(GeneralSendBuffer *send);
 };
 
@@ -1,6 +1,7 @@
 #ifndef RPCSERVER_HREADER
 #define RPCSERVER_HREADER
 #include <thread>
+#include <atomic>
 #include <unordered_map>
 #include <vector>
 #include "RdmaSocket.hpp"
@@ -20,6 +21,7 @@ typedef struct {
 	uint64_t send;
 	uint16_t NodeID;
 	uint16_t offset;
+	uint64_t timeReady;                 /* Monotonic time in us request is retried from. */
 } RPCTask;
 
 class RPCServer {
@@ -37,8 +39,10 @@ private:
 	FileSystem *fs;
 	int cqSize;
 	Thread2ID th2id;
-	vector<RPCTask*> tasks;
+	vector<RPCTask*> tasks;              /* Requests put off until leases of other clients end. */
+	mutex mutexTasks;
 	bool UnlockWait;
+	std::atomic<bool> stopping;         /* Workers return once set. */
 	void TestSend();
 	void TestRecv();
 	void Worker(int id);
@@ -22,7 +22,9 @@ typedef struct  {
 typedef struct {
     uint64_t TxID;
     bool begin;
-    char logData[4086];
+    uint64_t target;                    /* Offset of item logData is put to from LocalLogAddress, 0 if none or applied. */
+    uint32_t size;                      /* Size of logData to put to target. */
+    char logData[4074];
     bool commit;
 } __attribute__((packed)) LocalLogEntry;
 
@@ -41,7 +43,10 @@ public:
 	uint64_t TxLocalBegin();
 	void TxWriteData(uint64_t TxID, uint64_t address, uint64_t size);
 	uint64_t getTxWriteDataAddress(uint64_t txID);
+	void TxWriteTarget(uint64_t TxID, uint64_t address);
+	void TxLocalApplied(uint64_t TxID);
 	void TxLocalCommit(uint64_t TxID, bool action);
+	void recover();
 	uint64_t TxDistributedBegin();
 	void TxDistributedPrepare(uint64_t TxID, bool action);
 	void TxDistributedCommit(uint64_t TxID, bool action);
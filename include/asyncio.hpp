@@ -0,0 +1,69 @@
+/*** Asynchronous file I/O header. io_uring with thread pool fallback. ***/
+
+/** Redundance check. **/
+#ifndef ASYNCIO_HEADER
+#define ASYNCIO_HEADER
+
+/** Included files. **/
+#include <stdint.h>                     /* Standard integers. E.g. uint16_t */
+#include <sys/uio.h>                    /* Vector I/O. E.g. struct iovec */
+#include <mutex>                        /* Mutex operations. */
+#include <condition_variable>           /* Wait for free slot. */
+#include <thread>                       /* Reaper and pool threads. */
+#include <functional>                   /* Completion callback. */
+#include <vector>
+#include "global.h"                     /* Queue template. */
+
+/** Structures. **/
+typedef std::function<void(int64_t)> AsyncIOCallback; /* Called with bytes transferred or -errno. */
+
+typedef struct {                        /* One vectored read or write. */
+    bool write;                         /* Write if true, read if false. */
+    int fd;                             /* File. */
+    struct iovec iov[2];                /* Buffers. Must stay valid until completion. */
+    int countIov;                       /* Count of buffers. */
+    uint64_t offset;                    /* File offset. */
+    AsyncIOCallback callback;           /* Completion callback. */
+} AsyncIORequest;
+
+/** Classes. **/
+class AsyncIO                           /* Submits requests to io_uring, or to a thread pool if io_uring is not available. */
+{
+private:
+    bool useRing;                       /* io_uring is set up. */
+    unsigned depth;                     /* Max requests in flight. */
+    unsigned countInflight;             /* Requests submitted and not completed. */
+    unsigned countUnsubmitted;          /* Requests in SQ ring not yet passed to kernel. */
+    std::mutex mutexSubmit;             /* Protects SQ ring and counters. */
+    std::condition_variable condSlot;   /* Signaled when a request completes. */
+    /* io_uring. */
+    int fdRing;
+    void *sqRing;
+    void *cqRing;
+    void *sqes;
+    uint64_t sizeSqRing;
+    uint64_t sizeCqRing;
+    uint64_t sizeSqes;
+    unsigned *sqHead, *sqTail, *sqMask, *sqEntries, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    void *cqes;
+    std::thread reaper;
+    /* Thread pool. */
+    Queue<AsyncIORequest *> queue;
+    std::vector<std::thread> workers;
+    bool setupRing();                   /* Create io_uring and map rings. */
+    void enter();                       /* Pass unsubmitted requests to kernel. Called with mutexSubmit held. */
+    void complete(AsyncIORequest *request, int64_t result);
+    void ReaperWorker();
+    void PoolWorker();
+
+public:
+    void submit(AsyncIORequest *request); /* Queue request, ownership is taken. Blocks while depth requests are in flight. */
+    void flush();                       /* Start all queued requests. */
+    bool isRing();                      /* Whether io_uring is used. */
+    AsyncIO(unsigned depth, int countThread); /* Constructor. Thread pool of countThread is used without io_uring. */
+    ~AsyncIO();                         /* Destructor. Requests in flight must be completed. */
+};
+
+/** Redundance check. **/
+#endif
@@ -12,6 +12,27 @@
 #include <stdio.h>                      /* Standard I/O operations. E.g. fprintf() */            
 #include <string.h>                     /* Header for memory operations. E.g. memset() */
 
+/** Design. **/
+
+/*
+    Bits are kept in buffer most significant bit first in each byte, so the layout of a persisted
+    buffer does not change. The buffer is scanned 64 bits at a time.
+
+    A summary is built above the buffer in memory only. Bit i of level 0 is set when word i of
+    buffer is full, bit i of level k + 1 is set when word i of level k is full. Levels are added
+    until one word is left, so finding the first free bit reads one word per level.
+
+                +----------------+
+      level 1   |1 0 ............|
+                +----------------+
+      level 0   |1 1 .... 1|0 1 .... 0|
+                +----------+----------+
+      buffer    |  64 bits | ........ | ....
+*/
+
+/** Definitions. **/
+#define BITMAP_LEVEL_MAX 8              /* Max summary levels. 64 ^ 8 words is far beyond any table. */
+
 /** Classes. **/
 class Bitmap
 {
@@ -19,6 +40,12 @@ private:
     uint8_t *bytes;                     /* Byte array to hold bitmap. */
     uint64_t varCountFree;              /* Count variable of free bits. */
     uint64_t varCountTotal;             /* Count variable of total bits. */
+    uint64_t countWord;                 /* Count of 64-bit words in buffer, the last one may be partial. */
+    uint64_t *summary[BITMAP_LEVEL_MAX]; /* Summary levels. Bit set means the word below is full. */
+    int countLevel;                     /* Count of summary levels. */
+    uint64_t loadWord(uint64_t index);  /* Word of buffer in position order, bits past end are set. */
+    void markFull(uint64_t index);      /* Word of buffer became full. */
+    void markNotFull(uint64_t index);   /* Word of buffer is not full any more. */
 
 public:
     bool get(uint64_t pos, bool *status); /* Get status of a bit. */
@@ -32,4 +59,4 @@ public:
 };
 
 /** Redundance check. **/
-#endif
\ No newline at end of file
+#endif
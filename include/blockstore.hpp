@@ -0,0 +1,195 @@
+/*** Block store header for the SSD storage tier and the spill tier. ***/
+
+/** Redundance check. **/
+#ifndef BLOCKSTORE_HEADER
+#define BLOCKSTORE_HEADER
+
+/** Included files. **/
+#include <stdint.h>                     /* Standard integers. E.g. uint16_t */
+#include <mutex>                        /* Mutex operations. */
+#include <condition_variable>           /* Wake compactor. */
+#include <thread>                       /* Compactor thread. */
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <string>
+#include <functional>                   /* Completion callback. */
+#include "asyncio.hpp"                  /* Asynchronous I/O. */
+#include "kcdirdb.h"                    /* Kyoto Cabinet directory database. */
+
+/** Design. **/
+
+/*
+    Log file is cut into segments. Records are appended to the open segment, a record never spans
+    two segments. Rewriting a key appends a new record and the old one becomes dead space.
+
+                                        - Record -
+    +-----------------------------------+------------------------------------------+
+    | Header (LOG_ALIGN bytes)          | Data (length rounded up to LOG_ALIGN)    |
+    | magic | key | length | sequence | |                                          |
+    | generation                        |                                          |
+    +-----------------------------------+------------------------------------------+
+
+                                       - Log file -
+    +--------------+--------------+--------------+------+--------------+
+    |  Segment 0   |  Segment 1   |  Segment 2   | .... |  Segment n   |
+    | rec rec .... | rec rec .... |    (free)    |      |              |
+    +--------------+--------------+--------------+------+--------------+
+
+    The index (key -> offset, length) lives only in memory. Compactor copies live records out of
+    the segment with least live bytes once free segments run low, or any nearly empty segment,
+    then returns it to free list.
+    A segment gets a new generation each time appending to it starts, and its records carry it, so
+    records left from an earlier use of a segment are never taken as records of the current one.
+    First header of a free segment is cleared, so nothing in it is taken as a record at all.
+    Headers carry key and sequence, so on warm restart the index is rebuilt by scanning the log,
+    the record with the highest sequence of a key wins. Removing a key appends a tombstone (a
+    header with length LOG_TOMBSTONE), so older records of it are not brought back. A tombstone
+    is live until its key is written again, or until the last segment holding an older record of
+    its key is recycled. Until then it is relocated by compaction like a record.
+
+    All I/O goes through AsyncIO. A write is published in the index when it completes, until then
+    reads of that key are served from the buffer being written. A relocated record keeps its
+    sequence, so a newer write racing with compaction always wins.
+*/
+
+/** Definitions. **/
+#define LOG_ALIGN 4096                  /* Alignment of O_DIRECT I/O and of records. */
+#define LOG_MAGIC 0x4e524653424c4f47ULL /* "NRFSBLOG". */
+#define LOG_TOMBSTONE ((uint64_t)-1)    /* Length of a record marking its key removed, it has no data. */
+#define LOG_SEGMENT_SIZE (256 * 1024 * 1024ULL) /* Size of a segment in bytes. */
+#define LOG_COMPACT_FREE 4              /* Compact when free segments are fewer than this. */
+#define LOG_COMPACT_LIVE 75             /* Only compact segments with live bytes below this percent. */
+#define LOG_COMPACT_IDLE 1              /* Compact segments with live bytes below this percent anyway, e.g. ones holding only tombstones. */
+#define LOG_IO_DEPTH 64                 /* Max I/O requests in flight. */
+#define LOG_IO_THREADS 8                /* Threads doing I/O when io_uring is not available. */
+#define POSIX_IO_DEPTH 32               /* Max spill tier requests in flight. */
+#define POSIX_IO_THREADS 8              /* Threads doing spill tier I/O when io_uring is not available. */
+
+/** Structures. **/
+typedef struct {                        /* Record header, padded to LOG_ALIGN on disk. */
+    uint64_t magic;                     /* LOG_MAGIC. */
+    uint64_t key;                       /* Key of block. */
+    uint64_t length;                    /* Length of data in bytes. */
+    uint64_t sequence;                  /* Increasing sequence, the latest record of a key wins. */
+    uint64_t generation;                /* Generation of segment when written, from 1. */
+} LogRecordHeader;
+
+typedef struct {                        /* Index entry of a record. */
+    uint64_t offset;                    /* Offset of record header in log file. */
+    uint64_t length;                    /* Length of data in bytes. */
+    uint64_t sequence;                  /* Sequence of record. */
+} LogIndexEntry;
+
+typedef struct {                        /* Write being in flight, its data is served from the caller buffer. */
+    const char *buffer;
+    uint64_t length;
+    uint64_t sequence;
+} PendingWrite;
+
+typedef std::function<void(int64_t)> BlockStoreCallback; /* Called with length of data, -1 on error. */
+
+/** Classes. **/
+class BlockStore                        /* Storage tier interface. Keys are block hashes. Must be thread safe. */
+{
+public:
+    virtual int64_t get(uint64_t key, char *buffer, uint64_t size) = 0; /* Read block. Return length, -1 if not found. */
+    virtual bool set(uint64_t key, const char *buffer, uint64_t size) = 0; /* Write block, replace old one. */
+    virtual bool remove(uint64_t key) = 0; /* Remove block. */
+    /* Asynchronous versions, buffer must stay valid until callback. Default ones are synchronous. */
+    virtual void getAsync(uint64_t key, char *buffer, uint64_t size, BlockStoreCallback callback) { callback(get(key, buffer, size)); }
+    virtual void setAsync(uint64_t key, const char *buffer, uint64_t size, BlockStoreCallback callback) { callback(set(key, buffer, size) ? (int64_t)size : -1); }
+    virtual void flush() {}             /* Start queued asynchronous requests. */
+    virtual bool full() { return false; } /* Whether new blocks should go to another store. */
+    virtual ~BlockStore() {}
+    static BlockStore *create(const char *engine, const char *path, uint64_t capacity, bool recover); /* Create store by engine name, NULL on error. */
+};
+
+class DirBlockStore : public BlockStore /* One file per block in a Kyoto Cabinet directory database. */
+{
+private:
+    kyotocabinet::DirDB db;
+
+public:
+    int64_t get(uint64_t key, char *buffer, uint64_t size);
+    bool set(uint64_t key, const char *buffer, uint64_t size);
+    bool remove(uint64_t key);
+    bool open(const char *path, bool recover);
+    ~DirBlockStore();
+};
+
+class LogBlockStore : public BlockStore /* Log structured store with O_DIRECT asynchronous I/O on a single file. */
+{
+private:
+    int fd;                             /* Log file. */
+    uint64_t countSegment;              /* Count of segments in log file. */
+    AsyncIO *io;                        /* io_uring or thread pool. */
+    std::mutex mutexIndex;              /* Protects everything below. */
+    std::unordered_map<uint64_t, LogIndexEntry> index;
+    std::unordered_map<uint64_t, PendingWrite> pending; /* Latest write in flight of each key. */
+    std::unordered_map<uint64_t, LogIndexEntry> tombstones; /* Removed keys whose older records may still be in log. */
+    std::vector<std::pair<uint64_t, uint64_t> > tombstonesQueued; /* Key and sequence of tombstones to append. */
+    std::unordered_map<uint64_t, uint64_t> countRecord; /* Data records of each key in log, live or dead, including writes in flight. */
+    std::vector<uint64_t> bytesLive;    /* Live bytes (including headers) of each segment. */
+    std::vector<uint64_t> countReader;  /* Reads in flight of each segment, segment cannot be recycled meanwhile. */
+    std::vector<uint64_t> segmentsFree; /* Free segments. */
+    std::vector<uint64_t> segmentsRetired; /* Full segments, candidates for compaction. */
+    std::vector<uint64_t> generations;  /* Generation of each segment, assigned when appending to it starts. */
+    uint64_t generationNext;            /* Generation of next segment appended to. */
+    uint64_t segmentCurrent;            /* Segment being appended to. */
+    uint64_t offsetCurrent;             /* Append offset in current segment. */
+    uint64_t sequence;                  /* Next record sequence. */
+    std::condition_variable condCompact;
+    std::thread compactor;
+    bool stop;
+    uint64_t recordSize(uint64_t length); /* On disk size of a record. */
+    bool reserve(uint64_t sizeRecord, uint64_t *offset); /* Take room at log head. Called with mutexIndex held. */
+    void write(uint64_t key, const char *buffer, uint64_t size, uint64_t sequenceOld, uint64_t offsetOld, BlockStoreCallback callback); /* Append record and publish it in index on completion. */
+    void writeTombstone(uint64_t key, uint64_t sequenceTombstone, uint64_t offsetOld, BlockStoreCallback callback); /* Append tombstone and publish it on completion. */
+    void writeTombstones();             /* Append queued tombstones and wait for them. */
+    bool rebuild();                     /* Rebuild index and segment lists by scanning log. */
+    bool scanSegment(uint64_t segment, uint64_t *generation, std::vector<LogRecordHeader> *headers); /* Read headers of records in segment. */
+    bool clearSegment(uint64_t segment, uint64_t *generation); /* Clear first header of a free segment. */
+    void forgetRecords(const std::vector<LogRecordHeader> &headers); /* Account records of a recycled segment. Called with mutexIndex held. */
+    bool compactSegment(uint64_t segment); /* Move live records out of segment. */
+    void CompactorWorker();
+
+public:
+    int64_t get(uint64_t key, char *buffer, uint64_t size);
+    bool set(uint64_t key, const char *buffer, uint64_t size);
+    bool remove(uint64_t key);
+    void getAsync(uint64_t key, char *buffer, uint64_t size, BlockStoreCallback callback);
+    void setAsync(uint64_t key, const char *buffer, uint64_t size, BlockStoreCallback callback);
+    void flush();
+    bool full();
+    bool open(const char *path, uint64_t capacity, bool recover);
+    uint64_t countTombstones();         /* Tombstones kept in log. */
+    LogBlockStore();
+    ~LogBlockStore();
+};
+
+class PosixBlockStore : public BlockStore /* One file per block in a directory, e.g. on a parallel file system. */
+{
+private:
+    std::string directory;              /* Directory of block files. */
+    AsyncIO *io;                        /* io_uring or thread pool. */
+    std::mutex mutexKeys;               /* Protects everything below. */
+    std::unordered_set<uint64_t> keys;  /* Keys having a block file. */
+    std::unordered_map<uint64_t, PendingWrite> pending; /* Latest write in flight of each key. */
+    uint64_t sequence;                  /* Suffix of temporary files. */
+    std::string getName(uint64_t key);  /* Block file of key. */
+
+public:
+    int64_t get(uint64_t key, char *buffer, uint64_t size);
+    bool set(uint64_t key, const char *buffer, uint64_t size);
+    bool remove(uint64_t key);
+    void getAsync(uint64_t key, char *buffer, uint64_t size, BlockStoreCallback callback);
+    void setAsync(uint64_t key, const char *buffer, uint64_t size, BlockStoreCallback callback);
+    void flush();
+    bool open(const char *path, bool recover);
+    PosixBlockStore();
+    ~PosixBlockStore();
+};
+
+/** Redundance check. **/
+#endif
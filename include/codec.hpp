@@ -0,0 +1,25 @@
+/*** Block compression header. ***/
+
+/** Redundance check. **/
+#ifndef CODEC_HEADER
+#define CODEC_HEADER
+
+/** Included files. **/
+#include <stdint.h>                     /* Standard integers. E.g. uint16_t */
+#include "common.hpp"                   /* BlockCodec. */
+
+/** Definitions. **/
+#define CODEC_ZSTD_LEVEL 1              /* zstd compression level, low levels keep up with SSD bandwidth. */
+
+/** Classes. **/
+class Codec                             /* LZ4 and zstd are used only if they are found at build time (HAVE_LZ4, HAVE_ZSTD). */
+{
+public:
+    static bool available(uint16_t codec); /* Whether codec is built in. */
+    static const char *name(uint16_t codec); /* Name of codec. */
+    static uint64_t compress(uint16_t codec, const char *src, uint64_t size, char *dest, uint64_t capacity); /* Compress, return length or 0. */
+    static bool decompress(uint16_t codec, const char *src, uint64_t length, char *dest, uint64_t size); /* Decompress exactly size bytes. */
+};
+
+/** Redundance check. **/
+#endif
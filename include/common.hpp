@@ -36,14 +36,38 @@ struct nrfsfileattr
 #define MAX_PATH_LENGTH 255             /* Max length of path. */
 
 /** Definitions. **/
-#define MAX_FILE_EXTENT_COUNT 512        /* Max extent count in meta of a file. */
+#define FILE_INLINE_BLOCK_COUNT 4       /* Block infos kept in file meta itself, enough for small files. */
+#define FILE_EXTENT_PAGE_COUNT 64       /* Extent pages a file meta refers to. */
+#define EXTENT_PAGE_BLOCK_COUNT 512     /* Block infos in an extent page. */
+#define MAX_FILE_EXTENT_COUNT (FILE_INLINE_BLOCK_COUNT + FILE_EXTENT_PAGE_COUNT * EXTENT_PAGE_BLOCK_COUNT) /* Max block count of a file, 512 GB. */
 #define BLOCK_SIZE (16 * 1024 * 1024)    /* Current block size in bytes. */
+#define TIER_SPILL 2                    /* Tier of blocks kept in SPILL_PATH. 0 is memory tier, 1 is SSD tier. */
 #define MAX_FILE_NAME_LENGTH 50         /* Max file name length. */
-#define MAX_DIRECTORY_COUNT 60         /* Max directory count. */
+#define MAX_DIRECTORY_COUNT 60         /* Max names in a readdir reply. */
+#define MAX_DIRECTORY_PLUS_COUNT (8 * MAX_DIRECTORY_COUNT) /* Max names with attributes in a readdirplus reply. */
+#define DIRECTORY_PAGE_ENTRY_COUNT MAX_DIRECTORY_COUNT /* Names in a directory page, a page is listed in one reply. */
+#define DIRECTORY_SHARD_MAX 64          /* Max shards of a directory, bits of shard bitmap. */
 
 /** Classes and structures. **/
 typedef uint64_t NodeHash;              /* Node hash. */
 
+typedef struct {                        /* Unique hash structure for identify a unique path. There might be collision. */
+  uint64_t value[4];
+} UniqueHash;
+
+typedef enum {                          /* Placement hint of a file, consumed by the placement policy on the server. */
+    PLACEMENT_HINT_NONE,                /* Let the policy decide. */
+    PLACEMENT_HINT_HOT,                 /* Prefer memory tier while there is room. */
+    PLACEMENT_HINT_COLD,                /* Always SSD tier. */
+    PLACEMENT_HINT_LOCAL                /* Keep all blocks on the metadata node. */
+} PlacementHint;
+
+typedef enum {                          /* Compression of blocks stored in memory tier and SSD tier. */
+    CODEC_NONE,                         /* Raw blocks. */
+    CODEC_LZ4,                          /* LZ4, fast. */
+    CODEC_ZSTD                          /* zstd, higher ratio. */
+} BlockCodec;
+
 typedef struct 
 {
     NodeHash hashNode; /* Node hash array of extent. */
@@ -62,9 +86,11 @@ typedef struct
 
 
 typedef struct {
+    uint64_t key;                       /* Key of block in RDMA region and tiers, assigned once at creation. */
     uint32_t BlockID;
     uint16_t nodeID;
     uint16_t tier;
+    uint16_t codec;                     /* Codec of stored data, see BlockCodec. Compressed blocks are kept by key in both tiers. */
     uint32_t indexCache;
     uint32_t indexMem;
     uint64_t StorageAddress;
@@ -79,25 +105,77 @@ typedef struct                          /* File meta structure. */
     time_t timeLastModified;        /* Last modified time. */
     uint64_t count;                 /* Count of extents. (not required and might have consistency problem with size) */
     uint64_t size;                  /* Size of extents. */
+    uint64_t generation;            /* Bumped by every write, truncate and meta update, drain checks it. */
     bool isNewFile;                 /* Whether the file is newly created or dirty */
     uint32_t tier;                  /* The storage tier the file resides*/
-    bool hasNextChunk;              /* Flag for large files since each FileMeta object contains MAX_FILE_EXTENT_COUNT blocks*/
-    uint64_t indexOfNextChunk;      /* Index of Next chunk*/
-    BlockInfo BlockList[MAX_FILE_EXTENT_COUNT];  /*Block metadata*/
+    uint16_t hintPlacement;         /* Placement hint, see PlacementHint. */
+    uint64_t heatWrite;             /* Bytes written recently, halved every idle second. */
+    uint16_t codec;                 /* Codec of blocks created afterwards, see BlockCodec. */
+    BlockInfo BlockListInline[FILE_INLINE_BLOCK_COUNT]; /* First blocks. */
+    uint32_t indexExtentPage[FILE_EXTENT_PAGE_COUNT]; /* Index + 1 of extent pages holding following blocks, 0 if not allocated. */
 } FileMeta;
 
+typedef struct                          /* Extent page, block infos of a file beyond inline ones. */
+{
+    BlockInfo BlockList[EXTENT_PAGE_BLOCK_COUNT];
+} ExtentPage;
+
 typedef struct {
 	char names[MAX_FILE_NAME_LENGTH];
 	bool isDirectories;
 } DirectoryMetaTuple;
 
-typedef struct                          /* Directory meta structure. */
+typedef struct                          /* Directory meta structure. Names are kept in directory pages. */
 {
     uint64_t count;                 /* Count of names. */
-    DirectoryMetaTuple tuple[MAX_DIRECTORY_COUNT];
+    uint16_t codec;                 /* Codec inherited by files and directories created inside. */
+    uint32_t indexPageFirst;        /* Index + 1 of first page, 0 if directory is empty. */
+    uint32_t indexPageLast;         /* Index + 1 of last page. */
+    uint32_t indexPageSpace;        /* Index + 1 of first page having a free slot. */
+    uint16_t shard;                 /* Index of this shard, 0 is directory meta itself. */
+    uint16_t depthShard;            /* Names whose hash mod 2^depthShard equals shard are kept here. */
+    uint16_t shardPending;          /* Shard split from this one and not in bitmap yet, 0 if none. */
+    uint64_t bitmapShard;           /* Shards of directory, only kept in shard 0. 0 means only shard 0. */
+    uint32_t timeLoad;              /* Second names added and removed are counted in. */
+    uint32_t countLoad;             /* Names added and removed in second timeLoad. */
+    uint32_t countLoadLast;         /* Names added and removed in second before. */
+    char path[MAX_PATH_LENGTH];     /* Path of directory. Names are hashed with it when name index is rebuilt. */
 } DirectoryMeta;
 
-typedef DirectoryMeta nrfsfilelist;
+typedef struct                          /* Directory page, names are packed from first slot. */
+{
+    uint32_t indexDirectory;        /* Index + 1 of directory meta owning page. */
+    uint32_t count;                 /* Count of names in page. */
+    uint32_t indexPageNext;         /* Index + 1 of next page in directory. */
+    uint32_t indexPagePrev;         /* Index + 1 of previous page in directory. */
+    uint32_t indexSpaceNext;        /* Index + 1 of next page having a free slot. */
+    uint32_t indexSpacePrev;        /* Index + 1 of previous page having a free slot. */
+    DirectoryMetaTuple tuple[DIRECTORY_PAGE_ENTRY_COUNT];
+} DirectoryPage;
+
+typedef struct                          /* Names of a directory listed in one reply. */
+{
+    uint64_t count;                 /* Count of names. */
+    uint64_t cursor;                /* Cursor to list following names, 0 if there are no more. */
+    DirectoryMetaTuple tuple[MAX_DIRECTORY_COUNT];
+} nrfsfilelist;
+
+typedef struct                          /* Name with attributes listed by readdirplus. */
+{
+    DirectoryMetaTuple tuple;       /* Name and type. */
+    bool valid;                     /* Attributes are got. Name may be removed between listing and getting them. */
+    uint64_t size;                  /* Size of file. */
+    uint64_t count;                 /* Count of extents, MAX_FILE_EXTENT_COUNT for a directory as in getattr. */
+    time_t timeLastModified;        /* Last modified time of file. */
+    uint64_t lease;                 /* Microseconds attributes may be cached by client, 0 for none. */
+} nrfsfileplus;
+
+typedef struct                          /* Names of a directory with attributes listed in one reply. */
+{
+    uint64_t count;                 /* Count of names. */
+    uint64_t cursor;                /* Cursor to list following names, 0 if there are no more. */
+    nrfsfileplus entry[MAX_DIRECTORY_PLUS_COUNT];
+} nrfsfilelistplus;
 
 
 static inline void NanosecondSleep(struct timespec *preTime, uint64_t diff) {
@@ -14,17 +14,83 @@
 #include <time.h>                       /* Time functions. */
 #include <iostream> 
 #include <mutex>                        /* Mutex functions. */
+#include <fcntl.h>                      /* File control. E.g. open() */
+#include <sys/stat.h>                   /* File status. E.g. mkdir() */
+#include <unordered_map>
+#include <string>
 #include "storage.hpp"                  /* Storage class, definition of node hash and and hash functions. */
 #include "debug.hpp"                    /* Debug class. */
 #include "global.h"                     /* Global header. */
 #include "hashtable.hpp"
 #include "lock.h"
+#include "placement.hpp"                /* Block placement policies. */
+#include "codec.hpp"                    /* Block compression. */
 #include <unordered_set>
 #include <thread>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <algorithm>
 
 /** Classes. **/
 
 #define PREFETCHER_NUMBER 4
+#define STAGER_NUMBER 2
+#define DRAINER_NUMBER 2
+#define DRAIN_STATE_KEEP_TIME 3600      /* Seconds state of a finished drain can be queried. */
+#define CACHE_ALLOCATE_RETRY 1000       /* Milliseconds flushCache() waits for write backs to release RDMA blocks. */
+#define MIGRATE_INTERVAL 5              /* Seconds between migration rounds, block heat is halved every round. */
+#define MIGRATE_HOT_HEAT 8              /* Heat from which an SSD tier block is promoted. */
+#define MIGRATE_BLOCKS_PER_ROUND 64     /* Max blocks moved in a round. */
+#define MIGRATE_BUSY_ACCESS 4096        /* Skip a round if more block accesses happened in the last one. */
+#define MIGRATE_BANDWIDTH 256 /*MB/s, 0 for unlimited*/
+#define MEM_REUSE_DELAY 1000000        /* us a freed memory tier block stays retired, clients may still access it in place. */
+#define HEAT_SHARD_COUNT 64             /* Block heat is kept in this many separately locked shards. */
+#define DIRECTORY_SPLIT_COUNT 2048      /* Split a directory shard once it holds this many names. */
+#define DIRECTORY_SPLIT_LOAD 4096       /* Or once this many names are added and removed in it in a second, */
+#define DIRECTORY_SPLIT_LOAD_COUNT 256  /* if it holds this many names at least. */
+#define DIRECTORY_SHARD_RETRY 16        /* Times to refresh split map when shard of a name is stale, also while it moves. */
+#define LEASE_HOLDER_MANY 0xFFFF        /* Lease is held by more than one client. */
+#define LEASE_SWEEP_INTERVAL 1000       /* ms between drops of expired leases. */
+
+typedef struct {
+       std::string path;            /* Path when first seen, block key is checked before moving. */
+       uint32_t BlockID;
+       uint16_t tier;
+       uint64_t heat;               /* Accesses, halved every MIGRATE_INTERVAL. */
+} BlockHeat;
+
+typedef struct {
+       std::mutex mutex;
+       std::unordered_map<uint64_t, BlockHeat> blocks; /* Keyed by block hash. */
+} HeatShard;
+
+typedef struct {
+       char path[MAX_PATH_LENGTH];
+       uint16_t tier;
+       bool pin;
+} StageTask;
+
+typedef struct {
+       char path[MAX_PATH_LENGTH];
+       uint16_t shard;
+} SplitTask;
+
+typedef struct {
+       uint64_t uniqueHashValue;
+       const char *data;            /* RDMA block or buffer. */
+       uint64_t length;
+       char *buffer;                /* Compressed data to free, NULL if data is the RDMA block. */
+       uint64_t indexCache;         /* RDMA block released once written. */
+} WriteBackTask;
+
+typedef struct {
+       uint64_t timeExpire;         /* Monotonic time in us the last lease granted ends. */
+       uint16_t holder;             /* Client holding it, LEASE_HOLDER_MANY for several. */
+       uint32_t countChange;        /* Changes in progress, no lease is granted meanwhile. */
+       uint64_t timeRevoke;         /* Monotonic time in us a waiting change is retried, no lease is granted until then. */
+} MetaLease;
 
 typedef struct {
        bool localNode;
@@ -46,7 +112,9 @@ class FileSystem
 private: 
     Storage *storage;                   /* Storage. */
     NodeHash hashLocalNode;             /* Local node hash. */
+    uint64_t countNode;                 /* Count of nodes. */
     LockService *lock;
+    std::shared_ptr<PlacementPolicy> placement; /* Placement policy of new blocks, accessed atomically. */
     std::unordered_set<uint64_t> *PrefetchManager;
     uint64_t addressHashTable;
     bool checkLocal(NodeHash hashNode); /* Check if node hash is local. */
@@ -54,47 +122,156 @@ private:
     bool getNameFromPath(const char *path, char *name); /* Get file name from path. */
     bool sendMessage(NodeHash hashNode, void *bufferSend, uint64_t lengthSend, /* Send message. */
                      void *bufferReceive, uint64_t lengthReceive);
-    void fillFilePositionInformation(uint64_t size, uint64_t offset, file_pos_info *fpi, FileMeta *metaFile); /* Fill file position information for read and write. */
+    void fillFilePositionInformation(uint64_t size, uint64_t offset, file_pos_info *fpi, BlockInfo *blocks); /* Fill file position information for read and write. */
+    bool isBlockInPlace(const BlockInfo *block); /* Whether block is served from memory tier without RDMA region copy. */
+    uint64_t getBlockOffset(BlockInfo *block); /* Offset of block from data region for clients. */
+    BlockInfo *getBlockInfo(FileMeta *metaFile, uint64_t BlockID, bool allocate); /* Block info of file, inline or in extent page. */
+    const BlockInfo *getBlockInfo(const FileMeta *metaFile, uint64_t BlockID);
+    void removeExtentPages(FileMeta *metaFile); /* Release extent pages of file meta. */
+    bool moveBlockLists(const char *pathNew, const FileMeta *metaFile, AddressHash hashAddressLocked); /* Give renamed file blocks of old meta. */
+    bool setBlockListLocked(UniqueHash *hashUnique, const FileMeta *metaFile, bool pages); /* Give file blocks of old meta, path is write locked by caller. */
+    void getDirectoryEntryHash(const char *path, uint16_t shard, const char *name, UniqueHash *hashUnique); /* Hash key of name in directory shard. */
+    void getDirectoryShardHash(const char *path, uint16_t shard, UniqueHash *hashUnique); /* Hash key of directory shard. */
+    uint16_t getDirectoryShard(const char *path, const char *name, bool refresh); /* Shard of name by split map. */
+    uint64_t getDirectoryShards(const char *path, bool refresh); /* Bitmap of shards of directory by split map. */
+    bool isNameInShard(const DirectoryMeta *metaDirectory, const char *name);
+    bool removeDirectoryShards(const char *path, uint64_t indexDirectoryMeta); /* Drop shards but 0 of an empty directory. */
+    bool splitDirectory(const char *path, uint16_t shard); /* Move half of names of shard to a new shard. */
+    uint64_t dropMovedNames(uint64_t indexDirectoryMeta, const char *path); /* Drop names a split has moved out of shard. */
+    void queueDirectorySplit(const char *path, uint16_t shard, const DirectoryMeta *metaDirectory); /* Queue shard to splitter once it is big enough. */
+    bool SplitterWorker();
+    DirectoryPage *getDirectoryPage(uint32_t index); /* Directory page by stored index, NULL for 0. */
+    void unlinkDirectorySpace(DirectoryMeta *metaDirectory, DirectoryPage *page); /* Take page out of pages having space. */
+    DirectoryPage *getDirectoryEntryPage(uint64_t indexDirectoryMeta, uint64_t indexEntry, const char *name); /* Page holding name at entry, NULL if entry is stale. */
+    void rebuildDirectories();          /* Relink directory pages and rebuild name index from them after warm restart. */
+    bool insertDirectoryEntry(uint64_t indexDirectoryMeta, const char *path, const char *name, bool isDirectory, uint64_t *address, uint64_t *size);
+    bool removeDirectoryEntry(uint64_t indexDirectoryMeta, const char *path, const char *name, uint64_t *address, uint64_t *size);
     bool fillRDMARegion(uint64_t uniqueHashValue, uint64_t BlockID, BlockInfo *block, const char *path, bool writeOperation); /* Copy data from Memory tier or SSD tier to the RDMA region, and fill file position information for read and write.*/
-    bool fillRDMARegionV2(uint64_t uniqueHashValue, uint64_t BlockID, uint16_t tier, uint64_t StorageAddress, bool writeOperation);
-    uint16_t getBlockNodeID();
-    uint16_t getBlockTier();
+    void fillRDMARegionBatch(const char *path, const FileMeta *metaFile, uint64_t start, uint64_t end); /* Read local SSD tier blocks into RDMA region with one batch of asynchronous reads. */
+    bool fillRDMARegionV2(uint64_t uniqueHashValue, uint64_t BlockID, uint16_t tier, uint16_t codec, uint64_t StorageAddress, bool writeOperation);
+    void getBlockPlacement(FileMeta *metaFile, uint64_t BlockID, uint64_t sizeFile, uint16_t *nodeID, uint16_t *tier); /* Ask placement policy for node and tier of new block. */
     bool createRemoteBlock(BlockInfo *newBlock);
     bool fillRemoteBlock(uint64_t uniqueHashValue, BlockInfo *newBlock, bool writeOperation);
     bool removeRemoteBlock(uint64_t uniqueHashValue, BlockInfo *newBlock);
-    bool removeBlock(uint64_t uniqueHashValue, uint16_t tier, uint64_t StorageAddress);
+    bool removeBlock(uint64_t uniqueHashValue, BlockInfo *block);
+    uint64_t encodeBlock(uint16_t codec, const char *src, char *buffer); /* Compress block, return stored length. */
+    bool decodeBlock(uint16_t codec, const char *src, uint64_t length, char *dest); /* Restore block from stored data. */
+    bool storeBlock(uint64_t uniqueHashValue, BlockInfo *block, const char *src); /* Write raw block to its tier, compressing it by codec. */
+    bool loadBlock(uint64_t uniqueHashValue, BlockInfo *block, char *dest); /* Read raw block from its tier. */
+    void removeStoredBlock(uint64_t uniqueHashValue, BlockInfo *block); /* Release tier storage of local block. */
+    int getBlockStores(BlockInfo *block, BlockStore **stores); /* Stores a keyed block may live in, in lookup order. */
+    void writeBackBlock(uint64_t uniqueHashValue, uint16_t tier, const char *data, uint64_t length, char *buffer, uint64_t indexCache); /* Asynchronous write back of evicted block. */
+    bool WriteBackerWorker();
+    bool createCacheBlock(uint64_t *index); /* Allocate RDMA block, fail if region is full. */
+    bool createMemBlock(uint64_t *index); /* Allocate memory tier block, reclaiming retired ones first. */
+    void retireMemBlock(uint64_t index); /* Free memory tier block once in-place accesses are over. */
     bool createNewBlock(BlockInfo *newBlock);
     std::string ltos(long l);
-    uint64_t getAddressHash(char *path);
+    uint64_t newBlockKey();             /* Get key of a new block. */
     bool LRUInsert(uint64_t key, BlockInfo *newBlock);
     bool PrefetcherWorker(int id);
+    bool promoteBlock(uint64_t uniqueHashValue, BlockInfo *block, uint16_t tier, bool pin); /* Promote local block to tier and fill RDMA region. */
+    bool moveBlockTier(uint64_t uniqueHashValue, BlockInfo *block, uint16_t tier); /* Move local block between memory tier and SSD tier. */
+    bool stageRemoteBlock(uint64_t uniqueHashValue, BlockInfo *block, uint16_t tier, bool pin, Message message);
+    bool stageFile(const char *path, uint16_t tier, bool pin); /* Stage all blocks of a file. */
+    bool StagerWorker(int id);
+    bool snapshotFile(const char *path, uint64_t *size, uint64_t *generation, std::vector<BlockInfo> *blocks);
+    bool drainFile(const char *path);  /* Copy all blocks of a file under drain path. */
+    bool drainBlock(const char *path, uint64_t uniqueHashValue, BlockInfo *block, uint64_t offset, uint64_t size);
+    bool drainRemoteBlock(const char *path, uint64_t uniqueHashValue, BlockInfo *block, uint64_t offset, uint64_t size);
+    void drainThrottle(uint64_t size);
+    bool DrainerWorker(int id);
+    void recordHeat(uint64_t uniqueHashValue, const char *path, BlockInfo *block); /* Account one access of block. */
+    void forgetHeat(const FileMeta *metaFile); /* Drop heat of all blocks of a removed or renamed file. */
+    bool migrateBlock(const char *path, uint32_t BlockID, uint64_t uniqueHashValue, uint16_t tier); /* Move block of file to tier and update file meta. */
+    bool MigratorWorker();
+    uint64_t grantLease(const char *path, uint16_t holder); /* Lease in us on metadata of path for a client. */
+    uint64_t revokeLease(const char *path, uint16_t source); /* Start a change, or get time to wait for leases of other clients. */
+    void finishRevoke(const char *path); /* Change revoked by revokeLease() is done. */
+    uint64_t revokeBatch(const char (*path)[MAX_PATH_LENGTH], uint16_t count, uint16_t source); /* Start changes of all paths of a batch or none. */
+    bool mknodLocked(const char *path, UniqueHash *hashUnique); /* Make node, path is write locked by caller. */
+    bool mknod2pcLocked(const char *path, UniqueHash *hashUnique); /* Make node by 2PC, path is write locked by caller. */
+    void sortBatch(const char (*path)[MAX_PATH_LENGTH], uint16_t count, UniqueHash *hashes, /* Order local paths of batch by hash item. */
+        std::vector<std::pair<AddressHash, uint16_t> > *order);
     /*Prefetch*/
     uint16_t FetchSignal;
     PrefetchInfo Prefetch_stride;
     Queue<PrefetchTask *>   Prefetch_queue[PREFETCHER_NUMBER];
     thread                  Prefecther[PREFETCHER_NUMBER];
+    /*Stage-in*/
+    Queue<StageTask *>      Stage_queue;
+    thread                  Stager[STAGER_NUMBER];
+    std::atomic<uint64_t>   countStagePending;
+    std::atomic<uint64_t>   countStageBlockStaged;
+    std::atomic<uint64_t>   countStageBlockFailed;
+    /*Stage-out*/
+    Queue<char *>           Drain_queue;
+    thread                  Drainer[DRAINER_NUMBER];
+    std::mutex              mutexDrain;
+    std::unordered_map<std::string, DrainState> drainState;
+    std::deque<std::pair<time_t, std::string> > drainFinished; /* Finish time and path of drains, oldest first. */
+    uint64_t                drainNextTime; /* Earliest time in ns to start next write, used for throttling. */
+    char                    drainPath[MAX_PATH_LENGTH]; /* Stage-out target directory. */
+    uint64_t                drainBandwidth; /* MB/s issued by this node, 0 for unlimited. */
+    /*Retired memory tier blocks*/
+    std::mutex              mutexRetired;
+    std::deque<std::pair<uint64_t, uint64_t> > retiredMem; /* Retire time in us and index, oldest first. */
+    /*Write back*/
+    Queue<WriteBackTask *>  WriteBack_queue; /* SSD tier write backs that failed, to retry in spill tier. */
+    thread                  WriteBacker;
+    /*Tier migration*/
+    thread                  Migrator;
+    HeatShard               heatShards[HEAT_SHARD_COUNT]; /* Heat of blocks whose meta is local, sharded by block hash. */
+    std::atomic<uint64_t>   countAccessRound; /* Block accesses since last round. */
+    /*Directory split*/
+    Queue<SplitTask *>      Split_queue;
+    thread                  Splitter;
+    std::mutex              mutexShard;
+    std::unordered_map<std::string, uint64_t> shardMap; /* Cached shard bitmaps of directories. */
+    std::unordered_set<std::string> splitPending; /* Shards queued to split, as path and shard. */
+    /*Metadata leases*/
+    std::mutex              mutexLease;
+    std::unordered_map<std::string, MetaLease> leases; /* Leases granted on paths, including missing ones. */
+    uint64_t                timeLeaseSweep; /* Monotonic time in us expired leases are dropped next. */
     
 public:
     void rootInitialize(NodeHash LocalNode);
+    void flushCache();                  /* Write dirty RDMA blocks back to their tiers, before a restart. */
     /* Internal functions. No parameter check. Must be called by message handler or functions in this class. */
-    bool addMetaToDirectory(const char *path, const char *name, bool isDirectory, uint64_t *TxID, 
-        uint64_t *srcBuffer, uint64_t *desBuffer, uint64_t *size, uint64_t *key, uint64_t *offset); /* Internal add meta to directory function. Might cause overhead. */
-    bool removeMetaFromDirectory(const char *path, const char *name, 
+    bool addMetaToDirectory(const char *path, const char *name, bool isDirectory, uint16_t *shard, uint64_t *TxID, 
+        uint64_t *srcBuffer, uint64_t *desBuffer, uint64_t *size, uint64_t *key, uint64_t *offset, uint16_t *codec); /* Internal add meta to directory function. Might cause overhead. */
+    bool addMetaToShard(const char *path, const char *name, bool isDirectory, uint16_t *shard, uint64_t *TxID, 
+        uint64_t *srcBuffer, uint64_t *desBuffer, uint64_t *size, uint64_t *key, uint64_t *offset, uint16_t *codec); /* Add meta to given shard of directory. */
+    bool removeMetaFromDirectory(const char *path, const char *name, uint16_t *shard,
         uint64_t *TxID, uint64_t *srcBuffer, uint64_t *desBuffer, uint64_t *size,  uint64_t *key, uint64_t *offset); /* Internal remove meta from directory function. Might cause overhead. */
-    bool updateDirectoryMeta(const char *path, uint64_t TxID, uint64_t srcBuffer, 
+    bool removeMetaFromShard(const char *path, const char *name, uint16_t *shard,
+        uint64_t *TxID, uint64_t *srcBuffer, uint64_t *desBuffer, uint64_t *size,  uint64_t *key, uint64_t *offset); /* Remove meta from given shard of directory. */
+    bool updateDirectoryMeta(const char *path, uint16_t shard, uint64_t TxID, uint64_t srcBuffer, 
         uint64_t desBuffer, uint64_t size, uint64_t key, uint64_t offset);
+    bool fillDirectoryShard(const char *path, uint16_t shard, uint16_t depthShard, uint16_t codec, /* Add names to shard, create it if needed. */
+        const DirectoryMetaTuple *tuple, uint64_t count);
+    bool addDirectoryShard(const char *path, uint16_t shard); /* Add shard to bitmap in shard 0. */
+    bool setExtentPage(const char *path, uint16_t indexPage, const ExtentPage *page); /* Give file a copy of extent page. */
+    bool setBlockList(const char *path, const FileMeta *metaFile); /* Give file inline blocks, size and count of old meta. */
+    bool removeDirectoryShard(const char *path, uint16_t shard, bool check); /* Drop shard and its names. */
     bool mknodWithMeta(const char *path, FileMeta *metaFile); /* Make node (file) with file meta. */
     /* External functions. */
-    void parseMessage(char *bufferRequest, char *bufferResponse); /* Parse message. */
+    uint64_t parseMessage(char *bufferRequest, char *bufferResponse); /* Parse message, or get time to retry it after. */
     bool mknod(const char *path);       /* Make node (file). */
     bool mknod2pc(const char *path);
     bool mknodcd(const char *path);
+    bool open(const char *path, bool create, uint16_t source, bool *isDirectory, bool *created, /* Open or create file and get its size. */
+        uint64_t *size, uint64_t *count, time_t *timeLastModified, uint64_t *wait);
+    uint64_t mknodBatch(const char (*path)[MAX_PATH_LENGTH], uint16_t count, uint16_t source, BatchResult *results); /* Make nodes of a batch. */
+    void statBatch(const char (*path)[MAX_PATH_LENGTH], uint16_t count, uint16_t source, BatchResult *results); /* Get sizes of a batch. */
+    uint64_t removeBatch(const char (*path)[MAX_PATH_LENGTH], uint16_t count, uint16_t source, BatchResult *results); /* Remove a batch. */
     bool getattr(const char *path, FileMeta *attribute, BlockInfo BlockList[MAX_MESSAGE_BLOCK_COUNT]); /* Get attributes. */
     bool access(const char *path, bool *isDirectory);      /* Check accessibility. */
     bool mkdir(const char *path);       /* Make directory. */
     bool mkdir2pc(const char *path);
     bool mkdircd(const char *path);
-    bool readdir(const char *path, nrfsfilelist *list); /* Read directory. */
+    bool readdir(const char *path, uint64_t cursor, nrfsfilelist *list); /* Read one page of directory from cursor. */
+    bool readdirplus(const char *path, uint64_t cursor, uint16_t holder, nrfsfilelistplus *list); /* Read pages of directory with attributes. */
     bool recursivereaddir(const char *path, int depth);
     bool readDirectoryMeta(const char *path, DirectoryMeta *meta, uint64_t *hashAddress, uint64_t *metaAddress, uint16_t *parentNodeID);
     bool extentRead(const char *path, uint64_t size, uint64_t offset, file_pos_info *fpi, uint64_t *key_offset, uint64_t *key); /* Allocate read extent. */
@@ -108,14 +285,22 @@ public:
     bool blockFree(uint64_t startBlock, uint64_t countBlock);
     bool rmdir(const char *path);       /* Remove directory. */
     bool rename(const char *pathOld, const char *pathNew); /* Rename file. */
+    bool stageIn(const char *path, uint16_t tier, bool pin); /* Queue file to be staged in. */
+    bool unpin(const char *path);       /* Unpin blocks of file. */
+    void stageStatus(uint64_t *countFilePending, uint64_t *countBlockStaged, uint64_t *countBlockFailed);
+    bool stageOut(const char *path);    /* Queue file to be drained under drain path. */
+    DrainState stageOutStatus(const char *path);
+    bool setPlacementHint(const char *path, uint16_t hint); /* Set placement hint of file. */
+    bool setCompression(const char *path, uint16_t codec); /* Set codec of file or directory. */
+    void setPlacementPolicy(PlacementPolicy *policy); /* Replace placement policy, e.g. in tests. */
+    void setDrainTarget(const char *path, uint64_t bandwidth); /* Stage-out directory and bandwidth. */
     uint64_t lockWriteHashItem(NodeHash hashNode, AddressHash hashAddressIndex); /* Lock hash item for write. */
     void unlockWriteHashItem(uint64_t key, NodeHash hashNode, AddressHash hashAddressIndex); /* Unlock hash item. */
     uint64_t lockReadHashItem(NodeHash hashNode, AddressHash hashAddressIndex); /* Lock hash item for read. */
     void unlockReadHashItem(uint64_t key, NodeHash hashNode, AddressHash hashAddressIndex); /* Unlock hash item. */
-    void updateRemoteMeta(uint16_t parentNodeID, DirectoryMeta *meta, uint64_t parentMetaAddress, uint64_t parentHashAddress);
     FileSystem(char *buffer, char *bufferBlock, char *extraBlock, uint64_t countFile, /* Constructor of file system. */
                uint64_t countDirectory, uint64_t countBlock, 
-               uint64_t countNode, NodeHash hashLocalNode); 
+               uint64_t countNode, NodeHash hashLocalNode, bool recover); 
     ~FileSystem();                      /* Destructor of file system. */
 };
 
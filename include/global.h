@@ -25,7 +25,22 @@ static inline uint32_t gettid() {
 #define DISTRIBUTEDLOGSIZE (1024 * 1024)
 #define EXTRADATASIZE (8 * 1024) /*MB*/
 #define RDMA_DATASIZE 1536 /*MB*/
-#define DB_PATH "/tmp/KCDB"
+#define DB_PATH "/tmp/KCDB"             /* Directory of "dir" SSD tier engine. */
+#define SSD_ENGINE "log"                /* SSD tier engine, "log", or "posix" (a file per block) and "dir" as fallbacks. */
+#define SSD_POSIX_PATH "/tmp/NRFS_SSD"  /* Directory of "posix" SSD tier engine. */
+#define SSD_LOG_PATH "/tmp/NRFS_SSD.log" /* Log file of "log" SSD tier engine, a raw SSD partition or a file. A file is grown sparse to SSD_CAPACITY. */
+#define SSD_CAPACITY (64 * 1024) /*MB*/
+#define STAGE_WAIT_INTERVAL 1000 /*us, server rechecks a stage-in wait this often before replying*/
+#define SPILL_PATH "/tmp/NRFS_SPILL"    /* Spill tier directory for blocks not fitting in memory and SSD tiers, normally on the parallel file system. */
+#define PLACEMENT_POLICY "heat"         /* Placement policy, "heat" by memory tier room, hint, size and write heat, or "local" to keep all blocks local in SSD tier. */
+#define COMPRESS_CODEC CODEC_NONE       /* Codec of root directory, inherited by everything created below it. */
+#define WARM_RESTART 0                  /* 1 to reattach metadata, memory tier and SSD tier left by last run instead of formatting them. */
+#define SHM_FILE_PATH ""                /* Map a file (e.g. on /dev/shm or a DAX device) instead of SysV shared memory, "" for SysV. */
+#define DIRECTORY_SHARD_ROUTE 0xFFFF    /* Shard in request, server picks shard of name by its split map. */
+#define DIRECTORY_SHARD_STALE 0xFFFE    /* Shard in reply, name is not kept in requested shard. */
+#define METADATA_LEASE_TIME 100 /*ms, lease of attributes and lookups cached by clients, 0 to disable*/
+#define METADATA_CACHE_COUNT 65536      /* Max paths in metadata cache of a client. */
+#define BATCH_PATH_COUNT 128            /* Max paths in a batched metadata request. */
 
 // #define TRANSACTION_2PC 1
 #define TRANSACTION_CD 1
@@ -61,13 +76,44 @@ typedef enum {                          /* Message enumerator. */
     MESSAGE_CREATEBLOCK,
     MESSAGE_READBLOCK,
     MESSAGE_REMOVEBLOCK,
-    MESSAGE_GETBLOCKINFO
+    MESSAGE_GETBLOCKINFO,
+    MESSAGE_STAGEIN,
+    MESSAGE_STAGEBLOCK,
+    MESSAGE_STAGESTATUS,
+    MESSAGE_UNPIN,
+    MESSAGE_UNPINBLOCK,
+    MESSAGE_STAGEOUT,
+    MESSAGE_DRAINBLOCK,
+    MESSAGE_STAGEOUTSTATUS,
+    MESSAGE_SETHINT,
+    MESSAGE_SETCODEC,
+    MESSAGE_MIGRATEBLOCK,
+    MESSAGE_SPLITDIRECTORY,
+    MESSAGE_ADDDIRECTORYSHARD,
+    MESSAGE_REMOVEDIRECTORYSHARD,
+    MESSAGE_OPEN,
+    MESSAGE_MKNODBATCH,
+    MESSAGE_STATBATCH,
+    MESSAGE_REMOVEBATCH,
+    MESSAGE_READDIRPLUS,
+    MESSAGE_SETEXTENTPAGE,
+    MESSAGE_SETBLOCKLIST,
+    MESSAGE_STAGEWAIT
 } Message;
 
+typedef enum {                          /* Stage-out state of a file. */
+    DRAIN_NONE,                         /* Not queued. */
+    DRAIN_PENDING,
+    DRAIN_DONE,
+    DRAIN_FAILED
+} DrainState;
+
 typedef struct {                        /* Extra information structure. */
     uint16_t sourceNodeID;              /* Source node ID. */
     uint64_t taskID;                    /* Task ID. */
     uint64_t sizeReceiveBuffer;         /* Size of receive buffer. */
+    bool hasHashPath;                   /* hashPath is set. */
+    UniqueHash hashPath;                /* Unique hash of path in request computed by client. */
 } ExtraInformation;
 
 typedef struct : ExtraInformation {     /* General send buffer structure. */
@@ -86,6 +132,7 @@ typedef struct : ExtraInformation {
 	uint64_t uniqueHashValue;
 	uint16_t BlockID;
 	uint16_t Storagetier;
+	uint16_t codec;                 /* Codec of block, see BlockCodec. */
 	uint64_t StorageAddress;
         bool writeOperation;
 } BlockRequestSendBuffer;
@@ -95,10 +142,47 @@ typedef struct : ExtraInformation {
         uint32_t indexCache;
 	uint32_t indexMem;
         uint64_t StorageAddress;
+        uint16_t Storagetier;           /* Tier actually used, memory tier might fall back to SSD tier. */
         bool result;
 } BlockRequestReceiveBuffer;
 
 
+typedef struct : ExtraInformation {     /* stageIn and unpin send buffer structure. */
+    Message message;                    /* Message type. */
+    char path[MAX_PATH_LENGTH];         /* Path of file. */
+    uint16_t tier;                      /* Target tier. 0 - memory tier, otherwise only fill RDMA region. */
+    bool pin;                           /* Keep blocks in RDMA region until unpinned. */
+} StageInSendBuffer;
+
+typedef struct : ExtraInformation {     /* setHint send buffer structure. */
+    Message message;                    /* Message type. */
+    char path[MAX_PATH_LENGTH];         /* Path of file. */
+    uint16_t hint;                      /* Placement hint, see PlacementHint. */
+} PlacementHintSendBuffer;
+
+typedef struct : ExtraInformation {     /* setCodec send buffer structure. */
+    Message message;                    /* Message type. */
+    char path[MAX_PATH_LENGTH];         /* Path of file or directory. */
+    uint16_t codec;                     /* Codec, see BlockCodec. */
+} CodecSendBuffer;
+
+typedef struct : ExtraInformation {     /* stageBlock and unpinBlock send buffer structure. */
+    Message message;                    /* Message type. */
+    uint64_t uniqueHashValue;           /* Key of block. */
+    uint16_t tier;                      /* Target tier. */
+    bool pin;                           /* Pin block or not. */
+    BlockInfo block;                    /* Block info kept in file meta. */
+} StageBlockSendBuffer;
+
+typedef struct : ExtraInformation {     /* drainBlock send buffer structure. */
+    Message message;                    /* Message type. */
+    char path[MAX_PATH_LENGTH];         /* Path of file, also path under drain path. */
+    uint64_t uniqueHashValue;           /* Key of block. */
+    uint64_t offset;                    /* Offset of block in file. */
+    uint64_t size;                      /* Valid size of block. */
+    BlockInfo block;                    /* Block info kept in file meta. */
+} DrainBlockSendBuffer;
+
 typedef struct : ExtraInformation {     /* General receive buffer structure. */
 	Message message;                    /* Message type. */
         bool result;                        /* Result. */
@@ -109,14 +193,46 @@ typedef struct : ExtraInformation {     /* addMetaToDirectory send buffer struct
     char path[MAX_PATH_LENGTH];         /* Path. */
     char name[MAX_FILE_NAME_LENGTH];    /* Name to add. */
     bool isDirectory;                   /* Is directory or not. */
+    uint16_t shard;                     /* Shard of name, DIRECTORY_SHARD_ROUTE to let server find it. */
 } AddMetaToDirectorySendBuffer;
 
 typedef struct : ExtraInformation {     /* removeMetaFromDirectory send buffer structure. */
     Message message;                    /* Message type. */
     char path[MAX_PATH_LENGTH];         /* Path. */
     char name[MAX_FILE_NAME_LENGTH];    /* Name to add. */
+    uint16_t shard;                     /* Shard of name, DIRECTORY_SHARD_ROUTE to let server find it. */
 } RemoveMetaFromDirectorySendBuffer;
 
+typedef struct : ExtraInformation {     /* fillDirectoryShard send buffer structure. */
+    Message message;                    /* Message type. */
+    char path[MAX_PATH_LENGTH];         /* Path of directory. */
+    uint16_t shard;                     /* Shard to fill, created if it does not exist. */
+    uint16_t depthShard;                /* Depth of new shard. */
+    uint16_t codec;                     /* Codec of directory. */
+    uint64_t count;                     /* Count of names. */
+    DirectoryMetaTuple tuple[DIRECTORY_PAGE_ENTRY_COUNT]; /* Names moved to shard. */
+} SplitDirectorySendBuffer;
+
+typedef struct : ExtraInformation {     /* addDirectoryShard and removeDirectoryShard send buffer structure. */
+    Message message;                    /* Message type. */
+    char path[MAX_PATH_LENGTH];         /* Path of directory. */
+    uint16_t shard;                     /* Shard. */
+    bool check;                         /* Only check if shard is empty, do not remove it. */
+} DirectoryShardSendBuffer;
+
+typedef struct : ExtraInformation {     /* setExtentPage send buffer structure. */
+    Message message;                    /* Message type. */
+    char path[MAX_PATH_LENGTH];         /* Path of file taking page. */
+    uint16_t indexPage;                 /* Index of page in file meta. */
+    ExtentPage page;                    /* Block infos of page. */
+} ExtentPageSendBuffer;
+
+typedef struct : ExtraInformation {     /* setBlockList send buffer structure. */
+    Message message;                    /* Message type. */
+    char path[MAX_PATH_LENGTH];         /* Path of file taking block list. */
+    FileMeta metaFile;                  /* Old file meta, its extent page indexes are not used. */
+} BlockListSendBuffer;
+
 typedef struct : ExtraInformation {     /* extentRead send buffer structure. */
     Message message;                    /* Message type. */
     char path[MAX_PATH_LENGTH];         /* Path. */
@@ -163,19 +279,77 @@ typedef struct : ExtraInformation {     /* rename send buffer structure. */
     char pathNew[MAX_PATH_LENGTH];      /* New path. */
 } RenameSendBuffer;
 
+typedef struct : ExtraInformation {     /* access receive buffer structure. */
+    Message message;                    /* Message type, MESSAGE_NOTDIR for a file. */
+    bool result;                        /* Result. */
+    uint64_t lease;                     /* Microseconds result may be cached, 0 for none. */
+} AccessReceiveBuffer;
+
+typedef struct : ExtraInformation {     /* open send buffer structure. */
+    Message message;                    /* Message type. */
+    char path[MAX_PATH_LENGTH];         /* Path. */
+    bool create;                        /* Create an empty file if path does not exist. */
+} OpenSendBuffer;
+
+typedef struct : ExtraInformation {     /* open receive buffer structure. */
+    Message message;                    /* Message type. */
+    bool result;                        /* Path exists or is created. */
+    bool isDirectory;                   /* Path is a directory. */
+    bool created;                       /* File is created by this request. */
+    uint64_t lease;                     /* Microseconds attribute may be cached, 0 for none. */
+    uint64_t size;                      /* Size of file. */
+    uint64_t count;                     /* Count of extents of file. */
+    time_t timeLastModified;            /* Last modified time of file. */
+} OpenReceiveBuffer;
+
+typedef struct {                        /* Result of one path in a batched request. */
+    bool result;                        /* Result. */
+    bool isDirectory;                   /* Path is a directory. */
+    uint64_t lease;                     /* Microseconds attribute may be cached, 0 for none. */
+    uint64_t size;                      /* Size of file. */
+    uint64_t count;                     /* Count of extents of file. */
+    time_t timeLastModified;            /* Last modified time of file. */
+} BatchResult;
+
+typedef struct : ExtraInformation {     /* batched mknod, stat and remove send buffer structure. */
+    Message message;                    /* Message type. */
+    uint16_t count;                     /* Count of paths. Only those are sent. */
+    uint16_t holder;                    /* Client leases are granted to when a server sends batch for it, 0 otherwise. */
+    char path[BATCH_PATH_COUNT][MAX_PATH_LENGTH]; /* Paths, all owned by receiving node. */
+} BatchSendBuffer;
+
+typedef struct : ExtraInformation {     /* batched mknod, stat and remove receive buffer structure. */
+    Message message;                    /* Message type. */
+    bool result;                        /* Batch is processed, see results of each path. */
+    BatchResult results[BATCH_PATH_COUNT]; /* Results in order of paths. */
+} BatchReceiveBuffer;
+
 typedef struct : ExtraInformation {     /* getattr receive buffer structure. */
     Message message;                    /* Message type. */
     bool result;                        /* Result. */
+    uint64_t lease;                     /* Microseconds attribute may be cached, 0 for none. */
     BlockInfo BlockList[MAX_MESSAGE_BLOCK_COUNT];
     FileMeta attribute;             	/* Attribute. */
 } GetAttributeReceiveBuffer;
 
+typedef struct : ExtraInformation {     /* readdir send buffer structure. */
+    Message message;                    /* Message type. */
+    char path[MAX_PATH_LENGTH];         /* Path. */
+    uint64_t cursor;                    /* Page to read, 0 for first one. */
+} ReadDirectorySendBuffer;
+
 typedef struct : ExtraInformation {     /* readdir receive buffer structure. */
     Message message;                    /* Message type. */
     bool result;                        /* Result. */
     nrfsfilelist list;                  /* List. */
 } ReadDirectoryReceiveBuffer;
 
+typedef struct : ExtraInformation {     /* readdirplus receive buffer structure. */
+    Message message;                    /* Message type. */
+    bool result;                        /* Result. */
+    nrfsfilelistplus list;              /* List with attributes. */
+} ReadDirectoryPlusReceiveBuffer;
+
 typedef struct : ExtraInformation {     /* extentRead receive buffer structure. */
     Message message;                    /* Message type. */
     bool result;                        /* Result. */
@@ -200,6 +374,8 @@ typedef struct : GeneralReceiveBuffer {
     uint64_t size;
     uint64_t key;
     uint64_t offset;
+    uint16_t codec;                     /* Codec of directory, inherited by new meta. */
+    uint16_t shard;                     /* Shard changed, DIRECTORY_SHARD_STALE if name is not in shard. */
 } UpdataDirectoryMetaReceiveBuffer;
 
 typedef struct : UpdataDirectoryMetaReceiveBuffer {
@@ -213,6 +389,20 @@ typedef struct : GeneralReceiveBuffer {
     DirectoryMeta meta;
 } ReadDirectoryMetaReceiveBuffer;
 
+typedef struct : GeneralReceiveBuffer {
+    BlockInfo block;                    /* Block info after staging. */
+} StageBlockReceiveBuffer;
+
+typedef struct : GeneralReceiveBuffer {
+    uint64_t countFilePending;          /* Files queued or being staged. */
+    uint64_t countBlockStaged;          /* Blocks staged since server start. */
+    uint64_t countBlockFailed;          /* Blocks failed since server start. */
+} StageStatusReceiveBuffer;
+
+typedef struct : GeneralReceiveBuffer {
+    DrainState state;                   /* Stage-out state of file. */
+} StageOutStatusReceiveBuffer;
+
 /* A global queue manager. */
 template <typename T>
 class Queue {
@@ -1,6 +1,6 @@
 /*** Hash table header for index in file system. ***/
 
-/** Version 2 + Crypto++ support. **/
+/** Version 4. Open addressing with SIMD probed groups. **/
 
 /** Redundance check. **/
 #ifndef HASHTABLE_HEADER
@@ -13,109 +13,141 @@
 #include <string.h>                     /* String operations. E.g. memcmp() */
 #include <stdio.h>                      /* Standard I/O. */
 #include <mutex>                        /* Mutex operations. */
-#include "bitmap.hpp"                   /* Bitmap class. */
+#include <thread>                       /* Yield. */
+#include <string>
+#include <vector>
 #include "debug.hpp"                    /* Debug class. */
-// #include "sha256.h"                     /* SHA-256 algorithm. */
-#include "table.hpp"                    /* Table template. Use FreeBit structure. */
-#include <cryptopp/sha.h>                        /* SHA-256 algorithm in Crypto++ library. */
-
-/** Name space. **/
-using namespace CryptoPP;
+#include "common.hpp"                   /* UniqueHash. */
 
 /** Design. **/
 
 /*
     Chosen algorithm:
-        UniqueHash: SHA-256
-        AddressHash (describe in Verilog pseudocode): 256'b SHA-256[20:0]
-
-                   -  Hash items  -                      -  Chained items -
-                  (Fixed size: 16 MB)                  (Size depend on buffer)   (due to alignment)
-   AddressHash  | 8 bytes  | 8 bytes       |   | 32 bytes           | 8 bytes    | 8 bytes     | 8 bytes      |
-                +----------+---------------+   +--------------------+------------+-------------+--------------+            +--------------------+------------+----------------+
-  0 * 16 bytes  |   Lock   |   Head index -|-->|  UniqueHash(Path)  | Meta index | isDirectory | Next index  -|--> .... -->|  UniqueHash(Path)  | Meta Index |        0       |
-                +----------+---------------+   +--------------------+------------+-------------+--------------+            +--------------------+------------+----------------+
-  1 * 16 bytes  |   Lock   |   Head index -|-->|                    |            |             |             -|--> ....                                      0 for end of chain
-                +----------+---------------+   +--------------------+------------+-------------+--------------+
-                |          |               |   |                       An item of chain                       |
-                |   ....   |      ....     |   
-                |          |               |
-                +----------+---------------+
- 1M * 16 bytes  |   Lock   |   Head index -|--> ....
-                +----------+---------------+
-                      Here link and next are both index of chained items array
-
-                    +---------------------+--------------------------+-----------------------------------------+
-  - Total buffer -  |      Hash items     |  Bitmap of chained items |                Chained items            |
-                    +---------------------+--------------------------+-----------------------------------------+
-                    |  16 MB              |   (count / 8) bytes      |   (count * sizeof(ChainedItem)) bytes   |
-
-    
-    Position actually contains index of chained item.
-    +--------------+-------------------------+             +--------------+----------+
-    |   Position   |  Next free bit pointer -|--> .... --->|   Position   |   NULL   |
-    +--------------+-------------------------+             +--------------+----------+
-                                    - Free bit chain -
+        UniqueHash: 128-bit MurmurHash3 with HASH_SEED_PRIMARY in value[0..1] (address, home group, tag),
+                    64-bit FNV-1a in value[2] (verification) and its mix with HASH_SEED_SECONDARY in
+                    value[3] (placement)
+        AddressHash (describe in Verilog pseudocode): 256'b UniqueHash[19:0]
+        Home group: value[1] mapped to [0, count of groups)
+        Tag: 7 bits of value[1] above the ones choosing group
+        Client sends the hash of the path in request, server takes value[0..1] from it instead of
+        hashing the path again (see setHint()). value[2..3] come from another hash family and are
+        always computed by server, so a wrong hint makes a lookup miss but never match another path.
+
+    Slots are kept in groups of HASH_GROUP_SIZE. Control byte of each slot is empty, deleted, busy
+    or full with the tag of its key. Controls of a group are compared with the tag of a key in one
+    SIMD instruction, only slots whose tag matches are checked against the fingerprint in entry.
+    Two paths are taken as the same if value[1], value[2] and value[3] are all equal.
+
+                     - Hash items -                - Controls -                  - Entries -
+                   (Fixed size: 8 MB)           (16 bytes a group)           (32 bytes a slot)
+                    +----------+                +---+---+-----+---+     +-----------------------------+------------+
+    AddressHash  -> |   Lock   |   Home group -> | c | c | ... | c | --> | value[1] value[2] value[3]  | Meta index |
+                    +----------+                +---+---+-----+---+     +-----------------------------+------------+
+                    |   ....   |                |      ....       |     |              ....                        |
+                    +----------+                +-----------------+     +------------------------------------------+
+
+    A lookup probes groups from home group on until the key is found or a group has an empty slot.
+    Deleting a slot marks it deleted, insertion reuses deleted slots. The table holds every file and
+    directory meta, which are fixed in count, so it is sized once for them at HASH_LOAD_MAX when
+    metadata region is formatted. Capacity never changes, online or otherwise: it could never hold
+    more keys than meta tables have entries, and the region is reattached as is on warm restart.
+    Deleted slots still make lookups probe on, so under churn they would take every empty slot and
+    a miss would probe the whole table. Once HASH_DELETED_MAX percent of slots are deleted, or a put
+    finds no room left beside deleted slots, the table is rebuilt in place with all stripes locked:
+    full entries are put again from their home groups and deleted slots are empty. Rebuild stops
+    every writer and reader for one pass over the table, at most once per HASH_DELETED_MAX percent
+    of slots deleted.
+
+    Hash items are locks of file system operations, taken through RDMA. They are not used here.
+
+    Keys are split into HASH_LOCK_STRIPES stripes by home group. A writer holds the mutex of the
+    stripe and makes its sequence odd while changing slots of its key. Readers take no lock, they
+    probe again if sequence was odd or has changed meanwhile. Writers of different stripes might
+    pick the same free slot, so a slot is claimed by compare and swap of its control byte to busy,
+    entry is filled, then its tag is published.
+
+    Node of a path is value[3] % count of nodes. Under a colocated subtree (see setColocation())
+    value[3] of a path is not hashed from the path, it is value[3] of the subtree root plus, for
+    each component below root, hash of that prefix mod spread. With spread 1 every path in subtree
+    is on node of root, so creating or removing a name and updating its parent happen on one node.
+    A larger spread puts each name within spread nodes after its parent, to share a huge directory.
+    Keys other than paths (with a null inside, or not starting with '/') are never colocated.
+    Subtrees must be the same on clients and servers and must not change while they hold files.
 */
 
 /** Definitions. **/
 #define HASH_ADDRESS_BITS 20            /* 20 bits can hold 1048576 hash items. */
 #define HASH_ITEMS_COUNT (1 << HASH_ADDRESS_BITS) /* Actual count of hash items. */
 #define HASH_ITEMS_SIZE (HASH_ITEMS_COUNT * sizeof(HashItem)) /* Size of hash items in bytes. */
+#define HASH_GROUP_SIZE 16              /* Slots in a group, one SSE2 register of controls. */
+#define HASH_LOAD_MAX 87                /* Max percent of full and deleted slots. */
+#define HASH_DELETED_MAX 10             /* Percent of deleted slots from which table is rebuilt. */
+#define HASH_CONTROL_EMPTY 0x00         /* Never used since table was created. Zeroed buffer is an empty table. */
+#define HASH_CONTROL_DELETED 0x01       /* Used before, probing goes on. */
+#define HASH_CONTROL_BUSY 0x02          /* Claimed by a writer, entry is being filled. */
+#define HASH_CONTROL_FULL 0x80          /* Full if set, low 7 bits are tag. */
+#define HASH_LOCK_STRIPES 4096          /* Count of writer locks of keys. */
+#define HASH_SEED_PRIMARY 0             /* Seed of first 128 bits of unique hash. */
+#define HASH_SEED_SECONDARY 0x9e3779b97f4a7c15ULL /* Mixed into value[3] of unique hash. */
+#define HASH_FNV_BASIS 0xcbf29ce484222325ULL /* FNV-1a offset basis. */
+#define HASH_FNV_PRIME 0x100000001b3ULL /* FNV-1a prime. */
+#define HASH_META_DIRECTORY (1ULL << 63) /* Set in meta of entry if it is a directory. */
 
 /** Structures. **/
 typedef uint64_t AddressHash;           /* Address hash definition for locate. */
                                         /* 8-byte address is far enough. Acutally 20-bit (2.5-byte) is enough, but an 64-bit variable is better in address computation. */
 
-typedef struct {                        /* Unique hash structure for identify a unique path. There might be collision. */
-  //char bytes[32];                       /* 32-byte variable can hold all data in SHA-256 format. */
-  uint64_t value[4];
-} UniqueHash;
-
-typedef struct {                        /* Hash item structure. Total 16 bytes. Currently container class and type of item are combined together. */
+typedef struct {                        /* Hash item structure. Total 8 bytes. */
     uint64_t key;                       /* Key for lock. */
-    uint64_t indexHead;                 /* Index of head chained item. Value 0 is reserved for no item. */
 } HashItem;
 
-typedef struct {                        /* Chained item structure. Total 32 bytes. */
-    uint64_t indexNext;                 /* Index of next chained item. Value 0 is reserved for no item. */
-    uint64_t indexMeta;                 /* Index of meta. */
-    bool isDirectory;                   /* Mark directory if true. Mark file if false. Align to 8 bytes. */
-    UniqueHash hashUnique;              /* 32-byte unique hash for path. Lack of completeness. */
-} ChainedItem;
+typedef struct {                        /* Entry of a slot. Total 32 bytes, one cache line holds two. */
+    uint64_t fingerprint[3];            /* value[1], value[2] and value[3] of unique hash. */
+    uint64_t meta;                      /* Meta index, HASH_META_DIRECTORY set for directory. */
+} HashEntry;
 
-/* Use version in table template. */
-// typedef struct {                        /* Free bit structure. */
-//     uint64_t position;                  /* Position of bit. */
-//     void *nextFreeBit;                  /* Next free bit. */
-// } FreeBit;
+typedef struct {                        /* Writer lock and sequence of a stripe of keys. */
+    std::mutex mutex;
+    uint64_t sequence;                  /* Odd while a writer is changing slots of a key in stripe. */
+} HashStripe;
 
 /** Classes. **/
 class HashTable
 {
 private:
-    Bitmap *bitmapChainedItems;         /* Bitmap for chained items. */
-    std::mutex mutexBitmapChainedItems; /* Mutex for bitmap for chained items. */
     HashItem *itemsHash;                /* Hash items of hash table. */
-    ChainedItem *itemsChained;          /* Chained items of hash table. */
-    FreeBit *headFreeBit;               /* Head free bit in the chain. */
-    
+    uint8_t *controls;                  /* Control bytes, HASH_GROUP_SIZE a group. */
+    HashEntry *entries;                 /* Entries of slots. */
+    uint64_t countGroup;                /* Count of groups. */
+    uint64_t countSaved;                /* Count of full slots. */
+    uint64_t countDeleted;              /* Count of deleted slots. */
+    std::mutex mutexRebuild;            /* One rebuild at a time. */
+    HashStripe stripes[HASH_LOCK_STRIPES]; /* Writer locks of keys. */
+    uint64_t getGroup(UniqueHash *hashUnique); /* Get home group of key. */
+    bool find(UniqueHash *hashUnique, uint64_t *slot); /* Find slot of key. */
+    HashStripe *lockStripe(uint64_t group); /* Lock stripe of key for writing. */
+    void unlockStripe(HashStripe *stripe); /* Unlock stripe. */
+    void rebuild();                     /* Put full entries again and drop deleted slots. */
+
 public:
     static void getAddressHash(const char *buf, uint64_t len, AddressHash *hashAddress); /* Get address hash of specific string. */
     static AddressHash getAddressHash(UniqueHash *hashUnique); /* Get address hash by unique hash. */
     static void getUniqueHash(const char *buf, uint64_t len, UniqueHash *hashUnique); /* Get unique hash of specific string. */
+    static void setHint(const char *path, UniqueHash *hashUnique); /* Use client hash for path on this thread, NULL to clear. */
+    static void setColocation(const std::vector<std::pair<std::string, uint16_t> > &subtrees); /* Root and spread of colocated subtrees. */
     uint64_t sizeBufferUsed;            /* Size of used bytes in buffer. */
-    bool get(const char *path, uint64_t *indexMeta, bool *isDirectory); /* Get a chained item. */
-    bool get(UniqueHash *hashUnique, uint64_t *indexMeta, bool *isDirectory); /* Get a chained item by hash. */
-    bool put(const char *path, uint64_t indexMeta, bool isDirectory); /* Put a chained item. */
-    bool put(UniqueHash *hashUnique, uint64_t indexMeta, bool isDirectory); /* Put a chained item by hash. */
-    bool del(const char *path);         /* Delete a hash item. */
-    bool del(UniqueHash *hashUnique);   /* Delete a hash item by hash. */
-    uint64_t getSavedHashItemsCount();  /* Get saved hash items count. */
-    uint64_t getSavedChainedItemsCount(); /* Get saved chained items count. */
-    uint64_t getTotalHashItemsCount();  /* Get total hash items count. */
-    uint64_t getTotalChainedItemsCount(); /* Get total chained items count. */
-    uint64_t getMaxLengthOfChain();     /* Get max length of chain. */
+    bool get(const char *path, uint64_t *indexMeta, bool *isDirectory); /* Get an item. */
+    bool get(UniqueHash *hashUnique, uint64_t *indexMeta, bool *isDirectory); /* Get an item by hash. */
+    bool put(const char *path, uint64_t indexMeta, bool isDirectory); /* Put an item. */
+    bool put(UniqueHash *hashUnique, uint64_t indexMeta, bool isDirectory); /* Put an item by hash. */
+    bool del(const char *path);         /* Delete an item. */
+    bool del(UniqueHash *hashUnique);   /* Delete an item by hash. */
+    uint64_t getSavedItemsCount();      /* Get saved items count. */
+    uint64_t getTotalItemsCount();      /* Get total slots count. */
+    uint64_t getMaxProbeLength();       /* Get max count of groups probed to find a saved item. */
+    uint64_t getProbeLength(UniqueHash *hashUnique); /* Get count of groups probed to look up a key. */
+    uint64_t getDeletedItemsCount();    /* Get deleted slots count. */
+    void recover();                     /* Release locks and slots held by a stopped server. */
     HashTable(char *buffer, uint64_t count); /* Constructor of hash table. */
     ~HashTable();                       /* Destructor of hash table. */
 };
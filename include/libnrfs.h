@@ -113,6 +113,16 @@ int libnrfsRename(nrfs fs, const char* oldpath, const char* newpath);
 */
 int libnrfsListDirectory(nrfs fs, const char* path, nrfsfilelist *list);
 
+/** 
+* nrfsListDirectoryNext - Get next page of files/directories for a given
+* directory-path.
+* @param fs The configured filesystem handle.
+* @param path The path of the directory.
+* @param cursor 0 to read first page. Set to next page, or 0 after last page.
+* @return Returns 0 on success, -1 if the path not exsit or cursor is stale.
+*/
+int libnrfsListDirectoryNext(nrfs fs, const char* path, uint64_t *cursor, nrfsfilelist *list);
+
 /**
 * for performance test
 */
@@ -8,9 +8,12 @@
 #define	_LRUCACHE_HPP_INCLUDED_
 
 #include <unordered_map>
+#include <unordered_set>
 #include <list>
 #include <cstddef>
+#include <cstring>
 #include <stdexcept>
+#include <mutex>
 
 namespace cache {
 
@@ -20,11 +23,16 @@ public:
 	typedef typename std::pair<key_t, value_t> key_value_pair_t;
 	typedef typename std::list<key_value_pair_t>::iterator list_iterator_t;
 
+	/* Every method takes the cache mutex, so the cache is shared by RPC workers, stagers, drainers,
+	   migrator and prefetcher without locking outside. */
 	lru_cache(size_t max_size) :
-		_max_size(max_size) {
+		_max_size(max_size), _max_pinned(max_size / 2) {
 	}
 	
-	const value_t& put(const key_t& key, const value_t& value) {
+	/* Insert key, return evicted value or a zeroed one. If every other item is pinned nothing can be
+	   evicted, then key is not inserted and *inserted is set false. */
+	value_t put(const key_t& key, const value_t& value, bool *inserted = NULL) {
+		std::lock_guard<std::mutex> lock(_mutex);
 		value_t replacedValue;
                 memset(&replacedValue, 0, sizeof(value_t));
 		auto it = _cache_items_map.find(key);
@@ -34,19 +42,69 @@ public:
 			_cache_items_map.erase(it);
 		}
 		_cache_items_map[key] = _cache_items_list.begin();
+		if (inserted != NULL) {
+			*inserted = true;
+		}
 		
 		if (_cache_items_map.size() > _max_size - 10) {  //_max_size - 10
+			/* Pinned items are skipped, evict the least recently used unpinned one. */
 			auto last = _cache_items_list.end();
-			last--;
-			replacedValue = last->second;
-			_cache_items_map.erase(last->first);
-			_cache_items_list.pop_back();
-			return replacedValue;
+			while (--last != _cache_items_list.begin()) {
+				if (!is_pinned_locked(last->first)) {
+					replacedValue = last->second;
+					_cache_items_map.erase(last->first);
+					_cache_items_list.erase(last);
+					return replacedValue;
+				}
+			}
+			/* No victim, do not grow past max size. */
+			_cache_items_map.erase(key);
+			_cache_items_list.pop_front();
+			if (inserted != NULL) {
+				*inserted = false;
+			}
 		}
 		return replacedValue;
 	}
+
+	/* Keep key resident until unpin() is called. Key need not be cached yet. At most half of the
+	   cache can be pinned, so put() always finds a victim. Return false if pin is refused. */
+	bool pin(const key_t& key) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return pin_locked(key);
+	}
+
+	void unpin(const key_t& key) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_pinned_keys.erase(key);
+	}
+
+	bool is_pinned(const key_t& key) const {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return is_pinned_locked(key);
+	}
+
+	/* Look key up and make it most recently used. If pinned is not NULL, key is also pinned in the
+	   same step, so it cannot be evicted between lookup and pin. *pinned is set true only if this
+	   call pinned key, then caller unpins it; it is false if key was pinned already or pin is
+	   refused. Return false and leave value untouched if key is not cached. */
+	bool find(const key_t& key, value_t *value, bool *pinned = NULL) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto it = _cache_items_map.find(key);
+		if (it == _cache_items_map.end()) {
+			return false;
+		}
+		_cache_items_list.splice(_cache_items_list.begin(), _cache_items_list, it->second);
+		*value = it->second->second;
+		if (pinned != NULL) {
+			*pinned = !is_pinned_locked(key) && pin_locked(key);
+		}
+		return true;
+	}
 	
-	const value_t& get(const key_t& key) {
+	/* Value is returned by copy, a reference would outlive the lock. */
+	value_t get(const key_t& key) {
+		std::lock_guard<std::mutex> lock(_mutex);
 		auto it = _cache_items_map.find(key);
 		if (it == _cache_items_map.end()) {
 			throw std::range_error("There is no such key in cache");
@@ -56,18 +114,59 @@ public:
 		}
 	}
 	
+	/* Drop key without evicting anything. Return false if key is not cached. */
+	bool remove(const key_t& key) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto it = _cache_items_map.find(key);
+		if (it == _cache_items_map.end()) {
+			return false;
+		}
+		_cache_items_list.erase(it->second);
+		_cache_items_map.erase(it);
+		return true;
+	}
+
 	bool exists(const key_t& key) const {
+		std::lock_guard<std::mutex> lock(_mutex);
 		return _cache_items_map.find(key) != _cache_items_map.end();
 	}
 	
 	size_t size() const {
+		std::lock_guard<std::mutex> lock(_mutex);
 		return _cache_items_map.size();
 	}
+
+	/* Call func(key, value) on every item, most recently used first. Order is not changed. Cache is
+	   locked meanwhile, func must not call back into it. */
+	template<typename func_t>
+	void for_each(func_t func) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (auto it = _cache_items_list.begin(); it != _cache_items_list.end(); it++) {
+			func(it->first, it->second);
+		}
+	}
 	
 private:
+	bool pin_locked(const key_t& key) {
+		if (is_pinned_locked(key)) {
+			return true;
+		} else if (_pinned_keys.size() >= _max_pinned) {
+			return false;
+		}
+		_pinned_keys.insert(key);
+		return true;
+	}
+
+	bool is_pinned_locked(const key_t& key) const {
+		return _pinned_keys.find(key) != _pinned_keys.end();
+	}
+
+	mutable std::mutex _mutex;
 	std::list<key_value_pair_t> _cache_items_list;
 	std::unordered_map<key_t, list_iterator_t> _cache_items_map;
+	std::unordered_set<key_t> _pinned_keys;
 	size_t _max_size;
+	size_t _max_pinned;
 };
 
 } // namespace cache
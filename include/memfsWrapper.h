@@ -3,7 +3,6 @@
 
 #include <time.h>
 
-#define MAX_FILE_EXTENT_COUNT 512
 #define BLOCK_SIZE (16 * 1024 * 1024)
 #define MAX_FILE_NAME_LENGTH 50
 #define MAX_DIRECTORY_COUNT 60
@@ -7,14 +7,21 @@
 #include <stdlib.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <debug.hpp>
 #include "global.h"
 #define SHARE_MEMORY_KEY 78
+#define SUPERBLOCK_SIZE 4096            /* Last page of segment, reserved after extra data. */
+#define SUPERBLOCK_MAGIC 0x4e524653534d454dULL /* "NRFSSMEM". */
+#define SUPERBLOCK_VERSION 12           /* Bump when layout or path hash changes, older segments are not reattached. */
 
 /************************************************************************************************
-	+-------+-------+-----+-------+-------------+-------------+----------+------------+---------+
-	| Cli_1 | Cli_2 | ... | Cli_N | SERVER_SEND | SERVER_RECV | MetaData | Data_block | LogFile |
-	+-------+-------+-----+-------+-------------+-------------+----------+------------+---------+
+	+-------+-------+-----+-------+-------------+-------------+----------+------------+---------+-----------+------------+
+	| Cli_1 | Cli_2 | ... | Cli_N | SERVER_SEND | SERVER_RECV | MetaData | Data_block | LogFile | ExtraData | SuperBlock |
+	+-------+-------+-----+-------+-------------+-------------+----------+------------+---------+-----------+------------+
 								 /				 \
 	  --------------------------/				  \---------------------------
 	/																		  \
@@ -22,6 +29,15 @@
 	|  Ser_1 (1, 2, ... 8)  |  Ser_2 (1, 2, ... 8)  | ... |  Ser_M (1, 2, ... 8)  | 
 	+-----------------------+-----------------------+-----+-----------------------+
 ************************************************************************************************/
+typedef struct {                        /* Describes segment so that a restarted server can reattach it. */
+	uint64_t magic;                     /* SUPERBLOCK_MAGIC. */
+	uint64_t sizeTotal;                 /* Size of segment. */
+	uint64_t countServer;               /* Layout depends on count of servers. */
+	uint64_t clean;                     /* Segment was detached by a clean stop. */
+	uint64_t version;                   /* SUPERBLOCK_VERSION. */
+	uint64_t sequenceBlock;             /* Next block key sequence, kept across warm restarts. */
+} SuperBlock;
+
 typedef unordered_map<uint32_t, int> Thread2ID;
 class MemoryManager {
 private:
@@ -34,16 +50,23 @@ private:
 	uint64_t DataBaseAddress;
 	uint8_t *SendPoolPointer;
 	uint64_t DMFSTotalSize;
+	uint64_t RegisteredSize;
 	uint64_t LocalLogAddress;
 	uint64_t DistributedLogAddress;
 	uint64_t ExtraDataAddress;
 	int shmid;
+	int fdShm;                          /* File of SHM_FILE_PATH, -1 for SysV. */
+	uint64_t SegmentSize;
+	SuperBlock *superblock;
+	bool warm;                          /* Segment of last run is reattached. */
 	Thread2ID th2id;
+	void attach(uint64_t size);         /* Map segment, reuse existing one of the same size. */
 public:
 	MemoryManager(uint64_t mm, uint64_t ServerCount, int DataSize);
 	~MemoryManager();
 	uint64_t getDmfsBaseAddress();
 	uint64_t getDmfsTotalSize();
+	uint64_t getRegisteredSize();
 	uint64_t getMetadataBaseAddress();
 	uint64_t getDataAddress();
 	uint64_t getServerSendAddress(uint16_t NodeID, uint64_t *buffer);
@@ -52,6 +75,9 @@ public:
 	uint64_t getLocalLogAddress();
 	uint64_t getDistributedLogAddress();
 	uint64_t getExtraDataAddress();
+	uint64_t getExtraDataOffset();
+	bool isWarm();
+	uint64_t getBlockSequence();        /* Take next block key sequence, never 0. */
 	void setID(int ID);
 };
 
@@ -127,6 +127,37 @@ int nrfsCreateDirectory(nrfs fs, const char* path);
 * @return Returns 0 on success, -1 on error. 
 */
 int nrfsDelete(nrfs fs, const char* path);
+
+/**
+* nrfsMknodBatch - create files, paths owned by the same server are sent in one request.
+* @param fs The configured filesystem handle.
+* @param paths The full paths to the files.
+* @param count The no. of paths.
+* @param results Buffer of 0 on success, -1 on error for each path, may be NULL.
+* @return Returns 0 if all files are created, -1 otherwise.
+*/
+int nrfsMknodBatch(nrfs fs, const char** paths, int count, int* results);
+
+/**
+* nrfsStatBatch - Get the attributes of files, paths owned by the same server are sent in one request.
+* @param fs The configured filesystem handle.
+* @param paths The full paths to the files.
+* @param count The no. of paths.
+* @param attrs Buffer of attributes of each path.
+* @param results Buffer of 0 on success, -1 on error for each path, may be NULL.
+* @return Returns 0 if all attributes are got, -1 otherwise.
+*/
+int nrfsStatBatch(nrfs fs, const char** paths, int count, FileMeta* attrs, int* results);
+
+/**
+* nrfsDeleteBatch - Delete files or empty directories, paths owned by the same server are sent in one request.
+* @param fs The configured filesystem handle.
+* @param paths The paths of files or directories.
+* @param count The no. of paths.
+* @param results Buffer of 0 on success, -1 on error for each path, may be NULL.
+* @return Returns 0 if all paths are removed, -1 otherwise.
+*/
+int nrfsDeleteBatch(nrfs fs, const char** paths, int count, int* results);
 int nrfsFreeBlock(uint16_t node_id, uint64_t startBlock, uint64_t  countBlock);
 /**
 * nrfsRename - Rename file. 
@@ -146,6 +177,87 @@ int nrfsRename(nrfs fs, const char* oldpath, const char* newpath);
 */
 int nrfsListDirectory(nrfs fs, const char* path, nrfsfilelist *list);
 
+/** 
+* nrfsListDirectoryNext - Get next page of files/directories for a given
+* directory-path.
+* @param fs The configured filesystem handle.
+* @param path The path of the directory.
+* @param cursor 0 to read first page. Set to next page, or 0 after last page.
+* @return Returns 0 on success, -1 if the path not exsit or cursor is stale.
+*/
+int nrfsListDirectoryNext(nrfs fs, const char* path, uint64_t *cursor, nrfsfilelist *list);
+
+/** 
+* nrfsListDirectoryPlus - Get next pages of files/directories for a given
+* directory-path with size, extent count and modification time of each.
+* Attributes are cached, so nrfsGetAttribute() on listed names needs no request.
+* @param fs The configured filesystem handle.
+* @param path The path of the directory.
+* @param cursor 0 to read first pages. Set to next page, or 0 after last page.
+* @return Returns 0 on success, -1 if the path not exsit or cursor is stale.
+*/
+int nrfsListDirectoryPlus(nrfs fs, const char* path, uint64_t *cursor, nrfsfilelistplus *list);
+
+/**
+* nrfsSetPlacementHint - Set placement hint of a file for blocks written afterwards.
+* @param fs The configured filesystem handle.
+* @param path The full path to the file.
+* @param hint PLACEMENT_HINT_NONE, PLACEMENT_HINT_HOT, PLACEMENT_HINT_COLD or PLACEMENT_HINT_LOCAL.
+* @return Returns 0 on success, -1 on error.
+*/
+int nrfsSetPlacementHint(nrfs fs, const char *path, int hint);
+
+/**
+* nrfsSetCompression - Set codec of a file, or of a directory whose new files and
+* subdirectories inherit it. Blocks created afterwards are compressed in memory tier and SSD tier.
+* @param fs The configured filesystem handle.
+* @param path The full path to the file or directory.
+* @param codec CODEC_NONE, CODEC_LZ4 or CODEC_ZSTD. Fails if the codec is not built in.
+* @return Returns 0 on success, -1 on error.
+*/
+int nrfsSetCompression(nrfs fs, const char *path, int codec);
+
+/**
+* nrfsStageIn - Promote files into the memory tier and RDMA region before a job.
+* Directories are expanded recursively, servers stage their files in parallel.
+* @param fs The configured filesystem handle.
+* @param paths Paths of files or directories.
+* @param count Count of paths.
+* @param tier Target tier. 0 - memory tier, 1 - keep on SSD and only fill RDMA region.
+* @param pin Keep staged blocks resident until nrfsUnpin is called.
+* @return Returns 0 when all blocks are staged, -1 on error.
+*/
+int nrfsStageIn(nrfs fs, const char **paths, int count, int tier, bool pin);
+
+/**
+* nrfsUnpin - Unpin files staged with pin, so that they can be evicted again.
+* @param fs The configured filesystem handle.
+* @param paths Paths of files or directories.
+* @param count Count of paths.
+* @return Returns 0 on success, -1 on error.
+*/
+int nrfsUnpin(nrfs fs, const char **paths, int count);
+
+/**
+* nrfsStageOut - Drain files to the stage-out directory of servers asynchronously.
+* Blocks are copied by the servers holding them, directories are expanded recursively.
+* @param fs The configured filesystem handle.
+* @param paths Paths of files or directories.
+* @param count Count of paths.
+* @return Returns 0 when all files are queued, -1 on error.
+*/
+int nrfsStageOut(nrfs fs, const char **paths, int count);
+
+/**
+* nrfsStageOutQuery - Query completion of nrfsStageOut.
+* @param fs The configured filesystem handle.
+* Files below the paths which were never staged out are skipped.
+* @param paths Paths passed to nrfsStageOut.
+* @param count Count of paths.
+* @return Returns the number of files still being drained, 0 when all are done, -1 if any failed.
+*/
+int nrfsStageOutQuery(nrfs fs, const char **paths, int count);
+
 /**
 * for performance test
 */
@@ -0,0 +1,55 @@
+/*** Block placement policy header. ***/
+
+/** Redundance check. **/
+#ifndef PLACEMENT_HEADER
+#define PLACEMENT_HEADER
+
+/** Included files. **/
+#include <stdint.h>                     /* Standard integers. E.g. uint16_t */
+#include "common.hpp"                   /* BLOCK_SIZE and PlacementHint. */
+
+/** Definitions. **/
+#define PLACEMENT_MEMORY_RESERVE 10     /* Percent of memory tier kept free, blocks go to SSD tier below it. */
+#define PLACEMENT_MEMORY_PRESSURE 50    /* Percent of memory tier free below which only hot files use it. */
+#define PLACEMENT_SMALL_FILE (4 * (uint64_t)BLOCK_SIZE) /* Files up to this size prefer memory tier. */
+#define PLACEMENT_HOT_HEAT (4 * (uint64_t)BLOCK_SIZE) /* Write heat from which a file is treated as hot. */
+#define PLACEMENT_STRIPE_FILE (16 * (uint64_t)BLOCK_SIZE) /* Files larger than this are striped over nodes. */
+
+/** Structures. **/
+typedef struct {                        /* Everything a policy may look at for one new block. */
+    uint16_t nodeLocal;                 /* Node holding the file meta. From 1 to countNode. */
+    uint64_t countNode;                 /* Count of nodes. */
+    uint64_t countMemoryFree;           /* Free blocks in local memory tier. */
+    uint64_t countMemoryTotal;          /* Total blocks in local memory tier. */
+    uint64_t sizeFile;                  /* Size of file after the current write. */
+    uint64_t heatWrite;                 /* Decayed write heat of file. */
+    uint16_t hint;                      /* Placement hint of file. */
+    uint32_t BlockID;                   /* Block to place. */
+} PlacementContext;
+
+/** Classes. **/
+class PlacementPolicy                   /* Decides node and tier of newly created blocks. Must be thread safe. */
+{
+public:
+    virtual void place(PlacementContext *context, uint16_t *nodeID, uint16_t *tier) = 0;
+    virtual const char *name() = 0;
+    virtual ~PlacementPolicy() {}
+    static PlacementPolicy *create(const char *name); /* Create policy by name, NULL if unknown. */
+};
+
+class LocalPlacementPolicy : public PlacementPolicy /* All blocks on metadata node in SSD tier. */
+{
+public:
+    void place(PlacementContext *context, uint16_t *nodeID, uint16_t *tier);
+    const char *name();
+};
+
+class HeatPlacementPolicy : public PlacementPolicy /* Memory tier for small or hot files while it has room, stripe large files. */
+{
+public:
+    void place(PlacementContext *context, uint16_t *nodeID, uint16_t *tier);
+    const char *name();
+};
+
+/** Redundance check. **/
+#endif
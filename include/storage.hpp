@@ -11,9 +11,17 @@
 #include "hashtable.hpp"                /* Hash table class. */
 #include "table.hpp"                    /* Table template. */
 #include "global.h"
-#include "kcdirdb.h"
-#include "kcdirdb.h"
+#include "blockstore.hpp"             /* SSD tier block store. */
 #include "lrucache.hpp"
+#include <mutex>                        /* Mutex operations. */
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/** Definitions. **/
+#define MEM_CHUNK_COUNT 64              /* Chunks per memory tier block when packing compressed blocks. */
+#define MEM_CHUNK_SIZE (BLOCK_SIZE / MEM_CHUNK_COUNT) /* Allocation unit of compressed blocks. */
+#define MEM_SLOT_MAGIC 0x4e5246534d534c54ULL /* "NRFSMSLT". */
 
 typedef struct                          /* Block structure. */
 {
@@ -26,24 +34,81 @@ typedef struct                          /* Block structure. */
    block bitmap and fix). Besides, there is no checksum here, data correctness cannot be 
    determined. */
 
+typedef struct {                        /* Location of a compressed block in memory tier. */
+    uint64_t slot;                      /* Memory tier block holding it. */
+    uint16_t chunk;                     /* First chunk in slot. */
+    uint16_t countChunk;                /* Count of chunks. */
+    uint64_t length;                    /* Length of data in bytes. */
+    uint64_t sequence;                  /* Increasing sequence, the latest copy of a key wins. */
+} MemIndexEntry;
+
+typedef struct {                        /* Compressed block in a memory tier block, found by its first chunk. */
+    uint64_t key;                       /* Key of block. */
+    uint64_t length;                    /* Length of data in bytes, 0 if chunk does not start a block. */
+    uint64_t sequence;                  /* Sequence of copy. */
+} MemSlotRecord;
+
+typedef struct {                        /* Memory tier block packing compressed blocks. */
+    uint64_t used;                      /* Bitmap of used chunks, chunk 0 holds header. */
+    uint64_t freeing;                   /* Chunks released while being read, freed after last read. */
+    uint32_t countReader;               /* Reads copying out of block. */
+    uint16_t run;                       /* Longest run of free chunks, size class of block. */
+} MemSlot;
+
+typedef struct {                        /* Chunk 0 of a memory tier block packing compressed blocks. Kept in shared memory, so index can be rebuilt. */
+    uint64_t magic;                     /* MEM_SLOT_MAGIC. */
+    uint64_t slot;                      /* Memory tier block of itself. */
+    MemSlotRecord records[MEM_CHUNK_COUNT];
+} MemSlotHeader;
+
+class MemBlockStore : public BlockStore /* Packs compressed blocks into memory tier blocks, several per block. */
+{
+private:
+    Table<Block> *table;                /* Memory tier blocks. */
+    char *base;                         /* Address of memory tier block 0. */
+    std::mutex mutexIndex;              /* Protects everything below. Data is copied without it. */
+    std::unordered_map<uint64_t, MemIndexEntry> index;
+    std::unordered_map<uint64_t, uint64_t> pending; /* Key -> sequence of latest write being copied. */
+    std::unordered_map<uint64_t, MemSlot> slots; /* Memory tier block -> its chunks. */
+    std::vector<std::unordered_set<uint64_t> > slotsByRun; /* Partly used blocks by longest free run, from 1 to MEM_CHUNK_COUNT - 1. */
+    uint64_t sequence;                  /* Next copy sequence. */
+    MemSlotHeader *getHeader(uint64_t slot);
+    void classify(uint64_t slot, MemSlot *state); /* Move block to size class of its longest free run. */
+    bool allocate(uint64_t countChunk, MemIndexEntry *entry); /* Find contiguous free chunks. */
+    void release(MemIndexEntry *entry); /* Free chunks, and the block once it is empty. */
+    void freeChunks(uint64_t slot, uint64_t chunks); /* Clear chunks in bitmap of block. */
+
+public:
+    int64_t get(uint64_t key, char *buffer, uint64_t size);
+    bool set(uint64_t key, const char *buffer, uint64_t size);
+    bool remove(uint64_t key);
+    void recover();                     /* Rebuild index from a reattached buffer. */
+    MemBlockStore(Table<Block> *table, char *base);
+};
+
 class Storage
 {
 private:
     uint64_t countNode;                 /* Count of nodes. */
+    char *bitmapBlock;                  /* Bitmap of block table. */
 
 public:
     uint64_t sizeBufferUsed;            /* Size of used bytes in buffer. */
     HashTable *hashtable;               /* Hash table. */
     Table<FileMeta> *tableFileMeta;     /* File meta table. */
     Table<DirectoryMeta> *tableDirectoryMeta; /* Directory meta table. */
+    Table<ExtentPage> *tableExtentPage; /* Extent pages of large files. */
+    Table<DirectoryPage> *tableDirectoryPage; /* Names of directories. */
     Table<Block> *tableBlock;           /* Block table. */
     Table<Block> *extraTableBlock;      /*Extra Block table*/
     NodeHash getNodeHash(UniqueHash *hashUnique); /* Get node hash by unique hash. */
 
-    kyotocabinet::DirDB db;
+    BlockStore *tierSSD;                /* SSD tier. */
+    BlockStore *tierMemory;             /* Compressed blocks of memory tier. */
+    BlockStore *tierSpill;              /* Spill tier, also takes SSD tier blocks once it is full. */
     cache::lru_cache<uint64_t, BlockInfo> *BlockManager;
     //NodeHash getNodeHash(const char *buffer); /* Get node hash. */
-    Storage(char *buffer, char *bufferBlock, char *extraBlock, uint64_t countFile, uint64_t countDirectory, uint64_t countBlock, uint64_t countNode); /* Constructor. */
+    Storage(char *buffer, char *bufferBlock, char *extraBlock, uint64_t countFile, uint64_t countDirectory, uint64_t countBlock, uint64_t countNode, bool recover); /* Constructor. */
     ~Storage();                         /* Deconstructor. */
 };
 
@@ -2,8 +2,6 @@
 
 /** Version 1. **/
 
-/* FIXME: Ignore malloc() failure. */
-
 /** Redundance check. **/
 #ifndef TABLE_HEADER
 #define TABLE_HEADER
@@ -32,11 +30,8 @@
     +---+---+---+---+---+---+------+---+---+---+---+
                 - Structure of bitmap -
     
-    Use free bit chain to allocate a new item. (The free bit chain is generated from bitmap.)
-    +--------------+-------------------------+             +--------------+----------+
-    |   Position   |  Next free bit pointer -|--> .... --->|   Position   |   NULL   |
-    +--------------+-------------------------+             +--------------+----------+
-                                    - Free bit chain -
+    A new item takes the first free bit, found through summary of bitmap. Nothing is allocated
+    on creation or removal.
                       index
                             +--------------+
                         0   |    Item 0    |
@@ -52,12 +47,6 @@
 
 */
 
-/** Structures. **/
-typedef struct {                        /* Free bit structure. */
-    uint64_t position;                  /* Position of bit. */
-    void *nextFreeBit;                  /* Next free bit. */
-} FreeBit;
-
 /** Classes. **/
 template<typename T> class Table
 {
@@ -65,8 +54,6 @@ private:
     Bitmap *bitmapItems;                /* Bitmap for items. */
     std::mutex mutexBitmapItems;        /* Mutex for bitmap for items. */
     T *items;                           /* Items of table. */
-    FreeBit *headFreeBit;               /* Head free bit in the chain. */
-    FreeBit *tailFreeBit;               /* Tail free bit in the chain. */
 
 public:
     uint64_t sizeBufferUsed;            /* Size of used bytes in buffer. */
@@ -76,10 +63,14 @@ public:
     bool get(uint64_t index, T *item, uint64_t *address);
     bool put(uint64_t index, T *item);  /* Put an item. */
     bool put(uint64_t index, T *item, uint64_t *address);
+    bool view(uint64_t index, const T **item); /* Get an item in place for reading. */
+    bool reference(uint64_t index, T **item); /* Get an item in place for writing. */
     bool remove(uint64_t index);        /* Remove an item. */
     uint64_t countSavedItems();         /* Saved items count. */
     uint64_t countTotalItems();         /* Total items count. */
+    bool exists(uint64_t index);        /* Whether an item is created. */
     Table(char *buffer, uint64_t count); /* Constructor of table. */
+    Table(char *buffer, char *bufferBitmap, uint64_t count); /* Constructor of table with bitmap kept elsewhere. */
     ~Table();                           /* Destructor of table. */
 };
 
@@ -94,13 +85,9 @@ template<typename T> bool Table<T>::create(uint64_t *index)
         bool result;
         mutexBitmapItems.lock();        /* Lock table bitmap. */
         {
-            if (headFreeBit == NULL) {  /* If there is no free bit in bitmap. */
-                return false;           /* Fail due to out of free bit. */
+            if (bitmapItems->findFree(index) == false) { /* If there is no free bit in bitmap. */
+                result = false;         /* Fail due to out of free bit. */
             } else {
-                *index = headFreeBit->position; /* Get index from free bit. */
-                FreeBit *currentFreeBit = headFreeBit; /* Get current free bit. */
-                headFreeBit = (FreeBit *)(headFreeBit->nextFreeBit); /* Move current free bit out of free bit chain. */
-                free(currentFreeBit);   /* Release current free bit as used. */
                 if (bitmapItems->set(*index) == false) { /* Occupy the position first. Need not to roll back. */ 
                     result = false;     /* Fail due to bitmap set error. No recovery here. */
                 } else {
@@ -126,13 +113,9 @@ template<typename T> bool Table<T>::create(uint64_t *index, T *item)
         bool result;
         mutexBitmapItems.lock();        /* Lock table bitmap. */
         {
-            if (headFreeBit == NULL) {  /* If there is no free bit in bitmap. */
-                return false;           /* Fail due to out of free bit. */
+            if (bitmapItems->findFree(index) == false) { /* If there is no free bit in bitmap. */
+                result = false;         /* Fail due to out of free bit. */
             } else {
-                *index = headFreeBit->position; /* Get index from free bit. */
-                FreeBit *currentFreeBit = headFreeBit; /* Get current free bit. */
-                headFreeBit = (FreeBit *)(headFreeBit->nextFreeBit); /* Move current free bit out of free bit chain. */
-                free(currentFreeBit);   /* Release current free bit as used. */
                 if (bitmapItems->set(*index) == false) { /* Occupy the position first. Need not to roll back. */ 
                     result = false;     /* Fail due to bitmap set error. No recovery here. */
                 } else {
@@ -264,6 +247,44 @@ template<typename T> bool Table<T>::put(uint64_t index, T *item, uint64_t *addre
     return result;                  /* Return specific result. */
 }
 
+/* Get an item in place for reading. Item is not copied, so only the fields read are touched.
+   Table mutex only covers the existence check, caller keeps item stable by holding read lock of
+   its hash item until it is done with the pointer.
+   @param   index   Index of item.
+   @param   item    Buffer of pointer to item.
+   @return          If item does not exist or other errors occur return false. Otherwise return true. */
+template<typename T> bool Table<T>::view(uint64_t index, const T **item)
+{
+    T *itemWritable;
+    if (reference(index, &itemWritable) == false) {
+        return false;
+    } else {
+        *item = itemWritable;
+        return true;
+    }
+}
+
+/* Get an item in place for writing. Fields written through the pointer are updated in buffer
+   directly, no put is needed. Caller holds write lock of hash item of the item.
+   @param   index   Index of item.
+   @param   item    Buffer of pointer to item.
+   @return          If item does not exist or other errors occur return false. Otherwise return true. */
+template<typename T> bool Table<T>::reference(uint64_t index, T **item)
+{
+    if (item == NULL) {
+        return false;                   /* Fail due to null item buffer. */
+    } else {
+        bool status;                    /* Status of existence of item. */
+        std::lock_guard<std::mutex> lockBitmap(mutexBitmapItems);
+        if ((bitmapItems->get(index, &status) == false) || (status == false)) {
+            return false;               /* Fail due to no item. */
+        } else {
+            *item = &items[index];
+            return true;
+        }
+    }
+}
+
 /* Remove an item.
    @param   index   Index of item to remove.
    @return          If error occurs return false, otherwise return true. */
@@ -283,11 +304,7 @@ template<typename T> bool Table<T>::remove(uint64_t index)
                 if (bitmapItems->clear(index) == false) {
                     result = false;     /* Fail due to bitmap clear error. */
                 } else {
-                    FreeBit *currentFreeBit = (FreeBit *)malloc(sizeof(FreeBit)); /* New free bit. */
-                    currentFreeBit->nextFreeBit = headFreeBit; /* Add current free bit to free bit chain. */
-                    currentFreeBit->position = index; /* Index of newly released item. */
-                    headFreeBit = currentFreeBit; /* Update head free bit. */
-                    result = true;      /* Succeed. */
+                    result = true;      /* Succeed. Position is found free by next creation. */
                 }
             }
         }
@@ -310,12 +327,32 @@ template<typename T> uint64_t Table<T>::countTotalItems()
     return (bitmapItems->countTotal()); /* Return count of total items. */
 }
 
-/* Constructor of table. Initialize bitmap, items array and free bit chain. 
+/* Check if an item is created.
+   @param   index   Index of item.
+   @return          If item exists return true, otherwise return false. */
+template<typename T> bool Table<T>::exists(uint64_t index)
+{
+    bool status;
+    std::lock_guard<std::mutex> lockBitmap(mutexBitmapItems);
+    return (bitmapItems->get(index, &status) == true) && (status == true);
+}
+
+/* Constructor of table. Initialize bitmap and items array. 
    @param   buffer  Buffer of whole table (including bitmap and items).
    @param   count   Count of items in table (can be divided by 8 due to bitmap requirement). */
 template<typename T> Table<T>::Table(char *buffer, uint64_t count)
+    : Table(buffer, (buffer == NULL) ? NULL : buffer + count * sizeof(T), count)
+{
+}
+
+/* Constructor of table. Items already marked in bitmap are kept, so a table in a reattached
+   buffer keeps its content.
+   @param   buffer          Buffer of items.
+   @param   bufferBitmap    Buffer of bitmap, count / 8 bytes.
+   @param   count           Count of items in table (can be divided by 8 due to bitmap requirement). */
+template<typename T> Table<T>::Table(char *buffer, char *bufferBitmap, uint64_t count)
 {
-    if (buffer == NULL) {
+    if ((buffer == NULL) || (bufferBitmap == NULL)) {
         fprintf(stderr, "Table: buffer is null.\n");
         exit(EXIT_FAILURE);             /* Fail due to null buffer pointer. */
     } else {
@@ -323,35 +360,10 @@ template<typename T> Table<T>::Table(char *buffer, uint64_t count)
             fprintf(stderr, "Table: count should be times of eight.\n");
             exit(EXIT_FAILURE);         /* Fail due to count alignment. */
         } else {
-            bitmapItems = new Bitmap(count, buffer + count * sizeof(T)); /* Initialize item bitmap. */
+            bitmapItems = new Bitmap(count, bufferBitmap); /* Initialize item bitmap. */
 	    //Debug::notifyInfo("Bitmap address is %ld", (long)(buffer + count * sizeof(T)));
             items = (T *)(buffer); /* Initialize items array. */
             sizeBufferUsed = count / 8 + count * sizeof(T); /* Size of used bytes in buffer. */
-            /*  
-                Initialize free bit chain.
-            */
-            headFreeBit = NULL;         /* Initialize head free bit pointer. */
-            FreeBit *currentFreeBit;
-            // for (uint64_t index = 0; index < count / 8; index++) { /* Search in all bytes in array. */
-            //     for (uint64_t offset = 0; offset <= 7; offset++) { /* Search in all offsets in byte. */
-            //         if ((buffer[index] & (1 << (7 - offset))) == 0) { /* Judge if bit is cleared. */
-            //             currentFreeBit = (FreeBit *)malloc(sizeof(FreeBit)); /* Create a new free bit. */
-            //             currentFreeBit->position = index * 8 + offset; /* Assign position. */
-            //             currentFreeBit->nextFreeBit = headFreeBit; /* Push current free bit before head. */
-            //             headFreeBit = currentFreeBit; /* Update head free bit. */
-            //         }
-            //     }
-            // }
-            for (int index = count / 8 - 1; index >= 0; index--) { /* Search in all bytes in array. */
-                for (int offset = 7; offset >= 0; offset--) { /* Search in all offsets in byte. */
-                    if ((buffer[index] & (1 << (7 - offset))) == 0) { /* Judge if bit is cleared. */
-                        currentFreeBit = (FreeBit *)malloc(sizeof(FreeBit)); /* Create a new free bit. */
-                        currentFreeBit->position = index * 8 + offset; /* Assign position. */
-                        currentFreeBit->nextFreeBit = headFreeBit; /* Push current free bit before head. */
-                        headFreeBit = currentFreeBit; /* Update head free bit. */
-                    }
-                }
-            }
         }
     }
 }
@@ -359,12 +371,6 @@ template<typename T> Table<T>::Table(char *buffer, uint64_t count)
 /* Destructor of table. */
 template<typename T> Table<T>::~Table()
 {
-    FreeBit *currentFreeBit;
-    while (headFreeBit != NULL) {
-        currentFreeBit = headFreeBit;
-        headFreeBit = (FreeBit *)(headFreeBit->nextFreeBit); /* Move to next. */
-        free(currentFreeBit);           /* Release free bit. */
-    }
     delete bitmapItems;                 /* Release table bitmap. */
 }
 
@@ -4,6 +4,10 @@
 #include <mutex>
 #include <random>
 #include <thread>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <time.h>
 #include "nrfs.h"
 #include "RPCClient.hpp"
 #include "storage.hpp"
@@ -18,20 +22,100 @@ uint64_t DmfsDataOffset;
 struct  timeval start1, end1;
 uint64_t diff;
 uint64_t WriteTime1 = 0, WriteTime2 = 0, WriteTime3 = 0, WriteTime4 = 0, ReadTime1 = 0, ReadTime2 = 0, ReadTime3 = 0, ReadTime4 = 0;
+/* Hash of the path last located on this thread, sent along if that path is the one in request. */
+static thread_local const char *pathLocated = NULL;
+static thread_local UniqueHash hashLocated;
+
+/* Metadata cached under leases granted by servers, keyed by corrected path. */
+typedef struct {
+	int access;                         /* Result of nrfsAccess(). */
+	uint64_t timeAccess;                /* Monotonic time in us lease of access ends, 0 if not cached. */
+	uint64_t size;                      /* Attribute from nrfsGetAttribute(). */
+	uint64_t count;
+	time_t timeLastModified;
+	uint64_t timeAttribute;             /* Monotonic time in us lease of attribute ends, 0 if not cached. */
+} MetaCacheEntry;
+static mutex mutexMetaCache;
+static unordered_map<string, MetaCacheEntry> metaCache;
+
+static uint64_t getTimeMicro()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* Get entry of path to fill, making room if cache is full. Called with mutexMetaCache held. */
+static MetaCacheEntry *getMetaCacheEntry(const char *path, uint64_t timeNow)
+{
+	if ((metaCache.size() >= METADATA_CACHE_COUNT) && (metaCache.find(path) == metaCache.end())) {
+		for (auto it = metaCache.begin(); it != metaCache.end(); ) {
+			if ((it->second.timeAccess <= timeNow) && (it->second.timeAttribute <= timeNow))
+				it = metaCache.erase(it);
+			else
+				it++;
+		}
+		if (metaCache.size() >= METADATA_CACHE_COUNT)
+			metaCache.clear();
+	}
+	MetaCacheEntry &entry = metaCache[path];
+	return &entry;
+}
+
+/* Cache result of nrfsAccess().
+   @param   path    Corrected path.
+   @param   access  Result.
+   @param   time    Time request was sent.
+   @param   lease   Lease granted by server in us. */
+static void cacheAccess(const char *path, int access, uint64_t time, uint64_t lease)
+{
+	if (lease == 0)
+		return;
+	lock_guard<mutex> lockCache(mutexMetaCache);
+	MetaCacheEntry *entry = getMetaCacheEntry(path, time);
+	entry->access = access;
+	entry->timeAccess = time + lease;
+}
+
+/* Cache attribute from nrfsGetAttribute(), path is known to exist then. */
+static void cacheAttribute(const char *path, const FileMeta *attr, uint64_t time, uint64_t lease)
+{
+	if (lease == 0)
+		return;
+	lock_guard<mutex> lockCache(mutexMetaCache);
+	MetaCacheEntry *entry = getMetaCacheEntry(path, time);
+	entry->size = attr->size;
+	entry->count = attr->count;
+	entry->timeLastModified = attr->timeLastModified;
+	entry->timeAttribute = time + lease;
+	entry->access = (attr->count == MAX_FILE_EXTENT_COUNT) ? 0 : 1;
+	entry->timeAccess = time + lease;
+}
+
+/* Drop cached metadata of path changed by this client. Server does not wait for lease of the client
+   changing a path, so it must not be used afterwards. */
+static void invalidateMetaCache(const char *path)
+{
+	lock_guard<mutex> lockCache(mutexMetaCache);
+	metaCache.erase(path);
+}
+
 uint16_t get_node_id_by_path(char* path)
 {
-	UniqueHash hashUnique;
-	HashTable::getUniqueHash(path, strlen(path), &hashUnique);
-	return ((hashUnique.value[3] % client->getConfInstance()->getServerCount()) + 1);
+	HashTable::getUniqueHash(path, strlen(path), &hashLocated);
+	pathLocated = path;
+	return ((hashLocated.value[3] % client->getConfInstance()->getServerCount()) + 1);
 }
 
 bool sendMessage(uint16_t node_id, void* sendBuffer, long unsigned int sendLength,
 								   void* recvBuffer, long unsigned int recvLength)
 {
 	Debug::debugItem("sendMessage: dst node id: %d", node_id);
+	bool hinted = (pathLocated == ((GeneralSendBuffer *)sendBuffer)->path);
+	pathLocated = NULL;
 	/* one request per time */
 	return client->RdmaCall(node_id, (char*)sendBuffer, (uint64_t)sendLength,
-							  (char*)recvBuffer, (uint64_t)recvLength);
+							  (char*)recvBuffer, (uint64_t)recvLength, hinted ? &hashLocated : NULL);
 }
 
 void correct(const char *old_path, char *new_path)
@@ -140,7 +224,7 @@ nrfs nrfsConnect(const char* host, int port, int size)
 	Debug::debugTitle("nrfsConnect");
     client = new RPCClient();
     DmfsDataOffset =  CLIENT_MESSAGE_SIZE * MAX_CLIENT_NUMBER;
-	DmfsDataOffset += SERVER_MASSAGE_SIZE * SERVER_MASSAGE_NUM * client->getConfInstance()->getServerCount();
+	DmfsDataOffset += 2 * SERVER_MASSAGE_SIZE * SERVER_MASSAGE_NUM * client->getConfInstance()->getServerCount(); /* Send and receive pools. */
     DmfsDataOffset += METADATA_SIZE;
     printf("FileMetaSize = %ld, DirMetaSize = %ld\n", sizeof(FileMeta), sizeof(DirectoryMeta));
     usleep(100000);
@@ -184,6 +268,7 @@ int nrfsAddMetaToDirectory(nrfs fs, char* parent, char* name, bool isDirectory)
     strcpy(bufferAddMetaToDirectorySend.path, parent);  /* Assign path. */
     strcpy(bufferAddMetaToDirectorySend.name, name);  /* Assign name. */
     bufferAddMetaToDirectorySend.isDirectory = isDirectory; /* Assign state of directory. */
+    bufferAddMetaToDirectorySend.shard = DIRECTORY_SHARD_ROUTE; /* Shard is found by server. */
 
     uint16_t hashNode = get_node_id_by_path(parent);
     
@@ -198,6 +283,8 @@ int nrfsAddMetaToDirectory(nrfs fs, char* parent, char* name, bool isDirectory)
     } else {
         if (bufferGeneralReceive.result == false) {
             result = 1;           /* Fail due to remote function returns false. */
+        } else if (bufferGeneralReceive.size == 0) {
+            result = 0;           /* Name is appended and directory is unlocked already. */
         } else {
         	DoRemoteCommitSendBuffer bufferSend;
             strcpy(bufferSend.path, parent);
@@ -208,6 +295,7 @@ int nrfsAddMetaToDirectory(nrfs fs, char* parent, char* name, bool isDirectory)
             bufferSend.size = bufferGeneralReceive.size;
             bufferSend.key = bufferGeneralReceive.key;
             bufferSend.offset = bufferGeneralReceive.offset;
+            bufferSend.shard = bufferGeneralReceive.shard;
             GeneralReceiveBuffer bufferReceive;
             if (sendMessage(hashNode,
                     &bufferSend, 
@@ -237,6 +325,7 @@ int nrfsRemoveMetaFromDirectory(nrfs fs, char* path, char* name)
     bufferRemoveMetaFromDirectorySend.message = MESSAGE_REMOVEMETAFROMDIRECTORY; /* Assign message type. */
     strcpy(bufferRemoveMetaFromDirectorySend.path, path);  /* Assign path. */
     strcpy(bufferRemoveMetaFromDirectorySend.name, name);  /* Assign name. */
+    bufferRemoveMetaFromDirectorySend.shard = DIRECTORY_SHARD_ROUTE; /* Shard is found by server. */
 
     uint16_t hashNode = get_node_id_by_path(path);
 
@@ -286,11 +375,13 @@ int nrfsMknodWithMeta(nrfs fs, char *path, FileMeta *metaFile)
 				uint16_t hashNode = get_node_id_by_path(path);
 
 	            GeneralReceiveBuffer bufferGeneralReceive; /* Receive buffer. */
-	            if (sendMessage(hashNode, 
+	            bool sent = sendMessage(hashNode, 
 	                            &bufferMakeNodeWithMetaSend, 
 	                            sizeof(MakeNodeWithMetaSendBuffer), 
 	                            &bufferGeneralReceive, 
-	                            sizeof(GeneralReceiveBuffer)) == false) {
+	                            sizeof(GeneralReceiveBuffer));
+	            invalidateMetaCache(path);
+	            if (sent == false) {
 	                result = 1;           /* Fail due to send message error. */
 	            } else {
 	                if (bufferGeneralReceive.result == false) {
@@ -324,34 +415,57 @@ int nrfsMknodWithMeta(nrfs fs, char *path, FileMeta *metaFile)
 nrfsFile nrfsOpenFile(nrfs fs, const char* _path, int flags)
 {
 	Debug::debugTitle("nrfsOpenFile");
+	OpenSendBuffer sendBuffer;
+	OpenReceiveBuffer receiveBuffer;
 	char *file;
-	int result;
-	result = nrfsAccess(fs, _path);
-        if (result == 1) {
-	    file = (char*)malloc(MAX_FILE_NAME_LENGTH);
-	    correct(_path, file);
-            return (nrfsFile)file;
-	} else if (result ==  0) {
-	    printf("Debug-nrfs.cpp: It's a dirtory, failed to open a file\n");
-	    return NULL;
-	} else {
-	    if((flags & O_CREAT)) {
-		printf("Debug-nrfs.cpp: File does not exist, create a new file\n");
-		result = nrfsMknod(fs, _path);
-                if (result == 0) {
-	  	    file = (char*)malloc(MAX_FILE_NAME_LENGTH);
-   	            correct(_path, file);
-                    printf("Debug-nrfs.cpp: File %s created\n", file);
-                    return (nrfsFile)file;
-                } else {
-                  printf("Debug-nrfs.cpp: File create failed\n");
-                }
-	    } else {
-		printf("Debug-nrfs.cpp: File does not exist\n");
-	    }
-	}
+	sendBuffer.message = MESSAGE_OPEN;
+	sendBuffer.create = ((flags & O_CREAT) != 0);
 
-	return NULL;
+	correct(_path, sendBuffer.path);
+	uint64_t timeSend = getTimeMicro();
+	{
+		lock_guard<mutex> lockCache(mutexMetaCache);
+		auto it = metaCache.find(sendBuffer.path);
+		if ((it != metaCache.end()) && (it->second.timeAccess > timeSend)) {
+			if (it->second.access == 0) {
+				printf("Debug-nrfs.cpp: It's a dirtory, failed to open a file\n");
+				return NULL;
+			} else if (it->second.access == 1) {
+				file = (char*)malloc(MAX_PATH_LENGTH);
+				strcpy(file, sendBuffer.path);
+				return (nrfsFile)file; /* Lease has not ended. */
+			} else if (!sendBuffer.create) {
+				printf("Debug-nrfs.cpp: File does not exist\n");
+				return NULL;
+			}
+		}
+	}
+	/* Lookup, create and getattr in one round trip. */
+	uint16_t node_id = get_node_id_by_path(sendBuffer.path);
+	sendMessage(node_id, &sendBuffer, sizeof(OpenSendBuffer),
+		&receiveBuffer, sizeof(OpenReceiveBuffer));
+	if (!receiveBuffer.result) {
+		printf("Debug-nrfs.cpp: %s\n", sendBuffer.create ? "File create failed" : "File does not exist");
+		return NULL;
+	}
+	if (receiveBuffer.created) {
+		invalidateMetaCache(sendBuffer.path); /* Drop negative lookup cached before. */
+		Debug::debugItem("nrfsOpenFile: %s created", sendBuffer.path);
+	}
+	if (receiveBuffer.isDirectory) {
+		cacheAccess(sendBuffer.path, 0, timeSend, receiveBuffer.lease);
+		printf("Debug-nrfs.cpp: It's a dirtory, failed to open a file\n");
+		return NULL;
+	}
+	FileMeta attr;
+	memset(&attr, 0, sizeof(FileMeta)); /* Fields not in reply are left zero. */
+	attr.size = receiveBuffer.size;
+	attr.count = receiveBuffer.count;
+	attr.timeLastModified = receiveBuffer.timeLastModified;
+	cacheAttribute(sendBuffer.path, &attr, timeSend, receiveBuffer.lease);
+	file = (char*)malloc(MAX_PATH_LENGTH);
+	strcpy(file, sendBuffer.path);
+	return (nrfsFile)file;
 }
 
 
@@ -374,6 +488,7 @@ int nrfsMknod(nrfs fs, const char* _path)
 	uint16_t node_id  = get_node_id_by_path(sendBuffer.path);
 	sendMessage(node_id, &sendBuffer, sizeof(GeneralSendBuffer), 
 		&receiveBuffer, sizeof(GeneralReceiveBuffer));
+	invalidateMetaCache(sendBuffer.path); /* Drop negative lookup cached by nrfsOpenFile(). */
 	if(receiveBuffer.result == true) {
 		result = 0;
 	} else {
@@ -422,6 +537,19 @@ int nrfsGetAttribute(nrfs fs, nrfsFile _file, FileMeta *attr)
 
     correct((char*)_file, bufferGeneralSend.path);
 
+    uint64_t timeSend = getTimeMicro();
+    {
+        lock_guard<mutex> lockCache(mutexMetaCache);
+        auto it = metaCache.find(bufferGeneralSend.path);
+        if ((it != metaCache.end()) && (it->second.timeAttribute > timeSend)) { /* Lease has not ended. */
+            memset(attr, 0, sizeof(FileMeta));
+            attr->size = it->second.size;
+            attr->count = it->second.count;
+            attr->timeLastModified = it->second.timeLastModified;
+            return 0;
+        }
+    }
+
     uint16_t node_id = get_node_id_by_path(bufferGeneralSend.path);
 
     GetAttributeReceiveBuffer *bufferGetAttributeReceive = (GetAttributeReceiveBuffer *)malloc(sizeof(GetAttributeReceiveBuffer));
@@ -430,11 +558,12 @@ int nrfsGetAttribute(nrfs fs, nrfsFile _file, FileMeta *attr)
 					bufferGetAttributeReceive, sizeof(GetAttributeReceiveBuffer));
     Debug::debugItem("\tMETA.size = %d, block.count is %d ", bufferGetAttributeReceive->attribute.size, bufferGetAttributeReceive->attribute.count);
     memcpy((void *)attr, (void *)&bufferGetAttributeReceive->attribute, sizeof(bufferGetAttributeReceive->attribute));
-    if(bufferGetAttributeReceive->result) {
-	return 0;
-    } else {
-        return -1;
+    int result = bufferGetAttributeReceive->result ? 0 : -1;
+    if (result == 0) {
+        cacheAttribute(bufferGeneralSend.path, attr, timeSend, bufferGetAttributeReceive->lease);
     }
+    free(bufferGetAttributeReceive);
+    return result;
 }
 
 /*Get the block info of this file*/
@@ -479,24 +608,34 @@ int nrfsAccess(nrfs fs, const char* _path)
 	Debug::debugTitle("nrfsAccess");
 	Debug::debugItem("nrfsAccess: %s", _path);
 	GeneralSendBuffer sendBuffer;
-	GeneralReceiveBuffer *receiveBuffer = (GeneralReceiveBuffer *)malloc(sizeof(GeneralReceiveBuffer));
-	Debug::debugItem("nrfsAccess size of receiveBuffer %d", sizeof(GeneralReceiveBuffer));
+	AccessReceiveBuffer receiveBuffer;
+	int result;
 	sendBuffer.message = MESSAGE_ACCESS;
 
 	correct(_path, sendBuffer.path);
+	uint64_t timeSend = getTimeMicro();
+	{
+		lock_guard<mutex> lockCache(mutexMetaCache);
+		auto it = metaCache.find(sendBuffer.path);
+		if ((it != metaCache.end()) && (it->second.timeAccess > timeSend))
+			return it->second.access; /* Lease has not ended. */
+	}
 	uint16_t node_id = get_node_id_by_path(sendBuffer.path);
 	
 	sendMessage(node_id, &sendBuffer, sizeof(GeneralSendBuffer), 
-					receiveBuffer, sizeof(GeneralReceiveBuffer));
+					&receiveBuffer, sizeof(AccessReceiveBuffer));
         Debug::debugItem("nrfsAccess Clinet side");
-	if(receiveBuffer->result) {
-	    if (receiveBuffer->message == MESSAGE_NOTDIR) {
-		return 1;
+	if(receiveBuffer.result) {
+	    if (receiveBuffer.message == MESSAGE_NOTDIR) {
+		result = 1;
+	    } else {
+		result = 0;
 	    }
-	    return 0;
 	} else {
-	    return -1;
+	    result = -1;
 	}
+	cacheAccess(sendBuffer.path, result, timeSend, receiveBuffer.lease);
+	return result;
 }
 
 /**
@@ -539,6 +678,7 @@ int nrfsWrite(nrfs fs, nrfsFile _file, const void* buffer, uint64_t size, uint64
 	gettimeofday(&start1, NULL);
 	sendMessage(node_id, bufferExtentWriteSend, sizeof(ExtentWriteSendBuffer), 
 					bufferExtentWriteReceive, sizeof(ExtentWriteReceiveBuffer));
+	invalidateMetaCache(bufferExtentWriteSend->path);
 
 	gettimeofday(&end1, NULL);
 	diff = 1000000 * (end1.tv_sec - start1.tv_sec) + end1.tv_usec - start1.tv_usec;
@@ -722,6 +862,7 @@ int nrfsCreateDirectory(nrfs fs, const char* _path)
 		uint16_t node_id = get_node_id_by_path(bufferGeneralSend.path);
 		sendMessage(node_id, &bufferGeneralSend, sizeof(GeneralSendBuffer), 
 			&bufferGeneralReceive, sizeof(GeneralReceiveBuffer));
+		invalidateMetaCache(bufferGeneralSend.path);
 		if(bufferGeneralReceive.result == false) {
 			return 1;
 		} else {
@@ -744,6 +885,7 @@ int nrfsCreateDirectory(nrfs fs, const char* _path)
 	uint16_t node_id = get_node_id_by_path(bufferGeneralSend.path);
 	sendMessage(node_id, &bufferGeneralSend, sizeof(GeneralSendBuffer), 
 		&bufferGeneralReceive, sizeof(GeneralReceiveBuffer));
+	invalidateMetaCache(bufferGeneralSend.path);
 	if(bufferGeneralReceive.result == false)
 		result = 1;
 	else
@@ -781,21 +923,160 @@ int nrfsDelete(nrfs fs, const char* _path)
 
 	sendMessage(node_id, &bufferGeneralSend, sizeof(GeneralSendBuffer), 
 					bufferReceive, sizeof(GetAttributeReceiveBuffer));
+	invalidateMetaCache(bufferGeneralSend.path);
 	if (bufferReceive->result == false) {
 		Debug::notifyError("Remove file failed.");
 		result = 1;
 	} else if (bufferReceive->attribute.count != MAX_FILE_EXTENT_COUNT) {
-		for (uint64_t i = 0; i < bufferReceive->attribute.count; i++) {
-			if (((uint16_t)(bufferReceive->attribute.BlockList[i].nodeID) != node_id) && (bufferReceive->attribute.BlockList[i].nodeID != 0)) {
-				nrfsFreeBlock((uint16_t)(bufferReceive->attribute.BlockList[i].nodeID),
-						bufferReceive->attribute.BlockList[i].indexMem,
-						1);
+		result = 0;             /* Server has removed blocks on all nodes. */
+	}
+	return result;
+}
+
+/* Send paths grouped by owning server, one message per server and BATCH_PATH_COUNT paths.
+   @param   message Batched message type.
+   @param   paths   Paths, not corrected.
+   @param   count   Count of paths.
+   @param   results Buffer of results in order of paths.
+   @return          If every path succeeds return true, otherwise return false. */
+static bool sendBatch(Message message, const char **paths, int count, BatchResult *results)
+{
+	uint16_t countServer = client->getConfInstance()->getServerCount();
+	vector<vector<int> > groups(countServer + 1);
+	char path[MAX_PATH_LENGTH];
+	for (int i = 0; i < count; i++) {
+		correct(paths[i], path);
+		groups[get_node_id_by_path(path)].push_back(i);
+	}
+	BatchSendBuffer *bufferSend = (BatchSendBuffer *)malloc(sizeof(BatchSendBuffer));
+	BatchReceiveBuffer *bufferReceive = (BatchReceiveBuffer *)malloc(sizeof(BatchReceiveBuffer));
+	bool result = true;
+	for (uint16_t node_id = 1; node_id <= countServer; node_id++) {
+		for (size_t start = 0; start < groups[node_id].size(); start += BATCH_PATH_COUNT) {
+			uint16_t n = (uint16_t)min((size_t)BATCH_PATH_COUNT, groups[node_id].size() - start);
+			bufferSend->message = message;
+			bufferSend->count = n;
+			bufferSend->holder = 0;
+			for (uint16_t j = 0; j < n; j++)
+				correct(paths[groups[node_id][start + j]], bufferSend->path[j]);
+			uint64_t lengthSend = (uint64_t)((char *)bufferSend->path[n] - (char *)bufferSend); /* Unused paths are not sent. */
+			sendMessage(node_id, bufferSend, lengthSend, bufferReceive, sizeof(BatchReceiveBuffer));
+			for (uint16_t j = 0; j < n; j++) {
+				BatchResult *entry = &results[groups[node_id][start + j]];
+				if (bufferReceive->result)
+					*entry = bufferReceive->results[j];
+				else
+					memset(entry, 0, sizeof(BatchResult));
+				result = result && entry->result;
 			}
 		}
-		result = 0;
 	}
+	free(bufferSend);
+	free(bufferReceive);
 	return result;
 }
+
+/**
+*nrfsMknodBatch - create files, one request per server.
+* @param fs The configured filesystem handle.
+* @param paths The full paths to the files.
+* @param count The no. of paths.
+* @param results Buffer of 0 on success, -1 on error for each path, may be NULL.
+* @return Returns 0 if all files are created, -1 otherwise.
+**/
+int nrfsMknodBatch(nrfs fs, const char **paths, int count, int *results)
+{
+	Debug::debugTitle("nrfsMknodBatch");
+	BatchResult *resultsBatch = (BatchResult *)malloc(sizeof(BatchResult) * count);
+	bool result = sendBatch(MESSAGE_MKNODBATCH, paths, count, resultsBatch);
+	char path[MAX_PATH_LENGTH];
+	for (int i = 0; i < count; i++) {
+		correct(paths[i], path);
+		invalidateMetaCache(path); /* Drop negative lookup cached by nrfsOpenFile(). */
+		if (results != NULL)
+			results[i] = resultsBatch[i].result ? 0 : -1;
+	}
+	free(resultsBatch);
+	return result ? 0 : -1;
+}
+
+/**
+*nrfsStatBatch - Get the attributes of files, one request per server for those not cached.
+* @param fs The configured filesystem handle.
+* @param paths The full paths to the files.
+* @param count The no. of paths.
+* @param attrs Buffer of attributes, size and count are filled.
+* @param results Buffer of 0 on success, -1 on error for each path, may be NULL.
+* @return Returns 0 if all attributes are got, -1 otherwise.
+**/
+int nrfsStatBatch(nrfs fs, const char **paths, int count, FileMeta *attrs, int *results)
+{
+	Debug::debugTitle("nrfsStatBatch");
+	vector<const char *> pathsMissed;
+	vector<int> indexMissed;
+	char path[MAX_PATH_LENGTH];
+	uint64_t timeSend = getTimeMicro();
+	for (int i = 0; i < count; i++) {
+		correct(paths[i], path);
+		memset(&attrs[i], 0, sizeof(FileMeta));
+		lock_guard<mutex> lockCache(mutexMetaCache);
+		auto it = metaCache.find(path);
+		if ((it != metaCache.end()) && (it->second.timeAttribute > timeSend)) { /* Lease has not ended. */
+			attrs[i].size = it->second.size;
+			attrs[i].count = it->second.count;
+			attrs[i].timeLastModified = it->second.timeLastModified;
+			if (results != NULL)
+				results[i] = 0;
+		} else {
+			pathsMissed.push_back(paths[i]);
+			indexMissed.push_back(i);
+		}
+	}
+	bool result = true;
+	if (pathsMissed.size() != 0) {
+		BatchResult *resultsBatch = (BatchResult *)malloc(sizeof(BatchResult) * pathsMissed.size());
+		result = sendBatch(MESSAGE_STATBATCH, pathsMissed.data(), (int)pathsMissed.size(), resultsBatch);
+		for (size_t j = 0; j < pathsMissed.size(); j++) {
+			int i = indexMissed[j];
+			if (resultsBatch[j].result) {
+				attrs[i].size = resultsBatch[j].size;
+				attrs[i].count = resultsBatch[j].count;
+				attrs[i].timeLastModified = resultsBatch[j].timeLastModified;
+				correct(paths[i], path);
+				cacheAttribute(path, &attrs[i], timeSend, resultsBatch[j].lease);
+			}
+			if (results != NULL)
+				results[i] = resultsBatch[j].result ? 0 : -1;
+		}
+		free(resultsBatch);
+	}
+	return result ? 0 : -1;
+}
+
+/**
+*nrfsDeleteBatch - Delete files or empty directories, one request per server.
+* @param fs The configured filesystem handle.
+* @param paths The paths of files or directories.
+* @param count The no. of paths.
+* @param results Buffer of 0 on success, -1 on error for each path, may be NULL.
+* @return Returns 0 if all paths are removed, -1 otherwise.
+**/
+int nrfsDeleteBatch(nrfs fs, const char **paths, int count, int *results)
+{
+	Debug::debugTitle("nrfsDeleteBatch");
+	BatchResult *resultsBatch = (BatchResult *)malloc(sizeof(BatchResult) * count);
+	bool result = sendBatch(MESSAGE_REMOVEBATCH, paths, count, resultsBatch);
+	char path[MAX_PATH_LENGTH];
+	for (int i = 0; i < count; i++) {
+		correct(paths[i], path);
+		invalidateMetaCache(path);
+		if (results != NULL)
+			results[i] = resultsBatch[i].result ? 0 : -1;
+	}
+	free(resultsBatch);
+	return result ? 0 : -1;
+}
+
 int nrfsFreeBlock(uint16_t nodeHash, uint64_t startBlock, uint64_t countBlock)
 {
 	BlockFreeSendBuffer bufferSend;
@@ -819,8 +1100,19 @@ int renameDirectory(nrfs fs, const char *oldPath, const char *newPath)
 	int result = 0;
 	char tempoldPath[MAX_PATH_LENGTH];
 	char tempnewPath[MAX_PATH_LENGTH];
+	uint64_t cursor = 0;
 	result |= nrfsCreateDirectory(fs, newPath);
-	nrfsListDirectory(fs, oldPath, &list);
+	/* Names moved out shrink the directory, so always start again from the first page. Pages of
+	   a sharded directory may be empty while a later shard still holds names. */
+	while((result == 0) && (nrfsListDirectoryNext(fs, oldPath, &cursor, &list) == 0))
+	{
+	if(list.count == 0)
+	{
+		if(cursor == 0)
+			break;
+		continue;
+	}
+	cursor = 0;
 	for(i = 0; i < list.count; i++)
 	{
 		memset(tempoldPath, '\0', MAX_PATH_LENGTH);
@@ -843,6 +1135,7 @@ int renameDirectory(nrfs fs, const char *oldPath, const char *newPath)
 		if(result)
 			break;
 	}
+	}
 	result |= nrfsDelete(fs, oldPath);
 	return 0;
 }
@@ -878,6 +1171,7 @@ int nrfsRename(nrfs fs, const char* _oldpath, const char* _newpath)
 		}
 		/* Rename for a directory is not implemented */
 
+		/* Blocks of new meta are given by node of old meta on rename, from the meta it holds. */
 		if(nrfsMknodWithMeta(fs, bufferRenameSend.pathNew, &meta))
 		{
 			Debug::notifyError("nrfsMknodWithMeta failed.");
@@ -889,6 +1183,7 @@ int nrfsRename(nrfs fs, const char* _oldpath, const char* _newpath)
 
 			sendMessage(node_id, &bufferRenameSend, sizeof(RenameSendBuffer), 
 							&bufferGeneralReceive, sizeof(GeneralReceiveBuffer));
+			invalidateMetaCache(bufferRenameSend.pathOld);
 			if(bufferGeneralReceive.result == false)
 			{
 				result = 1;
@@ -904,32 +1199,344 @@ int nrfsRename(nrfs fs, const char* _oldpath, const char* _newpath)
 
 /** 
 * nrfsListDirectory - Get list of files/directories for a given
-* directory-path.
+* directory-path. Only first page is returned, see nrfsListDirectoryNext().
 * @param fs The configured filesystem handle.
 * @param path The path of the directory.
 * @return Returns the number of the entries or -1 if the path not exsit.
 */
 int nrfsListDirectory(nrfs fs, const char* _path, nrfsfilelist *list)
 {
-	Debug::debugTitle("nrfsListDirectory");
-	GeneralSendBuffer bufferGeneralSend; /* Send buffer. */
-    bufferGeneralSend.message = MESSAGE_READDIR; /* Assign message type. */
+	uint64_t cursor = 0;
+	return nrfsListDirectoryNext(fs, _path, &cursor, list);
+}
+
+/** 
+* nrfsListDirectoryNext - Get next page of files/directories for a given
+* directory-path.
+* @param fs The configured filesystem handle.
+* @param path The path of the directory.
+* @param cursor 0 to read first page. Set to next page, or 0 after last page.
+* @return Returns 0 on success, -1 if the path not exsit or cursor is stale.
+*/
+int nrfsListDirectoryNext(nrfs fs, const char* _path, uint64_t *cursor, nrfsfilelist *list)
+{
+	Debug::debugTitle("nrfsListDirectoryNext");
+	ReadDirectorySendBuffer bufferReadDirectorySend; /* Send buffer. */
+    bufferReadDirectorySend.message = MESSAGE_READDIR; /* Assign message type. */
+    bufferReadDirectorySend.cursor = *cursor;
 
     ReadDirectoryReceiveBuffer bufferReadDirectoryReceive; /* Receive buffer. */
 
-	correct(_path, bufferGeneralSend.path);
+	correct(_path, bufferReadDirectorySend.path);
 	
-	uint16_t node_id = get_node_id_by_path(bufferGeneralSend.path);
+	uint16_t node_id = get_node_id_by_path(bufferReadDirectorySend.path);
 
-	sendMessage(node_id, &bufferGeneralSend, sizeof(GeneralSendBuffer), 
+	sendMessage(node_id, &bufferReadDirectorySend, sizeof(ReadDirectorySendBuffer), 
 					&bufferReadDirectoryReceive, sizeof(ReadDirectoryReceiveBuffer));
 	*list = bufferReadDirectoryReceive.list;
 	if(bufferReadDirectoryReceive.result)
+	{
+		*cursor = list->cursor;
+		return 0;
+	}
+	else
+		return -1;
+}
+
+/** 
+* nrfsListDirectoryPlus - Get next pages of files/directories for a given
+* directory-path with their attributes, which are cached for nrfsGetAttribute().
+* @param fs The configured filesystem handle.
+* @param path The path of the directory.
+* @param cursor 0 to read first pages. Set to next page, or 0 after last page.
+* @param list Buffer of names with attributes.
+* @return Returns 0 on success, -1 if the path not exsit or cursor is stale.
+*/
+int nrfsListDirectoryPlus(nrfs fs, const char* _path, uint64_t *cursor, nrfsfilelistplus *list)
+{
+	Debug::debugTitle("nrfsListDirectoryPlus");
+	ReadDirectorySendBuffer bufferSend; /* Send buffer. */
+	bufferSend.message = MESSAGE_READDIRPLUS; /* Assign message type. */
+	bufferSend.cursor = *cursor;
+	ReadDirectoryPlusReceiveBuffer *bufferReceive = (ReadDirectoryPlusReceiveBuffer *)malloc(sizeof(ReadDirectoryPlusReceiveBuffer));
+
+	correct(_path, bufferSend.path);
+	uint64_t timeSend = getTimeMicro();
+	uint16_t node_id = get_node_id_by_path(bufferSend.path);
+	sendMessage(node_id, &bufferSend, sizeof(ReadDirectorySendBuffer),
+		bufferReceive, sizeof(ReadDirectoryPlusReceiveBuffer));
+	int result = bufferReceive->result ? 0 : -1;
+	if (result == 0) {
+		memcpy(list, &(bufferReceive->list), sizeof(nrfsfilelistplus));
+		*cursor = list->cursor;
+		char path[MAX_PATH_LENGTH];
+		FileMeta attr;
+		for (uint64_t i = 0; i < list->count; i++) {
+			if (!list->entry[i].valid)
+				continue;
+			snprintf(path, MAX_PATH_LENGTH, "%s/%s", bufferSend.path, list->entry[i].tuple.names);
+			correct(path, path);
+			attr.size = list->entry[i].size;
+			attr.count = list->entry[i].count;
+			attr.timeLastModified = list->entry[i].timeLastModified;
+			cacheAttribute(path, &attr, timeSend, list->entry[i].lease);
+		}
+	}
+	free(bufferReceive);
+	return result;
+}
+
+/* Collect files under path. Directories are expanded recursively.
+   @param   path    Path of file or directory.
+   @param   files   Vector to hold corrected file paths.
+   @return          If succeed return 0, otherwise return -1. */
+int collectFiles(nrfs fs, const char *_path, vector<string> &files)
+{
+	char path[MAX_PATH_LENGTH];
+	char child[MAX_PATH_LENGTH];
+	correct(_path, path);
+	int result = nrfsAccess(fs, path);
+	if (result == 1) {
+		files.push_back(string(path));
+		return 0;
+	} else if (result == 0) {
+		nrfsfilelist list;
+		uint64_t cursor = 0;
+		do {
+			if (nrfsListDirectoryNext(fs, path, &cursor, &list))
+				return -1;
+			for (uint32_t i = 0; i < list.count; i++) {
+				sprintf(child, "%s/%s", path, list.tuple[i].names);
+				if (collectFiles(fs, child, files))
+					return -1;
+			}
+		} while (cursor != 0);
+		return 0;
+	}
+	Debug::notifyError("%s does not exist.", path);
+	return -1;
+}
+
+/* Get staging progress of a server. If wait is set, server replies once no file is queued. */
+int nrfsStageStatus(uint16_t node_id, StageStatusReceiveBuffer *status, bool wait = false)
+{
+	GeneralSendBuffer bufferSend;
+	bufferSend.message = wait ? MESSAGE_STAGEWAIT : MESSAGE_STAGESTATUS;
+	sendMessage(node_id, &bufferSend, sizeof(GeneralSendBuffer),
+					status, sizeof(StageStatusReceiveBuffer));
+	if (status->result)
 		return 0;
 	else
 		return -1;
 }
 
+/**
+* nrfsSetPlacementHint - Set placement hint of a file for blocks written afterwards.
+* @param fs The configured filesystem handle.
+* @param path The full path to the file.
+* @param hint Placement hint.
+* @return Returns 0 on success, -1 on error.
+*/
+int nrfsSetPlacementHint(nrfs fs, const char *_path, int hint)
+{
+	Debug::debugTitle("nrfsSetPlacementHint");
+	PlacementHintSendBuffer bufferSend;
+	GeneralReceiveBuffer bufferReceive;
+	bufferSend.message = MESSAGE_SETHINT;
+	bufferSend.hint = (uint16_t)hint;
+	correct(_path, bufferSend.path);
+	uint16_t node_id = get_node_id_by_path(bufferSend.path);
+	sendMessage(node_id, &bufferSend, sizeof(PlacementHintSendBuffer),
+					&bufferReceive, sizeof(GeneralReceiveBuffer));
+	return bufferReceive.result ? 0 : -1;
+}
+
+/**
+* nrfsSetCompression - Set codec of a file or directory.
+* @param fs The configured filesystem handle.
+* @param path The full path to the file or directory.
+* @param codec Codec.
+* @return Returns 0 on success, -1 on error.
+*/
+int nrfsSetCompression(nrfs fs, const char *_path, int codec)
+{
+	Debug::debugTitle("nrfsSetCompression");
+	CodecSendBuffer bufferSend;
+	GeneralReceiveBuffer bufferReceive;
+	bufferSend.message = MESSAGE_SETCODEC;
+	bufferSend.codec = (uint16_t)codec;
+	correct(_path, bufferSend.path);
+	uint16_t node_id = get_node_id_by_path(bufferSend.path);
+	sendMessage(node_id, &bufferSend, sizeof(CodecSendBuffer),
+					&bufferReceive, sizeof(GeneralReceiveBuffer));
+	return bufferReceive.result ? 0 : -1;
+}
+
+/**
+* nrfsStageIn - Promote files into the memory tier and RDMA region before a job.
+* @param fs The configured filesystem handle.
+* @param paths Paths of files or directories.
+* @param count Count of paths.
+* @param tier Target tier. 0 - memory tier, 1 - keep on SSD and only fill RDMA region.
+* @param pin Keep staged blocks resident until nrfsUnpin is called.
+* @return Returns 0 when all blocks are staged, -1 on error.
+*/
+int nrfsStageIn(nrfs fs, const char **paths, int count, int tier, bool pin)
+{
+	Debug::debugTitle("nrfsStageIn");
+	int result = 0;
+	vector<string> files;
+	for (int i = 0; i < count; i++) {
+		if (collectFiles(fs, paths[i], files))
+			return -1;
+	}
+	int serverCount = client->getConfInstance()->getServerCount();
+	vector<StageStatusReceiveBuffer> baseline(serverCount + 1);
+	vector<bool> involved(serverCount + 1, false);
+	/* Counters of servers are accumulated, take a baseline to report progress of this call. */
+	for (int i = 1; i <= serverCount; i++)
+		nrfsStageStatus(i, &baseline[i]);
+
+	/* Requests are queued by servers and return at once, so that all servers stage in parallel. */
+	StageInSendBuffer bufferSend;
+	GeneralReceiveBuffer bufferReceive;
+	bufferSend.message = MESSAGE_STAGEIN;
+	bufferSend.tier = (uint16_t)tier;
+	bufferSend.pin = pin;
+	for (auto file = files.begin(); file != files.end(); file++) {
+		strcpy(bufferSend.path, file->c_str());
+		uint16_t node_id = get_node_id_by_path(bufferSend.path);
+		sendMessage(node_id, &bufferSend, sizeof(StageInSendBuffer),
+						&bufferReceive, sizeof(GeneralReceiveBuffer));
+		if (bufferReceive.result == false) {
+			Debug::notifyError("Stage in %s failed.", bufferSend.path);
+			result = -1;
+		} else {
+			involved[node_id] = true;
+		}
+	}
+
+	/* Each involved server replies when its queue is drained, servers keep staging in parallel meanwhile. */
+	uint64_t staged = 0, failed = 0;
+	StageStatusReceiveBuffer status;
+	for (int i = 1; i <= serverCount; i++) {
+		if (!involved[i])
+			continue;
+		if (nrfsStageStatus(i, &status, true)) {
+			result = -1;
+			continue;
+		}
+		staged += status.countBlockStaged - baseline[i].countBlockStaged;
+		failed += status.countBlockFailed - baseline[i].countBlockFailed;
+	}
+	Debug::notifyInfo("nrfsStageIn: %lu blocks staged, %lu blocks failed.", staged, failed);
+	if (failed > 0)
+		result = -1;
+	return result;
+}
+
+/**
+* nrfsUnpin - Unpin files staged with pin, so that they can be evicted again.
+* @param fs The configured filesystem handle.
+* @param paths Paths of files or directories.
+* @param count Count of paths.
+* @return Returns 0 on success, -1 on error.
+*/
+int nrfsUnpin(nrfs fs, const char **paths, int count)
+{
+	Debug::debugTitle("nrfsUnpin");
+	int result = 0;
+	vector<string> files;
+	for (int i = 0; i < count; i++) {
+		if (collectFiles(fs, paths[i], files))
+			return -1;
+	}
+	GeneralSendBuffer bufferSend;
+	GeneralReceiveBuffer bufferReceive;
+	bufferSend.message = MESSAGE_UNPIN;
+	for (auto file = files.begin(); file != files.end(); file++) {
+		strcpy(bufferSend.path, file->c_str());
+		uint16_t node_id = get_node_id_by_path(bufferSend.path);
+		sendMessage(node_id, &bufferSend, sizeof(GeneralSendBuffer),
+						&bufferReceive, sizeof(GeneralReceiveBuffer));
+		if (bufferReceive.result == false)
+			result = -1;
+	}
+	return result;
+}
+
+/**
+* nrfsStageOut - Drain files to the stage-out directory of servers asynchronously.
+* @param fs The configured filesystem handle.
+* @param paths Paths of files or directories.
+* @param count Count of paths.
+* @return Returns 0 when all files are queued, -1 on error.
+*/
+int nrfsStageOut(nrfs fs, const char **paths, int count)
+{
+	Debug::debugTitle("nrfsStageOut");
+	int result = 0;
+	vector<string> files;
+	for (int i = 0; i < count; i++) {
+		if (collectFiles(fs, paths[i], files))
+			return -1;
+	}
+	GeneralSendBuffer bufferSend;
+	GeneralReceiveBuffer bufferReceive;
+	bufferSend.message = MESSAGE_STAGEOUT;
+	for (auto file = files.begin(); file != files.end(); file++) {
+		strcpy(bufferSend.path, file->c_str());
+		uint16_t node_id = get_node_id_by_path(bufferSend.path);
+		sendMessage(node_id, &bufferSend, sizeof(GeneralSendBuffer),
+						&bufferReceive, sizeof(GeneralReceiveBuffer));
+		if (bufferReceive.result == false) {
+			Debug::notifyError("Stage out %s failed.", bufferSend.path);
+			result = -1;
+		}
+	}
+	return result;
+}
+
+/**
+* nrfsStageOutQuery - Query completion of nrfsStageOut.
+* @param fs The configured filesystem handle.
+* Files below the paths which were never staged out are skipped.
+* @param paths Paths passed to nrfsStageOut.
+* @param count Count of paths.
+* @return Returns the number of files still being drained, 0 when all are done, -1 if any failed.
+*/
+int nrfsStageOutQuery(nrfs fs, const char **paths, int count)
+{
+	Debug::debugTitle("nrfsStageOutQuery");
+	int pending = 0;
+	bool failed = false;
+	vector<string> files;
+	for (int i = 0; i < count; i++) {
+		if (collectFiles(fs, paths[i], files))
+			return -1;
+	}
+	GeneralSendBuffer bufferSend;
+	StageOutStatusReceiveBuffer bufferReceive;
+	bufferSend.message = MESSAGE_STAGEOUTSTATUS;
+	for (auto file = files.begin(); file != files.end(); file++) {
+		strcpy(bufferSend.path, file->c_str());
+		uint16_t node_id = get_node_id_by_path(bufferSend.path);
+		sendMessage(node_id, &bufferSend, sizeof(GeneralSendBuffer),
+						&bufferReceive, sizeof(StageOutStatusReceiveBuffer));
+		if (bufferReceive.state == DRAIN_PENDING) {
+			pending++;
+		} else if (bufferReceive.state == DRAIN_NONE) {
+			continue;                   /* Created after nrfsStageOut, or finished long ago. */
+		} else if (bufferReceive.state != DRAIN_DONE) {
+			Debug::notifyError("Stage out %s is not done, state = %d.", bufferSend.path, (int)bufferReceive.state);
+			failed = true;
+		}
+	}
+	if (failed)
+		return -1;
+	return pending;
+}
+
 /**
 * for performance test
 */
@@ -1,5 +1,6 @@
 #include "TxManager.hpp"
 #include "debug.hpp"
+#include "global.h"
 
 using namespace std;
 
@@ -31,6 +32,10 @@ uint64_t TxManager::TxLocalBegin() {
 
 void TxManager::TxWriteData(uint64_t TxID, uint64_t buffer, uint64_t size) {
 	LocalLogEntry *log = (LocalLogEntry *)LocalLogAddress;
+	if (size > sizeof(log[TxID].logData)) {
+		size = sizeof(log[TxID].logData); /* Do not run into next entry. */
+	}
+	log[TxID].size = size;
 	memcpy((void *)log[TxID].logData, (void *)buffer, size);
 	FlushData((uint64_t)log[TxID].logData, size);
 }
@@ -40,6 +45,20 @@ uint64_t TxManager::getTxWriteDataAddress(uint64_t TxID) {
 	return (uint64_t)log[TxID].logData;
 }
 
+/* Record where logged data is put, so a committed entry not yet applied can be redone by recover(). */
+void TxManager::TxWriteTarget(uint64_t TxID, uint64_t address) {
+	LocalLogEntry *log = (LocalLogEntry *)LocalLogAddress;
+	log[TxID].target = address - LocalLogAddress;
+	FlushData((uint64_t)&log[TxID].target, sizeof(log[TxID].target));
+}
+
+/* Logged data has been put to its target, nothing to redo. */
+void TxManager::TxLocalApplied(uint64_t TxID) {
+	LocalLogEntry *log = (LocalLogEntry *)LocalLogAddress;
+	log[TxID].target = 0;
+	FlushData((uint64_t)&log[TxID].target, sizeof(log[TxID].target));
+}
+
 void TxManager::TxLocalCommit(uint64_t TxID, bool action) {
 	LocalLogEntry *log = (LocalLogEntry *)LocalLogAddress;
 	log[TxID].commit = action;
@@ -67,3 +86,38 @@ void TxManager::TxDistributedCommit(uint64_t TxID, bool action) {
 	log[TxID].commit = action;
 	FlushData((uint64_t)&log[TxID].commit, CACHELINE_SIZE);
 }
+
+/* Replay logs left in a reattached segment, then empty them. Committed local entries whose data
+   was not put to its target yet are redone in log order. Other unfinished transactions can not
+   be resolved and are only reported. */
+void TxManager::recover() {
+	LocalLogEntry *logLocal = (LocalLogEntry *)LocalLogAddress;
+	DistributedLogEntry *logDistributed = (DistributedLogEntry *)DistributedLogAddress;
+	uint64_t countLocal = LOCALLOGSIZE / sizeof(LocalLogEntry);
+	uint64_t countDistributed = DISTRIBUTEDLOGSIZE / sizeof(DistributedLogEntry);
+	uint64_t countRedo = 0, countDoubt = 0;
+	uint64_t i;
+	for (i = 0; (i < countLocal) && logLocal[i].begin && (logLocal[i].TxID == i); i++) {
+		if (logLocal[i].commit == false) {
+			countDoubt++;
+		} else if ((logLocal[i].target != 0) && (logLocal[i].size <= sizeof(logLocal[i].logData))) {
+			memcpy((void *)(LocalLogAddress + logLocal[i].target), (void *)logLocal[i].logData, logLocal[i].size);
+			FlushData(LocalLogAddress + logLocal[i].target, logLocal[i].size);
+			countRedo++;
+		}
+	}
+	Debug::notifyInfo("Local log: %lu entries, %lu redone, %lu not committed", i, countRedo, countDoubt);
+	countDoubt = 0;
+	for (i = 0; (i < countDistributed) && logDistributed[i].begin && (logDistributed[i].TxID == i); i++) {
+		if (logDistributed[i].commit == false) {
+			countDoubt++;
+		}
+	}
+	if (countDoubt != 0) {
+		Debug::notifyError("Distributed log: %lu of %lu transactions not committed", countDoubt, i);
+	}
+	memset((void *)LocalLogAddress, 0, LOCALLOGSIZE);
+	memset((void *)DistributedLogAddress, 0, DISTRIBUTEDLOGSIZE);
+	LocalLogIndex = 0;
+	DistributedLogIndex = 0;
+}
@@ -0,0 +1,238 @@
+/*** Asynchronous file I/O. io_uring with thread pool fallback. ***/
+
+/** Included files. **/
+#include <string.h>                     /* String operations. E.g. memset() */
+#include <errno.h>                      /* Error number. */
+#include <unistd.h>                     /* POSIX API. E.g. syscall() */
+#include <sys/mman.h>                   /* Map rings. */
+#include <sys/syscall.h>                /* System call numbers. */
+#include "asyncio.hpp"
+#include "debug.hpp"                    /* Debug class. */
+
+/* io_uring is used through raw system calls, liburing is not required. */
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define ASYNCIO_URING 1
+#endif
+#endif
+
+/** Implemented functions. **/
+/* Constructor. Try io_uring first, start thread pool if it is not available.
+   @param   depth           Max requests in flight.
+   @param   countThread     Count of threads in fallback pool. */
+AsyncIO::AsyncIO(unsigned depth, int countThread)
+{
+    this->depth = depth;
+    countInflight = 0;
+    countUnsubmitted = 0;
+    fdRing = -1;
+    useRing = setupRing();
+    if (useRing) {
+        reaper = std::thread(&AsyncIO::ReaperWorker, this);
+        Debug::notifyInfo("AsyncIO: io_uring, depth %d", (int)depth);
+    } else {
+        for (int i = 0; i < countThread; i++) {
+            workers.push_back(std::thread(&AsyncIO::PoolWorker, this));
+        }
+        Debug::notifyInfo("AsyncIO: io_uring is not available, use %d threads", countThread);
+    }
+}
+
+/* Create io_uring and map SQ ring, CQ ring and SQE array.
+   @return  If io_uring is ready return true, otherwise return false. */
+bool AsyncIO::setupRing()
+{
+#ifdef ASYNCIO_URING
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    fdRing = (int)syscall(__NR_io_uring_setup, depth, &params);
+    if (fdRing < 0) {
+        return false;
+    }
+    sizeSqRing = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    sizeCqRing = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    sizeSqes = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqRing = mmap(NULL, sizeSqRing, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fdRing, IORING_OFF_SQ_RING);
+    cqRing = mmap(NULL, sizeCqRing, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fdRing, IORING_OFF_CQ_RING);
+    sqes = mmap(NULL, sizeSqes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fdRing, IORING_OFF_SQES);
+    if ((sqRing == MAP_FAILED) || (cqRing == MAP_FAILED) || (sqes == MAP_FAILED)) {
+        close(fdRing);
+        fdRing = -1;
+        return false;
+    }
+    sqHead = (unsigned *)((char *)sqRing + params.sq_off.head);
+    sqTail = (unsigned *)((char *)sqRing + params.sq_off.tail);
+    sqMask = (unsigned *)((char *)sqRing + params.sq_off.ring_mask);
+    sqEntries = (unsigned *)((char *)sqRing + params.sq_off.ring_entries);
+    sqArray = (unsigned *)((char *)sqRing + params.sq_off.array);
+    cqHead = (unsigned *)((char *)cqRing + params.cq_off.head);
+    cqTail = (unsigned *)((char *)cqRing + params.cq_off.tail);
+    cqMask = (unsigned *)((char *)cqRing + params.cq_off.ring_mask);
+    cqes = (char *)cqRing + params.cq_off.cqes;
+    if (depth > params.sq_entries) {
+        depth = params.sq_entries;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+/* Queue a request. With io_uring it is put into SQ ring and started by flush(), or right away when
+   the ring is full. In the pool it starts as soon as a thread is free.
+   @param   request     Request allocated with new, released after callback. */
+void AsyncIO::submit(AsyncIORequest *request)
+{
+    std::unique_lock<std::mutex> lockSubmit(mutexSubmit);
+    while (countInflight >= depth) {
+        if (countUnsubmitted > 0) {
+            enter();
+        }
+        condSlot.wait(lockSubmit);
+    }
+    countInflight++;
+    if (!useRing) {
+        lockSubmit.unlock();
+        queue.push(request);
+        return;
+    }
+#ifdef ASYNCIO_URING
+    unsigned tail = *sqTail;
+    unsigned index = tail & *sqMask;
+    struct io_uring_sqe *sqe = &((struct io_uring_sqe *)sqes)[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = request->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = request->fd;
+    sqe->addr = (uint64_t)request->iov;
+    sqe->len = request->countIov;
+    sqe->off = request->offset;
+    sqe->user_data = (uint64_t)request;
+    sqArray[index] = index;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    countUnsubmitted++;
+    if (countUnsubmitted == *sqEntries) {
+        enter();
+    }
+#endif
+}
+
+/* Pass all queued SQEs to kernel in one system call. */
+void AsyncIO::enter()
+{
+#ifdef ASYNCIO_URING
+    while (countUnsubmitted > 0) {
+        int result = (int)syscall(__NR_io_uring_enter, fdRing, countUnsubmitted, 0, 0, NULL, 0);
+        if (result < 0) {
+            if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)) {
+                continue;
+            }
+            Debug::notifyError("io_uring_enter failed: %s", strerror(errno));
+            return;
+        }
+        countUnsubmitted -= result;
+    }
+#endif
+}
+
+/* Start all queued requests. */
+void AsyncIO::flush()
+{
+    if (useRing) {
+        std::lock_guard<std::mutex> lockSubmit(mutexSubmit);
+        enter();
+    }
+}
+
+bool AsyncIO::isRing()
+{
+    return useRing;
+}
+
+/* Run callback, release request and its slot. */
+void AsyncIO::complete(AsyncIORequest *request, int64_t result)
+{
+    request->callback(result);
+    delete request;
+    std::lock_guard<std::mutex> lockSubmit(mutexSubmit);
+    countInflight--;
+    condSlot.notify_all();
+}
+
+/* Reap io_uring completions. Callbacks run on this thread and must not wait for other requests. */
+void AsyncIO::ReaperWorker()
+{
+#ifdef ASYNCIO_URING
+    while (true) {
+        int result = (int)syscall(__NR_io_uring_enter, fdRing, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if ((result < 0) && (errno != EINTR)) {
+            Debug::notifyError("io_uring wait failed: %s", strerror(errno));
+        }
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe *cqe = &((struct io_uring_cqe *)cqes)[head & *cqMask];
+            AsyncIORequest *request = (AsyncIORequest *)cqe->user_data;
+            int64_t res = cqe->res;
+            head++;
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            if (request == NULL) { /* Wake up from destructor. */
+                return;
+            }
+            complete(request, res);
+        }
+    }
+#endif
+}
+
+/* Pool thread. A NULL request stops it. */
+void AsyncIO::PoolWorker()
+{
+    while (true) {
+        AsyncIORequest *request = queue.pop();
+        if (request == NULL) {
+            return;
+        }
+        ssize_t result;
+        if (request->write) {
+            result = pwritev(request->fd, request->iov, request->countIov, request->offset);
+        } else {
+            result = preadv(request->fd, request->iov, request->countIov, request->offset);
+        }
+        complete(request, (result < 0) ? -errno : result);
+    }
+}
+
+/* Destructor. Stop reaper with a NOP request, or pool threads with NULL requests. */
+AsyncIO::~AsyncIO()
+{
+    if (useRing) {
+#ifdef ASYNCIO_URING
+        {
+            std::lock_guard<std::mutex> lockSubmit(mutexSubmit);
+            unsigned tail = *sqTail;
+            unsigned index = tail & *sqMask;
+            struct io_uring_sqe *sqe = &((struct io_uring_sqe *)sqes)[index];
+            memset(sqe, 0, sizeof(struct io_uring_sqe));
+            sqe->opcode = IORING_OP_NOP;
+            sqe->user_data = 0;
+            sqArray[index] = index;
+            __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+            countUnsubmitted++;
+            enter();
+        }
+        reaper.join();
+        munmap(sqes, sizeSqes);
+        munmap(cqRing, sizeCqRing);
+        munmap(sqRing, sizeSqRing);
+        close(fdRing);
+#endif
+    } else {
+        for (size_t i = 0; i < workers.size(); i++) {
+            queue.push(NULL);
+        }
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+}
@@ -40,6 +40,8 @@ bool Bitmap::set(uint64_t pos)
         else {
             bytes[index] |= (1 << (7 - offset)); /* Set bit in position. */
             varCountFree--;             /* Count of free bits decreases. */
+            if (loadWord(pos / 64) == ~0ULL)
+                markFull(pos / 64);     /* Last free bit of word is taken. */
         }
         return true;                    /* Succeed in setting bit. */
     } else
@@ -58,6 +60,7 @@ bool Bitmap::clear(uint64_t pos)
         if ((bytes[index] & (1 << (7 - offset))) != 0) { /* Judge if bit is set. */
             bytes[index] &= ~(1 << (7 - offset)); /* Clear bit in position. */
             varCountFree++;             /* Count of free bits increases. */
+            markNotFull(pos / 64);
         } else
             ;                           /* Do nothing. */
         return true;                    /* Succeed in clearing bit. */
@@ -65,7 +68,8 @@ bool Bitmap::clear(uint64_t pos)
         return false;                   /* Fail in clearing bit. */
 }
 
-/* Find first free bit. (That is the first cleared bit since position 0.)
+/* Find first free bit. (That is the first cleared bit since position 0.) Summary is walked from
+   top level down, then the word found in buffer is searched, one word is read on each level.
    @param   pos     If a first free bit is found, then it contains position of the first free bit.
    @return          If operation succeeds then return true, otherwise return false.
                     E.g. if no free bits or null position pointer then return false. */
@@ -73,15 +77,18 @@ bool Bitmap::findFree(uint64_t *pos)    /* Find first free bit. */
 {
     if (pos != NULL) {                  /* Judge if position is valid. */
         if (varCountFree > 0) {         /* Judge if free bit exists. */
-            for (unsigned int index = 0; index < varCountTotal / 8; index++) { /* Search in all bytes in array. */
-                for (int offset = 0; offset <= 7; offset++) { /* Search in all offsets in byte. */
-                    if ((bytes[index] & (1 << (7 - offset))) == 0) { /* Judge if bit is cleared. */
-                        *pos = index * 8 + offset; /* Return position of cleared bit. */
-                        return true;
-                    }
-                }
+            uint64_t index = 0;         /* Index of word in current level. */
+            for (int level = countLevel - 1; level >= 0; level--) {
+                uint64_t word = summary[level][index];
+                if (word == ~0ULL)
+                    return false;       /* Should not reach here. */
+                index = index * 64 + __builtin_ctzll(~word); /* First word not full in level below. */
             }
-            return false;               /* Should not reach here. */
+            uint64_t word = loadWord(index);
+            if (word == ~0ULL)
+                return false;           /* Should not reach here. */
+            *pos = index * 64 + __builtin_clzll(~word); /* Position order starts from most significant bit. */
+            return true;
         } else
             return false;               /* Fail in finding first free bit due to no free bits. */
     } else
@@ -102,7 +109,49 @@ uint64_t Bitmap::countTotal()
     return varCountTotal;               /* Return count of total bits. */
 }
 
+/* Load a word of buffer. Bits are returned in position order, position 0 being the most
+   significant bit, bits past the end of bitmap are set so they are never found free.
+   @param   index   Index of word.
+   @return          Word in position order. */
+uint64_t Bitmap::loadWord(uint64_t index)
+{
+    uint64_t word = ~0ULL;
+    uint64_t offset = index * 8;        /* Offset of word in byte array. */
+    uint64_t length = varCountTotal / 8 - offset;
+    memcpy(&word, bytes + offset, (length < 8) ? length : 8); /* Buffer might not be aligned. */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    word = __builtin_bswap64(word);     /* First byte goes to most significant byte. */
+#endif
+    return word;
+}
+
+/* Mark a word of buffer full in summary, and levels above if their words become full.
+   @param   index   Index of word in buffer. */
+void Bitmap::markFull(uint64_t index)
+{
+    for (int level = 0; level < countLevel; level++) {
+        summary[level][index / 64] |= 1ULL << (index % 64);
+        if (summary[level][index / 64] != ~0ULL)
+            break;                      /* Word of this level still has room. */
+        index /= 64;
+    }
+}
+
+/* Mark a word of buffer not full in summary, and levels above if their words were full.
+   @param   index   Index of word in buffer. */
+void Bitmap::markNotFull(uint64_t index)
+{
+    for (int level = 0; level < countLevel; level++) {
+        bool full = (summary[level][index / 64] == ~0ULL);
+        summary[level][index / 64] &= ~(1ULL << (index % 64));
+        if (full == false)
+            break;                      /* Level above did not mark this word. */
+        index /= 64;
+    }
+}
+
 /* Constructor of bitmap. Here use existed buffer as bitmap and initialize other parameter based on buffer.
+   Free bits are counted a word at a time and summary levels are built from buffer.
    (If fail in constructing, error information will be printed in standard error output.)
    @param   count   The count of total bits in the bitmap.
    @param   buffer  The buffer to contain bitmap. */
@@ -112,14 +161,42 @@ Bitmap::Bitmap(uint64_t count, char *buffer) /* Constructor of bitmap. */
         if (buffer != NULL) {           /* Judge if buffer is null or not. */
             bytes = (uint8_t *)buffer;  /* Assign byte array of bitmap. */
             varCountTotal = count;      /* Initialize count of total bits. */
-            varCountFree = 0;           /* Initialize count of free bits. */
-            for (unsigned int index = 0; index < varCountTotal / 8; index++) { /* Search in all bytes in array. */
-                for (int offset = 0; offset <= 7; offset++) { /* Search in all offsets in byte. */
-                    if ((bytes[index] & (1 << (7 - offset))) == 0) { /* Judge if bit is cleared. */
-                        varCountFree++; /* Increment of free bit. */
+            countWord = (count + 63) / 64;
+            uint64_t countSet = 0;      /* Set bits including padding of last word. */
+            for (uint64_t index = 0; index < countWord; index++) {
+                countSet += __builtin_popcountll(loadWord(index));
+            }
+            varCountFree = countWord * 64 - countSet; /* Padding bits are set, so they are not counted. */
+            countLevel = 0;
+            uint64_t countBelow = countWord; /* Count of words in level below. */
+            do {
+                if (countLevel == BITMAP_LEVEL_MAX) {
+                    fprintf(stderr, "Bitmap: too many bits.\n");
+                    exit(EXIT_FAILURE);
+                }
+                uint64_t countCurrent = (countBelow + 63) / 64;
+                if (countCurrent == 0)
+                    countCurrent = 1;   /* Empty bitmap still has a full top word. */
+                uint64_t *words = (uint64_t *)malloc(countCurrent * sizeof(uint64_t));
+                if (words == NULL) {
+                    fprintf(stderr, "Bitmap: cannot allocate summary.\n");
+                    exit(EXIT_FAILURE);
+                }
+                for (uint64_t index = 0; index < countCurrent; index++) {
+                    uint64_t word = 0;
+                    for (uint64_t bit = 0; bit < 64; bit++) {
+                        uint64_t below = index * 64 + bit;
+                        bool full = (below >= countBelow) /* Padding is full. */
+                            || ((countLevel == 0) ? (loadWord(below) == ~0ULL) : (summary[countLevel - 1][below] == ~0ULL));
+                        if (full)
+                            word |= 1ULL << bit;
                     }
+                    words[index] = word;
                 }
-            }
+                summary[countLevel] = words;
+                countLevel++;
+                countBelow = countCurrent;
+            } while (countBelow > 1);
         } else {
             fprintf(stderr, "Bitmap: buffer pointer is null.\n");
             exit(EXIT_FAILURE);         /* Fail due to null buffer pointer. */
@@ -130,8 +207,10 @@ Bitmap::Bitmap(uint64_t count, char *buffer) /* Constructor of bitmap. */
     }
 }
 
-/* Deconstructor of bitmap. Here do nothing due to persistence. */
+/* Deconstructor of bitmap. Only summary is released, buffer is kept due to persistence. */
 Bitmap::~Bitmap()                       /* Destructor of bitmap. */
 {
-    ;                                   /* Do nothing. */
+    for (int level = 0; level < countLevel; level++) {
+        free(summary[level]);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,1034 @@
+/*** Block stores for the SSD storage tier and the spill tier. ***/
+
+/** Included files. **/
+#include <stdio.h>                      /* Standard I/O. */
+#include <stdlib.h>                     /* Standard library. E.g. posix_memalign() */
+#include <string.h>                     /* String operations. E.g. memcpy() */
+#include <errno.h>                      /* Error number. */
+#include <fcntl.h>                      /* File control. E.g. open() */
+#include <unistd.h>                     /* POSIX API. E.g. pread() */
+#include <sys/uio.h>                    /* Vector I/O. E.g. pwritev() */
+#include <sys/stat.h>                   /* File status. E.g. mkdir() */
+#include <dirent.h>                     /* Directory listing. E.g. readdir() */
+#include <chrono>
+#include "blockstore.hpp"
+#include "debug.hpp"                    /* Debug class. */
+
+/** Implemented functions. **/
+typedef struct {                        /* Wait for one asynchronous request. */
+    std::mutex mutexDone;
+    std::condition_variable condDone;
+    bool done;
+    int64_t result;
+} BlockWaiter;
+
+static BlockStoreCallback notifyWaiter(BlockWaiter *waiter)
+{
+    waiter->done = false;
+    return [waiter](int64_t result) {
+        std::lock_guard<std::mutex> lockDone(waiter->mutexDone);
+        waiter->result = result;
+        waiter->done = true;
+        waiter->condDone.notify_one();
+    };
+}
+
+static int64_t waitWaiter(BlockWaiter *waiter)
+{
+    std::unique_lock<std::mutex> lockDone(waiter->mutexDone);
+    while (!waiter->done) {
+        waiter->condDone.wait(lockDone);
+    }
+    return waiter->result;
+}
+
+/* Create block store by engine name.
+   @param   engine      "log" for LogBlockStore, "dir" for DirBlockStore, "posix" for PosixBlockStore.
+   @param   path        Log file, database directory or spill directory.
+   @param   capacity    Capacity in bytes. Only used by log engine.
+   @param   recover     Keep blocks left by last run instead of truncating the store.
+   @return              Opened store, or NULL on error. */
+BlockStore *BlockStore::create(const char *engine, const char *path, uint64_t capacity, bool recover)
+{
+    if (strcmp(engine, "log") == 0) {
+        LogBlockStore *store = new LogBlockStore();
+        if (store->open(path, capacity, recover) == false) {
+            delete store;
+            return NULL;
+        }
+        return store;
+    } else if (strcmp(engine, "dir") == 0) {
+        DirBlockStore *store = new DirBlockStore();
+        if (store->open(path, recover) == false) {
+            delete store;
+            return NULL;
+        }
+        return store;
+    } else if (strcmp(engine, "posix") == 0) {
+        PosixBlockStore *store = new PosixBlockStore();
+        if (store->open(path, recover) == false) {
+            delete store;
+            return NULL;
+        }
+        return store;
+    } else {
+        Debug::notifyError("Unknown block store engine %s.", engine);
+        return NULL;
+    }
+}
+
+/* Open directory database, old content is truncated unless recovering. */
+bool DirBlockStore::open(const char *path, bool recover)
+{
+    uint32_t mode = kyotocabinet::DirDB::OWRITER | kyotocabinet::DirDB::OCREATE;
+    if (!recover) {
+        mode |= kyotocabinet::DirDB::OTRUNCATE;
+    }
+    if (!db.open(path, mode)) {
+        Debug::notifyError("DB open error: %s", db.error().name());
+        return false;
+    }
+    return true;
+}
+
+int64_t DirBlockStore::get(uint64_t key, char *buffer, uint64_t size)
+{
+    char keyString[24];
+    int lengthKey = sprintf(keyString, "%lu", (unsigned long)key);
+    return db.get(keyString, lengthKey, buffer, size);
+}
+
+bool DirBlockStore::set(uint64_t key, const char *buffer, uint64_t size)
+{
+    char keyString[24];
+    int lengthKey = sprintf(keyString, "%lu", (unsigned long)key);
+    return db.set(keyString, lengthKey, buffer, size);
+}
+
+bool DirBlockStore::remove(uint64_t key)
+{
+    char keyString[24];
+    int lengthKey = sprintf(keyString, "%lu", (unsigned long)key);
+    return db.remove(keyString, lengthKey);
+}
+
+DirBlockStore::~DirBlockStore()
+{
+    db.close();
+}
+
+static inline uint64_t alignUp(uint64_t size)
+{
+    return (size + LOG_ALIGN - 1) / LOG_ALIGN * LOG_ALIGN;
+}
+
+static inline bool isAligned(const void *buffer, uint64_t size)
+{
+    return (((uint64_t)buffer % LOG_ALIGN) == 0) && ((size % LOG_ALIGN) == 0);
+}
+
+LogBlockStore::LogBlockStore()
+{
+    fd = -1;
+    countSegment = 0;
+    io = NULL;
+    segmentCurrent = 0;
+    offsetCurrent = 0;
+    sequence = 0;
+    generationNext = 1;
+    stop = false;
+}
+
+/* Open log file, old content is truncated unless recovering. Falls back to buffered I/O if the
+   file system does not support O_DIRECT (e.g. tmpfs).
+   @param   path        Path of log file.
+   @param   capacity    Size of log file in bytes.
+   @param   recover     Rebuild index from records left by last run.
+   @return              If succeed return true, otherwise return false. */
+bool LogBlockStore::open(const char *path, uint64_t capacity, bool recover)
+{
+    if ((path == NULL) || (path[0] == '\0')) {
+        Debug::notifyError("Log block store needs an explicit log file, it is grown to capacity.");
+        return false;
+    }
+    countSegment = capacity / LOG_SEGMENT_SIZE;
+    if (countSegment < LOG_COMPACT_FREE + 2) {
+        Debug::notifyError("SSD tier capacity is too small, at least %d segments.", LOG_COMPACT_FREE + 2);
+        return false;
+    }
+    int flags = O_RDWR | O_CREAT | (recover ? 0 : O_TRUNC);
+    fd = ::open(path, flags | O_DIRECT, 0644);
+    if ((fd < 0) && (errno == EINVAL)) {
+        Debug::notifyInfo("O_DIRECT is not supported on %s, use buffered I/O.", path);
+        fd = ::open(path, flags, 0644);
+    }
+    if (fd < 0) {
+        Debug::notifyError("Open log file %s failed: %s", path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || ((uint64_t)st.st_size < countSegment * LOG_SEGMENT_SIZE)) {
+        if (ftruncate(fd, countSegment * LOG_SEGMENT_SIZE) != 0) { /* Only grow, a raw partition cannot be resized. */
+            Debug::notifyError("Resize log file %s failed: %s", path, strerror(errno));
+            return false;
+        }
+    }
+    bytesLive.assign(countSegment, 0);
+    countReader.assign(countSegment, 0);
+    generations.assign(countSegment, 0);
+    if (recover) {
+        if (rebuild() == false) {
+            return false;
+        }
+    } else {
+        for (uint64_t i = 0; i < countSegment; i++) { /* A raw partition is not truncated. */
+            uint64_t generation;
+            if (clearSegment(i, &generation) == false) {
+                Debug::notifyError("Clear log file %s failed: %s", path, strerror(errno));
+                return false;
+            }
+            if (generation >= generationNext) {
+                generationNext = generation + 1; /* Records left behind are never of a new generation. */
+            }
+        }
+        for (uint64_t i = countSegment - 1; i > 0; i--) {
+            segmentsFree.push_back(i);
+        }
+        segmentCurrent = 0;
+        offsetCurrent = 0;
+        generations[segmentCurrent] = generationNext++;
+    }
+    io = new AsyncIO(LOG_IO_DEPTH, LOG_IO_THREADS);
+    compactor = std::thread(&LogBlockStore::CompactorWorker, this);
+    Debug::notifyInfo("Log block store %s, %lu segments", path, (unsigned long)countSegment);
+    return true;
+}
+
+/* Size of a record on disk, header plus aligned data. */
+uint64_t LogBlockStore::recordSize(uint64_t length)
+{
+    return (length == LOG_TOMBSTONE) ? LOG_ALIGN : (LOG_ALIGN + alignUp(length));
+}
+
+/* Read headers of records written into a segment, in log order. Offset of a record is not kept in
+   its header, it is the sum of sizes of records before it. Scan stops at the first record of
+   another generation, which is left from an earlier use of segment.
+   @param   segment     Segment to scan.
+   @param   generation  Generation of segment, 0 to take the one of its first record. Buffer of it.
+   @param   headers     Buffer of headers, cleared first.
+   @return              If succeed return true, otherwise return false. */
+bool LogBlockStore::scanSegment(uint64_t segment, uint64_t *generation, std::vector<LogRecordHeader> *headers)
+{
+    LogRecordHeader *header;
+    if (posix_memalign((void **)&header, LOG_ALIGN, LOG_ALIGN) != 0) {
+        return false;
+    }
+    headers->clear();
+    uint64_t offset = 0;
+    while (offset + LOG_ALIGN <= LOG_SEGMENT_SIZE) {
+        if ((pread(fd, header, LOG_ALIGN, segment * LOG_SEGMENT_SIZE + offset) != LOG_ALIGN) ||
+            (header->magic != LOG_MAGIC) ||
+            ((header->length != LOG_TOMBSTONE) && (header->length > LOG_SEGMENT_SIZE - LOG_ALIGN)) ||
+            (offset + recordSize(header->length) > LOG_SEGMENT_SIZE) ||
+            ((*generation != 0) && (header->generation != *generation))) {
+            break;                      /* End of records written into this segment. */
+        }
+        *generation = header->generation;
+        headers->push_back(*header);
+        offset += recordSize(header->length);
+    }
+    free(header);
+    return true;
+}
+
+/* Clear first record header of a segment, so none of its records are found by scanning.
+   @param   segment     Segment to clear.
+   @param   generation  Buffer of generation of cleared header, 0 if it is not a record.
+   @return              If succeed return true, otherwise return false. */
+bool LogBlockStore::clearSegment(uint64_t segment, uint64_t *generation)
+{
+    LogRecordHeader *header;
+    if (posix_memalign((void **)&header, LOG_ALIGN, LOG_ALIGN) != 0) {
+        return false;
+    }
+    *generation = 0;
+    if ((pread(fd, header, LOG_ALIGN, segment * LOG_SEGMENT_SIZE) == LOG_ALIGN) && (header->magic == LOG_MAGIC)) {
+        *generation = header->generation;
+    }
+    memset(header, 0, LOG_ALIGN);
+    bool result = (pwrite(fd, header, LOG_ALIGN, segment * LOG_SEGMENT_SIZE) == LOG_ALIGN);
+    free(header);
+    return result;
+}
+
+/* Account data records of a segment being recycled. A tombstone whose key has no older record
+   left in log hides nothing any more and is dropped. Called with mutexIndex held.
+   @param   headers     Headers of records in segment. */
+void LogBlockStore::forgetRecords(const std::vector<LogRecordHeader> &headers)
+{
+    for (auto header = headers.begin(); header != headers.end(); header++) {
+        if (header->length == LOG_TOMBSTONE) {
+            continue;
+        }
+        auto count = countRecord.find(header->key);
+        if ((count == countRecord.end()) || (--count->second > 0)) {
+            continue;
+        }
+        countRecord.erase(count);
+        auto tombstone = tombstones.find(header->key);
+        if (tombstone != tombstones.end()) {
+            bytesLive[tombstone->second.offset / LOG_SEGMENT_SIZE] -= LOG_ALIGN;
+            tombstones.erase(tombstone);
+        }
+    }
+}
+
+/* Scan record headers of every segment. The record with the highest sequence of a key wins. A
+   winning tombstone is kept only if older records of its key are still in log. Segments holding
+   live records are retired, others are free, appending starts in a free segment.
+   @return  If succeed return true, otherwise return false. */
+bool LogBlockStore::rebuild()
+{
+    std::unordered_map<uint64_t, LogIndexEntry> latest;
+    std::vector<LogRecordHeader> headers;
+    sequence = 0;
+    for (uint64_t segment = 0; segment < countSegment; segment++) {
+        uint64_t generation = 0;
+        if (scanSegment(segment, &generation, &headers) == false) {
+            return false;
+        }
+        generations[segment] = generation;
+        if (generation >= generationNext) {
+            generationNext = generation + 1;
+        }
+        uint64_t offset = 0;
+        for (auto header = headers.begin(); header != headers.end(); header++) {
+            LogIndexEntry entry;
+            entry.offset = segment * LOG_SEGMENT_SIZE + offset;
+            entry.length = header->length;
+            entry.sequence = header->sequence;
+            auto it = latest.find(header->key);
+            if ((it == latest.end()) || (it->second.sequence < entry.sequence)) {
+                latest[header->key] = entry;
+            }
+            if (header->length != LOG_TOMBSTONE) {
+                countRecord[header->key]++;
+            }
+            if (header->sequence >= sequence) {
+                sequence = header->sequence + 1;
+            }
+            offset += recordSize(header->length);
+        }
+    }
+    for (auto it = latest.begin(); it != latest.end(); it++) {
+        if (it->second.length != LOG_TOMBSTONE) {
+            index[it->first] = it->second;
+        } else if (countRecord.find(it->first) != countRecord.end()) {
+            tombstones[it->first] = it->second;
+        } else {
+            continue;                   /* Nothing left to hide. */
+        }
+        bytesLive[it->second.offset / LOG_SEGMENT_SIZE] += recordSize(it->second.length);
+    }
+    for (uint64_t i = countSegment; i > 0; i--) {
+        if (bytesLive[i - 1] != 0) {
+            segmentsRetired.push_back(i - 1);
+        } else {
+            segmentsFree.push_back(i - 1);
+        }
+    }
+    if (segmentsFree.empty()) {
+        Debug::notifyError("SSD tier is full, no segment to append to.");
+        return false;
+    }
+    segmentCurrent = segmentsFree.back();
+    segmentsFree.pop_back();
+    offsetCurrent = 0;
+    generations[segmentCurrent] = generationNext++;
+    Debug::notifyInfo("Log block store: %lu blocks, %lu tombstones, %lu free segments recovered", (unsigned long)index.size(),
+        (unsigned long)tombstones.size(), (unsigned long)segmentsFree.size());
+    return true;
+}
+
+/* Take room for a record at log head, moving to a free segment if current one has no room.
+   Called with mutexIndex held.
+   @param   sizeRecord  On disk size of record.
+   @param   offset      Buffer of offset of record.
+   @return              If log is full return false, otherwise return true. */
+bool LogBlockStore::reserve(uint64_t sizeRecord, uint64_t *offset)
+{
+    if (offsetCurrent + sizeRecord > LOG_SEGMENT_SIZE) {
+        if (segmentsFree.empty()) {
+            condCompact.notify_one();
+            Debug::notifyError("SSD tier is full.");
+            return false;
+        }
+        segmentsRetired.push_back(segmentCurrent);
+        segmentCurrent = segmentsFree.back();
+        segmentsFree.pop_back();
+        offsetCurrent = 0;
+        generations[segmentCurrent] = generationNext++;
+        if (segmentsFree.size() < LOG_COMPACT_FREE) {
+            condCompact.notify_one();
+        }
+    }
+    *offset = segmentCurrent * LOG_SEGMENT_SIZE + offsetCurrent;
+    offsetCurrent += sizeRecord;
+    bytesLive[segmentCurrent] += sizeRecord;
+    return true;
+}
+
+/* Append a record at log head asynchronously. Aligned data goes out in one vectored write from
+   caller buffer, other data is copied into an aligned record buffer first. On completion the record
+   is published in index, unless a newer write of the key exists or the key was removed meanwhile.
+   @param   key         Key of block.
+   @param   buffer      Data, valid until callback.
+   @param   size        Length of data.
+   @param   sequenceOld Sequence to keep when relocating a record.
+   @param   offsetOld   Offset of record being relocated, (uint64_t)-1 for a new write. Relocated
+                        record is published only if index still points to the old one.
+   @param   callback    Called with size on success, -1 on error. */
+void LogBlockStore::write(uint64_t key, const char *buffer, uint64_t size, uint64_t sequenceOld, uint64_t offsetOld, BlockStoreCallback callback)
+{
+    uint64_t sizeRecord = recordSize(size);
+    bool relocate = (offsetOld != (uint64_t)-1);
+    bool aligned = isAligned(buffer, size);
+    char *record;
+    if ((sizeRecord > LOG_SEGMENT_SIZE) ||
+        (posix_memalign((void **)&record, LOG_ALIGN, aligned ? LOG_ALIGN : sizeRecord) != 0)) {
+        callback(-1);
+        return;
+    }
+    memset(record, 0, LOG_ALIGN);
+    LogRecordHeader *header = (LogRecordHeader *)record;
+    header->magic = LOG_MAGIC;
+    header->key = key;
+    header->length = size;
+    uint64_t offset;
+    uint64_t segment;
+    uint64_t sequenceRecord;
+    {
+        std::unique_lock<std::mutex> lockIndex(mutexIndex);
+        if (reserve(sizeRecord, &offset) == false) {
+            lockIndex.unlock();
+            free(record);
+            callback(-1);
+            return;
+        }
+        segment = offset / LOG_SEGMENT_SIZE;
+        header->generation = generations[segment];
+        countRecord[key]++;             /* Counted while in flight, a tombstone must outlive it. */
+        sequenceRecord = relocate ? sequenceOld : sequence++;
+        if (!relocate) {
+            PendingWrite write;
+            write.buffer = buffer;
+            write.length = size;
+            write.sequence = sequenceRecord;
+            pending[key] = write;
+        }
+    }
+    header->sequence = sequenceRecord;
+    AsyncIORequest *request = new AsyncIORequest;
+    request->write = true;
+    request->fd = fd;
+    request->offset = offset;
+    if (aligned) {
+        request->iov[0].iov_base = record;
+        request->iov[0].iov_len = LOG_ALIGN;
+        request->iov[1].iov_base = (void *)buffer;
+        request->iov[1].iov_len = size;
+        request->countIov = 2;
+    } else {
+        memcpy(record + LOG_ALIGN, buffer, size);
+        memset(record + LOG_ALIGN + size, 0, sizeRecord - LOG_ALIGN - size);
+        request->iov[0].iov_base = record;
+        request->iov[0].iov_len = sizeRecord;
+        request->countIov = 1;
+    }
+    request->callback = [=](int64_t result) {
+        bool success = (result == (int64_t)sizeRecord);
+        {
+            std::lock_guard<std::mutex> lockIndex(mutexIndex);
+            bool publish = success;
+            auto it = index.find(key);
+            if (relocate) {
+                publish = publish && (it != index.end()) && (it->second.offset == offsetOld);
+            } else {
+                auto write = pending.find(key);
+                /* No pending entry means key was removed, or a newer write has been published. */
+                publish = publish && (write != pending.end()) && (write->second.sequence >= sequenceRecord) &&
+                          ((it == index.end()) || (it->second.sequence < sequenceRecord));
+                if ((write != pending.end()) && (write->second.sequence == sequenceRecord)) {
+                    pending.erase(write);
+                }
+            }
+            if (publish) {
+                if (it != index.end()) {
+                    bytesLive[it->second.offset / LOG_SEGMENT_SIZE] -= recordSize(it->second.length);
+                }
+                auto tombstone = tombstones.find(key);
+                if ((tombstone != tombstones.end()) && (tombstone->second.sequence < sequenceRecord)) {
+                    bytesLive[tombstone->second.offset / LOG_SEGMENT_SIZE] -= LOG_ALIGN; /* Key is written again. */
+                    tombstones.erase(tombstone);
+                }
+                LogIndexEntry entry;
+                entry.offset = offset;
+                entry.length = size;
+                entry.sequence = sequenceRecord;
+                index[key] = entry;
+            } else {
+                bytesLive[segment] -= sizeRecord;
+            }
+        }
+        free(record);
+        if (!success) {
+            Debug::notifyError("Write log record failed: %s", strerror(-result));
+        }
+        callback(success ? (int64_t)size : -1);
+    };
+    io->submit(request);
+}
+
+/* Append a tombstone asynchronously. On completion it is published, unless the key has been
+   written again meanwhile.
+   @param   key                 Key removed.
+   @param   sequenceTombstone   Sequence of tombstone, kept when relocating.
+   @param   offsetOld           Offset of tombstone being relocated, (uint64_t)-1 for a new one.
+   @param   callback            Called with 0 on success, -1 on error. */
+void LogBlockStore::writeTombstone(uint64_t key, uint64_t sequenceTombstone, uint64_t offsetOld, BlockStoreCallback callback)
+{
+    bool relocate = (offsetOld != (uint64_t)-1);
+    char *record;
+    if (posix_memalign((void **)&record, LOG_ALIGN, LOG_ALIGN) != 0) {
+        callback(-1);
+        return;
+    }
+    memset(record, 0, LOG_ALIGN);
+    LogRecordHeader *header = (LogRecordHeader *)record;
+    header->magic = LOG_MAGIC;
+    header->key = key;
+    header->length = LOG_TOMBSTONE;
+    header->sequence = sequenceTombstone;
+    uint64_t offset;
+    {
+        std::unique_lock<std::mutex> lockIndex(mutexIndex);
+        if (reserve(LOG_ALIGN, &offset) == false) {
+            lockIndex.unlock();
+            free(record);
+            callback(-1);
+            return;
+        }
+        header->generation = generations[offset / LOG_SEGMENT_SIZE];
+    }
+    AsyncIORequest *request = new AsyncIORequest;
+    request->write = true;
+    request->fd = fd;
+    request->offset = offset;
+    request->iov[0].iov_base = record;
+    request->iov[0].iov_len = LOG_ALIGN;
+    request->countIov = 1;
+    request->callback = [=](int64_t result) {
+        bool success = (result == LOG_ALIGN);
+        {
+            std::lock_guard<std::mutex> lockIndex(mutexIndex);
+            auto it = index.find(key);
+            auto tombstone = tombstones.find(key);
+            bool publish = success;
+            if (relocate) {
+                publish = publish && (tombstone != tombstones.end()) && (tombstone->second.offset == offsetOld);
+            } else {
+                publish = publish && ((it == index.end()) || (it->second.sequence < sequenceTombstone)) &&
+                          ((tombstone == tombstones.end()) || (tombstone->second.sequence < sequenceTombstone)) &&
+                          (countRecord.find(key) != countRecord.end()); /* Otherwise nothing to hide. */
+            }
+            if (publish) {
+                if (tombstone != tombstones.end()) {
+                    bytesLive[tombstone->second.offset / LOG_SEGMENT_SIZE] -= LOG_ALIGN;
+                }
+                LogIndexEntry entry;
+                entry.offset = offset;
+                entry.length = LOG_TOMBSTONE;
+                entry.sequence = sequenceTombstone;
+                tombstones[key] = entry;
+            } else {
+                bytesLive[offset / LOG_SEGMENT_SIZE] -= LOG_ALIGN;
+            }
+        }
+        free(record);
+        if (!success) {
+            Debug::notifyError("Write log tombstone failed: %s", strerror(-result));
+        }
+        callback(success ? 0 : -1);
+    };
+    io->submit(request);
+}
+
+/* Append tombstones queued by remove() and wait for them. Runs on compactor thread, remove() may be
+   called from I/O callbacks which must not submit requests of this store. */
+void LogBlockStore::writeTombstones()
+{
+    std::vector<std::pair<uint64_t, uint64_t> > queued;
+    {
+        std::lock_guard<std::mutex> lockIndex(mutexIndex);
+        queued.swap(tombstonesQueued);
+    }
+    if (queued.empty()) {
+        return;
+    }
+    BlockWaiter *waiters = new BlockWaiter[queued.size()];
+    for (size_t i = 0; i < queued.size(); i++) {
+        writeTombstone(queued[i].first, queued[i].second, (uint64_t)-1, notifyWaiter(&waiters[i]));
+    }
+    flush();
+    for (size_t i = 0; i < queued.size(); i++) {
+        waitWaiter(&waiters[i]);
+    }
+    delete[] waiters;
+}
+
+/* Write a block asynchronously, old record of the same key becomes dead space. */
+void LogBlockStore::setAsync(uint64_t key, const char *buffer, uint64_t size, BlockStoreCallback callback)
+{
+    write(key, buffer, size, 0, (uint64_t)-1, callback);
+}
+
+/* Read a block asynchronously. At most size bytes are read. Callback gets length of data, -1 if key
+   is not found or read fails. */
+void LogBlockStore::getAsync(uint64_t key, char *buffer, uint64_t size, BlockStoreCallback callback)
+{
+    LogIndexEntry entry;
+    uint64_t length;
+    {
+        std::unique_lock<std::mutex> lockIndex(mutexIndex);
+        auto write = pending.find(key);
+        if (write != pending.end()) { /* Latest data is still being written. */
+            length = (write->second.length < size) ? write->second.length : size;
+            memcpy(buffer, write->second.buffer, length);
+            lockIndex.unlock();
+            callback(length);
+            return;
+        }
+        auto it = index.find(key);
+        if (it == index.end()) {
+            lockIndex.unlock();
+            callback(-1);
+            return;
+        }
+        entry = it->second;
+        countReader[entry.offset / LOG_SEGMENT_SIZE]++; /* Segment cannot be recycled while reading. */
+    }
+    length = (entry.length < size) ? entry.length : size;
+    uint64_t segment = entry.offset / LOG_SEGMENT_SIZE;
+    char *bounce = NULL;
+    if (!isAligned(buffer, length) && (posix_memalign((void **)&bounce, LOG_ALIGN, alignUp(length)) != 0)) {
+        std::lock_guard<std::mutex> lockIndex(mutexIndex);
+        countReader[segment]--;
+        callback(-1);
+        return;
+    }
+    AsyncIORequest *request = new AsyncIORequest;
+    request->write = false;
+    request->fd = fd;
+    request->offset = entry.offset + LOG_ALIGN;
+    request->iov[0].iov_base = (bounce != NULL) ? bounce : buffer;
+    request->iov[0].iov_len = (bounce != NULL) ? alignUp(length) : length;
+    request->countIov = 1;
+    request->callback = [=](int64_t result) {
+        bool success = (result >= (int64_t)length);
+        if (bounce != NULL) {
+            if (success) {
+                memcpy(buffer, bounce, length);
+            }
+            free(bounce);
+        }
+        {
+            std::lock_guard<std::mutex> lockIndex(mutexIndex);
+            countReader[segment]--;
+        }
+        if (!success) {
+            Debug::notifyError("Read log record failed: %s", strerror(-result));
+        }
+        callback(success ? (int64_t)length : -1);
+    };
+    io->submit(request);
+}
+
+/* Start queued requests. */
+void LogBlockStore::flush()
+{
+    io->flush();
+}
+
+/* Write a block and wait for it. */
+bool LogBlockStore::set(uint64_t key, const char *buffer, uint64_t size)
+{
+    BlockWaiter waiter;
+    setAsync(key, buffer, size, notifyWaiter(&waiter));
+    flush();
+    return (waitWaiter(&waiter) == (int64_t)size);
+}
+
+/* Read a block and wait for it.
+   @return  Length of data read, -1 if key is not found or read fails. */
+int64_t LogBlockStore::get(uint64_t key, char *buffer, uint64_t size)
+{
+    BlockWaiter waiter;
+    getAsync(key, buffer, size, notifyWaiter(&waiter));
+    flush();
+    return waitWaiter(&waiter);
+}
+
+/* Remove a block. Its record becomes dead space, a write of it in flight is dropped. A tombstone
+   is queued for compactor thread to append, so the block stays removed after a restart. */
+bool LogBlockStore::remove(uint64_t key)
+{
+    std::lock_guard<std::mutex> lockIndex(mutexIndex);
+    bool result = (pending.erase(key) > 0);
+    auto it = index.find(key);
+    if (it != index.end()) {
+        bytesLive[it->second.offset / LOG_SEGMENT_SIZE] -= recordSize(it->second.length);
+        index.erase(it);
+        result = true;
+    }
+    if (result) {
+        tombstonesQueued.push_back(std::make_pair(key, sequence++));
+        condCompact.notify_one();
+    }
+    return result;
+}
+
+/* Copy live records of a retired segment to the log head and recycle the segment.
+   @param   segment     Segment to compact.
+   @return              If segment is recycled return true, otherwise return false. */
+bool LogBlockStore::compactSegment(uint64_t segment)
+{
+    std::vector<std::pair<uint64_t, LogIndexEntry> > records;
+    std::vector<std::pair<uint64_t, LogIndexEntry> > removed;
+    {
+        std::lock_guard<std::mutex> lockIndex(mutexIndex);
+        for (auto it = index.begin(); it != index.end(); it++) {
+            if (it->second.offset / LOG_SEGMENT_SIZE == segment) {
+                records.push_back(*it);
+            }
+        }
+        for (auto it = tombstones.begin(); it != tombstones.end(); it++) {
+            if (it->second.offset / LOG_SEGMENT_SIZE == segment) {
+                removed.push_back(*it);
+            }
+        }
+    }
+    for (auto it = removed.begin(); it != removed.end(); it++) {
+        BlockWaiter waiter;
+        writeTombstone(it->first, it->second.sequence, it->second.offset, notifyWaiter(&waiter));
+        flush();
+        if (waitWaiter(&waiter) < 0) {
+            return false;
+        }
+    }
+    for (auto it = records.begin(); it != records.end(); it++) {
+        char *buffer;
+        if (posix_memalign((void **)&buffer, LOG_ALIGN, alignUp(it->second.length)) != 0) {
+            return false;
+        }
+        /* Retired segment is not written any more, read it directly. */
+        if (pread(fd, buffer, alignUp(it->second.length), it->second.offset + LOG_ALIGN) != (ssize_t)alignUp(it->second.length)) {
+            free(buffer);
+            return false;
+        }
+        BlockWaiter waiter;
+        write(it->first, buffer, it->second.length, it->second.sequence, it->second.offset, notifyWaiter(&waiter));
+        flush();
+        int64_t result = waitWaiter(&waiter);
+        free(buffer);
+        if (result < 0) {
+            return false;
+        }
+    }
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lockIndex(mutexIndex);
+            if (bytesLive[segment] != 0) {
+                return false;
+            }
+            if (countReader[segment] == 0) {
+                break;
+            }
+        }
+        usleep(1000);                   /* Wait for reads still using old offsets. */
+    }
+    /* Nothing is live or in flight in segment, and it is not appended to, so headers are stable. */
+    std::vector<LogRecordHeader> headers;
+    uint64_t generation = generations[segment]; /* Not changed until segment is appended to again. */
+    if ((scanSegment(segment, &generation, &headers) == false) || (clearSegment(segment, &generation) == false)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lockIndex(mutexIndex);
+    forgetRecords(headers);
+    for (auto it = segmentsRetired.begin(); it != segmentsRetired.end(); it++) {
+        if (*it == segment) {
+            segmentsRetired.erase(it);
+            break;
+        }
+    }
+    segmentsFree.push_back(segment);
+    return true;
+}
+
+/* Compactor thread. Wakes when free segments run low, or every second to reclaim dead segments. */
+void LogBlockStore::CompactorWorker()
+{
+    bool found = false;
+    while (true) {
+        uint64_t victim = 0;
+        {
+            std::unique_lock<std::mutex> lockIndex(mutexIndex);
+            if (found == false) { /* Keep going without sleep while there is work. */
+                condCompact.wait_for(lockIndex, std::chrono::seconds(1));
+            }
+            if (stop) {
+                lockIndex.unlock();
+                writeTombstones();
+                return;
+            }
+            uint64_t bytesVictim = LOG_SEGMENT_SIZE;
+            for (auto it = segmentsRetired.begin(); it != segmentsRetired.end(); it++) {
+                if (bytesLive[*it] < bytesVictim) {
+                    victim = *it;
+                    bytesVictim = bytesLive[*it];
+                }
+            }
+            /* Empty and nearly empty segments are always reclaimed, partly live ones only under space pressure. */
+            found = (bytesVictim * 100 < LOG_SEGMENT_SIZE * LOG_COMPACT_IDLE) ||
+                ((segmentsFree.size() < LOG_COMPACT_FREE) && (bytesVictim * 100 < LOG_SEGMENT_SIZE * LOG_COMPACT_LIVE));
+        }
+        writeTombstones();
+        if (found) {
+            if (compactSegment(victim) == false) {
+                Debug::notifyError("Compact segment %lu failed.", (unsigned long)victim);
+                found = false;
+            }
+        }
+    }
+}
+
+LogBlockStore::~LogBlockStore()
+{
+    {
+        std::lock_guard<std::mutex> lockIndex(mutexIndex);
+        stop = true;
+    }
+    condCompact.notify_one();
+    if (compactor.joinable()) {
+        compactor.join();
+    }
+    delete io;
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+/* Count tombstones kept in log. */
+uint64_t LogBlockStore::countTombstones()
+{
+    std::lock_guard<std::mutex> lockIndex(mutexIndex);
+    return tombstones.size();
+}
+
+/* Check if log runs out of space, so new blocks should go elsewhere. */
+bool LogBlockStore::full()
+{
+    std::lock_guard<std::mutex> lockIndex(mutexIndex);
+    return segmentsFree.empty();
+}
+
+PosixBlockStore::PosixBlockStore()
+{
+    io = NULL;
+    sequence = 0;
+}
+
+/* Open block directory, it is created if missing. Files left by an earlier run are not trusted
+   and get overwritten, unless recovering. Then block files are kept and temporary files of writes
+   not completed are deleted.
+   @param   path    Directory.
+   @param   recover Keep block files of last run.
+   @return          If succeed return true, otherwise return false. */
+bool PosixBlockStore::open(const char *path, bool recover)
+{
+    if ((mkdir(path, 0755) != 0) && (errno != EEXIST)) {
+        Debug::notifyError("Create block directory %s failed: %s", path, strerror(errno));
+        return false;
+    }
+    directory = path;
+    if (recover) {
+        DIR *dir = opendir(path);
+        if (dir == NULL) {
+            Debug::notifyError("Open block directory %s failed: %s", path, strerror(errno));
+            return false;
+        }
+        struct dirent *item;
+        while ((item = readdir(dir)) != NULL) {
+            char *end;
+            uint64_t key = strtoull(item->d_name, &end, 16);
+            if ((end == item->d_name + 16) && (*end == '\0')) {
+                keys.insert(key);
+            } else if ((end == item->d_name + 16) && (*end == '.')) {
+                unlink((directory + "/" + item->d_name).c_str());
+            }
+        }
+        closedir(dir);
+        Debug::notifyInfo("Posix block store: %lu blocks recovered", (unsigned long)keys.size());
+    }
+    io = new AsyncIO(POSIX_IO_DEPTH, POSIX_IO_THREADS);
+    Debug::notifyInfo("Posix block store %s", path);
+    return true;
+}
+
+/* Get file name of a key. */
+std::string PosixBlockStore::getName(uint64_t key)
+{
+    char name[32];
+    sprintf(name, "/%016lx", (unsigned long)key);
+    return directory + name;
+}
+
+/* Write a block asynchronously into a temporary file, which replaces the block file on completion
+   unless a newer write of the key exists or the key was removed meanwhile.
+   @param   callback    Called with size on success, -1 on error. */
+void PosixBlockStore::setAsync(uint64_t key, const char *buffer, uint64_t size, BlockStoreCallback callback)
+{
+    uint64_t sequenceWrite;
+    {
+        std::lock_guard<std::mutex> lockKeys(mutexKeys);
+        sequenceWrite = sequence++;
+        PendingWrite write;
+        write.buffer = buffer;
+        write.length = size;
+        write.sequence = sequenceWrite;
+        pending[key] = write;
+    }
+    std::string name = getName(key);
+    std::string temporary = name + "." + std::to_string(sequenceWrite);
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        Debug::notifyError("Open spill file %s failed: %s", temporary.c_str(), strerror(errno));
+        std::lock_guard<std::mutex> lockKeys(mutexKeys);
+        auto write = pending.find(key);
+        if ((write != pending.end()) && (write->second.sequence == sequenceWrite)) {
+            pending.erase(write);
+        }
+        callback(-1);
+        return;
+    }
+    AsyncIORequest *request = new AsyncIORequest;
+    request->write = true;
+    request->fd = fd;
+    request->offset = 0;
+    request->iov[0].iov_base = (void *)buffer;
+    request->iov[0].iov_len = size;
+    request->countIov = 1;
+    request->callback = [=](int64_t result) {
+        bool success = (result == (int64_t)size);
+        close(fd);
+        {
+            std::lock_guard<std::mutex> lockKeys(mutexKeys);
+            auto write = pending.find(key);
+            bool latest = (write != pending.end()) && (write->second.sequence == sequenceWrite);
+            if (success && latest && (rename(temporary.c_str(), name.c_str()) == 0)) {
+                keys.insert(key);
+            } else {
+                unlink(temporary.c_str());
+                success = success && !latest; /* Superseded or removed writes are not errors. */
+            }
+            if (latest) {
+                pending.erase(write);
+            }
+        }
+        if (!success) {
+            Debug::notifyError("Write spill file %s failed.", name.c_str());
+        }
+        callback(success ? (int64_t)size : -1);
+    };
+    io->submit(request);
+}
+
+/* Read a block asynchronously. Data of a write in flight is served from its buffer.
+   @param   callback    Called with length of data, -1 if key is not found or read fails. */
+void PosixBlockStore::getAsync(uint64_t key, char *buffer, uint64_t size, BlockStoreCallback callback)
+{
+    {
+        std::unique_lock<std::mutex> lockKeys(mutexKeys);
+        auto write = pending.find(key);
+        if (write != pending.end()) {
+            uint64_t length = (write->second.length < size) ? write->second.length : size;
+            memcpy(buffer, write->second.buffer, length);
+            lockKeys.unlock();
+            callback(length);
+            return;
+        }
+        if (keys.find(key) == keys.end()) {
+            lockKeys.unlock();
+            callback(-1);
+            return;
+        }
+    }
+    int fd = ::open(getName(key).c_str(), O_RDONLY);
+    if (fd < 0) {
+        callback(-1);
+        return;
+    }
+    AsyncIORequest *request = new AsyncIORequest;
+    request->write = false;
+    request->fd = fd;
+    request->offset = 0;
+    request->iov[0].iov_base = buffer;
+    request->iov[0].iov_len = size;
+    request->countIov = 1;
+    request->callback = [=](int64_t result) {
+        close(fd);
+        callback((result < 0) ? -1 : result);
+    };
+    io->submit(request);
+}
+
+/* Start queued requests. */
+void PosixBlockStore::flush()
+{
+    io->flush();
+}
+
+/* Write a block and wait for it. */
+bool PosixBlockStore::set(uint64_t key, const char *buffer, uint64_t size)
+{
+    BlockWaiter waiter;
+    setAsync(key, buffer, size, notifyWaiter(&waiter));
+    flush();
+    return (waitWaiter(&waiter) == (int64_t)size);
+}
+
+/* Read a block and wait for it.
+   @return  Length of data read, -1 if key is not found or read fails. */
+int64_t PosixBlockStore::get(uint64_t key, char *buffer, uint64_t size)
+{
+    BlockWaiter waiter;
+    getAsync(key, buffer, size, notifyWaiter(&waiter));
+    flush();
+    return waitWaiter(&waiter);
+}
+
+/* Remove a block. Keys never written cost no file system operation. */
+bool PosixBlockStore::remove(uint64_t key)
+{
+    std::lock_guard<std::mutex> lockKeys(mutexKeys);
+    bool result = (pending.erase(key) > 0);
+    if (keys.erase(key) > 0) {
+        unlink(getName(key).c_str());
+        result = true;
+    }
+    return result;
+}
+
+PosixBlockStore::~PosixBlockStore()
+{
+    delete io;
+}
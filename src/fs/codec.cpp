@@ -0,0 +1,105 @@
+/*** Block compression. ***/
+
+/** Included files. **/
+#include <string.h>                     /* String operations. E.g. memcpy() */
+#include "codec.hpp"
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/** Implemented functions. **/
+/* Check if a codec can be used.
+   @param   codec   Codec, see BlockCodec.
+   @return          If codec is built in return true, otherwise return false. */
+bool Codec::available(uint16_t codec)
+{
+    switch (codec) {
+        case CODEC_NONE:
+            return true;
+#ifdef HAVE_LZ4
+        case CODEC_LZ4:
+            return true;
+#endif
+#ifdef HAVE_ZSTD
+        case CODEC_ZSTD:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+const char *Codec::name(uint16_t codec)
+{
+    switch (codec) {
+        case CODEC_NONE:
+            return "none";
+        case CODEC_LZ4:
+            return "lz4";
+        case CODEC_ZSTD:
+            return "zstd";
+        default:
+            return "unknown";
+    }
+}
+
+/* Compress data.
+   @param   codec       Codec, see BlockCodec.
+   @param   src         Data to compress.
+   @param   size        Length of data.
+   @param   dest        Buffer of compressed data.
+   @param   capacity    Length of buffer. Data not fitting in it is treated as incompressible.
+   @return              Compressed length, 0 if codec is not available or data does not fit. */
+uint64_t Codec::compress(uint16_t codec, const char *src, uint64_t size, char *dest, uint64_t capacity)
+{
+    switch (codec) {
+#ifdef HAVE_LZ4
+        case CODEC_LZ4:
+        {
+            int length = LZ4_compress_default(src, dest, (int)size, (int)capacity);
+            return (length > 0) ? (uint64_t)length : 0;
+        }
+#endif
+#ifdef HAVE_ZSTD
+        case CODEC_ZSTD:
+        {
+            size_t length = ZSTD_compress(dest, capacity, src, size, CODEC_ZSTD_LEVEL);
+            return ZSTD_isError(length) ? 0 : (uint64_t)length;
+        }
+#endif
+        default:
+            return 0;
+    }
+}
+
+/* Decompress data.
+   @param   codec       Codec, see BlockCodec.
+   @param   src         Compressed data.
+   @param   length      Length of compressed data.
+   @param   dest        Buffer of data.
+   @param   size        Length of original data.
+   @return              If succeed return true, otherwise return false. */
+bool Codec::decompress(uint16_t codec, const char *src, uint64_t length, char *dest, uint64_t size)
+{
+    switch (codec) {
+        case CODEC_NONE:
+            if (length != size) {
+                return false;
+            }
+            memcpy(dest, src, size);
+            return true;
+#ifdef HAVE_LZ4
+        case CODEC_LZ4:
+            return (LZ4_decompress_safe(src, dest, (int)length, (int)size) == (int)size);
+#endif
+#ifdef HAVE_ZSTD
+        case CODEC_ZSTD:
+            return (ZSTD_decompress(dest, size, src, length) == size);
+#endif
+        default:
+            return false;
+    }
+}
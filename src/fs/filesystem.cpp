@@ -25,6 +25,18 @@ uint64_t getTxWriteDataAddress(uint64_t TxID) {
     return server->getTxManagerInstance()->getTxWriteDataAddress(TxID);
 }
 
+void TxWriteTarget(uint64_t TxID, uint64_t address) {
+    if (!Dotx)
+        return;
+    server->getTxManagerInstance()->TxWriteTarget(TxID, address);
+}
+
+void TxLocalApplied(uint64_t TxID) {
+    if (!Dotx)
+        return;
+    server->getTxManagerInstance()->TxLocalApplied(TxID);
+}
+
 void TxLocalCommit(uint64_t TxID, bool action) {
     if (!Dotx)
         return;
@@ -49,39 +61,6 @@ void TxDistributedCommit(uint64_t TxID, bool action) {
     server->getTxManagerInstance()->TxDistributedCommit(TxID, action);
 }
 
-void FileSystem::updateRemoteMeta(uint16_t parentNodeID, DirectoryMeta *meta, uint64_t parentMetaAddress, uint64_t parentHashAddress) {
-	Debug::debugTitle("updateRemoteMeta");
-	/* Prepare imm data. */
-	uint32_t imm, temp;
-	/*
-	|  12b  |     20b    |
-	+-------+------------+
-	| 0XFFF | HashAdress |
-	+-------+------------+
-	*/
-	temp = 0XFFF;
-	imm = (temp << 20);
-	imm += (uint32_t)parentHashAddress;
-	/* Remote write with imm. */
-	uint64_t SendBuffer;
-	server->getMemoryManagerInstance()->getServerSendAddress(parentNodeID, &SendBuffer);
-	uint64_t RemoteBuffer = parentMetaAddress;
-	Debug::debugItem("imm = %x, SendBuffer = %lx, RemoteBuffer = %lx", imm, SendBuffer, RemoteBuffer);
-	if (parentNodeID == server->getRdmaSocketInstance()->getNodeID()) {
-		Debug::debugItem("updateMeta, memcopy to local node");
-		memcpy((void *)(RemoteBuffer + server->getMemoryManagerInstance()->getDmfsBaseAddress()), (void *)meta, sizeof(DirectoryMeta));
-		//unlockWriteHashItem(0, parentNodeID, parentHashAddress);
-		return;
-	}
-	Debug::debugItem("updateMeta, RDMA wirte to remotenode");
-        uint64_t size = sizeof(DirectoryMeta) - sizeof(DirectoryMetaTuple) * (MAX_DIRECTORY_COUNT - meta->count);
-	memcpy((void *)SendBuffer, (void *)meta, size);
-        server->getRdmaSocketInstance()->RdmaWrite(parentNodeID, SendBuffer, RemoteBuffer, size, -1, 1);
-	server->getRdmaSocketInstance()->RdmaRead(parentNodeID, SendBuffer, RemoteBuffer, size, 1, false);
-	/* Data will be written to the remote address, and lock will be released with the assist of imm data. */
-	/* WRITE READ will be send after that, flushing remote data. */
-}
-
 void RdmaCall(uint16_t NodeID, char *bufferSend, uint64_t lengthSend, char *bufferReceive, uint64_t lengthReceive) {
     server->getRPCClientInstance()->RdmaCall(NodeID, bufferSend, lengthSend, bufferReceive, lengthReceive);
 }
@@ -217,14 +196,42 @@ bool FileSystem::sendMessage(NodeHash hashNode, void *bufferSend, uint64_t lengt
     return true;//return _cmd.sendMessage((uint16_t)hashNode, (char *)bufferSend, lengthSend, (char *)bufferReceive, lengthReceive); /* Actual send message. */
 }
 
-/* Parse message. */
-void FileSystem::parseMessage(char *bufferRequest, char *bufferResponse) 
+/* Parse message. A change of metadata other clients hold leases on is not done, caller retries
+   message once they end instead of keeping a worker or a lock meanwhile.
+   @param   bufferRequest   Request.
+   @param   bufferResponse  Buffer of response, filled only if message is done.
+   @return                  0 if message is done, otherwise microseconds to retry it after. */
+uint64_t FileSystem::parseMessage(char *bufferRequest, char *bufferResponse) 
 {
     /* No check on parameters. */
     GeneralSendBuffer *bufferGeneralSend = (GeneralSendBuffer *)bufferRequest; /* Send and request. */
     GeneralReceiveBuffer *bufferGeneralReceive = (GeneralReceiveBuffer *)bufferResponse; /* Receive and response. */
     bufferGeneralReceive->message = MESSAGE_RESPONSE; /* Fill response message. */
     Debug::debugItem("Debug-filesystem.cpp: parseMessage once");
+    if (bufferGeneralSend->hasHashPath) {
+        HashTable::setHint(bufferGeneralSend->path, &(bufferGeneralSend->hashPath)); /* Skip primary hash of path of request. */
+    }
+    bool isChange;                      /* Request changes metadata clients may cache under lease. */
+    switch (bufferGeneralSend->message) {
+        case MESSAGE_MKNOD:
+        case MESSAGE_MKNODWITHMETA:
+        case MESSAGE_MKDIR:
+        case MESSAGE_REMOVE:
+        case MESSAGE_RMDIR:
+        case MESSAGE_RENAME:            /* New path is changed by MESSAGE_MKNODWITHMETA. */
+        case MESSAGE_TRUNCATE:
+        case MESSAGE_EXTENTWRITE:
+            isChange = true;
+            break;
+        default:
+            isChange = false;
+            break;
+    }
+    uint64_t wait = isChange ? revokeLease(bufferGeneralSend->path, bufferGeneralSend->sourceNodeID) : 0;
+    if (wait != 0) {
+        HashTable::setHint(NULL, NULL); /* Hint is set again on retry. */
+        return wait;
+    }
     switch(bufferGeneralSend->message) {
         case MESSAGE_ADDMETATODIRECTORY: 
         {
@@ -232,15 +239,18 @@ void FileSystem::parseMessage(char *bufferRequest, char *bufferResponse)
             AddMetaToDirectorySendBuffer *bufferSend = 
                 (AddMetaToDirectorySendBuffer *)bufferGeneralSend;
             UpdataDirectoryMetaReceiveBuffer *bufferReceive = (UpdataDirectoryMetaReceiveBuffer *)bufferResponse;
-            bufferReceive->result = addMetaToDirectory(
-                bufferSend->path, bufferSend->name, 
-                bufferSend->isDirectory, 
-                &(bufferReceive->TxID),
-                &(bufferReceive->srcBuffer),
-                &(bufferReceive->desBuffer),
-                &(bufferReceive->size),
-                &(bufferReceive->key),
-                &(bufferReceive->offset));
+            bufferReceive->shard = bufferSend->shard;
+            if (bufferSend->shard == DIRECTORY_SHARD_ROUTE) { /* Client does not keep split map. */
+                bufferReceive->result = addMetaToDirectory(
+                    bufferSend->path, bufferSend->name, bufferSend->isDirectory, &(bufferReceive->shard),
+                    &(bufferReceive->TxID), &(bufferReceive->srcBuffer), &(bufferReceive->desBuffer),
+                    &(bufferReceive->size), &(bufferReceive->key), &(bufferReceive->offset), &(bufferReceive->codec));
+            } else {
+                bufferReceive->result = addMetaToShard(
+                    bufferSend->path, bufferSend->name, bufferSend->isDirectory, &(bufferReceive->shard),
+                    &(bufferReceive->TxID), &(bufferReceive->srcBuffer), &(bufferReceive->desBuffer),
+                    &(bufferReceive->size), &(bufferReceive->key), &(bufferReceive->offset), &(bufferReceive->codec));
+            }
             break;
         }
         case MESSAGE_REMOVEMETAFROMDIRECTORY: 
@@ -249,14 +259,18 @@ void FileSystem::parseMessage(char *bufferRequest, char *bufferResponse)
             RemoveMetaFromDirectorySendBuffer *bufferSend = 
                 (RemoveMetaFromDirectorySendBuffer *)bufferGeneralSend;
             UpdataDirectoryMetaReceiveBuffer *bufferReceive = (UpdataDirectoryMetaReceiveBuffer *)bufferResponse;
-            bufferGeneralReceive->result = removeMetaFromDirectory(
-                bufferSend->path, bufferSend->name,
-                &(bufferReceive->TxID),
-                &(bufferReceive->srcBuffer),
-                &(bufferReceive->desBuffer),
-                &(bufferReceive->size),
-                &(bufferReceive->key),
-                &(bufferReceive->offset));
+            bufferReceive->shard = bufferSend->shard;
+            if (bufferSend->shard == DIRECTORY_SHARD_ROUTE) { /* Client does not keep split map. */
+                bufferGeneralReceive->result = removeMetaFromDirectory(
+                    bufferSend->path, bufferSend->name, &(bufferReceive->shard),
+                    &(bufferReceive->TxID), &(bufferReceive->srcBuffer), &(bufferReceive->desBuffer),
+                    &(bufferReceive->size), &(bufferReceive->key), &(bufferReceive->offset));
+            } else {
+                bufferGeneralReceive->result = removeMetaFromShard(
+                    bufferSend->path, bufferSend->name, &(bufferReceive->shard),
+                    &(bufferReceive->TxID), &(bufferReceive->srcBuffer), &(bufferReceive->desBuffer),
+                    &(bufferReceive->size), &(bufferReceive->key), &(bufferReceive->offset));
+            }
             break;
         }
         case MESSAGE_DOCOMMIT:
@@ -264,10 +278,46 @@ void FileSystem::parseMessage(char *bufferRequest, char *bufferResponse)
 	    Debug::debugItem("parseMessage: MESSAGE_DOCOMMIT");
             DoRemoteCommitSendBuffer *bufferSend = (DoRemoteCommitSendBuffer *)bufferGeneralSend;
             bufferGeneralReceive->result = updateDirectoryMeta(
-                bufferSend->path, bufferSend->TxID, bufferSend->srcBuffer, 
+                bufferSend->path, bufferSend->shard, bufferSend->TxID, bufferSend->srcBuffer, 
                 bufferSend->desBuffer, bufferSend->size, bufferSend->key, bufferSend->offset);
             break;
         }
+        case MESSAGE_SPLITDIRECTORY:
+        {
+	    Debug::debugItem("parseMessage: MESSAGE_SPLITDIRECTORY");
+            SplitDirectorySendBuffer *bufferSend = (SplitDirectorySendBuffer *)bufferGeneralSend;
+            bufferGeneralReceive->result = fillDirectoryShard(bufferSend->path, bufferSend->shard,
+                bufferSend->depthShard, bufferSend->codec, bufferSend->tuple, bufferSend->count);
+            break;
+        }
+        case MESSAGE_ADDDIRECTORYSHARD:
+        {
+	    Debug::debugItem("parseMessage: MESSAGE_ADDDIRECTORYSHARD");
+            DirectoryShardSendBuffer *bufferSend = (DirectoryShardSendBuffer *)bufferGeneralSend;
+            bufferGeneralReceive->result = addDirectoryShard(bufferSend->path, bufferSend->shard);
+            break;
+        }
+        case MESSAGE_SETEXTENTPAGE:
+        {
+	    Debug::debugItem("parseMessage: MESSAGE_SETEXTENTPAGE");
+            ExtentPageSendBuffer *bufferSend = (ExtentPageSendBuffer *)bufferGeneralSend;
+            bufferGeneralReceive->result = setExtentPage(bufferSend->path, bufferSend->indexPage, &(bufferSend->page));
+            break;
+        }
+        case MESSAGE_SETBLOCKLIST:
+        {
+	    Debug::debugItem("parseMessage: MESSAGE_SETBLOCKLIST");
+            BlockListSendBuffer *bufferSend = (BlockListSendBuffer *)bufferGeneralSend;
+            bufferGeneralReceive->result = setBlockList(bufferSend->path, &(bufferSend->metaFile));
+            break;
+        }
+        case MESSAGE_REMOVEDIRECTORYSHARD:
+        {
+	    Debug::debugItem("parseMessage: MESSAGE_REMOVEDIRECTORYSHARD");
+            DirectoryShardSendBuffer *bufferSend = (DirectoryShardSendBuffer *)bufferGeneralSend;
+            bufferGeneralReceive->result = removeDirectoryShard(bufferSend->path, bufferSend->shard, bufferSend->check);
+            break;
+        }
         case MESSAGE_MKNOD: 
         {
  	    Debug::debugItem("parseMessage: MESSAGE_MKNOD");
@@ -283,17 +333,54 @@ void FileSystem::parseMessage(char *bufferRequest, char *bufferResponse)
             bufferReceive->result = getattr(bufferGeneralSend->path, attr, bufferReceive->BlockList);
 	    bufferReceive->attribute.size = attr->size;
 	    bufferReceive->attribute.count = attr->count;
+	    bufferReceive->lease = bufferReceive->result ? grantLease(bufferGeneralSend->path, bufferGeneralSend->sourceNodeID) : 0;
+	    free(attr);
 	    Debug::debugItem("BlockID %d, node %d, tier %d", bufferReceive->BlockList[0].BlockID, bufferReceive->BlockList[0].nodeID, bufferReceive->BlockList[0].tier);
             break;
         }
         case MESSAGE_ACCESS: 
         {
 	    Debug::debugItem("parseMessage: MESSAGE_ACCESS");
+	    AccessReceiveBuffer *bufferReceive = (AccessReceiveBuffer *)bufferGeneralReceive;
 	    bool isDirectory = false;
-            bufferGeneralReceive->result = access(bufferGeneralSend->path, &isDirectory);
+            bufferReceive->result = access(bufferGeneralSend->path, &isDirectory);
 	    if (!isDirectory) {
 		Debug::debugItem("Not a Directory");
-		bufferGeneralReceive->message = MESSAGE_NOTDIR;
+		bufferReceive->message = MESSAGE_NOTDIR;
+	    }
+	    bufferReceive->lease = grantLease(bufferGeneralSend->path, bufferGeneralSend->sourceNodeID); /* Missing path is leased too. */
+            break;
+        }
+        case MESSAGE_OPEN:
+        {
+	    Debug::debugItem("parseMessage: MESSAGE_OPEN");
+	    OpenSendBuffer *bufferSend = (OpenSendBuffer *)bufferGeneralSend;
+	    OpenReceiveBuffer *bufferReceive = (OpenReceiveBuffer *)bufferGeneralReceive;
+	    bufferReceive->result = open(bufferSend->path, bufferSend->create, bufferSend->sourceNodeID,
+	        &(bufferReceive->isDirectory), &(bufferReceive->created), &(bufferReceive->size), &(bufferReceive->count),
+	        &(bufferReceive->timeLastModified), &wait);
+	    bufferReceive->lease = bufferReceive->result ? grantLease(bufferSend->path, bufferSend->sourceNodeID) : 0;
+            break;
+        }
+        case MESSAGE_MKNODBATCH:
+        case MESSAGE_STATBATCH:
+        case MESSAGE_REMOVEBATCH:
+        {
+	    Debug::debugItem("parseMessage: batch %d", (int)bufferGeneralSend->message);
+	    BatchSendBuffer *bufferSend = (BatchSendBuffer *)bufferGeneralSend;
+	    BatchReceiveBuffer *bufferReceive = (BatchReceiveBuffer *)bufferGeneralReceive;
+	    uint16_t source = ((bufferSend->sourceNodeID <= countNode) && (bufferSend->holder != 0)) ?
+		bufferSend->holder : bufferSend->sourceNodeID; /* Only servers act for clients. */
+	    memset(bufferReceive->results, 0, sizeof(BatchResult) * BATCH_PATH_COUNT);
+	    bufferReceive->result = (bufferSend->count <= BATCH_PATH_COUNT);
+	    if (bufferReceive->result == false) {
+		break;
+	    } else if (bufferSend->message == MESSAGE_MKNODBATCH) {
+		wait = mknodBatch(bufferSend->path, bufferSend->count, source, bufferReceive->results);
+	    } else if (bufferSend->message == MESSAGE_STATBATCH) {
+		statBatch(bufferSend->path, bufferSend->count, source, bufferReceive->results);
+	    } else {
+		wait = removeBatch(bufferSend->path, bufferSend->count, source, bufferReceive->results);
 	    }
             break;
         }
@@ -306,9 +393,21 @@ void FileSystem::parseMessage(char *bufferRequest, char *bufferResponse)
         case MESSAGE_READDIR: 
         {
 	    Debug::debugItem("parseMessage: MESSAGE_READDIR");
+            ReadDirectorySendBuffer *bufferSend = 
+                (ReadDirectorySendBuffer *)bufferGeneralSend;
             ReadDirectoryReceiveBuffer *bufferReceive = 
                 (ReadDirectoryReceiveBuffer *)bufferGeneralReceive;
-            bufferReceive->result = readdir(bufferGeneralSend->path, &(bufferReceive->list));
+            bufferReceive->result = readdir(bufferSend->path, bufferSend->cursor, &(bufferReceive->list));
+            break;
+        }
+        case MESSAGE_READDIRPLUS:
+        {
+	    Debug::debugItem("parseMessage: MESSAGE_READDIRPLUS");
+            ReadDirectorySendBuffer *bufferSend = 
+                (ReadDirectorySendBuffer *)bufferGeneralSend;
+            ReadDirectoryPlusReceiveBuffer *bufferReceive = 
+                (ReadDirectoryPlusReceiveBuffer *)bufferGeneralReceive;
+            bufferReceive->result = readdirplus(bufferSend->path, bufferSend->cursor, bufferSend->sourceNodeID, &(bufferReceive->list));
             break;
         }
         case MESSAGE_READDIRECTORYMETA:
@@ -447,8 +546,14 @@ void FileSystem::parseMessage(char *bufferRequest, char *bufferResponse)
             newBlock->BlockID = bufferSend->BlockID;
 	    newBlock->nodeID = (uint16_t)hashLocalNode;
 	    newBlock->tier = bufferSend->Storagetier;
+	    newBlock->codec = bufferSend->codec;
+	    newBlock->key = bufferSend->uniqueHashValue;
 	    newBlock->StorageAddress = bufferSend->StorageAddress;
 	    bufferReceive->result = createNewBlock(newBlock);
+	    bufferReceive->indexCache = newBlock->indexCache;
+	    bufferReceive->indexMem = newBlock->indexMem;
+	    bufferReceive->StorageAddress = newBlock->StorageAddress;
+	    bufferReceive->Storagetier = newBlock->tier;
 	    break;
 	}
 	case MESSAGE_READBLOCK:
@@ -462,7 +567,7 @@ void FileSystem::parseMessage(char *bufferRequest, char *bufferResponse)
 	    newBlock->nodeID = (uint16_t)hashLocalNode;
 	    newBlock->tier = bufferSend->Storagetier;
 	    newBlock->StorageAddress = bufferSend->StorageAddress;
-	    bufferReceive->result = fillRDMARegionV2(bufferSend->uniqueHashValue, newBlock->BlockID, newBlock->tier, newBlock->StorageAddress, bufferSend->writeOperation);
+	    bufferReceive->result = fillRDMARegionV2(bufferSend->uniqueHashValue, newBlock->BlockID, newBlock->tier, bufferSend->codec, newBlock->StorageAddress, bufferSend->writeOperation);
 	    break;
 	}
 	case MESSAGE_REMOVEBLOCK:
@@ -474,28 +579,652 @@ void FileSystem::parseMessage(char *bufferRequest, char *bufferResponse)
 	    newBlock->BlockID = bufferSend->BlockID;
             newBlock->nodeID = (uint16_t)hashLocalNode;
             newBlock->tier = bufferSend->Storagetier;
+            newBlock->codec = bufferSend->codec;
             newBlock->StorageAddress = bufferSend->StorageAddress;
-	    bufferReceive->result = removeBlock(bufferSend->uniqueHashValue, newBlock->tier, newBlock->StorageAddress);
+            newBlock->indexMem = (newBlock->StorageAddress - server->getMemoryManagerInstance()->getExtraDataAddress()) / BLOCK_SIZE;
+	    bufferReceive->result = removeBlock(bufferSend->uniqueHashValue, newBlock);
+	    break;
+	}
+	case MESSAGE_STAGEIN:
+	{
+	    Debug::debugItem("parseMessage: MESSAGE_STAGEIN");
+	    StageInSendBuffer *bufferSend = (StageInSendBuffer *) bufferGeneralSend;
+	    bufferGeneralReceive->result = stageIn(bufferSend->path, bufferSend->tier, bufferSend->pin);
+	    break;
+	}
+	case MESSAGE_UNPIN:
+	{
+	    Debug::debugItem("parseMessage: MESSAGE_UNPIN");
+	    bufferGeneralReceive->result = unpin(bufferGeneralSend->path);
+	    break;
+	}
+	case MESSAGE_STAGEBLOCK:
+	{
+	    Debug::debugItem("parseMessage: MESSAGE_STAGEBLOCK");
+	    StageBlockSendBuffer *bufferSend = (StageBlockSendBuffer *) bufferGeneralSend;
+	    StageBlockReceiveBuffer *bufferReceive = (StageBlockReceiveBuffer *) bufferGeneralReceive;
+	    bufferReceive->block = bufferSend->block;
+	    bufferReceive->result = promoteBlock(bufferSend->uniqueHashValue, &(bufferReceive->block), bufferSend->tier, bufferSend->pin);
+	    break;
+	}
+	case MESSAGE_MIGRATEBLOCK:
+	{
+	    Debug::debugItem("parseMessage: MESSAGE_MIGRATEBLOCK");
+	    StageBlockSendBuffer *bufferSend = (StageBlockSendBuffer *) bufferGeneralSend;
+	    StageBlockReceiveBuffer *bufferReceive = (StageBlockReceiveBuffer *) bufferGeneralReceive;
+	    bufferReceive->block = bufferSend->block;
+	    bufferReceive->result = moveBlockTier(bufferSend->uniqueHashValue, &(bufferReceive->block), bufferSend->tier);
+	    break;
+	}
+	case MESSAGE_UNPINBLOCK:
+	{
+	    Debug::debugItem("parseMessage: MESSAGE_UNPINBLOCK");
+	    StageBlockSendBuffer *bufferSend = (StageBlockSendBuffer *) bufferGeneralSend;
+	    storage->BlockManager->unpin(bufferSend->uniqueHashValue);
+	    bufferGeneralReceive->result = true;
+	    break;
+	}
+	case MESSAGE_STAGEOUT:
+	{
+	    Debug::debugItem("parseMessage: MESSAGE_STAGEOUT");
+	    bufferGeneralReceive->result = stageOut(bufferGeneralSend->path);
+	    break;
+	}
+	case MESSAGE_DRAINBLOCK:
+	{
+	    Debug::debugItem("parseMessage: MESSAGE_DRAINBLOCK");
+	    DrainBlockSendBuffer *bufferSend = (DrainBlockSendBuffer *) bufferGeneralSend;
+	    bufferGeneralReceive->result = drainBlock(bufferSend->path, bufferSend->uniqueHashValue, &(bufferSend->block), bufferSend->offset, bufferSend->size);
+	    break;
+	}
+	case MESSAGE_SETHINT:
+	{
+	    Debug::debugItem("parseMessage: MESSAGE_SETHINT");
+	    PlacementHintSendBuffer *bufferSend = (PlacementHintSendBuffer *) bufferGeneralSend;
+	    bufferGeneralReceive->result = setPlacementHint(bufferSend->path, bufferSend->hint);
+	    break;
+	}
+	case MESSAGE_SETCODEC:
+	{
+	    Debug::debugItem("parseMessage: MESSAGE_SETCODEC");
+	    CodecSendBuffer *bufferSend = (CodecSendBuffer *) bufferGeneralSend;
+	    bufferGeneralReceive->result = setCompression(bufferSend->path, bufferSend->codec);
+	    break;
+	}
+	case MESSAGE_STAGEOUTSTATUS:
+	{
+	    Debug::debugItem("parseMessage: MESSAGE_STAGEOUTSTATUS");
+	    StageOutStatusReceiveBuffer *bufferReceive = (StageOutStatusReceiveBuffer *) bufferGeneralReceive;
+	    bufferReceive->state = stageOutStatus(bufferGeneralSend->path);
+	    bufferReceive->result = true;
+	    break;
+	}
+	case MESSAGE_STAGESTATUS:
+	{
+	    Debug::debugItem("parseMessage: MESSAGE_STAGESTATUS");
+	    StageStatusReceiveBuffer *bufferReceive = (StageStatusReceiveBuffer *) bufferGeneralReceive;
+	    stageStatus(&(bufferReceive->countFilePending), &(bufferReceive->countBlockStaged), &(bufferReceive->countBlockFailed));
+	    bufferReceive->result = true;
+	    break;
+	}
+	case MESSAGE_STAGEWAIT:
+	{
+	    Debug::debugItem("parseMessage: MESSAGE_STAGEWAIT");
+	    if (countStagePending.load() > 0) {
+	        wait = STAGE_WAIT_INTERVAL; /* Reply is put off until queued files are staged. */
+	        break;
+	    }
+	    StageStatusReceiveBuffer *bufferReceive = (StageStatusReceiveBuffer *) bufferGeneralReceive;
+	    stageStatus(&(bufferReceive->countFilePending), &(bufferReceive->countBlockStaged), &(bufferReceive->countBlockFailed));
+	    bufferReceive->result = true;
 	    break;
 	}
         default:
             break;
     }
+    if (isChange) {
+        finishRevoke(bufferGeneralSend->path);
+    }
+    HashTable::setHint(NULL, NULL);     /* Request buffer will be reused. */
+    return wait;
+}
+
+/* Grant a client a lease on metadata of path, during which it may answer access and getattr of
+   path from its cache. Lease starts when client sends request, so it ends there before it ends here.
+   @param   path    Path, need not exist.
+   @param   holder  Node ID of client.
+   @return          Lease in microseconds, 0 if none is granted. */
+uint64_t FileSystem::grantLease(const char *path, uint16_t holder)
+{
+    if ((METADATA_LEASE_TIME == 0) || (holder <= countNode)) {
+        return 0;                       /* Servers do not cache. */
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t timeNow = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    std::lock_guard<std::mutex> lockLease(mutexLease);
+    if (timeNow >= timeLeaseSweep) {
+        for (auto it = leases.begin(); it != leases.end(); ) {
+            if ((it->second.timeExpire <= timeNow) && (it->second.timeRevoke <= timeNow) && (it->second.countChange == 0)) {
+                it = leases.erase(it);
+            } else {
+                it++;
+            }
+        }
+        timeLeaseSweep = timeNow + (uint64_t)LEASE_SWEEP_INTERVAL * 1000;
+    }
+    MetaLease &lease = leases[std::string(path)];
+    if ((lease.countChange != 0) || (lease.timeRevoke > timeNow)) {
+        return 0;                       /* Changing, cached answer would be stale at once. */
+    }
+    if (lease.timeExpire <= timeNow) {
+        lease.holder = holder;
+    } else if (lease.holder != holder) {
+        lease.holder = LEASE_HOLDER_MANY;
+    }
+    lease.timeExpire = timeNow + (uint64_t)METADATA_LEASE_TIME * 1000;
+    return (uint64_t)METADATA_LEASE_TIME * 1000;
+}
+
+/* Revoke leases on metadata of path before it is changed. Client doing the change drops its own
+   cached entry before sending request. If other clients hold a lease, nothing is waited for here:
+   no lease is granted until it ends and the change is retried then. Otherwise the change starts and
+   no lease is granted until finishRevoke() is called. Takes no hash item lock and never sleeps, so
+   it may be called with path locked.
+   @param   path    Path to change.
+   @param   source  Node ID of requester.
+   @return          0 if change may start, otherwise microseconds to retry it after. */
+uint64_t FileSystem::revokeLease(const char *path, uint16_t source)
+{
+    if (METADATA_LEASE_TIME == 0) {
+        return 0;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t timeNow = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    std::lock_guard<std::mutex> lockLease(mutexLease);
+    MetaLease &lease = leases[std::string(path)];
+    uint64_t timeExpire = (lease.holder == source) ? 0 : lease.timeExpire;
+    if (timeExpire > timeNow) {
+        Debug::debugItem("Retry change of %s after %lu us for lease", path, (unsigned long)(timeExpire - timeNow));
+        lease.timeRevoke = timeExpire;
+        return timeExpire - timeNow;
+    }
+    lease.countChange++;                /* Kept until finishRevoke(), so no lease is granted meanwhile. */
+    return 0;
+}
+
+/* End a change started by revokeLease(). Path is forgotten if no lease on it is left.
+   @param   path    Path changed. */
+void FileSystem::finishRevoke(const char *path)
+{
+    if (METADATA_LEASE_TIME == 0) {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t timeNow = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    std::lock_guard<std::mutex> lockLease(mutexLease);
+    auto it = leases.find(std::string(path));
+    if (it != leases.end()) {
+        it->second.countChange--;
+        if ((it->second.countChange == 0) && (it->second.timeExpire <= timeNow) && (it->second.timeRevoke <= timeNow)) {
+            leases.erase(it);
+        }
+    }
+}
+
+
+/* Get key of a name in directory, kept in hash table of the node holding its shard. Child path is
+   hashed with its terminating null, so the key never equals key of a path. Shard other than 0 is
+   appended, so shards on one node do not share keys.
+   @param   path            Path of directory.
+   @param   shard           Shard of directory holding name.
+   @param   name            Name in directory.
+   @param   hashUnique      Buffer of key. */
+void FileSystem::getDirectoryEntryHash(const char *path, uint16_t shard, const char *name, UniqueHash *hashUnique)
+{
+    char child[MAX_PATH_LENGTH + MAX_FILE_NAME_LENGTH + 2 + sizeof(uint16_t)];
+    int length = sprintf(child, "%s/%s", (strcmp(path, "/") == 0) ? "" : path, name) + 1;
+    if (shard != 0) {
+        memcpy(child + length, &shard, sizeof(uint16_t));
+        length += sizeof(uint16_t);
+    }
+    HashTable::getUniqueHash(child, length, hashUnique);
+}
+
+/* Get key of directory shard. Shard 0 is keyed by path, so it is the directory meta itself. Others
+   are keyed by path, its terminating null and shard, and are spread over nodes by that key.
+   @param   path            Path of directory.
+   @param   shard           Shard.
+   @param   hashUnique      Buffer of key. */
+void FileSystem::getDirectoryShardHash(const char *path, uint16_t shard, UniqueHash *hashUnique)
+{
+    if (shard == 0) {
+        HashTable::getUniqueHash(path, strlen(path), hashUnique);
+    } else {
+        char key[MAX_PATH_LENGTH + 1 + sizeof(uint16_t)];
+        uint64_t length = strlen(path) + 1;
+        memcpy(key, path, length);
+        memcpy(key + length, &shard, sizeof(uint16_t));
+        HashTable::getUniqueHash(key, length + sizeof(uint16_t), hashUnique);
+    }
+}
+
+/* Get hash of name that decides its shard. */
+static uint64_t getNameShardHash(const char *name)
+{
+    UniqueHash hashName;
+    HashTable::getUniqueHash(name, strlen(name), &hashName);
+    return hashName.value[1];           /* value[0] and value[3] place the name, so use another word. */
+}
+
+/* Check if name belongs to shard, i.e. shard has not been split on it. */
+bool FileSystem::isNameInShard(const DirectoryMeta *metaDirectory, const char *name)
+{
+    return (getNameShardHash(name) & ((1ULL << metaDirectory->depthShard) - 1)) == metaDirectory->shard;
+}
+
+/* Whether name moves to a shard being split from this one, so it must not be changed here. */
+static bool isNameMoving(const DirectoryMeta *metaDirectory, const char *name)
+{
+    return (metaDirectory->shardPending != 0) && ((getNameShardHash(name) & (1ULL << metaDirectory->depthShard)) != 0);
+}
+
+/* Count a name added to or removed from shard. Caller holds write lock of shard. */
+static void countShardLoad(DirectoryMeta *metaDirectory)
+{
+    uint32_t timeNow = (uint32_t)time(NULL);
+    if (timeNow != metaDirectory->timeLoad) {
+        metaDirectory->countLoadLast = (timeNow == metaDirectory->timeLoad + 1) ? metaDirectory->countLoad : 0;
+        metaDirectory->countLoad = 0;
+        metaDirectory->timeLoad = timeNow;
+    }
+    metaDirectory->countLoad++;
+}
+
+/* Check if shard should be split, as it holds many names or names are added and removed in it at
+   a high rate. Rate is taken over this second and the one before, so it is not lost to a split
+   queued at the end of a second. */
+static bool isSplitNeeded(const DirectoryMeta *metaDirectory)
+{
+    if (metaDirectory->count >= DIRECTORY_SPLIT_COUNT) {
+        return true;
+    } else if (metaDirectory->count < DIRECTORY_SPLIT_LOAD_COUNT) {
+        return false;
+    }
+    uint32_t timeNow = (uint32_t)time(NULL);
+    uint32_t load = 0;
+    if (timeNow == metaDirectory->timeLoad) {
+        load = std::max(metaDirectory->countLoad, metaDirectory->countLoadLast);
+    } else if (timeNow == metaDirectory->timeLoad + 1) {
+        load = metaDirectory->countLoad;
+    }
+    return load >= DIRECTORY_SPLIT_LOAD;
+}
+
+/* Get bitmap of shards of directory from split map. Unknown directories are taken as not split,
+   a stale bitmap is found out by shard servers and refreshed from shard 0.
+   @param   path            Path of directory.
+   @param   refresh         Read bitmap from shard 0 instead of split map.
+   @return                  Bitmap of shards, at least shard 0 is set. */
+uint64_t FileSystem::getDirectoryShards(const char *path, bool refresh)
+{
+    std::string key(path);
+    if (refresh == false) {
+        std::lock_guard<std::mutex> lockShard(mutexShard);
+        auto it = shardMap.find(key);
+        return (it == shardMap.end()) ? 1 : it->second;
+    }
+    DirectoryMeta meta;
+    uint64_t hashAddress, metaAddress;
+    uint16_t parentNodeID;
+    uint64_t bitmap = 1;
+    if (readDirectoryMeta(path, &meta, &hashAddress, &metaAddress, &parentNodeID) == true) {
+        bitmap = meta.bitmapShard | 1;
+    }
+    std::lock_guard<std::mutex> lockShard(mutexShard);
+    if (bitmap == 1) {
+        shardMap.erase(key);            /* Keep split map small, most directories are never split. */
+    } else {
+        shardMap[key] = bitmap;
+    }
+    return bitmap;
+}
+
+/* Get shard of name in directory, as GIGA+ does. Shard of name at max depth is taken, if it does
+   not exist its highest bit is cleared until an existing shard is reached.
+   @param   path            Path of directory.
+   @param   name            Name in directory.
+   @param   refresh         Read bitmap from shard 0 instead of split map.
+   @return                  Shard of name. */
+uint16_t FileSystem::getDirectoryShard(const char *path, const char *name, bool refresh)
+{
+    uint64_t bitmap = getDirectoryShards(path, refresh);
+    if (bitmap == 1) {
+        return 0;
+    }
+    uint64_t shard = getNameShardHash(name) & (DIRECTORY_SHARD_MAX - 1);
+    while ((bitmap & (1ULL << shard)) == 0) {
+        shard &= ~(1ULL << (63 - __builtin_clzll(shard))); /* Go to parent shard it was split from. */
+    }
+    return (uint16_t)shard;
+}
+
+/* Get directory page in place.
+   @param   index       Index + 1 of page.
+   @return              Page, NULL if index is 0 or page does not exist. */
+DirectoryPage *FileSystem::getDirectoryPage(uint32_t index)
+{
+    DirectoryPage *page;
+    if ((index == 0) || (storage->tableDirectoryPage->reference(index - 1, &page) == false)) {
+        return NULL;
+    }
+    return page;
+}
+
+/* Remove page from list of pages having a free slot. */
+void FileSystem::unlinkDirectorySpace(DirectoryMeta *metaDirectory, DirectoryPage *page)
+{
+    DirectoryPage *pagePrev = getDirectoryPage(page->indexSpacePrev);
+    DirectoryPage *pageNext = getDirectoryPage(page->indexSpaceNext);
+    if (pagePrev != NULL) {
+        pagePrev->indexSpaceNext = page->indexSpaceNext;
+    } else {
+        metaDirectory->indexPageSpace = page->indexSpaceNext;
+    }
+    if (pageNext != NULL) {
+        pageNext->indexSpacePrev = page->indexSpacePrev;
+    }
+    page->indexSpaceNext = 0;
+    page->indexSpacePrev = 0;
+}
+
+/* Get page holding name at an entry of name index. Entry may be stale if a crash came between
+   change of page and of name index, pages are always right.
+   @param   indexDirectoryMeta  Index of directory meta.
+   @param   indexEntry          Entry, i.e. (index of page) * DIRECTORY_PAGE_ENTRY_COUNT + slot.
+   @param   name                Name.
+   @return                      Page, NULL if name is not at entry. */
+DirectoryPage *FileSystem::getDirectoryEntryPage(uint64_t indexDirectoryMeta, uint64_t indexEntry, const char *name)
+{
+    DirectoryPage *page = getDirectoryPage((uint32_t)(indexEntry / DIRECTORY_PAGE_ENTRY_COUNT) + 1);
+    uint32_t slot = (uint32_t)(indexEntry % DIRECTORY_PAGE_ENTRY_COUNT);
+    if ((page == NULL) || (page->indexDirectory != indexDirectoryMeta + 1) || (slot >= page->count) ||
+        (strcmp(page->tuple[slot].names, name) != 0)) {
+        return NULL;
+    }
+    return page;
+}
+
+/* Add a name to directory. Name goes to first page having a free slot, a page is appended if there
+   is none, so it takes constant time. Caller holds write lock of directory.
+   @param   indexDirectoryMeta  Index of directory meta.
+   @param   path                Path of directory.
+   @param   name                Name to add.
+   @param   isDirectory         Whether name is a directory.
+   @param   address             Buffer of address of slot taken.
+   @param   size                Buffer of size of slot.
+   @return                      If name is added return true, otherwise (e.g. it exists) return false. */
+bool FileSystem::insertDirectoryEntry(uint64_t indexDirectoryMeta, const char *path, const char *name, bool isDirectory, uint64_t *address, uint64_t *size)
+{
+    DirectoryMeta *metaDirectory;
+    UniqueHash hashEntry;
+    uint64_t indexEntry;
+    bool isDirectoryEntry;
+    if ((strlen(name) >= MAX_FILE_NAME_LENGTH) || (storage->tableDirectoryMeta->reference(indexDirectoryMeta, &metaDirectory) == false)) {
+        return false;
+    }
+    getDirectoryEntryHash(path, metaDirectory->shard, name, &hashEntry);
+    if ((storage->hashtable->get(&hashEntry, &indexEntry, &isDirectoryEntry) == true) &&
+        (getDirectoryEntryPage(indexDirectoryMeta, indexEntry, name) != NULL)) {
+        return false;                   /* Fail due to existence of name. A stale entry is overwritten below. */
+    }
+    uint32_t indexPage = metaDirectory->indexPageSpace;
+    DirectoryPage *page = getDirectoryPage(indexPage);
+    if (page == NULL) {                 /* All pages are full, append one. */
+        uint64_t index;
+        if (storage->tableDirectoryPage->create(&index) == false) {
+            Debug::notifyError("Directory pages are used up.");
+            return false;
+        }
+        indexPage = (uint32_t)index + 1;
+        page = getDirectoryPage(indexPage);
+        memset(page, 0, sizeof(DirectoryPage));
+        page->indexDirectory = (uint32_t)indexDirectoryMeta + 1;
+        page->indexPagePrev = metaDirectory->indexPageLast;
+        DirectoryPage *pageLast = getDirectoryPage(metaDirectory->indexPageLast);
+        if (pageLast != NULL) {
+            pageLast->indexPageNext = indexPage;
+        } else {
+            metaDirectory->indexPageFirst = indexPage;
+        }
+        metaDirectory->indexPageLast = indexPage;
+        metaDirectory->indexPageSpace = indexPage;
+    }
+    uint32_t slot = page->count;
+    if (storage->hashtable->put(&hashEntry, (uint64_t)(indexPage - 1) * DIRECTORY_PAGE_ENTRY_COUNT + slot, false) == false) {
+        return false;                   /* Fail due to hash table put. Empty page is kept for next name. */
+    }
+    strcpy(page->tuple[slot].names, name);
+    page->tuple[slot].isDirectories = isDirectory;
+    page->count++;
+    metaDirectory->count++;
+    if (page->count == DIRECTORY_PAGE_ENTRY_COUNT) {
+        unlinkDirectorySpace(metaDirectory, page);
+    }
+    *address = (uint64_t)&page->tuple[slot];
+    *size = sizeof(DirectoryMetaTuple);
+    return true;
+}
+
+/* Remove a name from directory. Last name of its page takes its slot, a page left empty is released.
+   Caller holds write lock of directory. Page is changed before name index and page lists, so a crash
+   in the middle leaves names in pages right, and rebuildDirectories() repairs the rest on restart.
+   @param   indexDirectoryMeta  Index of directory meta.
+   @param   path                Path of directory.
+   @param   name                Name to remove.
+   @param   address             Buffer of address of slot changed, or of directory meta if page is released.
+   @param   size                Buffer of size of record changed.
+   @return                      If name is removed return true, otherwise return false. */
+bool FileSystem::removeDirectoryEntry(uint64_t indexDirectoryMeta, const char *path, const char *name, uint64_t *address, uint64_t *size)
+{
+    DirectoryMeta *metaDirectory;
+    UniqueHash hashEntry;
+    uint64_t indexEntry;
+    bool isDirectoryEntry;
+    if (storage->tableDirectoryMeta->reference(indexDirectoryMeta, &metaDirectory) == false) {
+        return false;
+    }
+    getDirectoryEntryHash(path, metaDirectory->shard, name, &hashEntry);
+    if (storage->hashtable->get(&hashEntry, &indexEntry, &isDirectoryEntry) == false) {
+        return false;                   /* Fail due to no selected name. */
+    }
+    uint32_t indexPage = (uint32_t)(indexEntry / DIRECTORY_PAGE_ENTRY_COUNT) + 1;
+    uint32_t slot = (uint32_t)(indexEntry % DIRECTORY_PAGE_ENTRY_COUNT);
+    DirectoryPage *page = getDirectoryEntryPage(indexDirectoryMeta, indexEntry, name);
+    if (page == NULL) {
+        storage->hashtable->del(&hashEntry); /* Stale entry left by a crash, name is not in directory. */
+        return false;
+    }
+    uint32_t slotLast = page->count - 1;
+    if (slot != slotLast) {             /* Move last name to the slot. It is kept twice until count drops. */
+        page->tuple[slot] = page->tuple[slotLast];
+    }
+    page->count = slotLast;
+    metaDirectory->count--;
+    storage->hashtable->del(&hashEntry);
+    if (slot != page->count) {
+        UniqueHash hashMoved;
+        getDirectoryEntryHash(path, metaDirectory->shard, page->tuple[slot].names, &hashMoved);
+        storage->hashtable->put(&hashMoved, indexEntry, false); /* Key exists, only its value is updated. */
+    }
+    if (page->count == DIRECTORY_PAGE_ENTRY_COUNT - 1) { /* Page gets a free slot. */
+        page->indexSpaceNext = metaDirectory->indexPageSpace;
+        DirectoryPage *pageSpace = getDirectoryPage(metaDirectory->indexPageSpace);
+        if (pageSpace != NULL) {
+            pageSpace->indexSpacePrev = indexPage;
+        }
+        metaDirectory->indexPageSpace = indexPage;
+    }
+    if (page->count == 0) {             /* Release empty page. */
+        unlinkDirectorySpace(metaDirectory, page);
+        DirectoryPage *pagePrev = getDirectoryPage(page->indexPagePrev);
+        DirectoryPage *pageNext = getDirectoryPage(page->indexPageNext);
+        if (pagePrev != NULL) {
+            pagePrev->indexPageNext = page->indexPageNext;
+        } else {
+            metaDirectory->indexPageFirst = page->indexPageNext;
+        }
+        if (pageNext != NULL) {
+            pageNext->indexPagePrev = page->indexPagePrev;
+        } else {
+            metaDirectory->indexPageLast = page->indexPagePrev;
+        }
+        page->indexDirectory = 0;       /* Cursors to it are rejected. */
+        storage->tableDirectoryPage->remove(indexPage - 1);
+        *address = (uint64_t)metaDirectory;
+        *size = sizeof(DirectoryMeta);
+    } else {
+        *address = (uint64_t)&page->tuple[slot];
+        *size = sizeof(DirectoryMetaTuple);
+    }
+    return true;
 }
 
+/* Rebuild directories from their pages after warm restart. Removal changes a page, then name index,
+   then page lists, none of them logged, so a crash may leave an entry of name index stale, a name
+   twice in its page or lists broken. Pages are relinked in index order, counts are summed again and
+   every name is put to name index, a duplicate is dropped. So are names an interrupted split has
+   moved to another shard already. Stale entries left are found out and
+   dropped by insertDirectoryEntry() and removeDirectoryEntry(). No lock is taken, workers are not
+   started yet. */
+void FileSystem::rebuildDirectories()
+{
+    uint64_t countMeta = storage->tableDirectoryMeta->countTotalItems();
+    uint64_t countPage = storage->tableDirectoryPage->countTotalItems();
+    uint64_t countName = 0, countDuplicate = 0;
+    for (uint64_t i = 0; i < countMeta; i++) {
+        DirectoryMeta *metaDirectory;
+        if (storage->tableDirectoryMeta->exists(i) && storage->tableDirectoryMeta->reference(i, &metaDirectory)) {
+            metaDirectory->count = 0;
+            metaDirectory->indexPageFirst = 0;
+            metaDirectory->indexPageLast = 0;
+            metaDirectory->indexPageSpace = 0;
+        }
+    }
+    for (uint64_t index = 0; index < countPage; index++) {
+        if (storage->tableDirectoryPage->exists(index) == false) {
+            continue;
+        }
+        uint32_t indexPage = (uint32_t)index + 1;
+        DirectoryPage *page = getDirectoryPage(indexPage);
+        DirectoryMeta *metaDirectory;
+        if ((page->indexDirectory == 0) || (storage->tableDirectoryMeta->exists(page->indexDirectory - 1) == false) ||
+            (storage->tableDirectoryMeta->reference(page->indexDirectory - 1, &metaDirectory) == false)) {
+            storage->tableDirectoryPage->remove(index); /* Release was interrupted. */
+            continue;
+        }
+        for (uint32_t slot = 0; slot < page->count;) {
+            UniqueHash hashEntry;
+            uint64_t indexEntry;
+            bool isDirectoryEntry;
+            getDirectoryEntryHash(metaDirectory->path, metaDirectory->shard, page->tuple[slot].names, &hashEntry);
+            if ((storage->hashtable->get(&hashEntry, &indexEntry, &isDirectoryEntry) == true) &&
+                (indexEntry < index * DIRECTORY_PAGE_ENTRY_COUNT + slot) &&
+                (getDirectoryEntryPage(page->indexDirectory - 1, indexEntry, page->tuple[slot].names) != NULL)) {
+                page->count--;          /* Put already at an earlier slot, i.e. a move was interrupted. */
+                page->tuple[slot] = page->tuple[page->count];
+                countDuplicate++;
+                continue;
+            }
+            storage->hashtable->put(&hashEntry, index * DIRECTORY_PAGE_ENTRY_COUNT + slot, false);
+            slot++;
+        }
+        if (page->count == 0) {
+            page->indexDirectory = 0;
+            storage->tableDirectoryPage->remove(index);
+            continue;
+        }
+        page->indexPageNext = 0;
+        page->indexPagePrev = metaDirectory->indexPageLast;
+        DirectoryPage *pageLast = getDirectoryPage(metaDirectory->indexPageLast);
+        if (pageLast != NULL) {
+            pageLast->indexPageNext = indexPage;
+        } else {
+            metaDirectory->indexPageFirst = indexPage;
+        }
+        metaDirectory->indexPageLast = indexPage;
+        page->indexSpaceNext = 0;
+        page->indexSpacePrev = 0;
+        if (page->count < DIRECTORY_PAGE_ENTRY_COUNT) {
+            page->indexSpaceNext = metaDirectory->indexPageSpace;
+            DirectoryPage *pageSpace = getDirectoryPage(metaDirectory->indexPageSpace);
+            if (pageSpace != NULL) {
+                pageSpace->indexSpacePrev = indexPage;
+            }
+            metaDirectory->indexPageSpace = indexPage;
+        }
+        metaDirectory->count += page->count;
+        countName += page->count;
+    }
+    for (uint64_t i = 0; i < countMeta; i++) {
+        const DirectoryMeta *metaDirectory;
+        if (storage->tableDirectoryMeta->exists(i) && storage->tableDirectoryMeta->view(i, &metaDirectory)) {
+            countDuplicate += dropMovedNames(i, metaDirectory->path); /* Split was interrupted after depth was raised. */
+            if (metaDirectory->shardPending != 0) {
+                SplitTask *split = (SplitTask *)malloc(sizeof(SplitTask)); /* Finish it, names moving are refused until then. */
+                strcpy(split->path, metaDirectory->path);
+                split->shard = metaDirectory->shard;
+                splitPending.insert(std::string(metaDirectory->path) + "#" + std::to_string(metaDirectory->shard));
+                Split_queue.push(split);
+            }
+        }
+    }
+    Debug::notifyInfo("Directories: %lu names rebuilt, %lu duplicates dropped", (unsigned long)countName, (unsigned long)countDuplicate);
+}
 
 /* Internal add meta to directory function. Might cause overhead. No check on parameters for internal function.
+   Shard of name is taken from split map, which is refreshed if a shard server finds it stale.
    @param   path            Path of directory.
    @param   name            Name of meta.
    @param   isDirectory     Judge if it is directory.
-   @return                  If succeed return true, otherwise return false. */
-bool FileSystem::addMetaToDirectory(const char *path, const char *name, bool isDirectory, 
-    uint64_t *TxID, uint64_t *srcBuffer, uint64_t *desBuffer, uint64_t *size, uint64_t *key, uint64_t *offset)
+   @param   shard           Buffer of shard changed, passed to updateDirectoryMeta().
+   @param   codec           Buffer of codec of directory, inherited by new name.
+   @return                  If succeed return true, otherwise return false. Name is already in
+                            place and shard unlocked, size is 0 so updateDirectoryMeta() is a no-op. */
+bool FileSystem::addMetaToDirectory(const char *path, const char *name, bool isDirectory, uint16_t *shard,
+    uint64_t *TxID, uint64_t *srcBuffer, uint64_t *desBuffer, uint64_t *size, uint64_t *key, uint64_t *offset, uint16_t *codec)
 {
-    Debug::debugTitle("FileSystem::addMetaToDirectory");
-    Debug::debugItem("Stage 1. Entry point. Path: %s.", path);
+    for (int i = 0; i < DIRECTORY_SHARD_RETRY; i++) {
+        *shard = getDirectoryShard(path, name, i != 0);
+        if (addMetaToShard(path, name, isDirectory, shard, TxID, srcBuffer, desBuffer, size, key, offset, codec) == true) {
+            return true;
+        } else if (*shard != DIRECTORY_SHARD_STALE) {
+            return false;
+        }
+    }
+    Debug::notifyError("Shard of %s in %s keeps being stale.", name, path);
+    return false;
+}
+
+/* Add meta to a shard of directory. No check on parameters for internal function.
+   @param   path            Path of directory.
+   @param   name            Name of meta.
+   @param   isDirectory     Judge if it is directory.
+   @param   shard           Shard to add to. Set to DIRECTORY_SHARD_STALE if name is not kept in it.
+   @param   codec           Buffer of codec of directory, inherited by new name.
+   @return                  If succeed return true, otherwise return false. Name is appended to a
+                            free slot and shard is unlocked right away, so creates in a directory
+                            do not wait for each other's commit. Size is set to 0, nothing is left
+                            for updateDirectoryMeta(). */
+bool FileSystem::addMetaToShard(const char *path, const char *name, bool isDirectory, uint16_t *shard,
+    uint64_t *TxID, uint64_t *srcBuffer, uint64_t *desBuffer, uint64_t *size, uint64_t *key, uint64_t *offset, uint16_t *codec)
+{
+    Debug::debugTitle("FileSystem::addMetaToShard");
+    Debug::debugItem("Stage 1. Entry point. Path: %s, shard: %d.", path, (int)*shard);
     UniqueHash hashUnique;
-    HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
+    getDirectoryShardHash(path, *shard, &hashUnique); /* Get unique hash. */
     NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
     AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
     uint64_t LocalTxID;
@@ -505,47 +1234,44 @@ bool FileSystem::addMetaToDirectory(const char *path, const char *name, bool isD
         *key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
         *offset = (uint64_t)hashAddress;
         Debug::debugItem("key = %lx, offset = %lx", *key, *offset);
+        LocalTxID = TxLocalBegin();
         {
             Debug::debugItem("Stage 2. Check directory.");
             uint64_t indexDirectoryMeta; /* Meta index of directory. */
             bool isDirectoryTemporary; /* Different from parameter isDirectory. */
             if (storage->hashtable->get(&hashUnique, &indexDirectoryMeta, &isDirectoryTemporary) == false) { /* If directory does not exist. */
+                if (*shard != 0) {
+                    *shard = DIRECTORY_SHARD_STALE; /* Split map refers to shard of a removed directory. */
+                }
                 result = false;         /* Fail due to directory path does not exist. In future detail error information should be returned and independent access() and create() functions should be offered. */
             } else {
                 if (isDirectoryTemporary == false) { /* If not a directory. */
                     result = false;     /* Fail due to path is not directory. */
                 } else {
-                    DirectoryMeta metaDirectory;
-                    if (storage->tableDirectoryMeta->get(indexDirectoryMeta, &metaDirectory) == false) { /* Get directory meta. */
+                    DirectoryMeta *metaDirectory;
+                    if (storage->tableDirectoryMeta->reference(indexDirectoryMeta, &metaDirectory) == false) { /* Get directory meta. */
                         result = false; /* Fail due to get directory meta error. */
+                    } else if ((isNameInShard(metaDirectory, name) == false) || isNameMoving(metaDirectory, name)) {
+                        *shard = DIRECTORY_SHARD_STALE; /* Shard has been split, name is kept elsewhere. */
+                        result = false;
+                    } else if (insertDirectoryEntry(indexDirectoryMeta, path, name, isDirectory, desBuffer, size) == false) {
+                        result = false; /* Fail due to existence of name or no free page. */
                     } else {
-                        LocalTxID = TxLocalBegin();
-                        metaDirectory.count++; /* Add count of names under directory. */
-                        //printf("metaDirectory.count: %d, name len: %d\n", metaDirectory.count, (int)strlen(name));
-                        strcpy(metaDirectory.tuple[metaDirectory.count - 1].names, name); /* Add name. */
-                        metaDirectory.tuple[metaDirectory.count - 1].isDirectories = isDirectory; /* Add directory state. */
-                        /* Write to log first. */
-                        TxWriteData(LocalTxID, (uint64_t)&metaDirectory, (uint64_t)sizeof(DirectoryMeta));
+                        *codec = metaDirectory->codec;
+                        /* Only slot taken is logged, it is already in place. */
+                        TxWriteData(LocalTxID, *desBuffer, *size);
                         *srcBuffer = getTxWriteDataAddress(LocalTxID);
-                        *size = (uint64_t)sizeof(DirectoryMeta);
-                        // printf("%s ", path);
                         *TxID = LocalTxID;
-                        if (storage->tableDirectoryMeta->put(indexDirectoryMeta, &metaDirectory, desBuffer) == false) { /* Update directory meta. */
-                            result = false; /* Fail due to put directory meta error. */
-                        } else {
-                            printf("addmeta, desBuffer = %lx, srcBuffer = %lx, size = %d\n", *desBuffer, *srcBuffer, *size);
-                            result = true; /* Succeed. */
-                        }
+                        *size = 0; /* Nothing left to commit. */
+                        countShardLoad(metaDirectory);
+                        queueDirectorySplit(path, metaDirectory->shard, metaDirectory);
+                        result = true; /* Succeed. */
                     }
                 }
             }
         }
-        if (result == false) {
-            TxLocalCommit(LocalTxID, false);
-        } else {
-            TxLocalCommit(LocalTxID, true);
-        }
-        // unlockWriteHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
+        TxLocalCommit(LocalTxID, result);
+        unlockWriteHashItem(*key, hashNode, hashAddress); /* No commit will come to unlock. */
         Debug::debugItem("Stage end.");
         return result;                  /* Return specific result. */
     } else {                            /* If remote node. */
@@ -554,6 +1280,7 @@ bool FileSystem::addMetaToDirectory(const char *path, const char *name, bool isD
 	    strcpy(bufferAddMetaToDirectorySend.path, path);  /* Assign path. */
 	    strcpy(bufferAddMetaToDirectorySend.name, name);  /* Assign name. */
         bufferAddMetaToDirectorySend.isDirectory = isDirectory;
+        bufferAddMetaToDirectorySend.shard = *shard;
         UpdataDirectoryMetaReceiveBuffer bufferGeneralReceive;
         RdmaCall((uint16_t)hashNode, 
                  (char *)&bufferAddMetaToDirectorySend, 
@@ -566,86 +1293,97 @@ bool FileSystem::addMetaToDirectory(const char *path, const char *name, bool isD
         *size = bufferGeneralReceive.size;
         *key = bufferGeneralReceive.key;
         *offset = bufferGeneralReceive.offset;
+        *codec = bufferGeneralReceive.codec;
+        *shard = bufferGeneralReceive.shard;
         return bufferGeneralReceive.result;
     }
 }
 
 /* Internal remove meta from directory function. Might cause overhead. No check on parameters for internal function.
+   Shard of name is taken from split map, which is refreshed if a shard server finds it stale.
    @param   path            Path of directory.
    @param   name            Name of meta.
-   @param   isDirectory     Judge if it is directory.
-   @return                  If succeed return true, otherwise return false. */
-bool FileSystem::removeMetaFromDirectory(const char *path, const char *name, 
+   @param   shard           Buffer of shard changed, passed to updateDirectoryMeta().
+   @return                  If succeed return true, otherwise return false. Directory shard stays
+                            locked until updateDirectoryMeta() only on success. */
+bool FileSystem::removeMetaFromDirectory(const char *path, const char *name, uint16_t *shard,
     uint64_t *TxID, uint64_t *srcBuffer, uint64_t *desBuffer, uint64_t *size,  uint64_t *key, uint64_t *offset)
 {
-    Debug::debugTitle("FileSystem::removeMetaFromDirectory");
-    Debug::debugItem("Stage 1. Entry point. Path: %s.", path);
-    UniqueHash hashUnique;
-    HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
-    NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
-    AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
-    uint64_t LocalTxID;
-    if (checkLocal(hashNode) == true) { /* If local node. */
-        bool result;
+    for (int i = 0; i < DIRECTORY_SHARD_RETRY; i++) {
+        *shard = getDirectoryShard(path, name, i != 0);
+        if (removeMetaFromShard(path, name, shard, TxID, srcBuffer, desBuffer, size, key, offset) == true) {
+            return true;
+        } else if (*shard != DIRECTORY_SHARD_STALE) {
+            return false;
+        }
+    }
+    Debug::notifyError("Shard of %s in %s keeps being stale.", name, path);
+    return false;
+}
+
+/* Remove meta from a shard of directory. No check on parameters for internal function.
+   @param   path            Path of directory.
+   @param   name            Name of meta.
+   @param   shard           Shard to remove from. Set to DIRECTORY_SHARD_STALE if name is not kept in it.
+   @return                  If succeed return true, otherwise return false. Shard stays locked
+                            until updateDirectoryMeta() only on success. */
+bool FileSystem::removeMetaFromShard(const char *path, const char *name, uint16_t *shard,
+    uint64_t *TxID, uint64_t *srcBuffer, uint64_t *desBuffer, uint64_t *size,  uint64_t *key, uint64_t *offset)
+{
+    Debug::debugTitle("FileSystem::removeMetaFromShard");
+    Debug::debugItem("Stage 1. Entry point. Path: %s, shard: %d.", path, (int)*shard);
+    UniqueHash hashUnique;
+    getDirectoryShardHash(path, *shard, &hashUnique); /* Get unique hash. */
+    NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
+    AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
+    uint64_t LocalTxID;
+    if (checkLocal(hashNode) == true) { /* If local node. */
+        bool result;
         *key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
         *offset = (uint64_t)hashAddress;
+        LocalTxID = TxLocalBegin();
         {
             Debug::debugItem("Stage 2. Check directory.");
             uint64_t indexDirectoryMeta; /* Meta index of directory. */
             bool isDirectory;
             if (storage->hashtable->get(&hashUnique, &indexDirectoryMeta, &isDirectory) == false) { /* If directory does not exist. */
-            	Debug::notifyError("Directory does not exist.");
+                if (*shard != 0) {
+                    *shard = DIRECTORY_SHARD_STALE; /* Split map refers to shard of a removed directory. */
+                } else {
+            	    Debug::notifyError("Directory does not exist.");
+                }
                 result = false;         /* Fail due to directory path does not exist. In future detail error information should be returned and independent access() and create() functions should be offered. */
             } else {
                 if (isDirectory == false) { /* If not a directory. */
                     result = false;     /* Fail due to path is not directory. */
                 } else {
-                    DirectoryMeta metaDirectory;
-                    if (storage->tableDirectoryMeta->get(indexDirectoryMeta, &metaDirectory) == false) { /* Get directory meta. */
-                    	Debug::notifyError("Get directory meta failed.");
+                    DirectoryMeta *metaDirectory;
+                    if (storage->tableDirectoryMeta->reference(indexDirectoryMeta, &metaDirectory) == false) {
                         result = false; /* Fail due to get directory meta error. */
+                    } else if ((isNameInShard(metaDirectory, name) == false) || isNameMoving(metaDirectory, name)) {
+                        *shard = DIRECTORY_SHARD_STALE; /* Shard has been split, name is kept elsewhere. */
+                        result = false;
+                    } else if (removeDirectoryEntry(indexDirectoryMeta, path, name, desBuffer, size) == false) {
+                    	Debug::notifyError("Fail due to no selected name.");
+                        result = false; /* Fail due to no selected name. */
                     } else {
-                        LocalTxID = TxLocalBegin();
-                        DirectoryMeta metaModifiedDirectory; /* Buffer to save modified directory. */
-                        bool found = false;
-                        uint64_t indexModifiedNames = 0;
-                        for (uint64_t i = 0; i < metaDirectory.count; i++) {
-                            if (strcmp(metaDirectory.tuple[i].names, name) == 0) { /* If found selected name. */
-                                found = true; /* Mark and continue. */
-                            } else {
-                                strcpy(metaModifiedDirectory.tuple[indexModifiedNames].names, metaDirectory.tuple[i].names); /* Copy original name to modified meta. */
-                                metaModifiedDirectory.tuple[indexModifiedNames].isDirectories = metaDirectory.tuple[i].isDirectories; /* Add directory state. */
-                                indexModifiedNames++;
-                            }
-                        }
-                        metaModifiedDirectory.count = indexModifiedNames; /* No need to +1. Current point to index after last one. Can be adapted to multiple removes. However it should not occur. */
-                        if (found == false) {
-                        	Debug::notifyError("Fail due to no selected name.");
-                            TxLocalCommit(LocalTxID, false);
-                            result = false; /* Fail due to no selected name. */
-                        } else {
-                            /* Write to log first. */
-                            TxWriteData(LocalTxID, (uint64_t)&metaModifiedDirectory, (uint64_t)sizeof(DirectoryMeta));
-                            *srcBuffer = getTxWriteDataAddress(LocalTxID);
-                            *size = (uint64_t)sizeof(DirectoryMeta);
-                            *TxID = LocalTxID;
-                            if (storage->tableDirectoryMeta->put(indexDirectoryMeta, &metaModifiedDirectory, desBuffer) == false) { /* Update directory meta. */
-                                result = false; /* Fail due to put directory meta error. */
-                            } else {
-                                Debug::debugItem("Item. ");
-                                result = true; /* Succeed. */
-                            }
-                        }
+                        /* Record changed is logged, commit applies it again. */
+                        TxWriteData(LocalTxID, *desBuffer, *size);
+                        *srcBuffer = getTxWriteDataAddress(LocalTxID);
+                        *TxID = LocalTxID;
+                        TxWriteTarget(LocalTxID, *desBuffer); /* Redo on warm restart if commit does not come. */
+                        countShardLoad(metaDirectory);
+                        result = true; /* Succeed. */
                     }
                 }
             }
         }
         if (result == false) {
             TxLocalCommit(LocalTxID, false);
+            unlockWriteHashItem(*key, hashNode, hashAddress); /* No commit will come to unlock. */
         } else {
             TxLocalCommit(LocalTxID, true);
         }
-        //unlockWriteHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
         Debug::debugItem("Stage end.");
         return result;                  /* Return specific result. */
     } else {                            /* If remote node. */
@@ -653,6 +1391,7 @@ bool FileSystem::removeMetaFromDirectory(const char *path, const char *name,
         bufferRemoveMetaFromDirectorySend.message = MESSAGE_REMOVEMETAFROMDIRECTORY; /* Assign message type. */
         strcpy(bufferRemoveMetaFromDirectorySend.path, path);  /* Assign path. */
         strcpy(bufferRemoveMetaFromDirectorySend.name, name);  /* Assign name. */
+        bufferRemoveMetaFromDirectorySend.shard = *shard;
         UpdataDirectoryMetaReceiveBuffer bufferGeneralReceive; /* Receive buffer. */
         RdmaCall((uint16_t)hashNode,
                  (char *)&bufferRemoveMetaFromDirectorySend,
@@ -665,19 +1404,27 @@ bool FileSystem::removeMetaFromDirectory(const char *path, const char *name,
         *size = bufferGeneralReceive.size;
         *key = bufferGeneralReceive.key;
         *offset = bufferGeneralReceive.offset;
+        *shard = bufferGeneralReceive.shard;
         return bufferGeneralReceive.result;
     }
 }
 
-bool FileSystem::updateDirectoryMeta(const char *path, uint64_t TxID, uint64_t srcBuffer, 
+/* Apply change of directory shard made by removeMetaFromDirectory() and unlock shard. Names added by
+   addMetaToDirectory() are applied already and come with size 0, so nothing is done for them.
+   @param   path            Path of directory.
+   @param   shard           Shard changed.
+   @return                  If succeed return true, otherwise return false. */
+bool FileSystem::updateDirectoryMeta(const char *path, uint16_t shard, uint64_t TxID, uint64_t srcBuffer, 
         uint64_t desBuffer, uint64_t size, uint64_t key, uint64_t offset) {
     Debug::debugTitle("FileSystem::updateDirectoryMeta");
     if (path == NULL) {
         return false;                   /* Fail due to null path. */
+    } else if (size == 0) {
+        return true;                    /* Name is appended and shard is unlocked already. */
     } else {
         Debug::debugItem("path = %s, TxID = %d, srcBuffer = %lx, desBuffer = %lx, size = %ld", path, TxID, srcBuffer, desBuffer, size);
         UniqueHash hashUnique;
-        HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
+        getDirectoryShardHash(path, shard, &hashUnique); /* Get unique hash. */
         NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
         // AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
         if (checkLocal(hashNode) == true) {
@@ -695,6 +1442,7 @@ bool FileSystem::updateDirectoryMeta(const char *path, uint64_t TxID, uint64_t s
                 Debug::debugItem("update, desbuf = %lx, srcbuf = %lx, size = %d",desBuffer, srcBuffer, size);
                 memcpy((void *)desBuffer, (void *)srcBuffer, size);
                 Debug::debugItem("copied");
+                TxLocalApplied(TxID);
             }
             Debug::debugItem("key = %lx, offset = %lx", key, offset);
             unlockWriteHashItem(key, hashNode, (AddressHash)offset);  /* Unlock hash item. */
@@ -707,6 +1455,7 @@ bool FileSystem::updateDirectoryMeta(const char *path, uint64_t TxID, uint64_t s
             DoRemoteCommitSendBuffer bufferSend;
             strcpy(bufferSend.path, path);
             bufferSend.message = MESSAGE_DOCOMMIT;
+            bufferSend.shard = shard;
             bufferSend.TxID = TxID;
             bufferSend.srcBuffer = srcBuffer;
             bufferSend.desBuffer = desBuffer;
@@ -727,6 +1476,352 @@ bool FileSystem::updateDirectoryMeta(const char *path, uint64_t TxID, uint64_t s
     }
 }
 
+/* Queue a directory shard grown to DIRECTORY_SPLIT_COUNT names, or busy with DIRECTORY_SPLIT_LOAD
+   adds and removes a second, to be split, once until it is split.
+   @param   path            Path of directory.
+   @param   shard           Shard.
+   @param   metaDirectory   Meta of shard. */
+void FileSystem::queueDirectorySplit(const char *path, uint16_t shard, const DirectoryMeta *metaDirectory)
+{
+    if ((isSplitNeeded(metaDirectory) == false) ||
+        (shard + (1U << metaDirectory->depthShard) >= DIRECTORY_SHARD_MAX)) {
+        return;
+    }
+    std::string task = std::string(path) + "#" + std::to_string(shard);
+    std::lock_guard<std::mutex> lockShard(mutexShard);
+    if (splitPending.insert(task).second == true) {
+        SplitTask *split = (SplitTask *)malloc(sizeof(SplitTask));
+        strcpy(split->path, path);
+        split->shard = shard;
+        Split_queue.push(split);
+    }
+}
+
+/* Add names moved by a split to a directory shard. Shard is created on first call, before it is
+   added to bitmap of directory, so nobody else uses it meanwhile.
+   @param   path            Path of directory.
+   @param   shard           Shard to fill.
+   @param   depthShard      Depth of shard.
+   @param   codec           Codec of directory.
+   @param   tuple           Names to add.
+   @param   count           Count of names.
+   @return                  If succeed return true, otherwise return false. */
+bool FileSystem::fillDirectoryShard(const char *path, uint16_t shard, uint16_t depthShard, uint16_t codec,
+    const DirectoryMetaTuple *tuple, uint64_t count)
+{
+    Debug::debugTitle("FileSystem::fillDirectoryShard");
+    Debug::debugItem("Stage 1. Entry point. Path: %s, shard: %d, count: %d.", path, (int)shard, (int)count);
+    UniqueHash hashUnique;
+    getDirectoryShardHash(path, shard, &hashUnique); /* Get unique hash. */
+    NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
+    AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
+    if (checkLocal(hashNode) == true) { /* If local node. */
+        bool result = true;
+        uint64_t key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
+        uint64_t indexDirectoryMeta;
+        bool isDirectory;
+        if (storage->hashtable->get(&hashUnique, &indexDirectoryMeta, &isDirectory) == false) { /* Create shard. */
+            DirectoryMeta metaDirectory;
+            memset(&metaDirectory, 0, sizeof(DirectoryMeta));
+            metaDirectory.codec = codec;
+            metaDirectory.shard = shard;
+            metaDirectory.depthShard = depthShard;
+            strcpy(metaDirectory.path, path);
+            if (storage->tableDirectoryMeta->create(&indexDirectoryMeta, &metaDirectory) == false) {
+                result = false;         /* Fail due to directory meta table full. */
+            } else if (storage->hashtable->put(&hashUnique, indexDirectoryMeta, true) == false) {
+                storage->tableDirectoryMeta->remove(indexDirectoryMeta);
+                result = false;         /* Fail due to hash table put. */
+            }
+        }
+        for (uint64_t i = 0; (result == true) && (i < count); i++) {
+            uint64_t address, size;
+            result = insertDirectoryEntry(indexDirectoryMeta, path, tuple[i].names, tuple[i].isDirectories, &address, &size);
+        }
+        unlockWriteHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
+        return result;
+    } else {
+        SplitDirectorySendBuffer bufferSend;
+        bufferSend.message = MESSAGE_SPLITDIRECTORY;
+        strcpy(bufferSend.path, path);
+        bufferSend.shard = shard;
+        bufferSend.depthShard = depthShard;
+        bufferSend.codec = codec;
+        bufferSend.count = count;
+        memcpy(bufferSend.tuple, tuple, count * sizeof(DirectoryMetaTuple));
+        GeneralReceiveBuffer bufferReceive;
+        RdmaCall((uint16_t)hashNode,
+                (char *)&bufferSend,
+                (uint64_t)sizeof(SplitDirectorySendBuffer),
+                (char *)&bufferReceive,
+                (uint64_t)sizeof(GeneralReceiveBuffer));
+        return bufferReceive.result;
+    }
+}
+
+/* Add shard to bitmap kept in shard 0 of directory. Split maps are refreshed from it.
+   @param   path            Path of directory.
+   @param   shard           Shard created by a split.
+   @return                  If succeed return true, otherwise return false. */
+bool FileSystem::addDirectoryShard(const char *path, uint16_t shard)
+{
+    Debug::debugTitle("FileSystem::addDirectoryShard");
+    Debug::debugItem("Stage 1. Entry point. Path: %s, shard: %d.", path, (int)shard);
+    UniqueHash hashUnique;
+    HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
+    NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
+    AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
+    if (checkLocal(hashNode) == true) { /* If local node. */
+        bool result;
+        uint64_t key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
+        uint64_t indexDirectoryMeta;
+        bool isDirectory;
+        DirectoryMeta *metaDirectory;
+        if ((storage->hashtable->get(&hashUnique, &indexDirectoryMeta, &isDirectory) == false) ||
+            (isDirectory == false) ||
+            (storage->tableDirectoryMeta->reference(indexDirectoryMeta, &metaDirectory) == false)) {
+            result = false;             /* Fail due to directory removed meanwhile. */
+        } else {
+            metaDirectory->bitmapShard |= 1ULL | (1ULL << shard);
+            result = true;
+        }
+        unlockWriteHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
+        return result;
+    } else {
+        DirectoryShardSendBuffer bufferSend;
+        bufferSend.message = MESSAGE_ADDDIRECTORYSHARD;
+        strcpy(bufferSend.path, path);
+        bufferSend.shard = shard;
+        bufferSend.check = false;
+        GeneralReceiveBuffer bufferReceive;
+        RdmaCall((uint16_t)hashNode,
+                (char *)&bufferSend,
+                (uint64_t)sizeof(DirectoryShardSendBuffer),
+                (char *)&bufferReceive,
+                (uint64_t)sizeof(GeneralReceiveBuffer));
+        return bufferReceive.result;
+    }
+}
+
+/* Remove a shard of directory and names in it.
+   @param   path            Path of directory.
+   @param   shard           Shard, not 0.
+   @param   check           Only check if shard is empty, do not remove it.
+   @return                  If shard is removed (or is empty when checking) or does not exist return
+                            true, otherwise return false. */
+bool FileSystem::removeDirectoryShard(const char *path, uint16_t shard, bool check)
+{
+    Debug::debugTitle("FileSystem::removeDirectoryShard");
+    Debug::debugItem("Stage 1. Entry point. Path: %s, shard: %d.", path, (int)shard);
+    UniqueHash hashUnique;
+    getDirectoryShardHash(path, shard, &hashUnique); /* Get unique hash. */
+    NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
+    AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
+    if (checkLocal(hashNode) == true) { /* If local node. */
+        bool result = true;
+        uint64_t key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
+        uint64_t indexDirectoryMeta;
+        bool isDirectory;
+        const DirectoryMeta *metaDirectory;
+        if ((storage->hashtable->get(&hashUnique, &indexDirectoryMeta, &isDirectory) == true) &&
+            (storage->tableDirectoryMeta->view(indexDirectoryMeta, &metaDirectory) == true)) {
+            if (check == true) {
+                result = (metaDirectory->count == 0);
+            } else {
+                uint32_t indexPage = metaDirectory->indexPageFirst;
+                for (DirectoryPage *page = getDirectoryPage(indexPage); page != NULL; page = getDirectoryPage(indexPage)) {
+                    for (uint32_t slot = 0; slot < page->count; slot++) {
+                        UniqueHash hashEntry;
+                        getDirectoryEntryHash(path, shard, page->tuple[slot].names, &hashEntry);
+                        storage->hashtable->del(&hashEntry);
+                    }
+                    uint32_t indexPageNext = page->indexPageNext;
+                    page->indexDirectory = 0; /* Cursors to it are rejected. */
+                    storage->tableDirectoryPage->remove(indexPage - 1);
+                    indexPage = indexPageNext;
+                }
+                storage->tableDirectoryMeta->remove(indexDirectoryMeta);
+                storage->hashtable->del(&hashUnique);
+            }
+        }
+        unlockWriteHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
+        return result;
+    } else {
+        DirectoryShardSendBuffer bufferSend;
+        bufferSend.message = MESSAGE_REMOVEDIRECTORYSHARD;
+        strcpy(bufferSend.path, path);
+        bufferSend.shard = shard;
+        bufferSend.check = check;
+        GeneralReceiveBuffer bufferReceive;
+        RdmaCall((uint16_t)hashNode,
+                (char *)&bufferSend,
+                (uint64_t)sizeof(DirectoryShardSendBuffer),
+                (char *)&bufferReceive,
+                (uint64_t)sizeof(GeneralReceiveBuffer));
+        return bufferReceive.result;
+    }
+}
+
+/* Remove shards other than 0 of a directory being removed, so that it has one shard again. Called
+   on node of shard 0 with it locked.
+   @param   path                Path of directory.
+   @param   indexDirectoryMeta  Index of directory meta, i.e. shard 0.
+   @return                      If all shards are empty and removed return true, otherwise return false. */
+bool FileSystem::removeDirectoryShards(const char *path, uint64_t indexDirectoryMeta)
+{
+    DirectoryMeta *metaDirectory;
+    if (storage->tableDirectoryMeta->reference(indexDirectoryMeta, &metaDirectory) == false) {
+        return false;
+    }
+    uint64_t bitmap = metaDirectory->bitmapShard & ~1ULL;
+    for (uint64_t rest = bitmap; rest != 0; rest &= rest - 1) {
+        if (removeDirectoryShard(path, (uint16_t)__builtin_ctzll(rest), true) == false) {
+            return false;               /* Fail due to names left in shard. */
+        }
+    }
+    for (uint64_t rest = bitmap; rest != 0; rest &= rest - 1) {
+        removeDirectoryShard(path, (uint16_t)__builtin_ctzll(rest), false);
+    }
+    metaDirectory->bitmapShard = 0;
+    metaDirectory->depthShard = 0;
+    std::lock_guard<std::mutex> lockShard(mutexShard);
+    shardMap.erase(std::string(path));
+    return true;
+}
+
+/* Drop names of a shard that belong to a shard split from it, i.e. names a split has copied to new
+   shard but has not dropped here yet. Caller holds write lock of shard.
+   @param   indexDirectoryMeta  Index of directory meta of shard.
+   @param   path                Path of directory.
+   @return                      Count of names dropped. */
+uint64_t FileSystem::dropMovedNames(uint64_t indexDirectoryMeta, const char *path)
+{
+    const DirectoryMeta *metaDirectory;
+    uint64_t count = 0;
+    if (storage->tableDirectoryMeta->view(indexDirectoryMeta, &metaDirectory) == false) {
+        return 0;
+    }
+    uint32_t indexPage = metaDirectory->indexPageFirst;
+    for (DirectoryPage *page = getDirectoryPage(indexPage); page != NULL; page = getDirectoryPage(indexPage)) {
+        indexPage = page->indexPageNext; /* Page is released once it is empty. */
+        for (uint32_t slot = page->count; slot-- > 0;) { /* Removal fills slot from end of page. */
+            if (isNameInShard(metaDirectory, page->tuple[slot].names) == false) {
+                char name[MAX_FILE_NAME_LENGTH];
+                uint64_t address, size;
+                strcpy(name, page->tuple[slot].names);
+                if (removeDirectoryEntry(indexDirectoryMeta, path, name, &address, &size) == true) {
+                    count++;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+/* Split a directory shard as GIGA+ does. Names whose hash has bit depthShard set move to new shard
+   shard + 2^depthShard, which lives on node of its own key. New shard is filled with this shard
+   locked. Shard 0 keeps bitmap itself, so it is added there and depth is raised at once. Another
+   shard must not wait for lock of shard 0 while it is locked, as rmdir locks shard 0 before the
+   others. So new shard is marked pending, this shard is unlocked while it is added to bitmap in
+   shard 0, then depth is raised and names are dropped here. Meanwhile names moving are refused as
+   stale here and clients retry, so they are changed in neither shard until new one is in split
+   maps. Split is not logged. A crash leaves new shard pending, next split finds out whether it got
+   to bitmap, then finishes the split or removes new shard. rebuildDirectories() queues that split.
+   @param   path    Path of directory.
+   @param   shard   Shard to split.
+   @return          If shard is split or needs no split return true, otherwise return false. */
+bool FileSystem::splitDirectory(const char *path, uint16_t shard)
+{
+    Debug::debugTitle("FileSystem::splitDirectory");
+    Debug::debugItem("Stage 1. Entry point. Path: %s, shard: %d.", path, (int)shard);
+    UniqueHash hashUnique;
+    getDirectoryShardHash(path, shard, &hashUnique); /* Get unique hash. */
+    NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
+    AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
+    /* Read before locking. Only splits of this shard, which run one at a time, add its pending shard. */
+    uint64_t bitmap = (shard == 0) ? 0 : getDirectoryShards(path, true);
+    bool result = true;
+    uint16_t shardNew = 0;              /* Shard to add to bitmap with this shard unlocked. */
+    uint64_t key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
+    uint64_t indexDirectoryMeta;
+    bool isDirectory;
+    DirectoryMeta *metaDirectory;
+    if ((storage->hashtable->get(&hashUnique, &indexDirectoryMeta, &isDirectory) == false) ||
+        (storage->tableDirectoryMeta->reference(indexDirectoryMeta, &metaDirectory) == false)) {
+        result = false;                 /* Fail due to directory removed meanwhile. */
+    } else if (metaDirectory->shardPending != 0) {
+        if ((bitmap & (1ULL << metaDirectory->shardPending)) != 0) {
+            Debug::notifyInfo("Finish split of shard %d of %s into shard %d.", (int)shard, path, (int)metaDirectory->shardPending);
+            metaDirectory->depthShard++; /* Last split got to bitmap, names moved are taken from new shard. */
+        } else {
+            removeDirectoryShard(path, metaDirectory->shardPending, false); /* Nobody uses it. */
+        }
+        metaDirectory->shardPending = 0;
+    }
+    if (result == true) {
+        dropMovedNames(indexDirectoryMeta, path);
+    }
+    if ((result == true) && isSplitNeeded(metaDirectory) &&
+        (shard + (1U << metaDirectory->depthShard) < DIRECTORY_SHARD_MAX)) {
+        uint16_t depthShard = metaDirectory->depthShard;
+        uint16_t shardSplit = shard + (1 << depthShard);
+        uint64_t bitSplit = 1ULL << depthShard;
+        DirectoryMetaTuple tuple[DIRECTORY_PAGE_ENTRY_COUNT];
+        uint64_t count = 0;
+        Debug::debugItem("Stage 2. Move names to shard %d.", (int)shardSplit);
+        removeDirectoryShard(path, shardSplit, false); /* Leftover of an interrupted split. */
+        result = fillDirectoryShard(path, shardSplit, depthShard + 1, metaDirectory->codec, tuple, 0);
+        for (const DirectoryPage *page = getDirectoryPage(metaDirectory->indexPageFirst); (result == true) && (page != NULL); page = getDirectoryPage(page->indexPageNext)) {
+            for (uint32_t slot = 0; (result == true) && (slot < page->count); slot++) {
+                if ((getNameShardHash(page->tuple[slot].names) & bitSplit) != 0) {
+                    tuple[count++] = page->tuple[slot];
+                    if (count == DIRECTORY_PAGE_ENTRY_COUNT) {
+                        result = fillDirectoryShard(path, shardSplit, depthShard + 1, metaDirectory->codec, tuple, count);
+                        count = 0;
+                    }
+                }
+            }
+        }
+        if ((result == true) && (count != 0)) {
+            result = fillDirectoryShard(path, shardSplit, depthShard + 1, metaDirectory->codec, tuple, count);
+        }
+        if (result == false) {
+            Debug::notifyError("Split of shard %d of %s failed.", (int)shard, path);
+            removeDirectoryShard(path, shardSplit, false);
+        } else if (shard == 0) {        /* Bitmap is here and locked already. */
+            Debug::debugItem("Stage 3. Add shard %d to bitmap, drop moved names.", (int)shardSplit);
+            metaDirectory->bitmapShard |= 1ULL | (1ULL << shardSplit);
+            metaDirectory->depthShard = depthShard + 1; /* Names moved are not in this shard any more. */
+            dropMovedNames(indexDirectoryMeta, path);
+        } else {
+            metaDirectory->shardPending = shardSplit; /* Names moving are refused until it is in bitmap. */
+            shardNew = shardSplit;
+        }
+    }
+    unlockWriteHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
+    if (shardNew != 0) {
+        Debug::debugItem("Stage 3. Add shard %d to bitmap.", (int)shardNew);
+        result = addDirectoryShard(path, shardNew); /* Locks shard 0, nothing else is locked. */
+        Debug::debugItem("Stage 4. Drop moved names.");
+        key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
+        if ((storage->hashtable->get(&hashUnique, &indexDirectoryMeta, &isDirectory) == false) ||
+            (storage->tableDirectoryMeta->reference(indexDirectoryMeta, &metaDirectory) == false)) {
+            result = false;             /* Directory is removed meanwhile, with shards in its bitmap. */
+        } else if (metaDirectory->shardPending == shardNew) {
+            if (result == true) {
+                metaDirectory->depthShard++; /* Names moved are not in this shard any more. */
+                dropMovedNames(indexDirectoryMeta, path);
+            } else {
+                Debug::notifyError("Split of shard %d of %s failed.", (int)shard, path);
+                removeDirectoryShard(path, shardNew, false);
+            }
+            metaDirectory->shardPending = 0;
+        }
+        unlockWriteHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
+    }
+    return result;
+}
+
 /* Make node (file) with file meta.
    @param   path        Path of file.
    @param   metaFile    File meta. 
@@ -755,6 +1850,9 @@ bool FileSystem::mknodWithMeta(const char *path, FileMeta *metaFile)
                     Debug::debugItem("Stage 3. Create file meta from old.");
                     uint64_t indexFileMeta;
                     metaFile->timeLastModified = time(NULL); /* Set last modified time. */
+                    /* Blocks are given by old node from old meta in moveBlockLists(), those sent by client are not valid. */
+                    memset(metaFile->BlockListInline, 0, sizeof(metaFile->BlockListInline));
+                    memset(metaFile->indexExtentPage, 0, sizeof(metaFile->indexExtentPage));
                     if (storage->tableFileMeta->create(&indexFileMeta, metaFile) == false) {
                         result = false; /* Fail due to create error. */
                     } else {
@@ -799,87 +1897,9 @@ bool FileSystem::mknodcd(const char *path)
         HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
         NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
         AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
-        // uint64_t DistributedTxID;
-        uint64_t LocalTxID;
         if (checkLocal(hashNode) == true) { /* If local node. */
-            bool result;
             uint64_t key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
-            {
-                // DistributedTxID = TxDistributedBegin();
-                LocalTxID = TxLocalBegin();
-                Debug::debugItem("Stage 2. Update parent directory metadata.");
-                char *parent = (char *)malloc(strlen(path) + 1);
-                char *name = (char *)malloc(strlen(path) + 1);
-                DirectoryMeta parentMeta;
-                uint64_t parentHashAddress, parentMetaAddress;
-                uint16_t parentNodeID;
-                getParentDirectory(path, parent);
-                getNameFromPath(path, name);
-                if (readDirectoryMeta(parent, &parentMeta, &parentHashAddress, &parentMetaAddress, &parentNodeID) == false) {
-                    Debug::notifyError("readDirectoryMeta failed.");
-                    // TxDistributedPrepare(DistributedTxID, false);
-                    result = false;
-                } else {
-                    uint64_t indexMeta;
-                    bool isDirectory = false;
-                    if (storage->hashtable->get(&hashUnique, &indexMeta, &isDirectory) == true) { /* If path exists. */
-                        Debug::notifyError("addMetaToDirectory failed.");
-                        // TxDistributedPrepare(DistributedTxID, false);
-                        result = false; /* Fail due to existence of path. */
-                    } else {
-                    	
-                    	/* Update directory meta first. */
-                    	parentMeta.count++; /* Add count of names under directory. */
-                        strcpy(parentMeta.tuple[parentMeta.count - 1].names, name); /* Add name. */
-                        parentMeta.tuple[parentMeta.count - 1].isDirectories = isDirectory; /* Add directory state. */
-                        
-                        Debug::debugItem("Stage 3. Create file meta. name is %s, isDirectory = %d", name, isDirectory);
-                        uint64_t indexFileMeta;
-                        FileMeta metaFile;
-                        metaFile.timeLastModified = time(NULL); /* Set last modified time. */
-                        metaFile.count = 0; /* Initialize count of extents as 0. */
-                        metaFile.size = 0;
-			metaFile.isNewFile = true;
-			metaFile.tier = 1;
-                        /* Apply updated data to local log. */
-                        TxWriteData(LocalTxID, (uint64_t)&parentMeta, (uint64_t)sizeof(DirectoryMeta));
-                        /* Receive remote prepare with (OK) */
-                        // TxDistributedPrepare(DistributedTxID, true);
-                        /* Start phase 2, commit it. */
-			if (parentNodeID == server->getRdmaSocketInstance()->getNodeID()) {
-			    UniqueHash dirhashUnique;
-			    HashTable::getUniqueHash(parent, strlen(parent), &dirhashUnique);
-			    uint64_t indexDirectoryMeta;
-			    bool isDirectoryTemporary;
-			    storage->hashtable->get(&dirhashUnique, &indexDirectoryMeta, &isDirectoryTemporary);
-			    Debug::debugItem("updateMetaV2, put metadata to tableDirectoryMeta, indexDirectoryMeta = %ld", (long)indexDirectoryMeta);
-			    Debug::debugItem("countSavedItems = %ld", storage->tableDirectoryMeta->countSavedItems());
-			    storage->tableDirectoryMeta->put(indexDirectoryMeta, &parentMeta);
-			} else {
-                            updateRemoteMeta(parentNodeID, &parentMeta, parentMetaAddress, parentHashAddress);
-			}
-                        /* Only allocate momery, write to log first. */
-                        if (storage->tableFileMeta->create(&indexFileMeta, &metaFile) == false) {
-                            result = false; /* Fail due to create error. */
-                        } else {
-                            if (storage->hashtable->put(&hashUnique, indexFileMeta, false) == false) { /* false for file. */
-                                result = false; /* Fail due to hash table put. No roll back. */
-                            } else {
-                                result = true;
-                            }
-                        }
-                    }
-                }
-                free(parent);
-            	free(name);
-            }
-            if (result == false) {
-                TxLocalCommit(LocalTxID, false);
-                // TxDistributedCommit(DistributedTxID, false);
-            } else {
-                TxLocalCommit(LocalTxID, true);
-                // TxDistributedCommit(DistributedTxID, true);
-            }
+            bool result = mknodLocked(path, &hashUnique);
             unlockWriteHashItem(key, hashNode, hashAddress);  /* Unlock hash item. */
             Debug::debugItem("Stage end.");
             return result;              /* Return specific result. */
@@ -888,6 +1908,128 @@ bool FileSystem::mknodcd(const char *path)
         }
     }
 }
+
+/* Create an empty file whose path is write locked by caller, as collect-dispatch transaction.
+   @param   path        Path of file.
+   @param   hashUnique  Key of path.
+   @return              If file is created return true, otherwise (e.g. it exists) return false. */
+bool FileSystem::mknodLocked(const char *path, UniqueHash *hashUnique)
+{
+    uint64_t LocalTxID;
+    uint64_t RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset;
+    uint16_t shard;                     /* Shard of parent holding name. */
+    bool result;
+    LocalTxID = TxLocalBegin();
+    Debug::debugItem("Stage 2. Update parent directory metadata.");
+    char *parent = (char *)malloc(strlen(path) + 1);
+    char *name = (char *)malloc(strlen(path) + 1);
+    uint16_t codec;
+    getParentDirectory(path, parent);
+    getNameFromPath(path, name);
+    uint64_t indexMeta;
+    bool isDirectory = false;
+    if (storage->hashtable->get(hashUnique, &indexMeta, &isDirectory) == true) { /* If path exists. */
+        result = false; /* Fail due to existence of path. */
+    } else if (addMetaToDirectory(parent, name, false, &shard, &RemoteTxID, &srcBuffer, &desBuffer, &size, &remotekey, &offset, &codec) == false) {
+        Debug::notifyError("addMetaToDirectory failed.");
+        result = false;
+    } else {
+        Debug::debugItem("Stage 3. Create file meta. name is %s", name);
+        uint64_t indexFileMeta;
+        FileMeta metaFile;
+        memset(&metaFile, 0, sizeof(FileMeta)); /* No extent pages yet. */
+        metaFile.timeLastModified = time(NULL); /* Set last modified time. */
+        metaFile.count = 0; /* Initialize count of extents as 0. */
+        metaFile.size = 0;
+        metaFile.isNewFile = true;
+        metaFile.tier = 1;
+        metaFile.hintPlacement = PLACEMENT_HINT_NONE;
+        metaFile.heatWrite = 0;
+        metaFile.codec = codec; /* Inherit compression of parent directory. */
+        /* Apply updated data to local log. */
+        TxWriteData(LocalTxID, (uint64_t)&metaFile, (uint64_t)sizeof(FileMeta));
+        /* Name is already appended to parent, nothing is left to commit. */
+        updateDirectoryMeta(parent, shard, RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset);
+        if (storage->tableFileMeta->create(&indexFileMeta, &metaFile) == false) {
+            result = false; /* Fail due to create error. */
+        } else {
+            if (storage->hashtable->put(hashUnique, indexFileMeta, false) == false) { /* false for file. */
+                result = false; /* Fail due to hash table put. No roll back. */
+            } else {
+                result = true;
+            }
+        }
+    }
+    free(parent);
+    free(name);
+    TxLocalCommit(LocalTxID, result);
+    return result;
+}
+
+/* Make node (file) by two phase commit, path is write locked by caller.
+   @param   path        Path of file.
+   @param   hashUnique  Unique hash of path.
+   @return              If operation succeeds then return true, otherwise return false. */
+bool FileSystem::mknod2pcLocked(const char *path, UniqueHash *hashUnique)
+{
+    uint64_t DistributedTxID;
+    uint64_t LocalTxID;
+    uint64_t RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset;
+    uint16_t shard;                     /* Shard of parent holding name. */
+    uint16_t codec;
+    bool result;
+    DistributedTxID = TxDistributedBegin();
+    LocalTxID = TxLocalBegin();
+    Debug::debugItem("Stage 2. Update parent directory metadata.");
+    char *parent = (char *)malloc(strlen(path) + 1);
+    char *name = (char *)malloc(strlen(path) + 1);
+    getParentDirectory(path, parent);
+    getNameFromPath(path, name);
+    uint64_t indexMeta;
+    bool isDirectory;
+    if (storage->hashtable->get(hashUnique, &indexMeta, &isDirectory) == true) { /* If path exists. */
+        TxDistributedPrepare(DistributedTxID, false);
+        result = false; /* Fail due to existence of path. */
+    } else if (addMetaToDirectory(parent, name, false, &shard, &RemoteTxID, &srcBuffer, &desBuffer, &size, &remotekey, &offset, &codec) == false) {
+        Debug::notifyError("addMetaToDirectory failed.");
+        TxDistributedPrepare(DistributedTxID, false);
+        result = false;
+    } else {
+        Debug::debugItem("Stage 3. Create file meta.");
+        uint64_t indexFileMeta;
+        FileMeta metaFile;
+        memset(&metaFile, 0, sizeof(FileMeta)); /* No extent pages yet. */
+        metaFile.timeLastModified = time(NULL); /* Set last modified time. */
+        metaFile.count = 0; /* Initialize count of extents as 0. */
+        metaFile.size = 0;
+        metaFile.hintPlacement = PLACEMENT_HINT_NONE;
+        metaFile.heatWrite = 0;
+        metaFile.codec = codec; /* Inherit compression of parent directory. */
+        /* Apply updated data to local log. */
+        TxWriteData(LocalTxID, (uint64_t)&metaFile, (uint64_t)sizeof(FileMeta));
+        /* Receive remote prepare with (OK) */
+        TxDistributedPrepare(DistributedTxID, true);
+        /* Start phase 2, commit it. */
+        Debug::debugItem("mknod, key = %lx, offset = %lx", remotekey, offset);
+        updateDirectoryMeta(parent, shard, RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset);
+        /* Only allocate momery, write to log first. */
+        if (storage->tableFileMeta->create(&indexFileMeta, &metaFile) == false) {
+            result = false; /* Fail due to create error. */
+        } else {
+            if (storage->hashtable->put(hashUnique, indexFileMeta, false) == false) { /* false for file. */
+                result = false; /* Fail due to hash table put. No roll back. */
+            } else {
+                result = true;
+            }
+        }
+    }
+    free(parent);
+    free(name);
+    TxLocalCommit(LocalTxID, result);
+    TxDistributedCommit(DistributedTxID, result);
+    return result;
+}
+
 bool FileSystem::mknod2pc(const char *path) 
 {
     printf("Debug-fileystem.cpp: mknod-2pc\n");
@@ -900,66 +2042,11 @@ bool FileSystem::mknod2pc(const char *path)
         HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
         NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
         AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
-        uint64_t DistributedTxID;
-        uint64_t LocalTxID;
-        uint64_t RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset;
         if (checkLocal(hashNode) == true) { /* If local node. */
             bool result;
             uint64_t key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
             {
-                DistributedTxID = TxDistributedBegin();
-                LocalTxID = TxLocalBegin();
-                Debug::debugItem("Stage 2. Update parent directory metadata.");
-                char *parent = (char *)malloc(strlen(path) + 1);
-                char *name = (char *)malloc(strlen(path) + 1);
-                getParentDirectory(path, parent);
-                getNameFromPath(path, name);
-                if (addMetaToDirectory(parent, name, false, &RemoteTxID, &srcBuffer, &desBuffer, &size, &remotekey, &offset) == false) {
-                    Debug::notifyError("addMetaToDirectory failed.");
-                    TxDistributedPrepare(DistributedTxID, false);
-                    result = false;
-                } else {
-                    uint64_t indexMeta;
-                    bool isDirectory;
-                    if (storage->hashtable->get(&hashUnique, &indexMeta, &isDirectory) == true) { /* If path exists. */
-                        Debug::notifyError("addMetaToDirectory failed.");
-                        TxDistributedPrepare(DistributedTxID, false);
-                        result = false; /* Fail due to existence of path. */
-                    } else {
-                        Debug::debugItem("Stage 3. Create file meta.");
-                        uint64_t indexFileMeta;
-                        FileMeta metaFile;
-                        metaFile.timeLastModified = time(NULL); /* Set last modified time. */
-                        metaFile.count = 0; /* Initialize count of extents as 0. */
-                        metaFile.size = 0;
-                        /* Apply updated data to local log. */
-                        TxWriteData(LocalTxID, (uint64_t)&metaFile, (uint64_t)sizeof(FileMeta));
-                        /* Receive remote prepare with (OK) */
-                        TxDistributedPrepare(DistributedTxID, true);
-                        /* Start phase 2, commit it. */
-                        Debug::debugItem("mknod, key = %lx, offset = %lx", remotekey, offset);
-                        updateDirectoryMeta(parent, RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset);
-                        /* Only allocate momery, write to log first. */
-                        if (storage->tableFileMeta->create(&indexFileMeta, &metaFile) == false) {
-                            result = false; /* Fail due to create error. */
-                        } else {
-                            if (storage->hashtable->put(&hashUnique, indexFileMeta, false) == false) { /* false for file. */
-                                result = false; /* Fail due to hash table put. No roll back. */
-                            } else {
-                                result = true;
-                            }
-                        }
-                    }
-                }
-                free(parent);
-                free(name);
-            }
-            if (result == false) {
-                TxLocalCommit(LocalTxID, false);
-                TxDistributedCommit(DistributedTxID, false);
-            } else {
-                TxLocalCommit(LocalTxID, true);
-                TxDistributedCommit(DistributedTxID, true);
+                result = mknod2pcLocked(path, &hashUnique);
             }
             unlockWriteHashItem(key, hashNode, hashAddress);  /* Unlock hash item. */
             Debug::debugItem("Stage end.");
@@ -998,12 +2085,14 @@ bool FileSystem::getattr(const char *path, FileMeta *attribute, BlockInfo BlockL
                 } else {
                     Debug::debugItem("Stage 2. Get meta.");
                     if (isDirectory == false) { /* If file meta. */
-                        if (storage->tableFileMeta->get(indexMeta, attribute) == false) {
+                        const FileMeta *metaFile;
+                        if (storage->tableFileMeta->view(indexMeta, &metaFile) == false) {
                             result = false; /* Fail due to get file meta error. */
                         } else {
+                            memcpy(attribute, metaFile, sizeof(FileMeta)); /* Extent pages are not copied. */
                             Debug::debugItem("FileSystem::getattr, meta.size = %ld, mete.count = %d", (long) attribute->size, attribute->count);
 			    for (int i = 0; i < attribute->count; i ++) {
-				BlockList[i] = attribute->BlockList[i];
+				BlockList[i] = *getBlockInfo(metaFile, i);
 				if (i == (MAX_MESSAGE_BLOCK_COUNT-1))
 				    break;
 			    }
@@ -1070,14 +2159,257 @@ bool FileSystem::access(const char *path, bool *isDirectory2)
     }
 }
 
-/* Make directory. 
-   @param   path    Path of folder. 
-   @return          If operation succeeds then return true, otherwise return false. */
-// bool FileSystem::mkdir(const char *path)
-// {
-//     Debug::debugTitle("FileSystem::mkdir");
-//     Debug::debugItem("Stage 1. Entry point. Path: %s.", path);
-//     char *parent = (char *)malloc(strlen(path) + 1);
+/* Open a file, create it first if it does not exist and create is set, and get its size, all in
+   one request under one lock of path. Leases on a missing path are revoked only when it is created.
+   @param   path        Path of file or folder.
+   @param   create      Create an empty file if path does not exist.
+   @param   source      Node ID of requester.
+   @param   isDirectory Buffer of whether path is a directory.
+   @param   created     Buffer of whether file is created by this call.
+   @param   size        Buffer of size of file.
+   @param   count       Buffer of count of extents of file.
+   @param   timeLastModified Buffer of last modified time of file.
+   @param   wait        Buffer of microseconds to retry after if a lease on missing path is held by
+                        another client, 0 otherwise.
+   @return              If path exists or is created return true, otherwise return false. */
+bool FileSystem::open(const char *path, bool create, uint16_t source, bool *isDirectory, bool *created,
+    uint64_t *size, uint64_t *count, time_t *timeLastModified, uint64_t *wait)
+{
+    Debug::debugTitle("FileSystem::open");
+    Debug::debugItem("Stage 1. Entry point. Path: %s.", path);
+    *isDirectory = false;
+    *created = false;
+    *size = 0;
+    *count = 0;
+    *timeLastModified = 0;
+    *wait = 0;
+    if (path == NULL) {
+        return false;                   /* Null path error. */
+    }
+    UniqueHash hashUnique;
+    HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
+    NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
+    AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
+    if (checkLocal(hashNode) == false) {
+        return false;                   /* Path is not on this node. */
+    }
+    bool result = false;
+    uint64_t key = lockWriteHashItem(hashNode, hashAddress); /* Lookup and creation under one lock. */
+    {
+        uint64_t indexMeta;
+        bool exists = storage->hashtable->get(&hashUnique, &indexMeta, isDirectory);
+        if ((exists == false) && (create == true)) {
+            Debug::debugItem("Stage 2. Create file.");
+            *wait = revokeLease(path, source); /* Missing path may be leased by access. Never sleeps. */
+            if (*wait == 0) {
+#ifdef TRANSACTION_2PC
+                *created = mknod2pcLocked(path, &hashUnique);
+#endif
+#ifdef TRANSACTION_CD
+                *created = mknodLocked(path, &hashUnique);
+#endif
+                finishRevoke(path);
+                exists = *created && storage->hashtable->get(&hashUnique, &indexMeta, isDirectory);
+            }
+        }
+        if (exists == true) {
+            Debug::debugItem("Stage 3. Get meta.");
+            const FileMeta *metaFile;
+            if (*isDirectory == true) {
+                result = true;
+            } else if (storage->tableFileMeta->view(indexMeta, &metaFile) == true) {
+                *size = metaFile->size;
+                *count = metaFile->count;
+                *timeLastModified = metaFile->timeLastModified;
+                result = true;
+            }
+        }
+    }
+    unlockWriteHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
+    Debug::debugItem("Stage end.");
+    return result;
+}
+
+/* Hash paths of a batch and order those on this node by hash item, so that paths sharing an item
+   are handled under one lock and items are taken in the same order by every batch.
+   @param   path    Paths.
+   @param   count   Count of paths.
+   @param   hashes  Buffer of unique hashes of paths.
+   @param   order   Buffer of address hash and index of local paths, sorted. */
+void FileSystem::sortBatch(const char (*path)[MAX_PATH_LENGTH], uint16_t count, UniqueHash *hashes,
+    std::vector<std::pair<AddressHash, uint16_t> > *order)
+{
+    order->clear();
+    for (uint16_t i = 0; i < count; i++) {
+        HashTable::getUniqueHash(path[i], strlen(path[i]), &hashes[i]);
+        if (checkLocal(storage->getNodeHash(&hashes[i])) == true) {
+            order->push_back(std::make_pair(HashTable::getAddressHash(&hashes[i]), i));
+        }
+    }
+    std::sort(order->begin(), order->end());
+}
+
+/* Start changes of all paths of a batch. If a lease on any of them is held by another client, none
+   is started, and batch is retried once all these leases end.
+   @param   path    Paths.
+   @param   count   Count of paths.
+   @param   source  Node ID of requester.
+   @return          0 if changes are started, otherwise microseconds to retry batch after. */
+uint64_t FileSystem::revokeBatch(const char (*path)[MAX_PATH_LENGTH], uint16_t count, uint16_t source)
+{
+    uint64_t wait = 0;
+    std::vector<uint16_t> started;
+    for (uint16_t i = 0; i < count; i++) {
+        uint64_t waitPath = revokeLease(path[i], source);
+        if (waitPath == 0) {
+            started.push_back(i);
+        } else if (waitPath > wait) {
+            wait = waitPath;
+        }
+    }
+    if (wait != 0) {
+        for (size_t i = 0; i < started.size(); i++) {
+            finishRevoke(path[started[i]]);
+        }
+    }
+    return wait;
+}
+
+/* Make nodes of a batch. Leases are revoked for all paths first, then paths are created in hash
+   item order with one write lock per item.
+   @param   path    Paths of files, owned by this node.
+   @param   count   Count of paths.
+   @param   source  Node ID of requester.
+   @param   results Buffer of results in order of paths.
+   @return          0 if batch is done, otherwise microseconds to retry it after. */
+uint64_t FileSystem::mknodBatch(const char (*path)[MAX_PATH_LENGTH], uint16_t count, uint16_t source, BatchResult *results)
+{
+    Debug::debugTitle("FileSystem::mknodBatch");
+    Debug::debugItem("Stage 1. Entry point. Count: %d.", (int)count);
+    uint64_t wait = revokeBatch(path, count, source);
+    if (wait != 0) {
+        return wait;
+    }
+    UniqueHash *hashes = (UniqueHash *)malloc(sizeof(UniqueHash) * count);
+    std::vector<std::pair<AddressHash, uint16_t> > order;
+    sortBatch(path, count, hashes, &order);
+    NodeHash hashNode = (order.size() == 0) ? 0 : storage->getNodeHash(&hashes[order[0].second]); /* Same for all local paths. */
+    uint64_t key = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        AddressHash hashAddress = order[i].first;
+        if ((i == 0) || (hashAddress != order[i - 1].first)) {
+            if (i != 0) {
+                unlockWriteHashItem(key, hashNode, order[i - 1].first); /* Unlock hash item. */
+            }
+            key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
+        }
+        uint16_t index = order[i].second;
+#ifdef TRANSACTION_2PC
+        results[index].result = mknod2pcLocked(path[index], &hashes[index]); /* Duplicate path fails as existing. */
+#endif
+#ifdef TRANSACTION_CD
+        results[index].result = mknodLocked(path[index], &hashes[index]); /* Duplicate path fails as existing. */
+#endif
+    }
+    if (order.size() != 0) {
+        unlockWriteHashItem(key, hashNode, order.back().first); /* Unlock hash item. */
+    }
+    free(hashes);
+    for (uint16_t i = 0; i < count; i++) {
+        finishRevoke(path[i]);
+    }
+    Debug::debugItem("Stage end.");
+    return 0;
+}
+
+/* Get sizes of a batch, in hash item order with one read lock per item.
+   @param   path    Paths of files or folders, owned by this node.
+   @param   count   Count of paths.
+   @param   source  Node ID of requester.
+   @param   results Buffer of results in order of paths. */
+void FileSystem::statBatch(const char (*path)[MAX_PATH_LENGTH], uint16_t count, uint16_t source, BatchResult *results)
+{
+    Debug::debugTitle("FileSystem::statBatch");
+    Debug::debugItem("Stage 1. Entry point. Count: %d.", (int)count);
+    UniqueHash *hashes = (UniqueHash *)malloc(sizeof(UniqueHash) * count);
+    std::vector<std::pair<AddressHash, uint16_t> > order;
+    sortBatch(path, count, hashes, &order);
+    NodeHash hashNode = (order.size() == 0) ? 0 : storage->getNodeHash(&hashes[order[0].second]); /* Same for all local paths. */
+    uint64_t key = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        AddressHash hashAddress = order[i].first;
+        if ((i == 0) || (hashAddress != order[i - 1].first)) {
+            if (i != 0) {
+                unlockReadHashItem(key, hashNode, order[i - 1].first); /* Unlock hash item. */
+            }
+            key = lockReadHashItem(hashNode, hashAddress); /* Lock hash item. */
+        }
+        uint16_t index = order[i].second;
+        uint64_t indexMeta;
+        bool isDirectory = false;
+        if (storage->hashtable->get(&hashes[index], &indexMeta, &isDirectory) == true) {
+            const FileMeta *metaFile;
+            results[index].isDirectory = isDirectory;
+            if (isDirectory == true) {
+                results[index].count = MAX_FILE_EXTENT_COUNT; /* Same meaning as in getattr. */
+                results[index].result = true;
+            } else if (storage->tableFileMeta->view(indexMeta, &metaFile) == true) {
+                results[index].size = metaFile->size;
+                results[index].count = metaFile->count;
+                results[index].timeLastModified = metaFile->timeLastModified;
+                results[index].result = true;
+            }
+        }
+    }
+    if (order.size() != 0) {
+        unlockReadHashItem(key, hashNode, order.back().first); /* Unlock hash item. */
+    }
+    free(hashes);
+    for (uint16_t i = 0; i < count; i++) {
+        if (results[i].result == true) {
+            results[i].lease = grantLease(path[i], source);
+        }
+    }
+    Debug::debugItem("Stage end.");
+}
+
+/* Remove files or empty directories of a batch. Leases are revoked for all paths first. Each path
+   is removed as by remove(), which frees blocks of files.
+   @param   path    Paths of files or folders, owned by this node.
+   @param   count   Count of paths.
+   @param   source  Node ID of requester.
+   @param   results Buffer of results in order of paths.
+   @return          0 if batch is done, otherwise microseconds to retry it after. */
+uint64_t FileSystem::removeBatch(const char (*path)[MAX_PATH_LENGTH], uint16_t count, uint16_t source, BatchResult *results)
+{
+    Debug::debugTitle("FileSystem::removeBatch");
+    Debug::debugItem("Stage 1. Entry point. Count: %d.", (int)count);
+    uint64_t wait = revokeBatch(path, count, source);
+    if (wait != 0) {
+        return wait;
+    }
+    FileMeta *metaFile = (FileMeta *)malloc(sizeof(FileMeta));
+    for (uint16_t i = 0; i < count; i++) {
+        memset(metaFile, 0, sizeof(FileMeta));
+        results[i].result = remove(path[i], metaFile);
+        results[i].isDirectory = (metaFile->count == MAX_FILE_EXTENT_COUNT);
+    }
+    free(metaFile);
+    for (uint16_t i = 0; i < count; i++) {
+        finishRevoke(path[i]);
+    }
+    Debug::debugItem("Stage end.");
+    return 0;
+}
+
+/* Make directory. 
+   @param   path    Path of folder. 
+   @return          If operation succeeds then return true, otherwise return false. */
+// bool FileSystem::mkdir(const char *path)
+// {
+//     Debug::debugTitle("FileSystem::mkdir");
+//     Debug::debugItem("Stage 1. Entry point. Path: %s.", path);
+//     char *parent = (char *)malloc(strlen(path) + 1);
 //     getParentDirectory(path, parent);
 //     nrfsfileattr attribute;
 //     Debug::debugItem("Stage 2. Check parent.");
@@ -1112,58 +2444,45 @@ bool FileSystem::mkdircd(const char *path)
         HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
         NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
         AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
-        // uint64_t DistributedTxID;
         uint64_t LocalTxID;
+        uint64_t RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset;
+        uint16_t shard;                 /* Shard of parent holding name. */
         if (checkLocal(hashNode) == true) { /* If local node. */
             bool result;
             uint64_t key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
             {
-                // DistributedTxID = TxDistributedBegin();
                 LocalTxID = TxLocalBegin();
                 Debug::debugItem("Stage 2. Check parent.");
                 char *parent = (char *)malloc(strlen(path) + 1);
                 char *name = (char *)malloc(strlen(path) + 1);
-                DirectoryMeta parentMeta;
-                uint64_t parentHashAddress, parentMetaAddress;
-                uint16_t parentNodeID;
+                uint16_t codec;
                 getParentDirectory(path, parent);
                 getNameFromPath(path, name);
-                if (readDirectoryMeta(parent, &parentMeta, &parentHashAddress, &parentMetaAddress, &parentNodeID) == false) {
-                    // TxDistributedPrepare(DistributedTxID, false);
+                uint64_t indexMeta;
+                bool isDirectory;
+                if (storage->hashtable->get(&hashUnique, &indexMeta, &isDirectory) == true) { /* If path exists. */
+                    result = false; /* Fail due to existence of path. */
+                } else if (addMetaToDirectory(parent, name, true, &shard, &RemoteTxID, &srcBuffer, &desBuffer, &size, &remotekey, &offset, &codec) == false) {
                     result = false;
                 } else {
-                    uint64_t indexMeta;
-                    bool isDirectory;
-                    if (storage->hashtable->get(&hashUnique, &indexMeta, &isDirectory) == true) { /* If path exists. */
-                        // TxDistributedPrepare(DistributedTxID, false);
-                        result = false; /* Fail due to existence of path. */
+                    Debug::debugItem("Stage 3. Write directory meta.");
+                    uint64_t indexDirectoryMeta;
+                    DirectoryMeta metaDirectory;
+                    memset(&metaDirectory, 0, sizeof(DirectoryMeta)); /* No names and no pages. */
+                    metaDirectory.codec = codec; /* Inherit compression of parent directory. */
+                    strcpy(metaDirectory.path, path);
+                    /* Apply updated data to local log. */
+                    TxWriteData(LocalTxID, (uint64_t)&metaDirectory, (uint64_t)sizeof(DirectoryMeta));
+                    /* Name is already appended to parent, nothing is left to commit. */
+                    updateDirectoryMeta(parent, shard, RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset);
+                    if (storage->tableDirectoryMeta->create(&indexDirectoryMeta, &metaDirectory) == false) {
+                        result = false; /* Fail due to create error. */
                     } else {
-
-                    	/* Update directory meta first. */
-                    	parentMeta.count++; /* Add count of names under directory. */
-                        strcpy(parentMeta.tuple[parentMeta.count - 1].names, name); /* Add name. */
-                        parentMeta.tuple[parentMeta.count - 1].isDirectories = true; /* Add directory state. */
-                        
-                        Debug::debugItem("Stage 3. Write directory meta.");
-                        uint64_t indexDirectoryMeta;
-                        DirectoryMeta metaDirectory;
-                        metaDirectory.count = 0; /* Initialize count of names as 0. */
-                        /* Apply updated data to local log. */
-                        TxWriteData(LocalTxID, (uint64_t)&parentMeta, (uint64_t)sizeof(DirectoryMeta));
-                        /* Receive remote prepare with (OK) */
-                        // TxDistributedPrepare(DistributedTxID, true);
-                        /* Start phase 2, commit it. */
-                        updateRemoteMeta(parentNodeID, &parentMeta, parentMetaAddress, parentHashAddress);
-                        
-                        if (storage->tableDirectoryMeta->create(&indexDirectoryMeta, &metaDirectory) == false) {
-                            result = false; /* Fail due to create error. */
+                        Debug::debugItem("indexDirectoryMeta = %d", indexDirectoryMeta);
+                        if (storage->hashtable->put(&hashUnique, indexDirectoryMeta, true) == false) { /* true for directory. */
+                            result = false; /* Fail due to hash table put. No roll back. */
                         } else {
-                            Debug::debugItem("indexDirectoryMeta = %d", indexDirectoryMeta);
-                            if (storage->hashtable->put(&hashUnique, indexDirectoryMeta, true) == false) { /* true for directory. */
-                                result = false; /* Fail due to hash table put. No roll back. */
-                            } else {
-                                result = true;
-                            }
+                            result = true;
                         }
                     }
                 }
@@ -1173,10 +2492,8 @@ bool FileSystem::mkdircd(const char *path)
 
             if (result == false) {
                 TxLocalCommit(LocalTxID, false);
-                // TxDistributedCommit(DistributedTxID, false);
             } else {
                 TxLocalCommit(LocalTxID, true);
-                // TxDistributedCommit(DistributedTxID, true);
             }
 
             unlockWriteHashItem(key, hashNode, hashAddress);  /* Unlock hash item. */
@@ -1202,6 +2519,8 @@ bool FileSystem::mkdir2pc(const char *path)
         uint64_t DistributedTxID;
         uint64_t LocalTxID;
         uint64_t RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset;
+        uint16_t shard;                 /* Shard of parent holding name. */
+        uint16_t codec;
         if (checkLocal(hashNode) == true) { /* If local node. */
             bool result;
             uint64_t key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
@@ -1213,7 +2532,7 @@ bool FileSystem::mkdir2pc(const char *path)
                 char *name = (char *)malloc(strlen(path) + 1);
                 getParentDirectory(path, parent);
                 getNameFromPath(path, name);
-                if (addMetaToDirectory(parent, name, true, &RemoteTxID, &srcBuffer, &desBuffer, &size, &remotekey, &offset) == false) {
+                if (addMetaToDirectory(parent, name, true, &shard, &RemoteTxID, &srcBuffer, &desBuffer, &size, &remotekey, &offset, &codec) == false) {
                     TxDistributedPrepare(DistributedTxID, false);
                     result = false;
                 } else {
@@ -1226,14 +2545,16 @@ bool FileSystem::mkdir2pc(const char *path)
                         Debug::debugItem("Stage 3. Write directory meta.");
                         uint64_t indexDirectoryMeta;
                         DirectoryMeta metaDirectory;
-                        metaDirectory.count = 0; /* Initialize count of names as 0. */
+                        memset(&metaDirectory, 0, sizeof(DirectoryMeta)); /* No names and no pages. */
+                        metaDirectory.codec = codec; /* Inherit compression of parent directory. */
+                        strcpy(metaDirectory.path, path);
                         /* Apply updated data to local log. */
                         TxWriteData(LocalTxID, (uint64_t)&metaDirectory, (uint64_t)sizeof(DirectoryMeta));
                         /* Receive remote prepare with (OK) */
                         TxDistributedPrepare(DistributedTxID, true);
                         /* Start phase 2, commit it. */
                         Debug::debugItem("mknod, key = %lx, offset = %lx", remotekey, offset);
-                        updateDirectoryMeta(parent, RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset);
+                        updateDirectoryMeta(parent, shard, RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset);
 
                         if (storage->tableDirectoryMeta->create(&indexDirectoryMeta, &metaDirectory) == false) {
                             result = false; /* Fail due to create error. */
@@ -1268,23 +2589,57 @@ bool FileSystem::mkdir2pc(const char *path)
     }
 }
 
-/* Read filenames in directory. 
+/* Read filenames in directory, one page at a time. Cursor holds shard in high 32 bits and index + 1
+   of page in low 32 bits, 0 for first page of shard. Requests come to node of shard 0, which knows
+   shards of directory and forwards a request to node of shard being listed.
    @param   path    Path of folder.
-   @param   list    List buffer of names in directory.
-   @return          If operation succeeds then return true, otherwise return false. */
-bool FileSystem::readdir(const char *path, nrfsfilelist *list)
+   @param   cursor  0 for first page, otherwise cursor of last list.
+   @param   list    List buffer of names in directory. Its cursor is 0 after last page.
+   @return          If operation succeeds then return true, otherwise (e.g. page of cursor has
+                    been released by removes meanwhile) return false. */
+bool FileSystem::readdir(const char *path, uint64_t cursor, nrfsfilelist *list)
 {
     Debug::debugTitle("FileSystem::readdir");
     Debug::debugItem("Stage 1. Entry point. Path: %s.", path);
     if ((path == NULL) || (list == NULL)) /* Judge if path and list buffer are valid. */
         return false;                   /* Null parameter error. */
     else {
+        uint64_t shard = cursor >> 32;
+        uint32_t indexPage = (uint32_t)cursor;
+        uint64_t bitmap = 0;            /* Shards of directory, 0 if not known on this node. */
         UniqueHash hashUnique;
         HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
         NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
         AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
+        if (checkLocal(hashNode) == true) { /* If node of shard 0. */
+            uint64_t key = lockReadHashItem(hashNode, hashAddress); /* Lock hash item. */
+            uint64_t indexDirectoryMeta;
+            bool isDirectory;
+            const DirectoryMeta *metaDirectory;
+            if ((storage->hashtable->get(&hashUnique, &indexDirectoryMeta, &isDirectory) == true) &&
+                (isDirectory == true) &&
+                (storage->tableDirectoryMeta->view(indexDirectoryMeta, &metaDirectory) == true)) {
+                bitmap = metaDirectory->bitmapShard | 1;
+            }
+            unlockReadHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
+            if (bitmap == 0) {
+                return false;           /* Fail due to path does not exist or is not directory. */
+            }
+            if (indexPage == 0) {       /* Skip to first existing shard from cursor. */
+                uint64_t rest = (shard < DIRECTORY_SHARD_MAX) ? (bitmap & (~0ULL << shard)) : 0;
+                if (rest == 0) {
+                    list->count = 0;
+                    list->cursor = 0;
+                    return true;
+                }
+                shard = __builtin_ctzll(rest);
+            }
+        }
+        getDirectoryShardHash(path, (uint16_t)shard, &hashUnique);
+        hashNode = storage->getNodeHash(&hashUnique);
+        hashAddress = HashTable::getAddressHash(&hashUnique);
+        bool result;
         if (checkLocal(hashNode) == true) { /* If local node. */
-            bool result;
             uint64_t key = lockReadHashItem(hashNode, hashAddress); /* Lock hash item. */
             {
                 uint64_t indexDirectoryMeta;
@@ -1296,31 +2651,153 @@ bool FileSystem::readdir(const char *path, nrfsfilelist *list)
                     if (isDirectory == false) { /* If file meta. */
                         result = false; /* Fail due to not directory. */
                     } else {
-                        DirectoryMeta metaDirectory; /* Copy operation of meta might cause overhead. */
-                        if (storage->tableDirectoryMeta->get(indexDirectoryMeta, &metaDirectory) == false) {
+                        const DirectoryMeta *metaDirectory;
+                        if (storage->tableDirectoryMeta->view(indexDirectoryMeta, &metaDirectory) == false) {
                             result = false; /* Fail due to get directory meta error. */
                         } else {
-                            list->count = metaDirectory.count; /* Assign count of names in directory. */
-                            for (uint64_t i = 0; i < metaDirectory.count; i++) {
-                                strcpy(list->tuple[i].names, metaDirectory.tuple[i].names);
-                                if (metaDirectory.tuple[i].isDirectories == true) {
-                                    list->tuple[i].isDirectories = true; /* Mode 1 for directory. */
-                                } else { 
-                                    list->tuple[i].isDirectories = false; /* Mode 0 for file. */
+                            const DirectoryPage *page = getDirectoryPage((indexPage == 0) ? metaDirectory->indexPageFirst : indexPage);
+                            list->count = 0;
+                            list->cursor = (shard + 1) << 32; /* Next shard, if any. */
+                            if (page == NULL) {
+                                result = (indexPage == 0); /* Empty shard. */
+                            } else if (page->indexDirectory != indexDirectoryMeta + 1) {
+                                Debug::notifyError("Cursor of %s is stale.", path);
+                                result = false; /* Fail due to page released. */
+                            } else {
+                                list->count = page->count; /* Assign count of names in page. */
+                                memcpy(list->tuple, page->tuple, page->count * sizeof(DirectoryMetaTuple));
+                                if (page->indexPageNext != 0) {
+                                    list->cursor = (shard << 32) | page->indexPageNext;
                                 }
+                                result = true; /* Succeed. */
                             }
-                            result = true; /* Succeed. */
                         }
                     }
                 }
             }
             unlockReadHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
-            Debug::debugItem("Stage end.");
-            return result;              /* Return specific result. */
+        } else if (bitmap != 0) {       /* Forward to node of shard. */
+            ReadDirectorySendBuffer bufferSend;
+            bufferSend.message = MESSAGE_READDIR;
+            strcpy(bufferSend.path, path);
+            bufferSend.cursor = (shard << 32) | indexPage;
+            ReadDirectoryReceiveBuffer *bufferReceive = (ReadDirectoryReceiveBuffer *)malloc(sizeof(ReadDirectoryReceiveBuffer));
+            RdmaCall((uint16_t)hashNode,
+                    (char *)&bufferSend,
+                    (uint64_t)sizeof(ReadDirectorySendBuffer),
+                    (char *)bufferReceive,
+                    (uint64_t)sizeof(ReadDirectoryReceiveBuffer));
+            result = bufferReceive->result;
+            memcpy(list, &(bufferReceive->list), sizeof(nrfsfilelist));
+            free(bufferReceive);
         } else {                        /* If remote node. */
             return false;
         }
+        if ((result == true) && ((uint32_t)list->cursor == 0)) { /* End of shard. */
+            uint64_t next = list->cursor >> 32;
+            if ((bitmap == 1) || ((bitmap != 0) && ((next >= DIRECTORY_SHARD_MAX) || ((bitmap & (~0ULL << next)) == 0)))) {
+                list->cursor = 0;       /* No more shards. */
+            }
+        }
+        Debug::debugItem("Stage end.");
+        return result;                  /* Return specific result. */
+    }
+}
+
+/* Read pages of directory from cursor with attributes of names, as readdirplus. Pages are read
+   until list is full. Attributes of names on this node are got in place, those on other nodes
+   with one batched stat per node, so a client needs no getattr per name.
+   @param   path    Path of folder.
+   @param   cursor  Cursor as in readdir(), 0 for first page.
+   @param   holder  Node ID of client attributes are leased to.
+   @param   list    List buffer of names with attributes.
+   @return          If operation succeeds then return true, otherwise return false. */
+bool FileSystem::readdirplus(const char *path, uint64_t cursor, uint16_t holder, nrfsfilelistplus *list)
+{
+    Debug::debugTitle("FileSystem::readdirplus");
+    Debug::debugItem("Stage 1. Entry point. Path: %s.", path);
+    if ((path == NULL) || (list == NULL) || (strlen(path) + MAX_FILE_NAME_LENGTH + 1 >= MAX_PATH_LENGTH)) {
+        return false;                   /* Null parameter or too long path error. */
+    }
+    nrfsfilelist *page = (nrfsfilelist *)malloc(sizeof(nrfsfilelist));
+    bool result = true;
+    list->count = 0;
+    list->cursor = cursor;
+    do {
+        if (readdir(path, list->cursor, page) == false) { /* Shards are walked by readdir(). */
+            result = false;
+            break;
+        }
+        for (uint64_t i = 0; i < page->count; i++) {
+            memset(&(list->entry[list->count]), 0, sizeof(nrfsfileplus));
+            list->entry[list->count].tuple = page->tuple[i];
+            list->count++;
+        }
+        list->cursor = page->cursor;
+    } while ((list->cursor != 0) && (list->count + MAX_DIRECTORY_COUNT <= MAX_DIRECTORY_PLUS_COUNT));
+    free(page);
+    if ((result == false) || (list->count == 0)) {
+        Debug::debugItem("Stage end.");
+        return result;
+    }
+    Debug::debugItem("Stage 2. Get attributes of %d names.", (int)list->count);
+    std::vector<std::vector<uint16_t> > groups(countNode + 1); /* Names by node of their meta. */
+    char child[MAX_PATH_LENGTH];
+    size_t lengthParent = strlen(path);
+    strcpy(child, path);
+    if ((lengthParent == 0) || (child[lengthParent - 1] != '/')) {
+        child[lengthParent++] = '/';
+    }
+    for (uint16_t i = 0; i < list->count; i++) {
+        strcpy(child + lengthParent, list->entry[i].tuple.names);
+        UniqueHash hashUnique;
+        HashTable::getUniqueHash(child, strlen(child), &hashUnique);
+        NodeHash hashNode = storage->getNodeHash(&hashUnique);
+        if ((hashNode >= 1) && (hashNode <= countNode)) {
+            groups[hashNode].push_back(i);
+        }
+    }
+    BatchSendBuffer *bufferSend = (BatchSendBuffer *)malloc(sizeof(BatchSendBuffer));
+    BatchReceiveBuffer *bufferReceive = (BatchReceiveBuffer *)malloc(sizeof(BatchReceiveBuffer));
+    for (uint16_t node = 1; node <= countNode; node++) {
+        for (size_t start = 0; start < groups[node].size(); start += BATCH_PATH_COUNT) {
+            uint16_t n = (uint16_t)std::min((size_t)BATCH_PATH_COUNT, groups[node].size() - start);
+            bufferSend->message = MESSAGE_STATBATCH;
+            bufferSend->count = n;
+            bufferSend->holder = holder;
+            for (uint16_t j = 0; j < n; j++) {
+                memcpy(bufferSend->path[j], child, lengthParent); /* Parent with trailing slash. */
+                strcpy(bufferSend->path[j] + lengthParent, list->entry[groups[node][start + j]].tuple.names);
+            }
+            memset(bufferReceive->results, 0, sizeof(BatchResult) * BATCH_PATH_COUNT);
+            if (checkLocal(node) == true) {
+                statBatch(bufferSend->path, n, holder, bufferReceive->results);
+            } else {
+                /* Server threads own one message slot each, so nodes are asked one by one. */
+                RdmaCall(node,
+                        (char *)bufferSend,
+                        (uint64_t)((char *)bufferSend->path[n] - (char *)bufferSend), /* Unused paths are not sent. */
+                        (char *)bufferReceive,
+                        (uint64_t)sizeof(BatchReceiveBuffer));
+                if (bufferReceive->result == false) {
+                    memset(bufferReceive->results, 0, sizeof(BatchResult) * BATCH_PATH_COUNT);
+                }
+            }
+            for (uint16_t j = 0; j < n; j++) {
+                nrfsfileplus *entry = &(list->entry[groups[node][start + j]]);
+                BatchResult *attribute = &(bufferReceive->results[j]);
+                entry->valid = attribute->result;
+                entry->size = attribute->size;
+                entry->count = attribute->count;
+                entry->timeLastModified = attribute->timeLastModified;
+                entry->lease = attribute->lease;
+            }
+        }
     }
+    free(bufferSend);
+    free(bufferReceive);
+    Debug::debugItem("Stage end.");
+    return true;
 }
 
 /* Read filenames in directory. 
@@ -1332,50 +2809,36 @@ bool FileSystem::recursivereaddir(const char *path, int depth)
     if (path == NULL) /* Judge if path and list buffer are valid. */
         return false;                   /* Null parameter error. */
     else {
-        UniqueHash hashUnique;
-        HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
-        NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
-        if (checkLocal(hashNode) == true) { /* If local node. */
-            bool result;
-            {
-                uint64_t indexDirectoryMeta;
-                bool isDirectory;
-                if (storage->hashtable->get(&hashUnique, &indexDirectoryMeta, &isDirectory) == false) { /* If path does not exist. */
-                    result = false;     /* Fail due to path does not exist. */
-                } else {
-                    if (isDirectory == false) { /* If file meta. */
-                        result = false; /* Fail due to not directory. */
-                    } else {
-                        DirectoryMeta metaDirectory; /* Copy operation of meta might cause overhead. */
-                        if (storage->tableDirectoryMeta->get(indexDirectoryMeta, &metaDirectory) == false) {
-                            result = false; /* Fail due to get directory meta error. */
-                        } else {
-                            for (uint64_t i = 0; i < metaDirectory.count; i++) {
+        nrfsfilelist *list = (nrfsfilelist *)malloc(sizeof(nrfsfilelist));
+        uint64_t cursor = 0;
+        uint64_t i = 0;
+        bool result = true;
+        do {
+            if (readdir(path, cursor, list) == false) { /* Pages of all shards. */
+                result = false;
+                break;
+            }
+            for (uint32_t j = 0; j < list->count; j++, i++) {
 				for (int nn = 0; nn < depth; nn++)
 					printf("\t");
-                                if (metaDirectory.tuple[i].isDirectories == true) {
-					printf("%d DIR %s\n", (int)i, metaDirectory.tuple[i].names);
+                if (list->tuple[j].isDirectories == true) {
+					printf("%d DIR %s\n", (int)i, list->tuple[j].names);
 					char *childPath = (char *)malloc(sizeof(char) * 
-						(strlen(path) + strlen(metaDirectory.tuple[i].names) + 2));
+						(strlen(path) + strlen(list->tuple[j].names) + 2));
 					strcpy(childPath, path);
 					if (strcmp(childPath, "/") != 0)
 						strcat(childPath, "/");
-					strcat(childPath, metaDirectory.tuple[i].names);
+					strcat(childPath, list->tuple[j].names);
 					recursivereaddir(childPath, depth + 1);
 					free(childPath);
-                                } else {
-					printf("%d FILE %s\n", (int)i, metaDirectory.tuple[i].names);
+                } else {
+					printf("%d FILE %s\n", (int)i, list->tuple[j].names);
 				}
-                            }
-                            result = true; /* Succeed. */
-                        }
-                    }
-                }
             }
-            return result;              /* Return specific result. */
-        } else {                        /* If remote node. */
-            return false;
-        }
+            cursor = list->cursor;
+        } while (cursor != 0);
+        free(list);
+        return result;              /* Return specific result. */
     }
 }
 
@@ -1506,8 +2969,8 @@ bool FileSystem::readDirectoryMeta(const char *path, DirectoryMeta *meta, uint64
    @param   size        Size to operate.
    @param   offset      Offset to operate. 
    @param   fpi         File position information.
-   @param   metaFile    File meta. */
-void FileSystem::fillFilePositionInformation(uint64_t size, uint64_t offset, file_pos_info *fpi, FileMeta *metaFile) {
+   @param   blocks      Block infos from the one holding offset, so only blocks operated are touched. */
+void FileSystem::fillFilePositionInformation(uint64_t size, uint64_t offset, file_pos_info *fpi, BlockInfo *blocks) {
     Debug::debugItem("Stage 8.");
     uint64_t offsetStart, offsetEnd;
     offsetStart = offset;  /* Relative offset of start byte to operate in file. */
@@ -1531,29 +2994,234 @@ void FileSystem::fillFilePositionInformation(uint64_t size, uint64_t offset, fil
     Debug::debugItem("Stage 11. boundStartExtent = %lu, boundEndExtent = %lu", boundStartExtent, boundEndExtent);
     if (boundStartExtent == boundEndExtent) { /* If in one extent. */
         fpi->len = 1;                   /* Assign length. */
-        fpi->tuple[0].node_id = metaFile->BlockList[boundStartExtent].nodeID; /* Assign node ID. */
-        fpi->tuple[0].offset = metaFile->BlockList[boundStartExtent].indexCache * BLOCK_SIZE + offsetInStartExtent; /* Assign offset. */
+        fpi->tuple[0].node_id = blocks[0].nodeID; /* Assign node ID. */
+        fpi->tuple[0].offset = getBlockOffset(&blocks[0]) + offsetInStartExtent; /* Assign offset. */
         fpi->tuple[0].size = size;
     } else {                            /* Multiple extents. */
         Debug::debugItem("Stage 12.");
         fpi->len = boundEndExtent - boundStartExtent + 1; /* Assign length. */
-        fpi->tuple[0].node_id = metaFile->BlockList[boundStartExtent].nodeID; /* Assign node ID of start extent. */
-        fpi->tuple[0].offset = metaFile->BlockList[boundStartExtent].indexCache * BLOCK_SIZE + offsetInStartExtent; /* Assign offset. */
+        fpi->tuple[0].node_id = blocks[0].nodeID; /* Assign node ID of start extent. */
+        fpi->tuple[0].offset = getBlockOffset(&blocks[0]) + offsetInStartExtent; /* Assign offset. */
         fpi->tuple[0].size = sizeInStartExtent; /* Assign size. */
         for (int i = 1; i <= ((int)(fpi->len) - 2); i++) { /* Start from second extent to one before last extent. */
-            fpi->tuple[i].node_id = metaFile->BlockList[boundStartExtent + i].nodeID; /* Assign node ID of start extent. */
-            fpi->tuple[i].offset = metaFile->BlockList[boundStartExtent + i].indexCache * BLOCK_SIZE; /* Assign offset. */
+            fpi->tuple[i].node_id = blocks[i].nodeID; /* Assign node ID of start extent. */
+            fpi->tuple[i].offset = getBlockOffset(&blocks[i]); /* Assign offset. */
             fpi->tuple[i].size = BLOCK_SIZE; /* Assign size. */
         }
-        fpi->tuple[fpi->len - 1].node_id= metaFile->BlockList[boundEndExtent].nodeID; /* Assign node ID of start extent. */
-        fpi->tuple[fpi->len - 1].offset = 0;  /* Assign offset. */
+        fpi->tuple[fpi->len - 1].node_id= blocks[boundEndExtent - boundStartExtent].nodeID; /* Assign node ID of start extent. */
+        fpi->tuple[fpi->len - 1].offset = getBlockOffset(&blocks[boundEndExtent - boundStartExtent]); /* Assign offset. */
         fpi->tuple[fpi->len - 1].size = sizeInEndExtent; /* Assign size. */
         Debug::debugItem("Stage 13.");
     }
 }
 
+/* Check if a block is served in place. Raw memory tier blocks are registered for RDMA, so clients
+   access them directly and they never take an RDMA region block.
+   @param   block       Block info.
+   @return              If block is served in place return true, otherwise return false. */
+bool FileSystem::isBlockInPlace(const BlockInfo *block) {
+    return (block->tier == 0) && (block->codec == CODEC_NONE);
+}
+
+/* Get offset of a block from data region, in memory tier for blocks served in place and in RDMA
+   region otherwise. Memory layout is the same on all nodes, so it is valid for remote blocks.
+   @param   block       Block info, indexMem or indexCache is used.
+   @return              Offset in bytes. */
+uint64_t FileSystem::getBlockOffset(BlockInfo *block) {
+    if (isBlockInPlace(block)) {
+        return server->getMemoryManagerInstance()->getExtraDataOffset() + (uint64_t)block->indexMem * BLOCK_SIZE;
+    }
+    return (uint64_t)block->indexCache * BLOCK_SIZE;
+}
+
+/* Get block info of a file. First blocks are inline in file meta, following ones are in extent
+   pages, so finding a block takes at most one page lookup. Caller holds lock of file.
+   @param   metaFile    File meta.
+   @param   BlockID     ID of block.
+   @param   allocate    Allocate extent page if it does not exist yet, for a new block.
+   @return              Block info in place, NULL if block is beyond max file size or its page is
+                        missing and cannot be allocated. */
+BlockInfo *FileSystem::getBlockInfo(FileMeta *metaFile, uint64_t BlockID, bool allocate) {
+    if (BlockID < FILE_INLINE_BLOCK_COUNT) {
+        return &metaFile->BlockListInline[BlockID];
+    } else if (BlockID >= MAX_FILE_EXTENT_COUNT) {
+        Debug::notifyError("Block %lu is beyond max file size.", (unsigned long)BlockID);
+        return NULL;
+    }
+    uint64_t indexPage = (BlockID - FILE_INLINE_BLOCK_COUNT) / EXTENT_PAGE_BLOCK_COUNT;
+    if (metaFile->indexExtentPage[indexPage] == 0) {
+        uint64_t index;
+        if ((allocate == false) || (storage->tableExtentPage->create(&index) == false)) {
+            return NULL;
+        }
+        metaFile->indexExtentPage[indexPage] = index + 1;
+    }
+    ExtentPage *page;
+    if (storage->tableExtentPage->reference(metaFile->indexExtentPage[indexPage] - 1, &page) == false) {
+        return NULL;
+    }
+    return &page->BlockList[(BlockID - FILE_INLINE_BLOCK_COUNT) % EXTENT_PAGE_BLOCK_COUNT];
+}
+
+/* Get block info of a file for reading. Extent pages are never allocated.
+   @param   metaFile    File meta.
+   @param   BlockID     ID of block, below count of file.
+   @return              Block info in place, NULL if it does not exist. */
+const BlockInfo *FileSystem::getBlockInfo(const FileMeta *metaFile, uint64_t BlockID) {
+    return getBlockInfo(const_cast<FileMeta *>(metaFile), BlockID, false);
+}
+
+/* Release extent pages of file meta, called when file meta is removed.
+   @param   metaFile    File meta. */
+void FileSystem::removeExtentPages(FileMeta *metaFile) {
+    for (int i = 0; i < FILE_EXTENT_PAGE_COUNT; i++) {
+        if (metaFile->indexExtentPage[i] != 0) {
+            storage->tableExtentPage->remove(metaFile->indexExtentPage[i] - 1);
+            metaFile->indexExtentPage[i] = 0;
+        }
+    }
+}
+
+/* Give a renamed file blocks of its old meta, before rename removes old meta. Block lists sent by
+   client are not used. Within a node new meta takes over extent pages, otherwise they are copied.
+   Caller holds lock of old path.
+   @param   pathNew             New path, its meta is already made without blocks.
+   @param   metaFile            Old file meta.
+   @param   hashAddressLocked   Address hash of old path.
+   @return                      If all blocks are given return true, otherwise return false. */
+bool FileSystem::moveBlockLists(const char *pathNew, const FileMeta *metaFile, AddressHash hashAddressLocked) {
+    UniqueHash hashUnique;
+    HashTable::getUniqueHash(pathNew, strlen(pathNew), &hashUnique);
+    NodeHash hashNode = storage->getNodeHash(&hashUnique);
+    AddressHash hashAddress = HashTable::getAddressHash(&hashUnique);
+    if (checkLocal(hashNode) == true) {
+        bool locked = (hashAddress == hashAddressLocked); /* Both paths share hash item, it is locked already. */
+        uint64_t key = locked ? 0 : lockWriteHashItem(hashNode, hashAddress);
+        bool result = setBlockListLocked(&hashUnique, metaFile, true);
+        if (locked == false) {
+            unlockWriteHashItem(key, hashNode, hashAddress);
+        }
+        return result;
+    }
+    for (int i = 0; i < FILE_EXTENT_PAGE_COUNT; i++) {
+        const ExtentPage *page;
+        if (metaFile->indexExtentPage[i] == 0) {
+            continue;
+        }
+        if ((storage->tableExtentPage->view(metaFile->indexExtentPage[i] - 1, &page) == false) ||
+            (setExtentPage(pathNew, i, page) == false)) {
+            Debug::notifyError("Copy extent page %d of file to %s failed.", i, pathNew);
+            return false;
+        }
+    }
+    return setBlockList(pathNew, metaFile);
+}
+
+/* Give a file inline blocks, size and count of its old meta, and its extent pages if set.
+   Caller holds lock of path.
+   @param   hashUnique  Key of path.
+   @param   metaFile    Old file meta.
+   @param   pages       Take over extent pages of old meta, which is on this node.
+   @return              If succeed return true, otherwise return false. */
+bool FileSystem::setBlockListLocked(UniqueHash *hashUnique, const FileMeta *metaFile, bool pages) {
+    uint64_t indexFileMeta;
+    bool isDirectory;
+    FileMeta *metaNew;
+    if ((storage->hashtable->get(hashUnique, &indexFileMeta, &isDirectory) == false) || (isDirectory == true) ||
+        (storage->tableFileMeta->reference(indexFileMeta, &metaNew) == false)) {
+        return false;                   /* Fail due to file removed meanwhile. */
+    }
+    metaNew->size = metaFile->size;
+    metaNew->count = metaFile->count;
+    memcpy(metaNew->BlockListInline, metaFile->BlockListInline, sizeof(metaNew->BlockListInline));
+    if (pages == true) {
+        memcpy(metaNew->indexExtentPage, metaFile->indexExtentPage, sizeof(metaNew->indexExtentPage));
+    }
+    return true;
+}
+
+/* Give a file inline blocks, size and count of its old meta, when it is renamed from another node.
+   @param   path        Path of file.
+   @param   metaFile    Old file meta.
+   @return              If succeed return true, otherwise return false. */
+bool FileSystem::setBlockList(const char *path, const FileMeta *metaFile) {
+    UniqueHash hashUnique;
+    HashTable::getUniqueHash(path, strlen(path), &hashUnique);
+    NodeHash hashNode = storage->getNodeHash(&hashUnique);
+    AddressHash hashAddress = HashTable::getAddressHash(&hashUnique);
+    if (checkLocal(hashNode) == true) {
+        uint64_t key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
+        bool result = setBlockListLocked(&hashUnique, metaFile, false);
+        unlockWriteHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
+        return result;
+    } else {
+        BlockListSendBuffer bufferSend;
+        bufferSend.message = MESSAGE_SETBLOCKLIST;
+        strcpy(bufferSend.path, path);
+        bufferSend.metaFile = *metaFile;
+        GeneralReceiveBuffer bufferReceive;
+        RdmaCall((uint16_t)hashNode,
+                (char *)&bufferSend,
+                (uint64_t)sizeof(BlockListSendBuffer),
+                (char *)&bufferReceive,
+                (uint64_t)sizeof(GeneralReceiveBuffer));
+        return bufferReceive.result;
+    }
+}
+
+/* Give a file a copy of an extent page, when it is renamed from another node.
+   @param   path        Path of file.
+   @param   indexPage   Index of page in file meta, not allocated yet.
+   @param   page        Block infos of page.
+   @return              If succeed return true, otherwise return false. */
+bool FileSystem::setExtentPage(const char *path, uint16_t indexPage, const ExtentPage *page) {
+    UniqueHash hashUnique;
+    HashTable::getUniqueHash(path, strlen(path), &hashUnique);
+    NodeHash hashNode = storage->getNodeHash(&hashUnique);
+    AddressHash hashAddress = HashTable::getAddressHash(&hashUnique);
+    if (checkLocal(hashNode) == true) {
+        if (indexPage >= FILE_EXTENT_PAGE_COUNT) {
+            return false;
+        }
+        bool result = false;
+        uint64_t key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
+        uint64_t indexFileMeta;
+        bool isDirectory;
+        FileMeta *metaFile;
+        uint64_t index;
+        if ((storage->hashtable->get(&hashUnique, &indexFileMeta, &isDirectory) == false) || (isDirectory == true) ||
+            (storage->tableFileMeta->reference(indexFileMeta, &metaFile) == false)) {
+            result = false;             /* Fail due to file removed meanwhile. */
+        } else if (metaFile->indexExtentPage[indexPage] != 0) {
+            result = false;             /* Page is set already, it is not taken from old node. */
+        } else if (storage->tableExtentPage->create(&index, const_cast<ExtentPage *>(page)) == false) {
+            Debug::notifyError("No extent page is left for %s.", path);
+            result = false;
+        } else {
+            metaFile->indexExtentPage[indexPage] = index + 1;
+            result = true;
+        }
+        unlockWriteHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
+        return result;
+    } else {
+        ExtentPageSendBuffer *bufferSend = new ExtentPageSendBuffer; /* Too large for stack of worker. */
+        bufferSend->message = MESSAGE_SETEXTENTPAGE;
+        strcpy(bufferSend->path, path);
+        bufferSend->indexPage = indexPage;
+        bufferSend->page = *page;
+        GeneralReceiveBuffer bufferReceive;
+        RdmaCall((uint16_t)hashNode,
+                (char *)bufferSend,
+                (uint64_t)sizeof(ExtentPageSendBuffer),
+                (char *)&bufferReceive,
+                (uint64_t)sizeof(GeneralReceiveBuffer));
+        delete bufferSend;
+        return bufferReceive.result;
+    }
+}
+
 /*Fill RDMA Region for remote read/write request*/
-bool FileSystem::fillRDMARegionV2(uint64_t uniqueHashValue, uint64_t BlockID, uint16_t tier, uint64_t StorageAddress, bool writeOperation) {
+bool FileSystem::fillRDMARegionV2(uint64_t uniqueHashValue, uint64_t BlockID, uint16_t tier, uint16_t codec, uint64_t StorageAddress, bool writeOperation) {
     bool ret = false;
     Debug::debugItem("Move data to RDMA region for remote read");
     uint64_t RdmaZoneBaseAddress = server->getMemoryManagerInstance()->getDataAddress();
@@ -1561,11 +3229,12 @@ bool FileSystem::fillRDMARegionV2(uint64_t uniqueHashValue, uint64_t BlockID, ui
     /*Init a new block*/
     BlockInfo *newBlock = (BlockInfo *)malloc(sizeof(BlockInfo));
 
-    if (storage->BlockManager->exists(uniqueHashValue)) {
-	*newBlock = storage->BlockManager->get(uniqueHashValue);
+    if (storage->BlockManager->find(uniqueHashValue, newBlock)) {
 	return true;
     } else {
+	newBlock->key = uniqueHashValue;
 	newBlock->tier = tier;
+	newBlock->codec = codec;
         newBlock->isDirty = writeOperation;
         newBlock->present = true;
         newBlock->StorageAddress = StorageAddress;
@@ -1573,7 +3242,7 @@ bool FileSystem::fillRDMARegionV2(uint64_t uniqueHashValue, uint64_t BlockID, ui
 	LRUInsert(uniqueHashValue, newBlock);
     }
 
-    if (storage->tableBlock->create(&indexCurrentExtraBlock) == false) { /*Allocate a new block in RDMA region*/
+    if (createCacheBlock(&indexCurrentExtraBlock) == false) { /*Allocate a new block in RDMA region*/
         Debug::notifyError("Create block in RDMA region failed!");
         return false;
     } else {
@@ -1583,20 +3252,10 @@ bool FileSystem::fillRDMARegionV2(uint64_t uniqueHashValue, uint64_t BlockID, ui
         newBlock->indexCache = indexCurrentExtraBlock;
         LRUInsert(uniqueHashValue, newBlock);
 
-	if (tier == 0) {
-	    void *src = (void *)StorageAddress;
-	    void *dest  = (void *)(RdmaZoneBaseAddress + indexCurrentExtraBlock * BLOCK_SIZE);
-	    memcpy(dest, src, BLOCK_SIZE);
-            Debug::debugItem("Copy data from Memory tier, src = %ld, dest = %ld", (long)StorageAddress, (long)(RdmaZoneBaseAddress + indexCurrentExtraBlock * BLOCK_SIZE));
-	    ret = true;
-	} else {
-	    Debug::debugItem("Copy data from SSD tier");
-	    const char *key = ltos((long)uniqueHashValue).data();
-            void *value  = (void *) (RdmaZoneBaseAddress + indexCurrentExtraBlock * BLOCK_SIZE);
-	    storage->db.get((const char *)key, sizeof(key), (char *)value, BLOCK_SIZE);
-            Debug::debugItem("Copy data from the SSD tier Done");
-	    ret = true;
-	}
+	Debug::debugItem("Copy data from tier %d", (int)tier);
+	void *dest  = (void *)(RdmaZoneBaseAddress + indexCurrentExtraBlock * BLOCK_SIZE);
+	loadBlock(uniqueHashValue, newBlock, (char *)dest);
+	ret = true;
     }
     return ret;
 }
@@ -1611,8 +3270,10 @@ bool FileSystem::fillRDMARegion(uint64_t uniqueHashValue, uint64_t BlockID, Bloc
     uint64_t indexCurrentExtraBlock;
     /*Init a new block*/
     BlockInfo *newBlock = (BlockInfo *)malloc(sizeof(BlockInfo));
+    newBlock->key = block->key;
     newBlock->BlockID = block->BlockID;
     newBlock->tier = block->tier;
+    newBlock->codec = block->codec;
     newBlock->isDirty = writeOperation;
     newBlock->present = true;
     newBlock->StorageAddress = block->StorageAddress;
@@ -1621,7 +3282,7 @@ bool FileSystem::fillRDMARegion(uint64_t uniqueHashValue, uint64_t BlockID, Bloc
     //if(!BlockManager->exists(uniqueHashValue)) {
     //    LRUInsert(uniqueHashValue, newBlock);
     //}
-    if (storage->tableBlock->create(&indexCurrentExtraBlock) == false) { /*Allocate a new block in RDMA region*/
+    if (createCacheBlock(&indexCurrentExtraBlock) == false) { /*Allocate a new block in RDMA region*/
         Debug::debugItem("Create block in RDMA region failed!");
 	Debug::notifyError("Create block in RDMA region failed!");
         return false;
@@ -1631,30 +3292,340 @@ bool FileSystem::fillRDMARegion(uint64_t uniqueHashValue, uint64_t BlockID, Bloc
 	newBlock->indexCache = indexCurrentExtraBlock;
 
 	/*Copy data*/
-	if(newBlock->tier == 0) {
-	    void *src = (void *)(block->StorageAddress);
-            void *dest  = (void *)(RdmaZoneBaseAddress + indexCurrentExtraBlock * BLOCK_SIZE);
-            Debug::debugItem("src = %ld, dest = %ld", (long)block->StorageAddress, (long)(RdmaZoneBaseAddress + indexCurrentExtraBlock * BLOCK_SIZE));
-            memcpy(dest, src, BLOCK_SIZE);
-            Debug::debugItem("Copy data from Memory tier, src = %ld", (long)block->StorageAddress);
-	} else {
-           Debug::debugItem("Copy data from SSD tier");
-	   const char *key = ltos((long)uniqueHashValue).data();
-           void *value  = (void *) (RdmaZoneBaseAddress + indexCurrentExtraBlock * BLOCK_SIZE);
-           storage->db.get((const char *)key, sizeof(key), (char *)value, BLOCK_SIZE);
-           Debug::debugItem("Copy data from the SSD tier Done");
-        }
+	Debug::debugItem("Copy data from tier %d", (int)newBlock->tier);
+	void *dest  = (void *)(RdmaZoneBaseAddress + indexCurrentExtraBlock * BLOCK_SIZE);
+	loadBlock(uniqueHashValue, newBlock, (char *)dest);
         /*update BlcokManager*/
         LRUInsert(uniqueHashValue, newBlock);
     }
     return true;
 }
 
-
-/* Read extent end. Only unlock path due to lock in extentRead.
-   @param   Key         key obtained from read lock.
-   @param   path        Path of file or folder.*/
-bool FileSystem::extentReadEnd(uint64_t key, char* path)
+/* Copy local SSD tier blocks of a read to the RDMA region in one batch. All reads are submitted
+   before waiting, so they overlap on the device. Blocks that fail here are left to fillRDMARegion.
+   @param   path        Path of file.
+   @param   metaFile    File meta.
+   @param   start       First block to read.
+   @param   end         Block after the last one. */
+void FileSystem::fillRDMARegionBatch(const char *path, const FileMeta *metaFile, uint64_t start, uint64_t end) {
+    uint64_t RdmaZoneBaseAddress = server->getMemoryManagerInstance()->getDataAddress();
+    std::vector<uint64_t> hashes, indexes;
+    std::vector<const BlockInfo *> blocks;
+    for (uint64_t i = start; (i < end) && (i < metaFile->count); i++) {
+        const BlockInfo *block = getBlockInfo(metaFile, i);
+        if ((block->nodeID != (uint16_t)hashLocalNode) || (block->tier == 0)) {
+            continue;
+        }
+        uint64_t uniqueHashValue = block->key;
+        if (storage->BlockManager->exists(uniqueHashValue) || (PrefetchManager->find(uniqueHashValue) != PrefetchManager->end())) {
+            continue;
+        }
+        uint64_t indexCache;
+        if (storage->tableBlock->create(&indexCache) == false) {
+            break;                      /* Rest goes through fillRDMARegion, which evicts. */
+        }
+        hashes.push_back(uniqueHashValue);
+        indexes.push_back(indexCache);
+        blocks.push_back(block);
+    }
+    if (hashes.empty()) {
+        return;
+    }
+    std::mutex mutexBatch;
+    std::condition_variable condBatch;
+    uint64_t countDone = 0;
+    std::vector<int64_t> results(hashes.size());
+    std::vector<char *> buffers(hashes.size(), NULL); /* Compressed blocks are read here and decoded after the batch. */
+    for (uint64_t k = 0; k < hashes.size(); k++) {
+        char *value = (char *)(RdmaZoneBaseAddress + indexes[k] * BLOCK_SIZE);
+        if (blocks[k]->codec != CODEC_NONE) {
+            buffers[k] = (char *)malloc(BLOCK_SIZE);
+            value = buffers[k];
+        }
+        BlockStore *store = (blocks[k]->tier == 1) ? storage->tierSSD : storage->tierSpill;
+        store->getAsync(hashes[k], value, BLOCK_SIZE, [&, k](int64_t result) {
+            std::lock_guard<std::mutex> lockBatch(mutexBatch);
+            results[k] = result;
+            countDone++;
+            condBatch.notify_one();
+        });
+    }
+    storage->tierSSD->flush();
+    storage->tierSpill->flush();
+    {
+        std::unique_lock<std::mutex> lockBatch(mutexBatch);
+        while (countDone < hashes.size()) {
+            condBatch.wait(lockBatch);
+        }
+    }
+    for (uint64_t k = 0; k < hashes.size(); k++) {
+        if ((buffers[k] != NULL) && (results[k] >= 0) &&
+            !decodeBlock(blocks[k]->codec, buffers[k], results[k], (char *)(RdmaZoneBaseAddress + indexes[k] * BLOCK_SIZE))) {
+            results[k] = -1;
+        }
+        free(buffers[k]);
+        if (results[k] < 0) {
+            storage->tableBlock->remove(indexes[k]);
+            continue;
+        }
+        BlockInfo newBlock = *blocks[k];
+        newBlock.isDirty = false;
+        newBlock.present = true;
+        newBlock.indexCache = indexes[k];
+        LRUInsert(hashes[k], &newBlock);
+    }
+    Debug::debugItem("Fill RDMA region with %d SSD tier blocks in one batch", (int)hashes.size());
+}
+
+/* Compress a block for a storage tier.
+   @param   codec   Codec, see BlockCodec.
+   @param   src     Raw block of BLOCK_SIZE bytes.
+   @param   buffer  Buffer of BLOCK_SIZE bytes for compressed data.
+   @return          Length of compressed data in buffer. BLOCK_SIZE if block does not shrink, then src is stored as it is. */
+uint64_t FileSystem::encodeBlock(uint16_t codec, const char *src, char *buffer) {
+    uint64_t length = Codec::compress(codec, src, BLOCK_SIZE, buffer, BLOCK_SIZE - 1);
+    return (length == 0) ? BLOCK_SIZE : length;
+}
+
+/* Restore a block read from a storage tier.
+   @param   codec   Codec, see BlockCodec.
+   @param   src     Stored data.
+   @param   length  Length of stored data, BLOCK_SIZE means raw.
+   @param   dest    Buffer of BLOCK_SIZE bytes.
+   @return          If succeed return true, otherwise return false. */
+bool FileSystem::decodeBlock(uint16_t codec, const char *src, uint64_t length, char *dest) {
+    if (length == BLOCK_SIZE) {
+        memcpy(dest, src, BLOCK_SIZE);
+        return true;
+    }
+    if (Codec::decompress(codec, src, length, dest, BLOCK_SIZE) == false) {
+        Debug::notifyError("Decompress block with codec %s failed.", Codec::name(codec));
+        return false;
+    }
+    return true;
+}
+
+/* Get block stores a keyed block may live in, in lookup order. Blocks not fitting in a store go
+   to the next one: compressed memory tier blocks to SSD tier, SSD tier blocks to spill tier.
+   @param   block   Block info, raw memory tier blocks are not keyed and have no store.
+   @param   stores  Buffer of at least 3 stores.
+   @return          Count of stores. */
+int FileSystem::getBlockStores(BlockInfo *block, BlockStore **stores) {
+    int count = 0;
+    if ((block->tier == 0) && (block->codec != CODEC_NONE)) {
+        stores[count++] = storage->tierMemory;
+    }
+    if (block->tier <= 1) {
+        stores[count++] = storage->tierSSD;
+    }
+    stores[count++] = storage->tierSpill;
+    return count;
+}
+
+/* Write a raw block to its storage tier, compressing it by codec. A keyed block goes to the first
+   store with room and stale copies in the others are removed.
+   @param   uniqueHashValue Key of block.
+   @param   block           Block info, tier, codec and StorageAddress are used.
+   @param   src             Raw block of BLOCK_SIZE bytes.
+   @return                  If succeed return true, otherwise return false. */
+bool FileSystem::storeBlock(uint64_t uniqueHashValue, BlockInfo *block, const char *src) {
+    if ((block->tier == 0) && (block->codec == CODEC_NONE)) {
+        memcpy((void *)block->StorageAddress, src, BLOCK_SIZE);
+        return true;
+    }
+    char *buffer = NULL;
+    uint64_t length = BLOCK_SIZE;
+    if (block->codec != CODEC_NONE) {
+        buffer = (char *)malloc(BLOCK_SIZE);
+        length = encodeBlock(block->codec, src, buffer);
+    }
+    const char *data = (length < BLOCK_SIZE) ? buffer : src;
+    BlockStore *stores[3];
+    int count = getBlockStores(block, stores);
+    int used = -1;
+    for (int i = 0; (i < count) && (used < 0); i++) {
+        if ((i < count - 1) && stores[i]->full()) {
+            continue;
+        }
+        if (stores[i]->set(uniqueHashValue, data, length)) {
+            used = i;
+        }
+    }
+    for (int i = 0; (i < count) && (used >= 0); i++) {
+        if (i != used) {
+            stores[i]->remove(uniqueHashValue);
+        }
+    }
+    if (used > 0) {
+        Debug::debugItem("Block %d of tier %d is spilled to next store", (int)block->BlockID, (int)block->tier);
+    }
+    free(buffer);
+    return (used >= 0);
+}
+
+/* Read a block from its storage tier into a raw buffer.
+   @param   uniqueHashValue Key of block.
+   @param   block           Block info, tier, codec and StorageAddress are used.
+   @param   dest            Buffer of BLOCK_SIZE bytes.
+   @return                  If succeed return true, otherwise return false. */
+bool FileSystem::loadBlock(uint64_t uniqueHashValue, BlockInfo *block, char *dest) {
+    if ((block->tier == 0) && (block->codec == CODEC_NONE)) {
+        memcpy(dest, (void *)block->StorageAddress, BLOCK_SIZE);
+        return true;
+    }
+    char *buffer = (block->codec == CODEC_NONE) ? dest : (char *)malloc(BLOCK_SIZE);
+    BlockStore *stores[3];
+    int count = getBlockStores(block, stores);
+    int64_t length = -1;
+    for (int i = 0; (i < count) && (length < 0); i++) {
+        length = stores[i]->get(uniqueHashValue, buffer, BLOCK_SIZE);
+    }
+    bool result = (length >= 0);
+    if (buffer != dest) {
+        result = result && decodeBlock(block->codec, buffer, length, dest);
+        free(buffer);
+    }
+    return result;
+}
+
+/* Release storage of a local block.
+   @param   uniqueHashValue Key of block.
+   @param   block           Block info in file meta. */
+void FileSystem::removeStoredBlock(uint64_t uniqueHashValue, BlockInfo *block) {
+    if ((block->tier == 0) && (block->codec == CODEC_NONE)) { /*Remove blocks in Memory tier*/
+        retireMemBlock(block->indexMem);
+        return;
+    }
+    BlockStore *stores[3];
+    int count = getBlockStores(block, stores);
+    for (int i = 0; i < count; i++) {
+        stores[i]->remove(uniqueHashValue);
+    }
+}
+
+/* Write a dirty evicted block back asynchronously. The RDMA block holding it is released when the
+   write completes. A failed SSD tier write is retried in spill tier by the write back thread, not in
+   the completion callback which runs on the I/O thread.
+   @param   uniqueHashValue Key of block.
+   @param   tier            Tier of block, 1 or TIER_SPILL.
+   @param   data            Data to write, the RDMA block or buffer.
+   @param   length          Length of data.
+   @param   buffer          Compressed data buffer to free, NULL if data is the RDMA block.
+   @param   indexCache      RDMA block. */
+void FileSystem::writeBackBlock(uint64_t uniqueHashValue, uint16_t tier, const char *data, uint64_t length, char *buffer, uint64_t indexCache) {
+    if ((tier == 1) && storage->tierSSD->full()) {
+        tier = TIER_SPILL;
+    }
+    BlockStore *store = (tier == 1) ? storage->tierSSD : storage->tierSpill;
+    store->setAsync(uniqueHashValue, data, length, [this, uniqueHashValue, tier, data, length, buffer, indexCache](int64_t result) {
+        if ((result < 0) && (tier == 1)) {
+            Debug::notifyInfo("Write back block %lx to SSD tier failed, spill it", (unsigned long)uniqueHashValue);
+            WriteBackTask *task = new WriteBackTask;
+            task->uniqueHashValue = uniqueHashValue;
+            task->data = data;
+            task->length = length;
+            task->buffer = buffer;
+            task->indexCache = indexCache;
+            WriteBack_queue.push(task);
+            return;
+        }
+        if (result < 0) {
+            Debug::notifyError("Write back block %lx failed", (unsigned long)uniqueHashValue);
+        } else if (tier == 1) {
+            storage->tierSpill->remove(uniqueHashValue);
+        } else {
+            storage->tierSSD->remove(uniqueHashValue);
+        }
+        free(buffer);
+        storage->tableBlock->remove(indexCache);
+    });
+    store->flush();
+}
+
+/* Write dirty RDMA blocks back to their tiers and wait for write backs in flight, so a restart
+   reattaching memory finds all data in tiers. RDMA region itself is not kept. Requests should be
+   stopped before. */
+void FileSystem::flushCache() {
+    uint64_t RdmaZoneBaseAddress = server->getMemoryManagerInstance()->getDataAddress();
+    uint64_t countDirty = 0;
+    storage->BlockManager->for_each([&](uint64_t uniqueHashValue, BlockInfo &block) {
+        if (!block.isDirty) {
+            return;
+        }
+        if (storeBlock(block.StorageAddress, &block, (char *)(RdmaZoneBaseAddress + (uint64_t)block.indexCache * BLOCK_SIZE))) {
+            block.isDirty = false;
+            countDirty++;
+        } else {
+            Debug::notifyError("Write back block %lx failed", (unsigned long)uniqueHashValue);
+        }
+    });
+    for (int i = 0; i < CACHE_ALLOCATE_RETRY; i++) {
+        if (storage->tableBlock->countSavedItems() <= storage->BlockManager->size()) {
+            break;                      /* Write backs in flight hold RDMA blocks not in BlockManager. */
+        }
+        storage->tierSSD->flush();
+        storage->tierSpill->flush();
+        usleep(1000);
+    }
+    {
+        std::lock_guard<std::mutex> lockRetired(mutexRetired); /* No client access is left, free them now. */
+        for (auto &retired : retiredMem) {
+            storage->extraTableBlock->remove(retired.second);
+        }
+        retiredMem.clear();
+    }
+    Debug::notifyInfo("Flush RDMA region: %lu dirty blocks written back", (unsigned long)countDirty);
+}
+
+/* Allocate a block in RDMA region. Blocks being written back hold their RDMA block until the write
+   completes. When region is full, queued write backs are submitted and allocation is tried once more
+   without waiting, so an RPC worker never sleeps here and the request fails instead.
+   @param   index   Buffer of index of RDMA block.
+   @return          If succeed return true, otherwise return false. */
+bool FileSystem::createCacheBlock(uint64_t *index) {
+    if (storage->tableBlock->create(index)) {
+        return true;
+    }
+    storage->tierSSD->flush();
+    storage->tierSpill->flush();
+    return storage->tableBlock->create(index);
+}
+
+/* Allocate a block in memory tier. Retired blocks whose delay is over are returned to the table
+   first, so they can be reused.
+   @param   index   Buffer of index of memory tier block.
+   @return          If succeed return true, otherwise return false. */
+bool FileSystem::createMemBlock(uint64_t *index) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t timeNow = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    {
+        std::lock_guard<std::mutex> lockRetired(mutexRetired);
+        while (!retiredMem.empty() && (retiredMem.front().first + MEM_REUSE_DELAY <= timeNow)) {
+            storage->extraTableBlock->remove(retiredMem.front().second);
+            retiredMem.pop_front();
+        }
+    }
+    return storage->extraTableBlock->create(index);
+}
+
+/* Free a memory tier block that was served in place. Clients access such blocks by RDMA after the
+   extent request has returned and the hash item is unlocked, so a client might still use the old
+   offset of a moved or removed block. The block is retired for MEM_REUSE_DELAY before it is reused,
+   otherwise such an access would hit another block.
+   @param   index   Index of memory tier block. */
+void FileSystem::retireMemBlock(uint64_t index) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t timeNow = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    std::lock_guard<std::mutex> lockRetired(mutexRetired);
+    retiredMem.push_back(std::make_pair(timeNow, index));
+}
+
+/* Read extent end. Only unlock path due to lock in extentRead.
+   @param   Key         key obtained from read lock.
+   @param   path        Path of file or folder.*/
+bool FileSystem::extentReadEnd(uint64_t key, char* path)
 {
     Debug::debugTitle("FileSystem::extentReadEnd");
 
@@ -1713,6 +3684,10 @@ bool FileSystem::updateMeta(const char *path, FileMeta *metaFile, uint64_t key)
                         result = false;
                     } else {
                     	metaFile->timeLastModified = time(NULL); /* Set last modified time. */
+                        const FileMeta *metaOld;
+                        if (storage->tableFileMeta->view(indexFileMeta, &metaOld) == true) {
+                            metaFile->generation = metaOld->generation + 1; /* Generation sent by client may be stale. */
+                        }
                         if (storage->tableFileMeta->put(indexFileMeta, metaFile) == false) {
                             result = false; /* Fail due to put file meta error. */
                         } else {
@@ -1798,7 +3773,7 @@ bool FileSystem::truncate(const char *path, uint64_t size) /* Truncate size of f
                                     // }
                                     for (int j = metaFile.count; //metaFile.tuple[i].countExtentBlock - 1; 
                                         j >= (int)(countNewTotalBlock - countTotalBlockTillLastExtentEnd - 1 + 1); j--) { /* i is current extent. */ /* Bound of first block to truncate. A -1 is to convert count to bound. A +1 is to move bound of last kept block to bound of first to truncate. */
-                                        if (storage->tableBlock->remove(metaFile.BlockList[i].indexMem) == false) {
+                                        if (storage->tableBlock->remove(getBlockInfo(&metaFile, i, false)->indexMem) == false) {
                                             resultFor = false;
                                             break;
                                         }
@@ -1817,7 +3792,7 @@ bool FileSystem::truncate(const char *path, uint64_t size) /* Truncate size of f
                                         // }
                                         for (uint64_t j = i + 1; j < metaFile.count; j++) { /* Remove rest extents. */
                                             for (int k = metaFile.count - 1; k >= 0; k--) {
-                                                if (storage->tableBlock->remove(metaFile.BlockList[j].indexMem) == false) {
+                                                if (storage->tableBlock->remove(getBlockInfo(&metaFile, j, false)->indexMem) == false) {
                                                     resultFor = false;
                                                     break;
                                                 }
@@ -1827,6 +3802,7 @@ bool FileSystem::truncate(const char *path, uint64_t size) /* Truncate size of f
                                             result = false; /* Fail due to block remove error. */
                                         } else {
                                             metaFile.size = size; /* Size is the acutal size. */
+                                            metaFile.generation++;
                                             metaFile.count = i + 1; /* i is the last extent containing last block. */
                                             if (storage->tableFileMeta->put(indexFileMeta, &metaFile) == false) { /* Update meta. */
                                                 result = false; /* Fail due to update file meta error. */
@@ -1865,6 +3841,7 @@ bool FileSystem::rmdir(const char *path)
         NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
         AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
         uint64_t RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset;
+        uint16_t shard;                 /* Shard of parent holding name. */
         if (checkLocal(hashNode) == true) { /* If local node. */
             bool result;
             uint64_t key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
@@ -1878,30 +3855,30 @@ bool FileSystem::rmdir(const char *path)
                     if (isDirectory == false) { /* If not directory meta. */
                         result = false;
                     } else {
-                        Debug::debugItem("Stage 3. Remove meta from directory.");
                         char *parent = (char *)malloc(strlen(path) + 1);
                         char *name = (char *)malloc(strlen(path) + 1);
                         getNameFromPath(path, name);
                         getParentDirectory(path, parent);
-                        if (removeMetaFromDirectory(parent, name, &RemoteTxID, &srcBuffer, &desBuffer, &size, &remotekey, &offset) == false) {
-                            result = false;
+                        DirectoryMeta metaDirectory;
+                        if (storage->tableDirectoryMeta->get(indexDirectoryMeta, &metaDirectory) == false) {
+                            result = false; /* Fail due to get file meta error. */
+                        } else if ((metaDirectory.count != 0) || (removeDirectoryShards(path, indexDirectoryMeta) == false)) { /* Directory is not empty. */
+                            result = false; /* Fail due to directory is not empty, before parent is locked. */
                         } else {
-                            DirectoryMeta metaDirectory;
-                            if (storage->tableDirectoryMeta->get(indexDirectoryMeta, &metaDirectory) == false) {
-                                result = false; /* Fail due to get file meta error. */
+                            Debug::debugItem("Stage 3. Remove meta from directory.");
+                            if (removeMetaFromDirectory(parent, name, &shard, &RemoteTxID, &srcBuffer, &desBuffer, &size, &remotekey, &offset) == false) {
+                                result = false;
                             } else {
-                                if (metaDirectory.count != 0) { /* Directory is not empty. */
-                                    result = false; /* Fail due to directory is not empty. */
+                                /* Name is already out of parent page, commit it and unlock parent. */
+                                updateDirectoryMeta(parent, shard, RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset);
+                                Debug::debugItem("Stage 4. Remove directory meta.");
+                                if (storage->tableDirectoryMeta->remove(indexDirectoryMeta) == false) {
+                                    result = false; /* Fail due to remove error. */
                                 } else {
-                                    Debug::debugItem("Stage 3. Remove directory meta.");
-                                    if (storage->tableDirectoryMeta->remove(indexDirectoryMeta) == false) {
-                                        result = false; /* Fail due to remove error. */
+                                    if (storage->hashtable->del(&hashUnique) == false) {
+                                        result = false; /* Fail due to hash table del. No roll back. */
                                     } else {
-                                        if (storage->hashtable->del(&hashUnique) == false) {
-                                            result = false; /* Fail due to hash table del. No roll back. */
-                                        } else {
-                                            result = true;
-                                        }
+                                        result = true;
                                     }
                                 }
                             }
@@ -1947,6 +3924,8 @@ bool FileSystem::removecd(const char *path, FileMeta *metaFile)
         AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
         // uint64_t DistributedTxID;
         uint64_t LocalTxID = 0;
+        uint64_t RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset;
+        uint16_t shard;                 /* Shard of parent holding name. */
         if (checkLocal(hashNode) == true) { /* If local node. */
             bool result;
             uint64_t key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
@@ -1959,9 +3938,6 @@ bool FileSystem::removecd(const char *path, FileMeta *metaFile)
 		    Debug::debugItem("indexMeta is %ld, isDirectory: %d", (long)indexMeta, (int)isDirectory);
                     char *parent = (char *)malloc(strlen(path) + 1);
                     char *name = (char *)malloc(strlen(path) + 1);
-                    DirectoryMeta parentMeta;
-	                uint64_t parentHashAddress, parentMetaAddress;
-	                uint16_t parentNodeID;
                     getParentDirectory(path, parent);
                     getNameFromPath(path, name);
                     Debug::debugItem("Stage 2. Get meta.");
@@ -1973,34 +3949,19 @@ bool FileSystem::removecd(const char *path, FileMeta *metaFile)
                             result = false; /* Fail due to get file meta error. */
                         } else {
                             metaFile->count = MAX_FILE_EXTENT_COUNT;
-                            if (metaDirectory.count != 0) { /* Directory is not empty. */
+                            if ((metaDirectory.count != 0) || (removeDirectoryShards(path, indexMeta) == false)) { /* Directory is not empty. */
                                 result = false; /* Fail due to directory is not empty. */
                             } else {
                                 // DistributedTxID = TxDistributedBegin();
                                 LocalTxID = TxLocalBegin();
-                            	if (readDirectoryMeta(parent, &parentMeta, &parentHashAddress, &parentMetaAddress, &parentNodeID) == false) {
+                            	if (removeMetaFromDirectory(parent, name, &shard, &RemoteTxID, &srcBuffer, &desBuffer, &size, &remotekey, &offset) == false) {
                             		Debug::notifyError("Remove Meta From Directory failed.");
-                                    // TxDistributedPrepare(DistributedTxID, false);
                             		result = false;
                             	} else {
-                            		/* Remove meta from directory */
-                            		DirectoryMeta metaModifiedDirectory; /* Buffer to save modified directory. */
-			                        uint64_t indexModifiedNames = 0;
-			                        for (uint64_t i = 0; i < parentMeta.count; i++) {
-			                            if (strcmp(parentMeta.tuple[i].names, name) == 0) { /* If found selected name. */
-			                            } else {
-			                                strcpy(metaModifiedDirectory.tuple[indexModifiedNames].names, parentMeta.tuple[i].names); /* Copy original name to modified meta. */
-			                                metaModifiedDirectory.tuple[indexModifiedNames].isDirectories = parentMeta.tuple[i].isDirectories; /* Add directory state. */
-			                                indexModifiedNames++;
-			                            }
-			                        }
-			                        metaModifiedDirectory.count = indexModifiedNames;
                                     /* Apply updated data to local log. */
-                                    TxWriteData(LocalTxID, (uint64_t)&parentMeta, (uint64_t)sizeof(DirectoryMeta));
-                                    /* Receive remote prepare with (OK) */
-                                    // TxDistributedPrepare(DistributedTxID, true);
-                                    /* Start phase 2, commit it. */
-                                    updateRemoteMeta(parentNodeID, &metaModifiedDirectory, parentMetaAddress, parentHashAddress);
+                                    TxWriteData(LocalTxID, (uint64_t)&metaDirectory, (uint64_t)sizeof(DirectoryMeta));
+                                    /* Name is already out of parent page, commit it and unlock parent. */
+                                    updateDirectoryMeta(parent, shard, RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset);
                                     /* Only allocate momery, write to log first. */
                             		Debug::debugItem("Stage 3. Remove directory meta.");
 	                                if (storage->tableDirectoryMeta->remove(indexMeta) == false) {
@@ -2026,54 +3987,34 @@ bool FileSystem::removecd(const char *path, FileMeta *metaFile)
                             Debug::debugItem("TxLocalBegin ready");
                             LocalTxID = TxLocalBegin();
 			    Debug::debugItem("TxLocalBegin");
-                        	if (readDirectoryMeta(parent, &parentMeta, &parentHashAddress, &parentMetaAddress, &parentNodeID) == false) {
+                        	if (removeMetaFromDirectory(parent, name, &shard, &RemoteTxID, &srcBuffer, &desBuffer, &size, &remotekey, &offset) == false) {
                         		Debug::notifyError("Remove Meta From Directory failed.");
-                                // TxDistributedPrepare(DistributedTxID, false);
                         		result = false;
                         	} else {
 					Debug::debugItem("Remove meta from directory");
-                        		/* Remove meta from directory */
-                        		DirectoryMeta metaModifiedDirectory; /* Buffer to save modified directory. */
-		                        uint64_t indexModifiedNames = 0;
-		                        for (uint64_t i = 0; i < parentMeta.count; i++) {
-		                            if (strcmp(parentMeta.tuple[i].names, name) == 0) { /* If found selected name. */
-		                            } else {
-		                                strcpy(metaModifiedDirectory.tuple[indexModifiedNames].names, parentMeta.tuple[i].names); /* Copy original name to modified meta. */
-		                                metaModifiedDirectory.tuple[indexModifiedNames].isDirectories = parentMeta.tuple[i].isDirectories; /* Add directory state. */
-		                                indexModifiedNames++;
-		                            }
-		                        }
-		                        metaModifiedDirectory.count = indexModifiedNames;
                                 /* Apply updated data to local log. */
-                                TxWriteData(LocalTxID, (uint64_t)&parentMeta, (uint64_t)sizeof(DirectoryMeta));
-                                /* Receive remote prepare with (OK) */
-                                // TxDistributedPrepare(DistributedTxID, true);
-                                /* Start phase 2, commit it. */
-                                updateRemoteMeta(parentNodeID, &metaModifiedDirectory, parentMetaAddress, parentHashAddress);
+                                TxWriteData(LocalTxID, (uint64_t)metaFile, (uint64_t)sizeof(FileMeta));
+                                /* Name is already out of parent page, commit it and unlock parent. */
+                                updateDirectoryMeta(parent, shard, RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset);
                         		/* Only allocate momery, write to log first. */
 								bool resultFor = true;
 	                            Debug::debugItem("Stage 3. Remove blocks.");
-				    for(uint64_t i = 0; i < (metaFile->size / BLOCK_SIZE); i++) {
-					/*Get unique hash for each block*/
-					char *key = (char *)malloc(sizeof(char) * (strlen(path) + 5));
-					sprintf(key, "%s_%d", path, (int) metaFile->BlockList[i].BlockID);
-					uint64_t uniqueHashValue = getAddressHash(key);
+				    for(uint64_t i = 0; i < metaFile->count; i++) {
+					BlockInfo *block = getBlockInfo(metaFile, i, false);
+					uint64_t uniqueHashValue = block->key;
 
-					if (metaFile->BlockList[i].nodeID == (uint16_t) hashLocalNode) {
+					if (block->nodeID == (uint16_t) hashLocalNode) {
 					    Debug::debugItem("Stage 4. Remove blocks locally.");
-					    if ( (int) metaFile->BlockList[i].tier == 0 ) { /*Remove blocks in Memory tier*/
-						storage->extraTableBlock->remove(metaFile->BlockList[i].indexMem);
-					    } else { /*Remove blocks in SSD tier*/
- 						const char *DBkey = ltos( (long) getAddressHash(key)).data();
-						storage->db.remove((const char *)DBkey, sizeof(DBkey));
-					    }
+					    removeStoredBlock(uniqueHashValue, block);
 					} else {
 					    Debug::debugItem("Stage 4. Sent block remove request to remote node");
-					    if (!removeRemoteBlock(uniqueHashValue, &metaFile->BlockList[i])) {
+					    if (!removeRemoteBlock(uniqueHashValue, block)) {
 						Debug::notifyError("Remove remote block failed.");
 					    }
 					}
 				    }
+				    forgetHeat(metaFile); /* Before extent pages are released. */
+				    removeExtentPages(metaFile);
 
 	                            if (resultFor == false) {
 	                                result = false; /* Fail due to block remove error. */
@@ -2126,6 +4067,7 @@ bool FileSystem::remove2pc(const char *path, FileMeta *metaFile)
         uint64_t DistributedTxID;
         uint64_t LocalTxID;
         uint64_t RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset;
+        uint16_t shard;                 /* Shard of parent holding name. */
         if (checkLocal(hashNode) == true) { /* If local node. */
             bool result;
             uint64_t key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
@@ -2147,12 +4089,12 @@ bool FileSystem::remove2pc(const char *path, FileMeta *metaFile)
                             result = false; /* Fail due to get file meta error. */
                         } else {
                             metaFile->count = MAX_FILE_EXTENT_COUNT;
-                            if (metaDirectory.count != 0) { /* Directory is not empty. */
+                            if ((metaDirectory.count != 0) || (removeDirectoryShards(path, indexMeta) == false)) { /* Directory is not empty. */
                                 result = false; /* Fail due to directory is not empty. */
                             } else {
                                 DistributedTxID = TxDistributedBegin();
                                 LocalTxID = TxLocalBegin();
-                                if (removeMetaFromDirectory(parent, name, &RemoteTxID, &srcBuffer, &desBuffer, &size, &remotekey, &offset) == false) {
+                                if (removeMetaFromDirectory(parent, name, &shard, &RemoteTxID, &srcBuffer, &desBuffer, &size, &remotekey, &offset) == false) {
                                     Debug::notifyError("Remove Meta From Directory failed.");
                                     TxDistributedPrepare(DistributedTxID, false);
                                     result = false;
@@ -2165,7 +4107,7 @@ bool FileSystem::remove2pc(const char *path, FileMeta *metaFile)
                                     /* Receive remote prepare with (OK) */
                                     TxDistributedPrepare(DistributedTxID, true);
                                     /* Start phase 2, commit it. */
-                                    updateDirectoryMeta(parent, RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset);
+                                    updateDirectoryMeta(parent, shard, RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset);
                                     /* Only allocate momery, write to log first. */
                                     Debug::debugItem("Stage 3. Remove directory meta.");
                                     if (storage->tableDirectoryMeta->remove(indexMeta) == false) {
@@ -2187,7 +4129,7 @@ bool FileSystem::remove2pc(const char *path, FileMeta *metaFile)
                         } else {
                             DistributedTxID = TxDistributedBegin();
                             LocalTxID = TxLocalBegin();
-                            if (removeMetaFromDirectory(parent, name, &RemoteTxID, &srcBuffer, &desBuffer, &size, &remotekey, &offset) == false) {
+                            if (removeMetaFromDirectory(parent, name, &shard, &RemoteTxID, &srcBuffer, &desBuffer, &size, &remotekey, &offset) == false) {
                                 Debug::notifyError("Remove Meta From Directory failed.");
                                 TxDistributedPrepare(DistributedTxID, false);
                                 result = false;
@@ -2200,7 +4142,7 @@ bool FileSystem::remove2pc(const char *path, FileMeta *metaFile)
                                 /* Receive remote prepare with (OK) */
                                 TxDistributedPrepare(DistributedTxID, true);
                                 /* Start phase 2, commit it. */
-                                updateDirectoryMeta(parent, RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset);
+                                updateDirectoryMeta(parent, shard, RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset);
                                 /* Only allocate momery, write to log first. */
                                 bool resultFor = true;
                                 Debug::debugItem("Stage 3. Remove blocks.");
@@ -2217,6 +4159,7 @@ bool FileSystem::remove2pc(const char *path, FileMeta *metaFile)
                                     result = false; /* Fail due to block remove error. */
                                 } else {
                                     Debug::debugItem("Stage 4. Remove file meta.");
+                                    removeExtentPages(metaFile);
                                     if (storage->tableFileMeta->remove(indexMeta) == false) {
                                         result = false; /* Fail due to remove error. */
                                     } else {
@@ -2279,6 +4222,7 @@ bool FileSystem::rename(const char *pathOld, const char *pathNew)
         NodeHash hashNodeOld = storage->getNodeHash(&hashUniqueOld); /* Get node hash by unique hash. */
         AddressHash hashAddressOld = HashTable::getAddressHash(&hashUniqueOld); /* Get address hash by unique hash. */
         uint64_t RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset;
+        uint16_t shard;                 /* Shard of parent holding name. */
         // UniqueHash hashUniqueNew;
         // HashTable::getUniqueHash(pathNew, strlen(pathNew), &hashUniqueNew); /* Get unique hash. */
         // NodeHash hashNodeNew = storage->getNodeHash(&hashUniqueNew); /* Get node hash by unique hash. */
@@ -2293,32 +4237,39 @@ bool FileSystem::rename(const char *pathOld, const char *pathNew)
                     result = false; /* Fail due to existence of path. */
                 } else {
                     Debug::debugItem("Stage 2. Get meta.");
+                    FileMeta metaFile;
+                    UniqueHash hashUniqueNew;
+                    HashTable::getUniqueHash(pathNew, strlen(pathNew), &hashUniqueNew);
+                    bool local = checkLocal(storage->getNodeHash(&hashUniqueNew)); /* New meta takes over extent pages, they are not released. */
                     if (isDirectory == true) { /* If directory meta. */
                         result = false; /* Fail due to directory rename is not supported. */
+                    } else if (storage->tableFileMeta->get(indexFileMeta, &metaFile) == false) {
+                        result = false; /* Fail due to get file meta error. */
+                    } else if (moveBlockLists(pathNew, &metaFile, hashAddressOld) == false) {
+                        result = false; /* Old file is kept. */
                     } else {
                     	char *parent = (char *)malloc(strlen(pathOld) + 1);
                     	char *name = (char *)malloc(strlen(pathOld) + 1);
                     	getParentDirectory(pathOld, parent);
                     	getNameFromPath(pathOld, name);
-                    	if (removeMetaFromDirectory(parent, name, &RemoteTxID, &srcBuffer, &desBuffer, &size, &remotekey, &offset) == false) {
+                    	if (removeMetaFromDirectory(parent, name, &shard, &RemoteTxID, &srcBuffer, &desBuffer, &size, &remotekey, &offset) == false) {
                     		result = false;
                     	} else {
-							FileMeta metaFile;
-	                        if (storage->tableFileMeta->get(indexFileMeta, &metaFile) == false) {
-	                            result = false; /* Fail due to get file meta error. */
-	                        } else{
-                                updateDirectoryMeta(parent, RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset);
-	                            Debug::debugItem("Stage 4. Remove file meta.");
-	                            if (storage->tableFileMeta->remove(indexFileMeta) == false) {
-	                                result = false; /* Fail due to remove error. */
-	                            } else {
-	                                if (storage->hashtable->del(&hashUniqueOld) == false) {
-	                                    result = false; /* Fail due to hash table del. No roll back. */
-	                                } else {
-	                                    result = true;
-	                                }
-	                            }
-	                        }
+                            updateDirectoryMeta(parent, shard, RemoteTxID, srcBuffer, desBuffer, size, remotekey, offset);
+                            forgetHeat(&metaFile); /* Heat is kept with old path. */
+                            Debug::debugItem("Stage 4. Remove file meta.");
+                            if (local == false) {
+                                removeExtentPages(&metaFile); /* Copied to new node already. */
+                            }
+                            if (storage->tableFileMeta->remove(indexFileMeta) == false) {
+                                result = false; /* Fail due to remove error. */
+                            } else {
+                                if (storage->hashtable->del(&hashUniqueOld) == false) {
+                                    result = false; /* Fail due to hash table del. No roll back. */
+                                } else {
+                                    result = true;
+                                }
+                            }
                     	}
                     	free(parent);
                     	free(name);
@@ -2345,10 +4296,16 @@ void FileSystem::rootInitialize(NodeHash LocalNode)
     HashTable::getUniqueHash("/", strlen("/"), &hashUnique);
     NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash. */
     Debug::debugItem("root node: %d", (int)hashNode);
-    if (hashNode == this->hashLocalNode) { /* Root directory is here. */
+    uint64_t indexRoot;
+    bool isDirectory;
+    if ((hashNode == this->hashLocalNode) && storage->hashtable->get(&hashUnique, &indexRoot, &isDirectory)) {
+        Debug::notifyInfo("Root directory is kept from last run.");
+    } else if (hashNode == this->hashLocalNode) { /* Root directory is here. */
         Debug::notifyInfo("Initialize root directory.");
         DirectoryMeta metaDirectory;
-        metaDirectory.count = 0;    /* Initialize count of files in root directory is 0. */
+        memset(&metaDirectory, 0, sizeof(DirectoryMeta)); /* Root directory is empty and has no pages. */
+        metaDirectory.codec = COMPRESS_CODEC;
+        strcpy(metaDirectory.path, "/");
         uint64_t indexDirectoryMeta;
         if (storage->tableDirectoryMeta->create(&indexDirectoryMeta, &metaDirectory) == false) {
             fprintf(stderr, "FileSystem::FileSystem: create directory meta error.\n");
@@ -2395,45 +4352,46 @@ bool FileSystem::extentRead(const char *path, uint64_t size, uint64_t offset, fi
                         Debug::notifyError("Directory meta.");
                         result = false; /* Fail due to not file. */
                     } else {
-			FileMeta metaFile;
+			const FileMeta *metaFile; /* Read in place, only blocks in range are copied. */
                         Debug::debugItem("Stage 3. Get Filemeta index.");
-                        if (storage->tableFileMeta->get(indexFileMeta, &metaFile) == false) {
+                        if (storage->tableFileMeta->view(indexFileMeta, &metaFile) == false) {
                             Debug::notifyError("Fail due to get file meta error.");
                             result = false; /* Fail due to get file meta error. */
                         } else {
-			    Debug::debugItem("Stage 3-1. meta.size = %ld, size = %d, offset = %d", (long) metaFile.size, size, offset);
-			    if (offset + 1 > metaFile.size) { /* Judge if offset and size are valid. */
+			    Debug::debugItem("Stage 3-1. meta.size = %ld, size = %d, offset = %d", (long) metaFile->size, size, offset);
+			    if (offset + 1 > metaFile->size) { /* Judge if offset and size are valid. */
                                 fpi->len = 0;
                                 return true;
                             }
-                            else if((metaFile.size - offset) < size)
+                            else if((metaFile->size - offset) < size)
                             {
-                                size = metaFile.size - offset;
+                                size = metaFile->size - offset;
                             }
 
-			    /*Locate the right chunk of file //To be implemented.
-
-			    if (metaFile.hasNextChunk) {
-				int chunkNum = offset / BLOCK_SIZE;
-				FileMeta tmpmetaFile;
-				while (chunkNum > 0) {
-				    storage->tableFileMeta->get(metaFile->indexOfNextChunk, &tmpmetaFile);
-  				    chunkNum--;
-				}
-			    }*/
+			    uint64_t start = offset / BLOCK_SIZE;
+			    uint64_t end = (offset + size - 1) / BLOCK_SIZE + 1;
+			    if (end - start > MAX_MESSAGE_BLOCK_COUNT) {
+				Debug::notifyError("Read of %lu blocks exceeds message capacity.", (unsigned long)(end - start));
+				return false;
+			    }
+			    BlockInfo blocks[MAX_MESSAGE_BLOCK_COUNT]; /* Cache indexes of this read are filled here, not in meta. */
+			    for (uint64_t k = start; k < end; k++) {
+				blocks[k - start] = *getBlockInfo(metaFile, k); /* Inline or in extent page. */
+			    }
 
 			    /*Make sure that all blocks to be read are resides in RDMA region*/
+                            fillRDMARegionBatch(path, metaFile, start, end);
                             uint64_t i;
-			    for (i = offset / BLOCK_SIZE; i < (offset + size - 1) / BLOCK_SIZE + 1; i++ ) {
+			    for (i = start; i < end; i++ ) {
 
-				/*Get unique hash for each block*/
-	                        char *key = (char *)malloc(sizeof(char) * (strlen(path) + 5));
-        	                sprintf(key, "%s_%d", path, (int)metaFile.BlockList[i].BlockID);
-                	        uint64_t uniqueHashValue = getAddressHash(key);
-				if (metaFile.BlockList[i].nodeID == (uint16_t)hashLocalNode) {
+                	        uint64_t uniqueHashValue = blocks[i - start].key;
+				recordHeat(uniqueHashValue, path, &blocks[i - start]);
+				if (isBlockInPlace(&blocks[i - start])) {
+				    Debug::debugItem("Block %d is read in place from memory tier", (int)i);
+				} else if (blocks[i - start].nodeID == (uint16_t)hashLocalNode) {
 				    if (!storage->BlockManager->exists(uniqueHashValue)) {
 					Debug::debugItem("Fill RDMA region once in local node, Block ID is %d", (int)i);
-					//fillRDMARegion(uniqueHashValue, i, &metaFile.BlockList[i], path, false);
+					//fillRDMARegion(uniqueHashValue, i, &blocks[i - start], path, false);
                                         /*v2*/
                                         
                                         if (PrefetchManager->find(uniqueHashValue) != PrefetchManager->end()) { //if (Prefetch_stride.previous_blockID == i) {
@@ -2442,13 +4400,7 @@ bool FileSystem::extentRead(const char *path, uint64_t size, uint64_t offset, fi
                                             ;
                                           }
                                         } else {
-                                          fillRDMARegion(uniqueHashValue, i, &metaFile.BlockList[i], path, false);
-                                        }
-                                        if (storage->BlockManager->exists(uniqueHashValue)) {
-                                          Debug::debugItem("Wait and Block %d is prefetched", (int)i);
-                                        } else {
-                                          Debug::notifyError("Block %d does not exist in RDMA region", (int)i);
-                                          return false;
+                                          fillRDMARegion(uniqueHashValue, i, &blocks[i - start], path, false);
                                         }
                                         
 				    } else {
@@ -2457,24 +4409,28 @@ bool FileSystem::extentRead(const char *path, uint64_t size, uint64_t offset, fi
                                     /*Prefetched block must be moved from the prefetch queue.*/
                                     PrefetchManager->erase(uniqueHashValue);
                                     Debug::debugItem("PrefetchManager erase key %s", key);
+                                    BlockInfo cachedBlock; /* Looked up once, block may be evicted between two lookups. */
+                                    if (!storage->BlockManager->find(uniqueHashValue, &cachedBlock)) {
+                                      Debug::notifyError("Block %d does not exist in RDMA region", (int)i);
+                                      return false;
+                                    }
+                                    blocks[i - start].indexCache = cachedBlock.indexCache;
 
 				} else {
 				    Debug::debugItem("Sent block read request to remote node");
-				    fillRemoteBlock(uniqueHashValue, &metaFile.BlockList[i], false);
+				    fillRemoteBlock(uniqueHashValue, &blocks[i - start], false);
 				}
         		    }
-			    fillFilePositionInformation(size, offset, fpi, &metaFile);
+			    fillFilePositionInformation(size, offset, fpi, blocks);
 			    result = true;
 
                             /*Prefetch*/
                             for (int j = i; j < i + PREFETCHER_NUMBER; j++) {
                               int Prefetch_blockID = j;
-                              if (Prefetch_blockID < metaFile.count) {
-                                char *Prefetch_key = (char *)malloc(sizeof(char) * (strlen(path) + 5));
-                                sprintf(Prefetch_key, "%s_%d", path, (int)metaFile.BlockList[Prefetch_blockID].BlockID);
-                                Debug::debugItem("Prefetch_key is %s", Prefetch_key);
-                                Debug::debugItem("Current block address is %ld", (long)metaFile.BlockList[Prefetch_blockID].StorageAddress);
-                                uint64_t Prefetch_uniqueHashValue = getAddressHash(Prefetch_key);
+                              if (Prefetch_blockID < metaFile->count) {
+                                const BlockInfo *Prefetch_block = getBlockInfo(metaFile, Prefetch_blockID);
+                                Debug::debugItem("Current block address is %ld", (long)Prefetch_block->StorageAddress);
+                                uint64_t Prefetch_uniqueHashValue = Prefetch_block->key;
 
                                 /*If current request has been filled in the prefetch queue, breck to next circle*/
                                 if (PrefetchManager->find(Prefetch_uniqueHashValue) != PrefetchManager->end()) {
@@ -2482,13 +4438,13 @@ bool FileSystem::extentRead(const char *path, uint64_t size, uint64_t offset, fi
                                 }
                                 PrefetchTask task[PREFETCHER_NUMBER];
                                 int taskid = j % PREFETCHER_NUMBER;
-                                if (metaFile.BlockList[Prefetch_blockID].nodeID == (uint16_t)hashLocalNode) {
+                                if ((Prefetch_block->nodeID == (uint16_t)hashLocalNode) && !isBlockInPlace(Prefetch_block)) {
                                   if (!storage->BlockManager->exists(Prefetch_uniqueHashValue)) {
                                     Debug::debugItem("Call preftch thread once\n");
                                     task[taskid].localNode = true;
                                     task[taskid].uniqueHashValue = Prefetch_uniqueHashValue;
                                     task[taskid].blockID = Prefetch_blockID;
-                                    task[taskid].block = metaFile.BlockList[Prefetch_blockID];
+                                    task[taskid].block = *Prefetch_block;
                                     task[taskid].path = path;
                                     task[taskid].writeOperation = false;
                                     Prefetch_stride.previous_blockID = Prefetch_blockID;
@@ -2558,7 +4514,7 @@ bool FileSystem::extentWrite(const char *path, uint64_t size, uint64_t offset, f
     *key_offset = hashAddress;
     uint64_t indexFileMeta;
     bool isDirectory;
-    FileMeta *metaFile = (FileMeta *)malloc(sizeof(FileMeta));
+    FileMeta *metaFile;                 /* Updated in place, only blocks written are touched. */
 
     if (storage->hashtable->get(&hashUnique, &indexFileMeta, &isDirectory) == false) { /* If path does not exist. */
         result = false;     /* Fail due to path does not exist. */
@@ -2568,26 +4524,27 @@ bool FileSystem::extentWrite(const char *path, uint64_t size, uint64_t offset, f
         if (isDirectory == true) { /* If directory meta. */
             result = false; /* Fail due to not file. */
         } else {
-	    if (storage->tableFileMeta->get(indexFileMeta, metaFile) == false) {
+	    if (storage->tableFileMeta->reference(indexFileMeta, &metaFile) == false) {
                 result = false; /* Fail due to get file meta error. */
             } else {
 		Debug::debugItem("Stage 3.");
+		uint64_t start = offset / BLOCK_SIZE;
+		uint64_t end = (offset + size - 1) / BLOCK_SIZE + 1;
+		if (end - start > MAX_MESSAGE_BLOCK_COUNT) {
+		    Debug::notifyError("Write of %lu blocks exceeds message capacity.", (unsigned long)(end - start));
+		    return false;
+		}
+		BlockInfo blocks[MAX_MESSAGE_BLOCK_COUNT]; /* Blocks written, copied out of inline list and extent pages. */
+		/* Decay write heat by idle seconds since last write, then account this write. */
+		uint64_t secondsIdle = (uint64_t)(time(NULL) - metaFile->timeLastModified);
+		metaFile->heatWrite = ((secondsIdle >= 64) ? 0 : (metaFile->heatWrite >> secondsIdle)) + size;
 
-		if ((metaFile->size == 0) || ((offset + size - 1) / BLOCK_SIZE > (metaFile->size - 1) / BLOCK_SIZE)) { /* Judge if new blocks need to be created. */
+		if ((offset + size - 1) / BLOCK_SIZE + 1 > metaFile->count) { /* Judge if new blocks need to be created. */
 		    Debug::debugItem("Stage 3-1. Init BlockInfo structure");
-		    uint64_t BlockID;
-		    uint64_t countExtraBlock; /* Count of extra blocks. At least 1. */
-
-		    /* Consider 0 size file. */
-                    Debug::debugItem("Stage 4. metaFile->size = %ld", (long)metaFile->size);
-		    if (metaFile->size == 0) {
-			BlockID = 0;
-			countExtraBlock = (offset + size - 1) / BLOCK_SIZE + 1;
-                        Debug::debugItem("Stage 4-1, countExtraBlock = %d, BLOCK_SIZE = %d", countExtraBlock, BLOCK_SIZE);
-		    } else {
-			BlockID = (int64_t)metaFile->count;
-			countExtraBlock = (offset + size - 1) / BLOCK_SIZE - (metaFile->size - 1) / BLOCK_SIZE;
-		    }
+		    /* Count blocks by count rather than size, blocks left by a failed write are reused. */
+		    uint64_t BlockID = metaFile->count;
+		    uint64_t countExtraBlock = (offset + size - 1) / BLOCK_SIZE + 1 - metaFile->count; /* Count of extra blocks. At least 1. */
+                    Debug::debugItem("Stage 4. metaFile->size = %ld, countExtraBlock = %ld", (long)metaFile->size, (long)countExtraBlock);
 		    uint64_t indexCurrentExtraBlock;
                     uint64_t indexCurrentMemBlock;
                     Debug::debugItem("Stage 5.");
@@ -2596,75 +4553,90 @@ bool FileSystem::extentWrite(const char *path, uint64_t size, uint64_t offset, f
 		    /*Allocate block for the wrtie data*/
                     for (uint64_t i = 0; i < countExtraBlock; i++) {
 			Debug::debugItem("for loop, i = %d, BlockID = %d, countExtraBlock = %ld", i, (int)BlockID + 1, (long)countExtraBlock);
-			BlockInfo *newBlock = (BlockInfo *)malloc(sizeof(BlockInfo));
+			BlockInfo *newBlock = getBlockInfo(metaFile, BlockID, true); /* Built in place, counted once created. */
+			if (newBlock == NULL) {
+			    Debug::notifyError("Block %d of %s is out of extent pages.", (int)BlockID, path);
+			    resultFor = false;
+			    break;
+			}
+			memset(newBlock, 0, sizeof(BlockInfo));
 			newBlock->BlockID = BlockID;
-			newBlock->nodeID = getBlockNodeID();
-			newBlock->tier = getBlockTier();
+			getBlockPlacement(metaFile, BlockID, offset + size, &newBlock->nodeID, &newBlock->tier);
+			newBlock->codec = metaFile->codec;
 
-			/*Get unique hash for each block*/
-		        char *key = (char *)malloc(sizeof(char) * (strlen(path) + 5));
-		        sprintf(key, "%s_%d", path, (int)newBlock->BlockID);
-	   		uint64_t uniqueHashValue = getAddressHash(key);
+			/* Key is assigned once here, the block keeps it when file is renamed. */
+			uint64_t uniqueHashValue = newBlockKey();
+			newBlock->key = uniqueHashValue;
 			newBlock->StorageAddress = uniqueHashValue;
 
 			Debug::debugItem("Server nodeID is %d, newBlock->nodeID is %d", (int)hashLocalNode, (int)newBlock->nodeID);
+			bool resultCreate;
 			if (newBlock->nodeID == (uint16_t)hashLocalNode) { /*If new block is allocated in local server*/
-			    createNewBlock(newBlock);
+			    resultCreate = createNewBlock(newBlock);
 			} else {
-			    createRemoteBlock(newBlock);
+			    resultCreate = createRemoteBlock(newBlock);
 			}
-			metaFile->BlockList[BlockID] = *newBlock;
+			if (resultCreate == false) {
+			    Debug::notifyError("Create block %d of %s failed.", (int)BlockID, path);
+			    resultFor = false;
+			    break;
+			}
+			recordHeat(uniqueHashValue, path, newBlock);
                         metaFile->count++;
                         BlockID ++;
-			/*Each FileMeta object contains MAX_FILE_EXTENT_COUNT blocks //To be implemented
-			if (metaFile->count >= (MAX_FILE_EXTENT_COUNT - 1)) {
-			    FileMeta *tmpmetaFile = (FileMeta *)malloc(sizeof(FileMeta));
-			    uint64_t indexOfNextChunk;
-			    torage->tableFileMeta->create(&indexOfNextChunk, tmpmetaFile);
-			    metaFile->indexOfNextChunk = indexOfNextChunk;
-			    metaFile->hasNextChunk = true;
-			    storage->tableFileMeta->put(indexFileMeta, metaFile);
-			    indexFileMeta = indexOfNextChunk;
-			    metaFile = tmpmetaFile;
-			}*/
+		    }
+		    if (resultFor == false) {
+			return false;   /* Blocks created so far are kept, size is unchanged. */
 		    }
 		    metaFile->size = offset + size;
-		    fillFilePositionInformation(size, offset, fpi, metaFile); /* Fill file position information. */
+		    for (uint64_t k = start; k < end; k++) {
+			blocks[k - start] = *getBlockInfo(metaFile, k, false);
+		    }
+		    fillFilePositionInformation(size, offset, fpi, blocks); /* Fill file position information. */
                     result = true;
 		} else {
 		    /*Fill RDMA Zone*/
                     Debug::debugItem("Stage 3-B. Write data to existing file");
-		    metaFile->size = (offset + size) > metaFile->size ? (offset + size) : metaFile->size;
 		    /*Make sure that all blocks to be read are resides in RDMA region*/
 		    for (uint64_t i = offset / BLOCK_SIZE; i < (offset + size - 1) / BLOCK_SIZE + 1; i++ ) {
-			/*Get unique hash for each block*/
-                        char *key = (char *)malloc(sizeof(char) * (strlen(path) + 5));
-                        sprintf(key, "%s_%d", path, (int)metaFile->BlockList[i].BlockID);
-                        uint64_t uniqueHashValue = getAddressHash(key);
+			BlockInfo *block = getBlockInfo(metaFile, i, false);
+                        uint64_t uniqueHashValue = block->key;
+			recordHeat(uniqueHashValue, path, block);
 
-			if (metaFile->BlockList[i].nodeID == (uint16_t)hashLocalNode) {
+			if (isBlockInPlace(block)) {
+			    Debug::debugItem("Block %d is written in place to memory tier", (int)i);
+			} else if (block->nodeID == (uint16_t)hashLocalNode) {
  			    if (!storage->BlockManager->exists(uniqueHashValue)) {
 				Debug::debugItem("Fill RDMA region once in local node, Block ID is %d", (int)i);
-				fillRDMARegion(uniqueHashValue, i, &metaFile->BlockList[i], path, true);
+				fillRDMARegion(uniqueHashValue, i, block, path, true);
 			    }
+			    BlockInfo cachedBlock; /* Looked up once, block may be evicted between two lookups. */
+			    if (storage->BlockManager->find(uniqueHashValue, &cachedBlock) == false) {
+				Debug::notifyError("Block %d does not exist in RDMA region", (int)i);
+				return false;
+			    }
+			    block->indexCache = cachedBlock.indexCache;
 			} else {
 			    Debug::debugItem("Sent block read request to remote node");
-			    fillRemoteBlock(uniqueHashValue, &metaFile->BlockList[i], true);
-			    metaFile->BlockList[i].present = true;
-			    metaFile->BlockList[i].isDirty = true;
+			    fillRemoteBlock(uniqueHashValue, block, true);
+			    block->present = true;
+			    block->isDirty = true;
 			}
 		    }
-		    fillFilePositionInformation(size, offset, fpi, metaFile); /* Fill file position information. */
+		    metaFile->size = (offset + size) > metaFile->size ? (offset + size) : metaFile->size;
+		    for (uint64_t k = start; k < end; k++) {
+			blocks[k - start] = *getBlockInfo(metaFile, k, false);
+		    }
+		    fillFilePositionInformation(size, offset, fpi, blocks); /* Fill file position information. */
                     result = true;
 		} /*End if new blocks need to be created.*/
 		if(result) {
 		    metaFile->isNewFile = true;
+		    metaFile->generation++; /* Data written through locations given here. */
 		    metaFile->timeLastModified = time(NULL);
-		    storage->tableFileMeta->put(indexFileMeta, metaFile);
-		    Debug::debugItem("Stage 5, put metaFile to the table");
+		    Debug::debugItem("Stage 5, meta is updated in place");
 		}
 		Debug::debugItem("Stage 6. meta.size = %ld",(long) metaFile->size);
-                free(metaFile);
                 Debug::debugItem("Stage end.");
                 return result;
 	    } /*End if get file meta succeed*/
@@ -2674,16 +4646,25 @@ bool FileSystem::extentWrite(const char *path, uint64_t size, uint64_t offset, f
     return result;
 }
 
-/*Get nodeID for newly created block*/
-uint16_t FileSystem::getBlockNodeID() {
-    uint16_t nodeID = hashLocalNode;
-    return nodeID;
-}
-
-/*Get storage tier for newly created block*/
-uint16_t FileSystem::getBlockTier() {
-    uint16_t tier = 1;
-    return tier;
+/* Get nodeID and storage tier for newly created block from placement policy.
+   @param   metaFile    File meta, provides hint and write heat.
+   @param   BlockID     ID of new block.
+   @param   sizeFile    Size of file after current write.
+   @param   nodeID      Buffer of node ID.
+   @param   tier        Buffer of tier. */
+void FileSystem::getBlockPlacement(FileMeta *metaFile, uint64_t BlockID, uint64_t sizeFile, uint16_t *nodeID, uint16_t *tier) {
+    PlacementContext context;
+    context.nodeLocal = (uint16_t)hashLocalNode;
+    context.countNode = countNode;
+    context.countMemoryTotal = storage->extraTableBlock->countTotalItems();
+    context.countMemoryFree = context.countMemoryTotal - storage->extraTableBlock->countSavedItems();
+    context.sizeFile = sizeFile;
+    context.heatWrite = metaFile->heatWrite;
+    context.hint = metaFile->hintPlacement;
+    context.BlockID = (uint32_t)BlockID;
+    std::shared_ptr<PlacementPolicy> policy = std::atomic_load(&placement); /* Kept alive if replaced meanwhile. */
+    policy->place(&context, nodeID, tier);
+    Debug::debugItem("Placement %s, block %d to node %d tier %d", policy->name(), (int)BlockID, (int)*nodeID, (int)*tier);
 }
 
 /*Sent block create request to remote server*/
@@ -2692,8 +4673,10 @@ bool FileSystem::createRemoteBlock(BlockInfo *newBlock) {
     bool ret = false;
     BlockRequestSendBuffer bufferSend;
     bufferSend.message = MESSAGE_CREATEBLOCK;
+    bufferSend.uniqueHashValue = newBlock->key;
     bufferSend.BlockID = newBlock->BlockID;
     bufferSend.Storagetier = newBlock->tier;
+    bufferSend.codec = newBlock->codec;
     bufferSend.StorageAddress = newBlock->StorageAddress;
     bufferSend.writeOperation = true;
     BlockRequestReceiveBuffer bufferReceive;
@@ -2705,6 +4688,7 @@ bool FileSystem::createRemoteBlock(BlockInfo *newBlock) {
 	newBlock->indexCache = bufferReceive.indexCache;
 	newBlock->indexMem = bufferReceive.indexMem;
 	newBlock->StorageAddress = bufferReceive.StorageAddress;
+	newBlock->tier = bufferReceive.Storagetier;
 	ret = true;
     }
     return ret;
@@ -2719,6 +4703,7 @@ bool FileSystem::removeRemoteBlock(uint64_t uniqueHashValue, BlockInfo *newBlock
     bufferSend.uniqueHashValue = uniqueHashValue;
     bufferSend.BlockID = newBlock->BlockID;
     bufferSend.Storagetier = newBlock->tier;
+    bufferSend.codec = newBlock->codec;
     bufferSend.StorageAddress = newBlock->StorageAddress;
     bufferSend.writeOperation = true;
     BlockRequestReceiveBuffer bufferReceive;
@@ -2733,60 +4718,57 @@ bool FileSystem::removeRemoteBlock(uint64_t uniqueHashValue, BlockInfo *newBlock
 }
 
 /*Remove block for remote request*/
-bool FileSystem::removeBlock(uint64_t uniqueHashValue, uint16_t tier, uint64_t StorageAddress) {
-    bool ret = false;
-    uint64_t MemZoneBaseAddress = server->getMemoryManagerInstance()->getExtraDataAddress();
-    Debug::debugItem("Move data to RDMA region for remote remove");
-    /*To be implemented*/
-    if ((int)tier == 0) {
-	int bid = (StorageAddress - MemZoneBaseAddress) / BLOCK_SIZE;
-	storage->extraTableBlock->remove(bid);
-        ret = true;
-    } else {
-	const char *key = ltos((long)uniqueHashValue).data();
-        storage->db.remove(key, sizeof(key));
-	ret = true;
-    }
-    return ret;
+bool FileSystem::removeBlock(uint64_t uniqueHashValue, BlockInfo *block) {
+    Debug::debugItem("Remove block for remote remove");
+    removeStoredBlock(uniqueHashValue, block);
+    return true;
 }
 
-/*Create a new block*/
+/*Create a new block. Memory tier falls back to SSD tier and SSD tier to spill tier when full.
+   Raw memory tier blocks are served in place, other blocks get an RDMA region block.
+   @param   newBlock    Block info, tier might be changed.
+   @return              If block is created return true, otherwise return false. */
 bool FileSystem::createNewBlock(BlockInfo *newBlock) {
-    bool ret = false;
     uint64_t indexCurrentExtraBlock;
     uint64_t indexCurrentMemBlock;
-    uint64_t uniqueHashValue = newBlock->StorageAddress;
+    uint64_t uniqueHashValue = newBlock->key;
     Debug::debugItem("Create a new block");
-    if (newBlock->tier == 0) { /*If this block is allocated in memory storage tier*/
-        Debug::debugItem("Memory storage tier");
-	uint64_t MemZoneBaseAddress = server->getMemoryManagerInstance()->getExtraDataAddress();
-	if ((storage->tableBlock->create(&indexCurrentExtraBlock) == false) || (storage->extraTableBlock->create(&indexCurrentMemBlock) == false)) {
-	    Debug::notifyError("Allocate blcok Error");
-            ret = false; /* Fail due to no enough space. Might cause inconsistency. */
-	} else { /* So we need to modify the allocation way in table class. */
-	    newBlock->indexCache = indexCurrentExtraBlock;
-	    newBlock->indexMem = indexCurrentMemBlock;
-	    newBlock->StorageAddress = MemZoneBaseAddress + indexCurrentMemBlock * BLOCK_SIZE;
-	    newBlock->isDirty = true;
-	    newBlock->present = true;
-	}
-	ret = true;
-    } else if (newBlock->tier == 1) {
-	Debug::debugItem("SSD storage tier");
-	if (storage->tableBlock->create(&indexCurrentExtraBlock) == false) {
-            Debug::notifyError("Allocate blcok Error");
-            ret = false; /* Fail due to no enough space. Might cause inconsistency. */
-        } else {
-	    newBlock->indexCache = indexCurrentExtraBlock;
-	    newBlock->indexMem = -1;
-	    newBlock->isDirty = true;
-            newBlock->present = true;
+    bool raw = (newBlock->codec == CODEC_NONE);
+    if ((newBlock->tier == 0) && !raw) {
+	/* Compressed blocks take memory tier space when written back, and spill to SSD tier if there is none. */
+	if (storage->extraTableBlock->countSavedItems() >= storage->extraTableBlock->countTotalItems()) {
+	    newBlock->tier = 1;
 	}
-	ret = true;
-    } /*End if 'tier == 0' */
+    } else if ((newBlock->tier == 0) && (createMemBlock(&indexCurrentMemBlock) == false)) {
+	Debug::debugItem("Memory storage tier is full, fall back to SSD storage tier");
+	newBlock->tier = 1; /* Placement only sees local capacity, so a remote memory tier might be full. */
+    }
+    if ((newBlock->tier == 1) && storage->tierSSD->full()) {
+	Debug::debugItem("SSD storage tier is full, fall back to spill tier");
+	newBlock->tier = TIER_SPILL;
+    }
+    if ((newBlock->tier == 0) && raw) { /* Served in place, no RDMA region block is needed. */
+	uint64_t MemZoneBaseAddress = server->getMemoryManagerInstance()->getExtraDataAddress();
+	newBlock->indexCache = 0;
+	newBlock->indexMem = indexCurrentMemBlock;
+	newBlock->StorageAddress = MemZoneBaseAddress + indexCurrentMemBlock * BLOCK_SIZE;
+	newBlock->isDirty = false;
+	newBlock->present = true;
+	Debug::debugItem("Block created in memory tier!");
+	return true;
+    }
+    if (createCacheBlock(&indexCurrentExtraBlock) == false) {
+	Debug::notifyError("Allocate block in RDMA region failed");
+	return false;
+    }
+    Debug::debugItem("Storage tier %d", (int)newBlock->tier);
+    newBlock->indexCache = indexCurrentExtraBlock;
+    newBlock->indexMem = -1; /* Kept by key in tiers. */
+    newBlock->isDirty = true;
+    newBlock->present = true;
     LRUInsert(uniqueHashValue, newBlock);
     Debug::debugItem("Block created!");
-    return ret;
+    return true;
 }
 
 /*Sent fill block request to remote node*/
@@ -2798,6 +4780,7 @@ bool FileSystem::fillRemoteBlock(uint64_t uniqueHashValue, BlockInfo *newBlock,
     bufferSend.uniqueHashValue = uniqueHashValue;
     bufferSend.BlockID = newBlock->BlockID;
     bufferSend.Storagetier = newBlock->tier;
+    bufferSend.codec = newBlock->codec;
     bufferSend.StorageAddress = newBlock->StorageAddress;
     bufferSend.writeOperation = writeOperation;
     BlockRequestReceiveBuffer bufferReceive;
@@ -2822,18 +4805,25 @@ std::string FileSystem::ltos(long l) {
     return result;
 }
 
-/*Get hash value of the input path*/
-uint64_t FileSystem::getAddressHash(char *path) {
-    UniqueHash hashUnique;
-    HashTable::getUniqueHash(path, strlen(path), &hashUnique);
-    return hashUnique.value[3];
+/* Get key of a new block. Node ID in high 16 bits keeps keys of nodes apart, sequence in superblock
+   keeps them apart across warm restarts.
+   @return  Block key. */
+uint64_t FileSystem::newBlockKey() {
+    uint64_t sequence = server->getMemoryManagerInstance()->getBlockSequence();
+    return ((uint64_t)hashLocalNode << 48) | (sequence & 0x0000FFFFFFFFFFFFULL);
 }
 
 /*Insert a block to BlockManager, and repalce an obsolete block with LRU strategy*/
 bool FileSystem::LRUInsert(uint64_t key, BlockInfo *newBlock) {
     Debug::debugItem("LRUInsert:: Call LRUInsert once");
     BlockInfo *oldBlock = (BlockInfo *)malloc(sizeof(BlockInfo));
-    *oldBlock = storage->BlockManager->put(key, *newBlock);
+    bool inserted;
+    *oldBlock = storage->BlockManager->put(key, *newBlock, &inserted);
+    if (inserted == false) {
+        Debug::notifyError("LRUInsert:: RDMA region is pinned full, block %d is not cached", (int)newBlock->BlockID);
+        free(oldBlock);
+        return false;
+    }
 
     /*Evict an obsolete block*/
     if ((long)oldBlock->StorageAddress != 0L) {
@@ -2844,20 +4834,29 @@ bool FileSystem::LRUInsert(uint64_t key, BlockInfo *newBlock) {
 	    return true;
 	}
 	/*If block is dirty, copy data to memory tier or SSD tier*/
+	uint64_t RdmaZoneBaseAddress = server->getMemoryManagerInstance()->getDataAddress();
+	char *value  = (char *) (RdmaZoneBaseAddress + oldBlock->indexCache * BLOCK_SIZE);
 	if (oldBlock->tier == 0) {
-	    uint64_t MemZoneBaseAddress = server->getMemoryManagerInstance()->getExtraDataAddress();
-	    uint64_t RdmaZoneBaseAddress = server->getMemoryManagerInstance()->getDataAddress();
-	    void *dest = (void *) (oldBlock->StorageAddress);
-	    void *src  = (void *) (RdmaZoneBaseAddress + oldBlock->indexCache * BLOCK_SIZE);
-            Debug::debugItem("LRUInsert:: src is %ld, dest is %ld", (long)src, (long)dest);
-	    memcpy(dest, src, BLOCK_SIZE);
+	    /*Only compressed blocks are cached, they are kept by key which is StorageAddress*/
+	    if (storeBlock(oldBlock->StorageAddress, oldBlock, value) == false) {
+		Debug::notifyError("LRUInsert:: Write back block %d to the memory tier failed", oldBlock->BlockID);
+	    }
 	    Debug::debugItem("LRUInsert:: Dirty data have been moved to the memory tier");
-	} else if (oldBlock->tier == 1) {
-	    uint64_t RdmaZoneBaseAddress = server->getMemoryManagerInstance()->getDataAddress();
-	    const char *key = ltos((long)oldBlock->StorageAddress).data();
-	    void *value  = (void *) (RdmaZoneBaseAddress + oldBlock->indexCache * BLOCK_SIZE);
-	    storage->db.set((const char *)key, sizeof(key), (const char *)value, BLOCK_SIZE);
-	    Debug::debugItem("LRUInsert:: Dirty data have been moved to the SSD tier");
+	} else {
+	    char *buffer = NULL;
+	    uint64_t length = BLOCK_SIZE;
+	    if (oldBlock->codec != CODEC_NONE) {
+		buffer = (char *)malloc(BLOCK_SIZE);
+		length = encodeBlock(oldBlock->codec, value, buffer);
+		if (length == BLOCK_SIZE) {
+		    free(buffer);
+		    buffer = NULL;
+		}
+	    }
+	    /*Write back asynchronously, the RDMA block is released when the write completes*/
+	    writeBackBlock(oldBlock->StorageAddress, oldBlock->tier, (buffer != NULL) ? buffer : value, length, buffer, oldBlock->indexCache);
+	    Debug::debugItem("LRUInsert:: Dirty data are being moved to tier %d", (int)oldBlock->tier);
+	    return true;
 	}
 	storage->tableBlock->remove(oldBlock->indexCache);
     }
@@ -2883,16 +4882,883 @@ bool FileSystem::PrefetcherWorker(int id) {
   return true;
 }
 
+/* Queue a file to be staged in by stager threads. Only existence is checked here, progress can be
+   queried with stageStatus().
+   @param   path    Path of file.
+   @param   tier    Target tier. 0 for memory tier, otherwise blocks stay in their tier and only fill RDMA region.
+   @param   pin     Keep staged blocks in RDMA region until unpinned.
+   @return          If file is queued return true, otherwise return false. */
+bool FileSystem::stageIn(const char *path, uint16_t tier, bool pin)
+{
+    Debug::debugTitle("FileSystem::stageIn");
+    Debug::debugItem("Stage 1. Entry point. Path: %s.", path);
+    UniqueHash hashUnique;
+    HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
+    NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
+    uint64_t indexFileMeta;
+    bool isDirectory;
+    if (checkLocal(hashNode) == false) {
+        Debug::notifyError("Stage in %s on wrong node.", path);
+        return false;
+    } else if ((storage->hashtable->get(&hashUnique, &indexFileMeta, &isDirectory) == false) || (isDirectory == true)) {
+        Debug::notifyError("Stage in %s failed, not a file.", path);
+        return false;
+    } else {
+        StageTask *task = (StageTask *)malloc(sizeof(StageTask));
+        strcpy(task->path, path);
+        task->tier = tier;
+        task->pin = pin;
+        countStagePending++;
+        Stage_queue.push(task);
+        return true;
+    }
+}
+
+/* Stage all blocks of a file and update block info in file meta. Called by stager threads. Local
+   blocks are staged under the file lock. Remote ones are staged without it, and their block infos
+   are updated afterwards if the file still has them.
+   @param   path    Path of file.
+   @param   tier    Target tier.
+   @param   pin     Pin blocks or not.
+   @return          If all blocks are staged return true, otherwise return false. */
+bool FileSystem::stageFile(const char *path, uint16_t tier, bool pin)
+{
+    Debug::debugTitle("FileSystem::stageFile");
+    Debug::debugItem("Stage 1. Entry point. Path: %s.", path);
+    UniqueHash hashUnique;
+    HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
+    NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
+    AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
+    bool result;
+    std::vector<std::pair<uint64_t, BlockInfo> > remotes; /* Index and copy of blocks on other nodes. */
+    uint64_t key = lockWriteHashItem(hashNode, hashAddress); /* Block info might be changed. */
+    uint64_t indexFileMeta;
+    bool isDirectory;
+    FileMeta *metaFile;                 /* Block infos are updated in place. */
+    if ((storage->hashtable->get(&hashUnique, &indexFileMeta, &isDirectory) == false) || (isDirectory == true)) {
+        result = false;                 /* File has been removed after it was queued. */
+    } else if (storage->tableFileMeta->reference(indexFileMeta, &metaFile) == false) {
+        result = false;
+    } else {
+        Debug::debugItem("Stage 2. Stage %d blocks.", (int)metaFile->count);
+        result = true;
+        for (uint64_t i = 0; i < metaFile->count; i++) {
+            BlockInfo *block = getBlockInfo(metaFile, i, false);
+            if (block->nodeID != (uint16_t)hashLocalNode) {
+                remotes.push_back(std::make_pair(i, *block));
+            } else if (promoteBlock(block->key, block, tier, pin)) {
+                countStageBlockStaged++;
+            } else {
+                countStageBlockFailed++;
+                result = false;
+            }
+        }
+    }
+    unlockWriteHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
+    if (remotes.empty()) {
+        Debug::debugItem("Stage end.");
+        return result;
+    }
+    Debug::debugItem("Stage 3. Stage %d remote blocks.", (int)remotes.size());
+    for (size_t i = 0; i < remotes.size(); i++) {
+        if (stageRemoteBlock(remotes[i].second.key, &(remotes[i].second), tier, pin, MESSAGE_STAGEBLOCK)) {
+            countStageBlockStaged++;
+        } else {
+            countStageBlockFailed++;
+            remotes[i].second.key = 0; /* Nothing to update. */
+            result = false;
+        }
+    }
+    key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
+    if ((storage->hashtable->get(&hashUnique, &indexFileMeta, &isDirectory) == true) && (isDirectory == false) &&
+        (storage->tableFileMeta->reference(indexFileMeta, &metaFile) == true)) {
+        for (size_t i = 0; i < remotes.size(); i++) {
+            const BlockInfo *staged = &(remotes[i].second);
+            if ((staged->key == 0) || (remotes[i].first >= metaFile->count)) {
+                continue;
+            }
+            BlockInfo *block = getBlockInfo(metaFile, remotes[i].first, false);
+            if (block->key == staged->key) { /* Block is still there, only take what staging changes. */
+                block->tier = staged->tier;
+                block->indexMem = staged->indexMem;
+                block->StorageAddress = staged->StorageAddress;
+                block->indexCache = staged->indexCache;
+                block->present = staged->present;
+            }
+        }
+    }
+    unlockWriteHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
+    Debug::debugItem("Stage end.");
+    return result;
+}
+
+/* Promote a local block to target tier and make sure it resides in RDMA region.
+   @param   uniqueHashValue Key of block.
+   @param   block           Block info in file meta. Updated if tier or cache index changes.
+   @param   tier            Target tier.
+   @param   pin             Pin block in RDMA region.
+   @return                  If succeed return true, otherwise return false. */
+bool FileSystem::promoteBlock(uint64_t uniqueHashValue, BlockInfo *block, uint16_t tier, bool pin)
+{
+    if ((tier == 0) && (moveBlockTier(uniqueHashValue, block, 0) == false)) {
+        return false;
+    }
+    if (isBlockInPlace(block)) {        /* Memory tier is resident already. */
+        block->present = true;
+        return true;
+    }
+    /* Pin before filling, so block cannot be evicted before it is looked up. */
+    bool pinned = pin ? storage->BlockManager->pin(uniqueHashValue) : true;
+    BlockInfo cachedBlock;
+    if (!storage->BlockManager->find(uniqueHashValue, &cachedBlock)) {
+        if ((fillRDMARegion(uniqueHashValue, block->BlockID, block, NULL, false) == false) ||
+            (storage->BlockManager->find(uniqueHashValue, &cachedBlock) == false)) {
+            if (pin && pinned) {
+                storage->BlockManager->unpin(uniqueHashValue);
+            }
+            return false;
+        }
+    }
+    block->indexCache = cachedBlock.indexCache;
+    block->present = true;
+    if (!pinned) {
+        Debug::notifyError("Too many blocks are pinned, block %d is staged unpinned.", (int)block->BlockID);
+        return false;
+    }
+    return true;
+}
+
+/* Move a local block between memory tier, SSD tier and spill tier. A cached copy in RDMA region is
+   the latest data, it stays cached and only its write back target changes, unless block is served
+   in place afterwards and the copy is dropped.
+   @param   uniqueHashValue Key of block.
+   @param   block           Block info in file meta. Updated on success.
+   @param   tier            Target tier, 0, 1 or TIER_SPILL.
+   @return                  If block resides in target tier return true, otherwise return false. */
+bool FileSystem::moveBlockTier(uint64_t uniqueHashValue, BlockInfo *block, uint16_t tier)
+{
+    if (block->tier == tier) {
+        return true;
+    }
+    uint64_t MemZoneBaseAddress = server->getMemoryManagerInstance()->getExtraDataAddress();
+    uint64_t RdmaZoneBaseAddress = server->getMemoryManagerInstance()->getDataAddress();
+    BlockInfo cachedBlock;
+    bool cached = storage->BlockManager->find(uniqueHashValue, &cachedBlock);
+    BlockInfo target = *block;
+    target.tier = tier;
+    target.indexMem = -1;
+    target.StorageAddress = uniqueHashValue;
+    if ((tier == 0) && (block->codec == CODEC_NONE)) {
+        uint64_t indexCurrentMemBlock;
+        if (createMemBlock(&indexCurrentMemBlock) == false) {
+            Debug::notifyError("Memory tier is full, block %d stays in tier %d.", (int)block->BlockID, (int)block->tier);
+            return false;
+        }
+        target.indexMem = indexCurrentMemBlock;
+        target.StorageAddress = MemZoneBaseAddress + indexCurrentMemBlock * BLOCK_SIZE;
+    }
+    bool result;
+    if (cached) {
+        result = storeBlock(uniqueHashValue, &target, (const char *)(RdmaZoneBaseAddress + cachedBlock.indexCache * BLOCK_SIZE));
+    } else {
+        char *buffer = (char *)malloc(BLOCK_SIZE);
+        result = loadBlock(uniqueHashValue, block, buffer) && storeBlock(uniqueHashValue, &target, buffer);
+        free(buffer);
+    }
+    if (result == false) {
+        Debug::notifyError("Move block %d from tier %d to tier %d failed.", (int)block->BlockID, (int)block->tier, (int)tier);
+        if ((tier == 0) && (block->codec == CODEC_NONE)) {
+            storage->extraTableBlock->remove(target.indexMem);
+        }
+        return false;
+    }
+    /* Release source, except stores shared with target which storeBlock has already updated. */
+    if ((block->tier == 0) && (block->codec == CODEC_NONE)) {
+        retireMemBlock(block->indexMem);
+    } else {
+        BlockStore *storesSource[3], *storesTarget[3];
+        int countSource = getBlockStores(block, storesSource);
+        int countTarget = ((tier == 0) && (block->codec == CODEC_NONE)) ? 0 : getBlockStores(&target, storesTarget);
+        for (int i = 0; i < countSource; i++) {
+            if (std::find(storesTarget, storesTarget + countTarget, storesSource[i]) == storesTarget + countTarget) {
+                storesSource[i]->remove(uniqueHashValue);
+            }
+        }
+    }
+    block->tier = target.tier;
+    block->indexMem = target.indexMem;
+    block->StorageAddress = target.StorageAddress;
+    Debug::debugItem("Block %d is moved to tier %d.", (int)block->BlockID, (int)tier);
+    if (cached && isBlockInPlace(block)) {
+        storage->BlockManager->remove(uniqueHashValue);
+        storage->tableBlock->remove(cachedBlock.indexCache);
+    } else if (cached) {
+        cachedBlock.tier = block->tier;
+        cachedBlock.indexMem = block->indexMem;
+        cachedBlock.StorageAddress = block->StorageAddress;
+        LRUInsert(uniqueHashValue, &cachedBlock);
+    }
+    return true;
+}
+
+/* Send stage or unpin request of a block to the node holding it.
+   @param   message     MESSAGE_STAGEBLOCK, MESSAGE_MIGRATEBLOCK or MESSAGE_UNPINBLOCK. */
+bool FileSystem::stageRemoteBlock(uint64_t uniqueHashValue, BlockInfo *block, uint16_t tier, bool pin, Message message) {
+    Debug::debugItem("Send block stage request to remote node, nodeid is %d", (int)block->nodeID);
+    StageBlockSendBuffer bufferSend;
+    bufferSend.message = message;
+    bufferSend.uniqueHashValue = uniqueHashValue;
+    bufferSend.tier = tier;
+    bufferSend.pin = pin;
+    bufferSend.block = *block;
+    StageBlockReceiveBuffer bufferReceive;
+    RdmaCall(block->nodeID, (char *)&bufferSend, (uint64_t)sizeof(StageBlockSendBuffer), (char *)&bufferReceive, (uint64_t)sizeof(StageBlockReceiveBuffer));
+    if (bufferReceive.result == false) {
+        Debug::notifyError("Remote Call on StageBlock With Error.");
+        return false;
+    }
+    if ((message == MESSAGE_STAGEBLOCK) || (message == MESSAGE_MIGRATEBLOCK)) {
+        *block = bufferReceive.block;
+    }
+    return true;
+}
+
+/* Unpin all blocks of a file, they will be evicted from RDMA region by LRU strategy again.
+   @param   path    Path of file.
+   @return          If succeed return true, otherwise return false. */
+bool FileSystem::unpin(const char *path)
+{
+    Debug::debugTitle("FileSystem::unpin");
+    Debug::debugItem("Stage 1. Entry point. Path: %s.", path);
+    UniqueHash hashUnique;
+    HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
+    NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
+    AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
+    if (checkLocal(hashNode) == false) {
+        return false;
+    }
+    bool result;
+    uint64_t key = lockReadHashItem(hashNode, hashAddress); /* Lock hash item. */
+    uint64_t indexFileMeta;
+    bool isDirectory;
+    const FileMeta *metaFile;
+    if ((storage->hashtable->get(&hashUnique, &indexFileMeta, &isDirectory) == false) || (isDirectory == true)) {
+        result = false;
+    } else if (storage->tableFileMeta->view(indexFileMeta, &metaFile) == false) {
+        result = false;
+    } else {
+        result = true;
+        for (uint64_t i = 0; i < metaFile->count; i++) {
+            BlockInfo block = *getBlockInfo(metaFile, i); /* Unpin does not change block info. */
+            uint64_t uniqueHashValue = block.key;
+            if (block.nodeID == (uint16_t)hashLocalNode) {
+                storage->BlockManager->unpin(uniqueHashValue);
+            } else {
+                if (stageRemoteBlock(uniqueHashValue, &block, 0, false, MESSAGE_UNPINBLOCK) == false) {
+                    result = false;
+                }
+            }
+        }
+    }
+    unlockReadHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
+    return result;
+}
+
+/* Get staging progress of this node. Block counters are accumulated since start. */
+void FileSystem::stageStatus(uint64_t *countFilePending, uint64_t *countBlockStaged, uint64_t *countBlockFailed)
+{
+    *countFilePending = countStagePending.load();
+    *countBlockStaged = countStageBlockStaged.load();
+    *countBlockFailed = countStageBlockFailed.load();
+}
+
+/*Stage-in Task*/
+bool FileSystem::StagerWorker(int id) {
+  StageTask *task;
+  bool registered = false;
+  while (true) {
+    task = Stage_queue.pop();
+    if (!registered) {
+      /* Use the last server message slots, they are not used by RPC workers. */
+      server->getMemoryManagerInstance()->setID(SERVER_MASSAGE_NUM - 1 - id);
+      registered = true;
+    }
+    Debug::debugItem("Stager %d stages file %s", id, task->path);
+    if (!stageFile(task->path, task->tier, task->pin)) {
+      Debug::notifyError("Stage in file %s failed.", task->path);
+    }
+    countStagePending--;
+    free(task);
+  }
+  return true;
+}
+
+/* Queue a file to be drained under drain path by drainer threads. Completion can be queried with stageOutStatus().
+   @param   path    Path of file.
+   @return          If file is queued return true, otherwise return false. */
+bool FileSystem::stageOut(const char *path)
+{
+    Debug::debugTitle("FileSystem::stageOut");
+    Debug::debugItem("Stage 1. Entry point. Path: %s.", path);
+    UniqueHash hashUnique;
+    HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
+    NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
+    uint64_t indexFileMeta;
+    bool isDirectory;
+    if (checkLocal(hashNode) == false) {
+        Debug::notifyError("Stage out %s on wrong node.", path);
+        return false;
+    } else if ((storage->hashtable->get(&hashUnique, &indexFileMeta, &isDirectory) == false) || (isDirectory == true)) {
+        Debug::notifyError("Stage out %s failed, not a file.", path);
+        return false;
+    } else {
+        {
+            std::lock_guard<std::mutex> lockDrain(mutexDrain);
+            if (drainState[path] == DRAIN_PENDING) {
+                return true;            /* Already queued. */
+            }
+            drainState[path] = DRAIN_PENDING;
+        }
+        char *task = (char *)malloc(MAX_PATH_LENGTH);
+        strcpy(task, path);
+        Drain_queue.push(task);
+        return true;
+    }
+}
+
+/* Get stage-out state of a file. State of a finished drain is kept for DRAIN_STATE_KEEP_TIME. */
+DrainState FileSystem::stageOutStatus(const char *path)
+{
+    std::lock_guard<std::mutex> lockDrain(mutexDrain);
+    auto it = drainState.find(path);
+    if (it == drainState.end()) {
+        return DRAIN_NONE;
+    } else {
+        return it->second;
+    }
+}
+
+/* Take size, write generation and block infos of a file under its read lock.
+   @param   path            Path of file.
+   @param   size            Buffer of file size.
+   @param   generation      Buffer of write generation, changed by every write of file.
+   @param   blocks          Buffer of block infos, cleared first.
+   @return                  If file exists return true, otherwise return false. */
+bool FileSystem::snapshotFile(const char *path, uint64_t *size, uint64_t *generation, std::vector<BlockInfo> *blocks)
+{
+    UniqueHash hashUnique;
+    HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
+    NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
+    AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
+    bool result;
+    uint64_t key = lockReadHashItem(hashNode, hashAddress); /* Lock hash item. */
+    uint64_t indexFileMeta;
+    bool isDirectory;
+    const FileMeta *metaFile;
+    blocks->clear();
+    if ((storage->hashtable->get(&hashUnique, &indexFileMeta, &isDirectory) == false) || (isDirectory == true)) {
+        result = false;
+    } else if (storage->tableFileMeta->view(indexFileMeta, &metaFile) == false) {
+        result = false;
+    } else {
+        *size = metaFile->size;
+        *generation = metaFile->generation;
+        for (uint64_t i = 0; i < metaFile->count; i++) {
+            blocks->push_back(*getBlockInfo(metaFile, i));
+        }
+        result = true;
+    }
+    unlockReadHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
+    return result;
+}
+
+/* Copy all blocks of a file to the same path under drain path. Blocks on other nodes are written
+   by those nodes directly, so drain path should be shared by all servers. Block infos are taken
+   under the file lock, and blocks are copied and throttled without it. If the file is written,
+   truncated or removed meanwhile, which changes its write generation, the drain fails.
+   @param   path    Path of file.
+   @return          If all blocks are drained return true, otherwise return false. */
+bool FileSystem::drainFile(const char *path)
+{
+    Debug::debugTitle("FileSystem::drainFile");
+    Debug::debugItem("Stage 1. Entry point. Path: %s.", path);
+    uint64_t sizeFile;
+    uint64_t generation;
+    std::vector<BlockInfo> blocks;
+    if (snapshotFile(path, &sizeFile, &generation, &blocks) == false) {
+        Debug::notifyError("Drain %s failed, file has been removed after it was queued.", path);
+        return false;
+    }
+    Debug::debugItem("Stage 2. Create target file.");
+    char target[MAX_PATH_LENGTH * 2];
+    sprintf(target, "%s%s", drainPath, path);
+    for (char *p = target + 1; *p != '\0'; p++) { /* Create parent directories in target. */
+        if (*p == '/') {
+            *p = '\0';
+            ::mkdir(target, 0755);
+            *p = '/';
+        }
+    }
+    int fd = ::open(target, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool result = (fd >= 0) && (ftruncate(fd, sizeFile) == 0);
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (result == false) {
+        Debug::notifyError("Create drain target %s failed.", target);
+        return false;
+    }
+    Debug::debugItem("Stage 3. Drain %d blocks.", (int)blocks.size());
+    for (size_t i = 0; (i < blocks.size()) && (result == true); i++) {
+        uint64_t offset = (uint64_t)blocks[i].BlockID * BLOCK_SIZE;
+        if (offset >= sizeFile) {
+            continue;                   /* Nothing valid in this block. */
+        }
+        uint64_t size = (sizeFile - offset) < BLOCK_SIZE ? (sizeFile - offset) : BLOCK_SIZE;
+        drainThrottle(size);            /* Sleep in drainer, never in RPC workers of other nodes. */
+        if (blocks[i].nodeID == (uint16_t)hashLocalNode) {
+            result = drainBlock(path, blocks[i].key, &blocks[i], offset, size);
+        } else {
+            result = drainRemoteBlock(path, blocks[i].key, &blocks[i], offset, size);
+        }
+    }
+    Debug::debugItem("Stage 4. Check file is not changed.");
+    uint64_t sizeNow;
+    uint64_t generationNow;
+    std::vector<BlockInfo> blocksNow;
+    if (result && ((snapshotFile(path, &sizeNow, &generationNow, &blocksNow) == false) ||
+                   (sizeNow != sizeFile) || (generationNow != generation) || (blocksNow.size() != blocks.size()))) {
+        Debug::notifyError("Drain %s failed, file is changed while draining.", path);
+        result = false;
+    }
+    Debug::debugItem("Stage end.");
+    return result;
+}
+
+/* Write valid part of a local block to target file, from whichever tier holds the latest data.
+   @param   path            Path of file.
+   @param   uniqueHashValue Key of block.
+   @param   block           Block info in file meta.
+   @param   offset          Offset of block in file.
+   @param   size            Valid size of block.
+   @return                  If succeed return true, otherwise return false. */
+bool FileSystem::drainBlock(const char *path, uint64_t uniqueHashValue, BlockInfo *block, uint64_t offset, uint64_t size)
+{
+    uint64_t RdmaZoneBaseAddress = server->getMemoryManagerInstance()->getDataAddress();
+    char target[MAX_PATH_LENGTH * 2];
+    sprintf(target, "%s%s", drainPath, path);
+    int fd = ::open(target, O_WRONLY);
+    if (fd < 0) {
+        Debug::notifyError("Open drain target %s failed.", target);
+        return false;
+    }
+    char *buffer = NULL;
+    char *src;
+    BlockInfo cachedBlock;
+    bool pinned = false;                /* Pinned here, unpinned once written. */
+    if (storage->BlockManager->find(uniqueHashValue, &cachedBlock, &pinned)) { /* Cached copy might be dirty. */
+        if ((pinned == false) && (storage->BlockManager->is_pinned(uniqueHashValue) == false)) {
+            Debug::notifyError("Too many blocks are pinned, block %d of %s is not drained.", (int)block->BlockID, path);
+            close(fd);
+            return false;               /* Copy could be evicted and its slot reused while it is written. */
+        }
+        src = (char *)(RdmaZoneBaseAddress + cachedBlock.indexCache * BLOCK_SIZE);
+    } else if ((block->tier == 0) && (block->codec == CODEC_NONE)) {
+        src = (char *)(block->StorageAddress);
+    } else {
+        buffer = (char *)malloc(BLOCK_SIZE);
+        loadBlock(uniqueHashValue, block, buffer);
+        src = buffer;
+    }
+    bool result = (pwrite(fd, src, size, offset) == (ssize_t)size);
+    if (result == false) {
+        Debug::notifyError("Drain block %d of %s failed.", (int)block->BlockID, path);
+    }
+    if (pinned == true) {
+        storage->BlockManager->unpin(uniqueHashValue);
+    }
+    close(fd);
+    free(buffer);
+    return result;
+}
+
+/*Sent drain block request to remote node*/
+bool FileSystem::drainRemoteBlock(const char *path, uint64_t uniqueHashValue, BlockInfo *block, uint64_t offset, uint64_t size) {
+    Debug::debugItem("Send block drain request to remote node, nodeid is %d", (int)block->nodeID);
+    DrainBlockSendBuffer bufferSend;
+    bufferSend.message = MESSAGE_DRAINBLOCK;
+    strcpy(bufferSend.path, path);
+    bufferSend.uniqueHashValue = uniqueHashValue;
+    bufferSend.offset = offset;
+    bufferSend.size = size;
+    bufferSend.block = *block;
+    GeneralReceiveBuffer bufferReceive;
+    RdmaCall(block->nodeID, (char *)&bufferSend, (uint64_t)sizeof(DrainBlockSendBuffer), (char *)&bufferReceive, (uint64_t)sizeof(GeneralReceiveBuffer));
+    if (bufferReceive.result == false) {
+        Debug::notifyError("Remote Call on DrainBlock With Error.");
+        return false;
+    }
+    return true;
+}
+
+/* Limit bandwidth of drains issued by this node, shared by all drainer threads.
+   @param   size    Size of data to write next. */
+void FileSystem::drainThrottle(uint64_t size)
+{
+    if (drainBandwidth == 0) {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t timeNow = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    uint64_t timeStart;
+    {
+        std::lock_guard<std::mutex> lockDrain(mutexDrain);
+        timeStart = drainNextTime > timeNow ? drainNextTime : timeNow;
+        drainNextTime = timeStart + size * 1000000000 / (drainBandwidth * 1024 * 1024);
+    }
+    if (timeStart > timeNow) {
+        usleep((timeStart - timeNow) / 1000);
+    }
+}
+
+/*Stage-out Task*/
+bool FileSystem::DrainerWorker(int id) {
+  char *path;
+  bool registered = false;
+  while (true) {
+    path = Drain_queue.pop();
+    if (!registered) {
+      /* Use server message slots below the ones of stagers. */
+      server->getMemoryManagerInstance()->setID(SERVER_MASSAGE_NUM - 1 - STAGER_NUMBER - id);
+      registered = true;
+    }
+    Debug::debugItem("Drainer %d drains file %s", id, path);
+    bool result = drainFile(path);
+    if (!result) {
+      Debug::notifyError("Stage out file %s failed.", path);
+    }
+    {
+      std::lock_guard<std::mutex> lockDrain(mutexDrain);
+      drainState[path] = result ? DRAIN_DONE : DRAIN_FAILED;
+      /* Forget states finished long ago. A path queued again meanwhile is pending and kept. */
+      time_t timeNow = time(NULL);
+      drainFinished.push_back(std::make_pair(timeNow, std::string(path)));
+      while (drainFinished.front().first + DRAIN_STATE_KEEP_TIME < timeNow) {
+        auto it = drainState.find(drainFinished.front().second);
+        if ((it != drainState.end()) && (it->second != DRAIN_PENDING)) {
+          drainState.erase(it);
+        }
+        drainFinished.pop_front();
+      }
+    }
+    free(path);
+  }
+  return true;
+}
+
+/* Account one access of a block in its heat. Called with file meta locked.
+   @param   uniqueHashValue Key of block.
+   @param   path            Path of file.
+   @param   block           Block info in file meta. */
+void FileSystem::recordHeat(uint64_t uniqueHashValue, const char *path, BlockInfo *block)
+{
+    HeatShard &shard = heatShards[uniqueHashValue % HEAT_SHARD_COUNT];
+    {
+        std::lock_guard<std::mutex> lockHeat(shard.mutex);
+        BlockHeat &heat = shard.blocks[uniqueHashValue];
+        if (heat.path.empty()) {
+            heat.path = path;
+            heat.heat = 0;
+        }
+        heat.BlockID = block->BlockID;
+        heat.tier = block->tier;
+        heat.heat++;
+    }
+    countAccessRound.fetch_add(1, std::memory_order_relaxed);
+}
+
+/* Drop heat of all blocks of a file, so stale paths are not kept. Called with file meta locked.
+   @param   metaFile    File meta. */
+void FileSystem::forgetHeat(const FileMeta *metaFile)
+{
+    for (uint64_t i = 0; i < metaFile->count; i++) {
+        uint64_t uniqueHashValue = getBlockInfo(metaFile, i)->key;
+        HeatShard &shard = heatShards[uniqueHashValue % HEAT_SHARD_COUNT];
+        std::lock_guard<std::mutex> lockHeat(shard.mutex);
+        shard.blocks.erase(uniqueHashValue);
+    }
+}
+
+/* Move a block of file to another tier and update file meta under write lock.
+   @param   path            Path of file.
+   @param   BlockID         ID of block.
+   @param   uniqueHashValue Key of block, nothing is moved if file no longer has it.
+   @param   tier            Target tier.
+   @return                  If succeed return true, otherwise return false. */
+bool FileSystem::migrateBlock(const char *path, uint32_t BlockID, uint64_t uniqueHashValue, uint16_t tier)
+{
+    Debug::debugTitle("FileSystem::migrateBlock");
+    Debug::debugItem("Stage 1. Entry point. Path: %s, block %d to tier %d.", path, (int)BlockID, (int)tier);
+    UniqueHash hashUnique;
+    HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
+    NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
+    AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
+    if (checkLocal(hashNode) == false) {
+        return false;
+    }
+    bool result;
+    uint64_t key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
+    uint64_t indexFileMeta;
+    bool isDirectory;
+    FileMeta *metaFile;
+    if ((storage->hashtable->get(&hashUnique, &indexFileMeta, &isDirectory) == false) || (isDirectory == true)) {
+        result = false;
+    } else if ((storage->tableFileMeta->reference(indexFileMeta, &metaFile) == false) || (BlockID >= metaFile->count)) {
+        result = false;
+    } else if (getBlockInfo(metaFile, BlockID, false)->key != uniqueHashValue) {
+        result = false;                 /* Path now names another file. */
+    } else {
+        BlockInfo *block = getBlockInfo(metaFile, BlockID, false);
+        if (block->nodeID == (uint16_t)hashLocalNode) {
+            result = moveBlockTier(uniqueHashValue, block, tier);
+        } else {
+            result = stageRemoteBlock(uniqueHashValue, block, tier, false, MESSAGE_MIGRATEBLOCK);
+        }
+    }
+    unlockWriteHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
+    return result;
+}
+
+/*Tier migration Task. Every round halves block heat, demotes idle memory tier blocks while memory
+  tier is under pressure and promotes hot SSD tier and spill tier blocks while there is room. Capacity of local
+  memory tier is used for remote blocks too, a full remote memory tier just rejects the move.*/
+bool FileSystem::MigratorWorker() {
+  bool registered = false;
+  while (true) {
+    sleep(MIGRATE_INTERVAL);
+    if (server == NULL) {
+      continue;
+    }
+    if (!registered) {
+      /* Use server message slot below the ones of stagers and drainers. */
+      server->getMemoryManagerInstance()->setID(SERVER_MASSAGE_NUM - 1 - STAGER_NUMBER - DRAINER_NUMBER);
+      registered = true;
+    }
+    std::vector<std::pair<uint64_t, BlockHeat> > hot, cold;
+    uint64_t countAccess = countAccessRound.exchange(0);
+    for (int i = 0; i < HEAT_SHARD_COUNT; i++) {
+      std::lock_guard<std::mutex> lockHeat(heatShards[i].mutex);
+      std::unordered_map<uint64_t, BlockHeat> &blockHeat = heatShards[i].blocks;
+      for (auto it = blockHeat.begin(); it != blockHeat.end(); ) {
+        it->second.heat >>= 1;
+        if ((it->second.tier != 0) && (it->second.heat >= MIGRATE_HOT_HEAT)) {
+          hot.push_back(*it);
+        } else if ((it->second.tier == 0) && (it->second.heat == 0)) {
+          cold.push_back(*it);
+        }
+        if ((it->second.tier != 0) && (it->second.heat == 0)) {
+          it = blockHeat.erase(it);
+        } else {
+          it++;
+        }
+      }
+    }
+    if (countAccess > MIGRATE_BUSY_ACCESS) {
+      Debug::debugItem("Migrator:: %ld accesses in last round, skip", (long)countAccess);
+      continue;
+    }
+    std::sort(hot.begin(), hot.end(), [](const std::pair<uint64_t, BlockHeat> &a, const std::pair<uint64_t, BlockHeat> &b) {
+      return a.second.heat > b.second.heat;
+    });
+    uint64_t budget = MIGRATE_BLOCKS_PER_ROUND;
+    uint64_t countMemoryTotal = storage->extraTableBlock->countTotalItems();
+    std::vector<std::pair<uint64_t, BlockHeat> > *candidates[2] = {&cold, &hot};
+    for (int direction = 0; direction < 2; direction++) {
+      for (auto it = candidates[direction]->begin(); (it != candidates[direction]->end()) && (budget > 0); it++) {
+        uint64_t percentFree = (countMemoryTotal == 0) ? 0 : /* No memory tier, only spilled blocks move. */
+            (countMemoryTotal - storage->extraTableBlock->countSavedItems()) * 100 / countMemoryTotal;
+        uint16_t tier = (direction == 0) ? 1 : 0;
+        if ((direction == 0) && (percentFree > PLACEMENT_MEMORY_PRESSURE)) {
+          break;
+        }
+        if ((direction == 1) && (percentFree <= PLACEMENT_MEMORY_RESERVE)) {
+          /* No room in memory tier, hot spilled blocks still come back to SSD tier. */
+          if ((it->second.tier != TIER_SPILL) || storage->tierSSD->full()) {
+            continue;
+          }
+          tier = 1;
+        }
+        bool result = migrateBlock(it->second.path.c_str(), it->second.BlockID, it->first, tier);
+        {
+          HeatShard &shard = heatShards[it->first % HEAT_SHARD_COUNT];
+          std::lock_guard<std::mutex> lockHeat(shard.mutex);
+          auto heat = shard.blocks.find(it->first);
+          if (heat != shard.blocks.end()) {
+            if (result) {
+              heat->second.tier = tier;
+            } else {
+              shard.blocks.erase(heat); /* File is gone or block cannot move, forget it until next access. */
+            }
+          }
+        }
+        if (result) {
+          budget--;
+          if (MIGRATE_BANDWIDTH != 0) {
+            usleep((uint64_t)BLOCK_SIZE * 1000000 / ((uint64_t)MIGRATE_BANDWIDTH * 1024 * 1024));
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+/*Write back Task. SSD tier write backs failed in completion callbacks are retried in spill tier.*/
+bool FileSystem::WriteBackerWorker() {
+  WriteBackTask *task;
+  while (true) {
+    task = WriteBack_queue.pop();
+    storage->tierSSD->remove(task->uniqueHashValue); /* Old copy would shadow the spilled one. */
+    writeBackBlock(task->uniqueHashValue, TIER_SPILL, task->data, task->length, task->buffer, task->indexCache);
+    delete task;
+  }
+  return true;
+}
+
+/*Directory split Task. Shards queued by updateDirectoryMeta are split one at a time, off the path of creates.*/
+bool FileSystem::SplitterWorker() {
+  SplitTask *task;
+  bool registered = false;
+  while (true) {
+    task = Split_queue.pop();
+    if (!registered) {
+      /* Use server message slot below the one of migrator. */
+      server->getMemoryManagerInstance()->setID(SERVER_MASSAGE_NUM - 2 - STAGER_NUMBER - DRAINER_NUMBER);
+      registered = true;
+    }
+    Debug::debugItem("Splitter splits shard %d of directory %s", (int)task->shard, task->path);
+    if (splitDirectory(task->path, task->shard) == false) {
+      Debug::notifyError("Split shard %d of directory %s failed.", (int)task->shard, task->path);
+    }
+    {
+      std::lock_guard<std::mutex> lockShard(mutexShard);
+      splitPending.erase(std::string(task->path) + "#" + std::to_string(task->shard));
+    }
+    free(task);
+  }
+  return true;
+}
+
+/* Set placement hint of a file. Only blocks created afterwards are affected.
+   @param   path    Path of file.
+   @param   hint    Placement hint, see PlacementHint.
+   @return          If succeed return true, otherwise return false. */
+bool FileSystem::setPlacementHint(const char *path, uint16_t hint)
+{
+    Debug::debugTitle("FileSystem::setPlacementHint");
+    Debug::debugItem("Stage 1. Entry point. Path: %s, hint: %d.", path, (int)hint);
+    if (hint > PLACEMENT_HINT_LOCAL) {
+        return false;
+    }
+    UniqueHash hashUnique;
+    HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
+    NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
+    AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
+    if (checkLocal(hashNode) == false) {
+        return false;
+    }
+    bool result;
+    uint64_t key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
+    uint64_t indexFileMeta;
+    bool isDirectory;
+    FileMeta *metaFile;
+    if ((storage->hashtable->get(&hashUnique, &indexFileMeta, &isDirectory) == false) || (isDirectory == true)) {
+        result = false;
+    } else if (storage->tableFileMeta->reference(indexFileMeta, &metaFile) == false) {
+        result = false;
+    } else {
+        metaFile->hintPlacement = hint;
+        result = true;
+    }
+    unlockWriteHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
+    return result;
+}
+
+/* Set codec of a file or directory. Blocks of a file created afterwards are compressed with it,
+   files and directories created in a directory inherit it.
+   @param   path    Path of file or directory.
+   @param   codec   Codec, see BlockCodec.
+   @return          If succeed return true, otherwise return false. */
+bool FileSystem::setCompression(const char *path, uint16_t codec)
+{
+    Debug::debugTitle("FileSystem::setCompression");
+    Debug::debugItem("Stage 1. Entry point. Path: %s, codec: %s.", path, Codec::name(codec));
+    if (Codec::available(codec) == false) {
+        Debug::notifyError("Codec %s is not built in.", Codec::name(codec));
+        return false;
+    }
+    UniqueHash hashUnique;
+    HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
+    NodeHash hashNode = storage->getNodeHash(&hashUnique); /* Get node hash by unique hash. */
+    AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
+    if (checkLocal(hashNode) == false) {
+        return false;
+    }
+    bool result;
+    uint64_t key = lockWriteHashItem(hashNode, hashAddress); /* Lock hash item. */
+    uint64_t indexMeta;
+    bool isDirectory;
+    if (storage->hashtable->get(&hashUnique, &indexMeta, &isDirectory) == false) {
+        result = false;
+    } else if (isDirectory == true) {
+        DirectoryMeta *metaDirectory;
+        result = storage->tableDirectoryMeta->reference(indexMeta, &metaDirectory);
+        if (result) {
+            metaDirectory->codec = codec;
+        }
+    } else {
+        FileMeta *metaFile;
+        result = storage->tableFileMeta->reference(indexMeta, &metaFile);
+        if (result) {
+            metaFile->codec = codec;
+        }
+    }
+    unlockWriteHashItem(key, hashNode, hashAddress); /* Unlock hash item. */
+    return result;
+}
+
+/* Replace placement policy. Safe while blocks are placed, old policy is released after its last
+   place() returns.
+   @param   policy  New policy, owned by file system afterwards, ignored if NULL. */
+void FileSystem::setPlacementPolicy(PlacementPolicy *policy)
+{
+    if (policy != NULL) {
+        std::atomic_store(&placement, std::shared_ptr<PlacementPolicy>(policy));
+    }
+}
+
+/* Set stage-out target from configuration. Called before anything is staged out.
+   @param   path        Target directory, normally on the parallel file system.
+   @param   bandwidth   Drain bandwidth in MB/s issued by this node, 0 for unlimited. */
+void FileSystem::setDrainTarget(const char *path, uint64_t bandwidth)
+{
+    strncpy(drainPath, path, MAX_PATH_LENGTH - 1);
+    drainPath[MAX_PATH_LENGTH - 1] = '\0';
+    drainBandwidth = bandwidth;
+}
+
 /* Constructor of file system. 
    @param   buffer              Buffer of memory.
    @param   countFile           Max count of file.
    @param   countDirectory      Max count of directory.
    @param   countBlock          Max count of blocks. 
    @param   countNode           Max count of nodes.
-   @param   hashLocalNode       Local node hash. From 1 to countNode. */
+   @param   hashLocalNode       Local node hash. From 1 to countNode.
+   @param   recover             Memory is reattached from last run, keep metadata and tiers. */
 FileSystem::FileSystem(char *buffer, char *bufferBlock, char *extraBlock, uint64_t countFile,
                        uint64_t countDirectory, uint64_t countBlock, 
-                       uint64_t countNode, NodeHash hashLocalNode)
+                       uint64_t countNode, NodeHash hashLocalNode, bool recover)
 {
     if ((buffer == NULL) || (bufferBlock == NULL) || (countFile == 0) || (countDirectory == 0) ||
         (countBlock == 0) || (countNode == 0) || (hashLocalNode < 1) || 
@@ -2902,7 +5768,11 @@ FileSystem::FileSystem(char *buffer, char *bufferBlock, char *extraBlock, uint64
         exit(EXIT_FAILURE);             /* Exit due to parameter error. */
     } else {
         this->addressHashTable = (uint64_t)buffer;
-        storage = new Storage(buffer, bufferBlock, extraBlock, countFile, countDirectory, countBlock, countNode); /* Initialize storage instance. */
+        this->countNode = countNode;
+        storage = new Storage(buffer, bufferBlock, extraBlock, countFile, countDirectory, countBlock, countNode, recover); /* Initialize storage instance. */
+        if (recover) {
+            rebuildDirectories();       /* Before workers and RPC workers start. */
+        }
 	printf("Debug-FileSystem.cpp: Storage init done\n");
         lock = new LockService((uint64_t)buffer);
 	printf("Debug-FileSystem.cpp: lock service done\n");
@@ -2917,10 +5787,45 @@ FileSystem::FileSystem(char *buffer, char *bufferBlock, char *extraBlock, uint64
     Prefetch_stride.previous_blockID = -1;
     Prefetch_stride.stride = 1;
     Prefetch_stride.Hitonce = false;
+    countStagePending = 0;
+    countStageBlockStaged = 0;
+    countStageBlockFailed = 0;
+    for (int i = 0; i < STAGER_NUMBER; i++) {
+      Stager[i] = thread(&FileSystem::StagerWorker, this, i);
+    }
+    Debug::debugItem("FileSystem:: Init stager thread");
+    drainNextTime = 0;
+    setDrainTarget("/tmp/DRAIN", 0);
+    for (int i = 0; i < DRAINER_NUMBER; i++) {
+      Drainer[i] = thread(&FileSystem::DrainerWorker, this, i);
+    }
+    Debug::debugItem("FileSystem:: Init drainer thread");
+    WriteBacker = thread(&FileSystem::WriteBackerWorker, this);
+    Debug::debugItem("FileSystem:: Init write back thread");
+    countAccessRound = 0;
+    timeLeaseSweep = 0;
+    Migrator = thread(&FileSystem::MigratorWorker, this);
+    Debug::debugItem("FileSystem:: Init migrator thread");
+    Splitter = thread(&FileSystem::SplitterWorker, this);
+    Debug::debugItem("FileSystem:: Init splitter thread");
+    placement.reset(PlacementPolicy::create(PLACEMENT_POLICY));
+    if (placement == NULL) {
+        fprintf(stderr, "FileSystem::FileSystem: unknown placement policy %s, use local.\n", PLACEMENT_POLICY);
+        placement.reset(new LocalPlacementPolicy());
+    }
 }
 /* Destructor of file system. */
 FileSystem::~FileSystem()
 {
     delete storage;                     /* Release storage instance. */
     Prefecther[0].detach();
+    for (int i = 0; i < STAGER_NUMBER; i++) {
+      Stager[i].detach();
+    }
+    for (int i = 0; i < DRAINER_NUMBER; i++) {
+      Drainer[i].detach();
+    }
+    WriteBacker.detach();
+    Migrator.detach();
+    Splitter.detach();
 }
@@ -1,13 +1,100 @@
 /*** Hash table class for index in file system. ***/
 
-/** Version 2 + Crypto++ support. **/
+/** Version 4. Non-cryptographic path hash, verified by a second hash family. **/
 
 /* FIXME: Ignore malloc failure. Do not examine the length of path. */
 
 /** Included files. **/
 #include "hashtable.hpp"
+#ifdef __SSE2__
+#include <emmintrin.h>                  /* SSE2 intrinsics. */
+#endif
 /** Global variable. **/
-// SHA256 sha256;                          /* FIXME: Is SHA256 class thread-safe? */
+static thread_local const char *pathHint = NULL; /* Path whose hash was sent by client. */
+static thread_local uint64_t lengthHint;
+static thread_local UniqueHash hashHint;
+static std::vector<std::pair<std::string, uint16_t> > colocations; /* Root and spread of colocated subtrees, set before use. */
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/* 128-bit MurmurHash3 (x64 variant). Output does not depend on byte order of host.
+   @param   buf         Buffer of original data.
+   @param   len         Length of buffer.
+   @param   seed        Seed.
+   @param   out         Buffer of two 64-bit words. */
+static void hash128(const char *buf, uint64_t len, uint64_t seed, uint64_t *out)
+{
+    const uint8_t *data = (const uint8_t *)buf;
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = seed, h2 = seed;
+    uint64_t countBlock = len / 16;
+    for (uint64_t i = 0; i < countBlock; i++) {
+        uint64_t k1, k2;
+        memcpy(&k1, data + i * 16, sizeof(uint64_t)); /* Unaligned safe load. */
+        memcpy(&k2, data + i * 16 + 8, sizeof(uint64_t));
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+    const uint8_t *tail = data + countBlock * 16;
+    uint64_t k1 = 0, k2 = 0;
+    switch (len & 15) {
+        case 15: k2 ^= (uint64_t)tail[14] << 48;
+        case 14: k2 ^= (uint64_t)tail[13] << 40;
+        case 13: k2 ^= (uint64_t)tail[12] << 32;
+        case 12: k2 ^= (uint64_t)tail[11] << 24;
+        case 11: k2 ^= (uint64_t)tail[10] << 16;
+        case 10: k2 ^= (uint64_t)tail[9] << 8;
+        case 9:  k2 ^= (uint64_t)tail[8];
+                 k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        case 8:  k1 ^= (uint64_t)tail[7] << 56;
+        case 7:  k1 ^= (uint64_t)tail[6] << 48;
+        case 6:  k1 ^= (uint64_t)tail[5] << 40;
+        case 5:  k1 ^= (uint64_t)tail[4] << 32;
+        case 4:  k1 ^= (uint64_t)tail[3] << 24;
+        case 3:  k1 ^= (uint64_t)tail[2] << 16;
+        case 2:  k1 ^= (uint64_t)tail[1] << 8;
+        case 1:  k1 ^= (uint64_t)tail[0];
+                 k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+    h1 ^= len; h2 ^= len;
+    h1 += h2; h2 += h1;
+    h1 = fmix64(h1); h2 = fmix64(h2);
+    h1 += h2; h2 += h1;
+    out[0] = h1;
+    out[1] = h2;
+}
+
+/* Verification and placement hash, 64-bit FNV-1a. It shares nothing with MurmurHash3, so a path
+   matching another in value[1] still differs here.
+   @param   buf         Buffer of original data.
+   @param   len         Length of buffer.
+   @param   out         Buffer of two 64-bit words, value[2] and value[3] of unique hash. */
+static void hashVerify(const char *buf, uint64_t len, uint64_t *out)
+{
+    uint64_t h = HASH_FNV_BASIS;
+    for (uint64_t i = 0; i < len; i++) {
+        h ^= (uint8_t)buf[i];
+        h *= HASH_FNV_PRIME;
+    }
+    out[0] = h;
+    out[1] = fmix64(h ^ HASH_SEED_SECONDARY); /* FNV-1a low bits are weak, mix before taking modulo. */
+}
 
 /* Get address hash of specific string. No check of parameter here.
    @param   buf         Buffer of original data.
@@ -15,15 +102,9 @@
    @param   hashAddress Buffer of address hash. */
 void HashTable::getAddressHash(const char *buf, uint64_t len, AddressHash *hashAddress)
 {
-    uint64_t sha256_buf[4];
-    // SHA256 sha256;
-    SHA256 sha256;
-    sha256.CalculateDigest((byte *)sha256_buf, (const byte *)buf, len);
-    // SHA256_CTX ctx;                     /* Context. */
-    // sha256_init(&ctx);                  /* Initialize SHA-256 context. */
-    // sha256_update(&ctx, (const BYTE *)buf, len); /* Update SHA-256 context. */
-    // sha256_final(&ctx, (BYTE *)sha256_buf); /* Finalize SHA-256 context. */
-    *hashAddress = sha256_buf[0] & 0x00000000000FFFFF; /* Address hash. Get 20 bits. */
+    UniqueHash hashUnique;
+    getUniqueHash(buf, len, &hashUnique);
+    *hashAddress = getAddressHash(&hashUnique);
 }
 
 /* Get address hash of specific string by unique hash.
@@ -34,22 +115,163 @@ AddressHash HashTable::getAddressHash(UniqueHash *hashUnique)
     return hashUnique->value[0] & 0x00000000000FFFFF; /* Address hash. Get 20 bits. */
 }
 
-/* Get unique hash of specific string. No check of parameter here.
+/* Get unique hash of specific string. No check of parameter here. If buf is the hinted path,
+   value[0..1] sent by client are used, value[2..3] are always computed here.
    @param   buf         Buffer of original data.
    @param   len         Length of buffer.
    @param   hashUnique  Buffer of unique hash. */
 void HashTable::getUniqueHash(const char *buf, uint64_t len, UniqueHash *hashUnique)
 {
-    // SHA256 sha256;
-    SHA256 sha256;
-    sha256.CalculateDigest((byte *)hashUnique, (const byte *)buf, len);
-    // SHA256_CTX ctx;                     /* Context. */
-    // sha256_init(&ctx);                  /* Initialize SHA-256 context. */
-    // sha256_update(&ctx, (const BYTE *)buf, len); /* Update SHA-256 context. */
-    // sha256_final(&ctx, (BYTE *)hashUnique); /* Finalize SHA-256 context. */
+    if ((buf == pathHint) && (len == lengthHint)) {
+        hashUnique->value[0] = hashHint.value[0];
+        hashUnique->value[1] = hashHint.value[1];
+    } else {
+        hash128(buf, len, HASH_SEED_PRIMARY, &hashUnique->value[0]); /* Address, home group and tag. */
+    }
+    hashVerify(buf, len, &hashUnique->value[2]); /* Verification and placement. */
+    if ((colocations.empty() == false) && (len != 0) && (buf[0] == '/') && (memchr(buf, '\0', len) == NULL)) {
+        const std::pair<std::string, uint16_t> *subtree = NULL;
+        for (size_t i = 0; i < colocations.size(); i++) { /* Deepest root holding path. */
+            const std::string &root = colocations[i].first;
+            if ((len > root.size()) && (memcmp(buf, root.data(), root.size()) == 0) &&
+                ((buf[root.size()] == '/') || (root.size() == 1)) &&
+                ((subtree == NULL) || (root.size() > subtree->first.size()))) {
+                subtree = &colocations[i];
+            }
+        }
+        if (subtree != NULL) {
+            uint64_t hashRoot[2];
+            hashVerify(subtree->first.data(), subtree->first.size(), hashRoot);
+            uint64_t placement = hashRoot[1]; /* Node of root. */
+            if (subtree->second > 1) {
+                for (uint64_t end = subtree->first.size() + 1; end <= len; end++) {
+                    if ((end == len) || (buf[end] == '/')) {
+                        uint64_t hashPrefix[2];
+                        hash128(buf, end, HASH_SEED_PRIMARY, hashPrefix);
+                        placement += hashPrefix[0] % subtree->second; /* Within spread nodes after parent. */
+                    }
+                }
+            }
+            hashUnique->value[3] = placement; /* value[1] and value[2] still tell paths apart. */
+        }
+    }
+}
+
+/* Set colocated subtrees. Called once on start by clients and servers alike, before any hash.
+   @param   subtrees    Root path and spread of each subtree. Trailing '/' of root is dropped. */
+void HashTable::setColocation(const std::vector<std::pair<std::string, uint16_t> > &subtrees)
+{
+    colocations.clear();
+    for (size_t i = 0; i < subtrees.size(); i++) {
+        std::string root = subtrees[i].first;
+        while ((root.size() > 1) && (root[root.size() - 1] == '/')) {
+            root.erase(root.size() - 1);
+        }
+        if ((root.empty() == true) || (root[0] != '/') || (subtrees[i].second == 0)) {
+            Debug::notifyError("Colocated subtree %s is invalid, skipped.", subtrees[i].first.c_str());
+            continue;
+        }
+        colocations.push_back(std::make_pair(root, subtrees[i].second));
+        Debug::notifyInfo("Colocate metadata under %s, spread %d", root.c_str(), (int)subtrees[i].second);
+    }
 }
 
-/* Get a chained item. Check unique hash to judge if chained item is right or not. 
+/* Use hash computed by client for path of current request on this thread.
+   @param   path        Path in request buffer, NULL to clear hint.
+   @param   hashUnique  Unique hash of path. */
+void HashTable::setHint(const char *path, UniqueHash *hashUnique)
+{
+    pathHint = path;
+    if (path != NULL) {
+        lengthHint = strlen(path);
+        hashHint = *hashUnique;
+    }
+}
+
+/* Get mask of slots in a group whose control byte equals value.
+   @param   control     Control bytes of group, aligned to 16 bytes.
+   @param   value       Control byte to match.
+   @return              Bit i is set if slot i matches. */
+static inline uint32_t matchControl(const uint8_t *control, uint8_t value)
+{
+#ifdef __SSE2__
+    __m128i group = _mm_load_si128((const __m128i *)control);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)value)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < HASH_GROUP_SIZE; i++) {
+        if (__atomic_load_n(&control[i], __ATOMIC_RELAXED) == value) {
+            mask |= (1U << i);
+        }
+    }
+    return mask;
+#endif
+}
+
+/* Get tag of key, stored in control byte of its slot. */
+static inline uint8_t getTag(UniqueHash *hashUnique)
+{
+    return (uint8_t)(HASH_CONTROL_FULL | (hashUnique->value[1] >> 57));
+}
+
+/* Get home group of key.
+   @param   hashUnique  Unique hash.
+   @return              Index of group. */
+uint64_t HashTable::getGroup(UniqueHash *hashUnique)
+{
+    return (uint64_t)(((unsigned __int128)(hashUnique->value[1] << 7) * countGroup) >> 64); /* Bits below tag, mapped without division. */
+}
+
+/* Find slot of key. Caller makes sure result is consistent.
+   @param   hashUnique  Unique hash.
+   @param   slot        Buffer of index of slot.
+   @return              If key is found return true, otherwise return false. */
+bool HashTable::find(UniqueHash *hashUnique, uint64_t *slot)
+{
+    uint8_t tag = getTag(hashUnique);
+    uint64_t group = getGroup(hashUnique);
+    for (uint64_t i = 0; i < countGroup; i++) {
+        const uint8_t *control = controls + group * HASH_GROUP_SIZE;
+        uint32_t mask = matchControl(control, tag);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE); /* Entry is read after its tag. */
+        while (mask != 0) {
+            uint64_t index = group * HASH_GROUP_SIZE + __builtin_ctz(mask);
+            HashEntry *entry = &entries[index];
+            if ((entry->fingerprint[0] == hashUnique->value[1]) && (entry->fingerprint[1] == hashUnique->value[2]) &&
+                (entry->fingerprint[2] == hashUnique->value[3])) {
+                *slot = index;
+                return true;
+            }
+            mask &= mask - 1;
+        }
+        if (matchControl(control, HASH_CONTROL_EMPTY) != 0) {
+            return false;               /* Key would have been put here. */
+        }
+        group = (group + 1 == countGroup) ? 0 : group + 1; /* Probe next group. */
+    }
+    return false;
+}
+
+/* Lock stripe of key for writing and make its readers retry.
+   @param   group       Home group of key.
+   @return              Stripe locked. */
+HashStripe *HashTable::lockStripe(uint64_t group)
+{
+    HashStripe *stripe = &stripes[group % HASH_LOCK_STRIPES];
+    stripe->mutex.lock();
+    __atomic_store_n(&stripe->sequence, stripe->sequence + 1, __ATOMIC_RELAXED); /* Odd, readers wait. */
+    __atomic_thread_fence(__ATOMIC_RELEASE); /* Sequence is visible before slots change. */
+    return stripe;
+}
+
+/* Unlock stripe of key, readers started meanwhile will retry. */
+void HashTable::unlockStripe(HashStripe *stripe)
+{
+    __atomic_store_n(&stripe->sequence, stripe->sequence + 1, __ATOMIC_RELEASE); /* Even again. */
+    stripe->mutex.unlock();
+}
+
+/* Get an item. Check unique hash to judge if item is right or not. 
    @param   path        Path.
    @param   indexMeta   Buffer of meta index. 
    @param   isDirectory Buffer to judge if item is directory or not.
@@ -61,43 +283,12 @@ bool HashTable::get(const char *path, uint64_t *indexMeta, bool *isDirectory)
     } else {
         UniqueHash hashUnique;
         HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
-        // printf("%016x%016x%016x%016x\n", hashUnique.value[3], hashUnique.value[2], hashUnique.value[1], hashUnique.value[0]);
-        AddressHash hashAddress = HashTable::getAddressHash(&hashUnique); /* Get address hash by unique hash. */
-        // getAddressHash(path, strlen(path), &hashAddress); /* Get address hash. */
-        bool result;
-        mutexBitmapChainedItems.lock(); /* Though currently there is no bitmap reading or writing, other operations such as delete might affect hash item reading. */
-        {
-            uint64_t indexHead = itemsHash[hashAddress].indexHead;
-            if (indexHead == 0) {
-                result = false;         /* Fail due to no hash item. */
-            } else {
-                // UniqueHash hashUnique;
-                // getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
-                uint64_t indexCurrent = indexHead; /* Index of current chained item. */
-                bool found = false;
-                do {                    /* Traverse every chained item. */
-                    if (memcmp(&(itemsChained[indexCurrent].hashUnique), &(hashUnique), sizeof(UniqueHash)) == 0) {
-                        *indexMeta = itemsChained[indexCurrent].indexMeta; /* Save meta index. */
-                        *isDirectory = itemsChained[indexCurrent].isDirectory; /* Save state of directory. */
-                        found = true;   /* Found one matched. */
-                        break;          /* Jump out. */
-                    } else {
-                        indexCurrent = itemsChained[indexCurrent].indexNext; /* Move to next chained item. */
-                    }
-                } while (indexCurrent != 0); /* If current item is over last chained item then jump out. */
-                if (found == true) {
-                    result = true;      /* Succeed. Find one matched. */
-                } else {
-                    result = false;     /* Fail due to no chained item matched. */
-                }
-            }
-        }
-        mutexBitmapChainedItems.unlock(); /* Unlock hash table bitmap. */
-        return result;                  /* Return specific result. */
+        return get(&hashUnique, indexMeta, isDirectory);
     }
 }
 
-/* Get a chained item by hash. Check unique hash to judge if chained item is right or not. 
+/* Get an item by hash. No lock is taken, slots are probed again if a writer of the same stripe
+   ran meanwhile.
    @param   hashUnique  Unique hash.
    @param   indexMeta   Buffer of meta index. 
    @param   isDirectory Buffer to judge if item is directory or not.
@@ -107,48 +298,32 @@ bool HashTable::get(UniqueHash *hashUnique, uint64_t *indexMeta, bool *isDirecto
     if ((hashUnique == NULL) || (indexMeta == NULL) || (isDirectory == NULL)) {
         return false;                   /* Fail due to null parameters. */
     } else {
-    // UniqueHash hashUnique;
-    // getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
-    AddressHash hashAddress = HashTable::getAddressHash(hashUnique); /* Get address hash by unique hash. */
-    // getAddressHash(path, strlen(path), &hashAddress); /* Get address hash. */
-    bool result;
-        mutexBitmapChainedItems.lock(); /* Though currently there is no bitmap reading or writing, other operations such as delete might affect hash item reading. */
-        {
-            uint64_t indexHead = itemsHash[hashAddress].indexHead;
-            // Debug::debugItem("get hashAddress = %d, indexHead = %d", hashAddress, indexHead);
-            if (indexHead == 0) {
-                result = false;         /* Fail due to no hash item. */
-            } else {
-                // UniqueHash hashUnique;
-                // getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
-                uint64_t indexCurrent = indexHead; /* Index of current chained item. */
-                bool found = false;
-                do {                    /* Traverse every chained item. */
-                    //printf("5.0 indexCurrent = %d, itemsChained = %lx\n", indexCurrent, itemsChained);
-                    //printf("5.0 indexCurrent = %d, %lx\n", (int)indexCurrent, itemsChained[indexCurrent].hashUnique.value[0]);
-                    if (memcmp(&(itemsChained[indexCurrent].hashUnique), hashUnique, sizeof(UniqueHash)) == 0) {
-                        *indexMeta = itemsChained[indexCurrent].indexMeta; /* Save meta index. */
-                        *isDirectory = itemsChained[indexCurrent].isDirectory; /* Save state of directory. */
-                        found = true;   /* Found one matched. */
-                        break;          /* Jump out. */
-                    } else {
-                        indexCurrent = itemsChained[indexCurrent].indexNext; /* Move to next chained item. */
-                    }
-                } while (indexCurrent != 0); /* If current item is over last chained item then jump out. */
+        HashStripe *stripe = &stripes[getGroup(hashUnique) % HASH_LOCK_STRIPES];
+        while (true) {
+            uint64_t sequence = __atomic_load_n(&stripe->sequence, __ATOMIC_ACQUIRE);
+            if ((sequence & 1) != 0) {
+                std::this_thread::yield(); /* Writer is changing slots. */
+                continue;
+            }
+            uint64_t slot;
+            uint64_t meta = 0;
+            bool found = find(hashUnique, &slot);
+            if (found == true) {
+                meta = __atomic_load_n(&(entries[slot].meta), __ATOMIC_RELAXED);
+            }
+            __atomic_thread_fence(__ATOMIC_ACQUIRE); /* Reads above complete before sequence is checked. */
+            if (__atomic_load_n(&stripe->sequence, __ATOMIC_RELAXED) == sequence) {
                 if (found == true) {
-                    result = true;      /* Succeed. Find one matched. */
-                } else {
-                    result = false;     /* Fail due to no chained item matched. */
+                    *indexMeta = meta & ~HASH_META_DIRECTORY; /* Save meta index. */
+                    *isDirectory = ((meta & HASH_META_DIRECTORY) != 0); /* Save state of directory. */
                 }
+                return found;
             }
         }
-        // Debug::debugItem("comp hashAddress = %d, indexMeta = %d", hashAddress, *indexMeta);
-        mutexBitmapChainedItems.unlock(); /* Unlock hash table bitmap. */
-        return result;                  /* Return specific result. */
     }
 }
 
-/* Put a chained item. If item has already existed, old meta index will be replaced by the new one. 
+/* Put an item. If item has already existed, old meta index will be replaced by the new one. 
    @param   path        Path.
    @param   indexMeta   Meta index to put in. 
    @param   isDirectory Judge if item is directory.
@@ -158,87 +333,15 @@ bool HashTable::put(const char *path, uint64_t indexMeta, bool isDirectory)
     if (path == NULL) {
         return false;                   /* Fail due to null path. */
     } else {
-        AddressHash hashAddress;
-        HashTable::getAddressHash(path, strlen(path), &hashAddress); /* Get address hash. */
-        bool result;
-        mutexBitmapChainedItems.lock(); /* Lock hash table bitmap. */
-        {
-            uint64_t indexHead = itemsHash[hashAddress].indexHead;
-            if (indexHead == 0) {       /* If there is no item currently. */
-                // Debug::debugItem("No item currently.");
-                uint64_t index;
-                // if (bitmapChainedItems->findFree(&index) == false) { /* Method of bitmap search.
-                if (headFreeBit == NULL) { /* Method of free bit chain. */
-                    result = false;     /* Fail due to no free bit in bitmap. */
-                } else {
-                    index = headFreeBit->position; /* Get free bit index. */
-                    FreeBit *currentFreeBit = headFreeBit; /* Get current free bit. */
-                    headFreeBit = (FreeBit *)(headFreeBit->nextFreeBit); /* Move current free bit out of free bit chain. */
-                    free(currentFreeBit); /* Release current free bit as used. */
-                    if (bitmapChainedItems->set(index) == false) { /* Occupy the position first. Need not to roll back. */ 
-                        result = false; /* Fail due to bitmap set error. */
-                    } else {
-                        itemsChained[index].indexNext = 0; /* Next item does not exist. */
-                        itemsChained[index].indexMeta = indexMeta; /* Assign specific meta index. */
-                        itemsChained[index].isDirectory = isDirectory; /* Assign state of directory. */
-                        UniqueHash hashUnique;
-                        HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
-                        itemsChained[index].hashUnique = hashUnique; /* Assign unique hash of specific path. */
-                        itemsHash[hashAddress].indexHead = index; /* Finally fill the chained item into hash table. */
-                        result = true;  /* Succeed. */
-                    }
-                }
-            } else {                    /* If there is already a chain here. */
-                UniqueHash hashUnique;
-                getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
-                uint64_t indexCurrent = indexHead; /* Index of current chained item. */
-                uint64_t indexBeforeCurrent = 0; /* Index of item before current chained item. Initial value 0. */
-                bool found = false;
-                do {                    /* Traverse every chained item. */
-                    if (memcmp(&(itemsChained[indexCurrent].hashUnique), &hashUnique, sizeof(UniqueHash)) == 0) {
-                        itemsChained[indexCurrent].indexMeta = indexMeta; /* Update meta index. */
-                        itemsChained[indexCurrent].isDirectory = isDirectory; /* Update state of directory. */
-                        found = true;   /* Found one matched. */
-                        break;          /* Jump out. */
-                    } else {
-                        indexBeforeCurrent = indexCurrent; /* Must be assigned at least once. */
-                        indexCurrent = itemsChained[indexCurrent].indexNext; /* Move to next chained item. */
-                    }
-                } while (indexCurrent != 0); /* If current item is over last chained item then jump out (indexBeforeCurrent will point to last chained item). */
-                if (found == true) {    /* If chained item has been found and updated. */
-                    result = true;      /* Succeed. Updated meta index. */
-                } else {                /* If there is no matched chained item, a new one need to be created. */
-                    uint64_t index;
-                    // if (bitmapChainedItems->findFree(&index) == false) { /* Method of bitmap search. */
-                    if (headFreeBit == NULL) { /* Method of free bit chain. */
-                        result = false; /* Fail due to no free bit in bitmap. */
-                    } else {
-                        index = headFreeBit->position; /* Get free bit index. */
-                        FreeBit *currentFreeBit = headFreeBit; /* Get current free bit. */
-                        headFreeBit = (FreeBit *)(headFreeBit->nextFreeBit); /* Move current free bit out of free bit chain. */
-                        free(currentFreeBit); /* Release current free bit as used. */
-                        if (bitmapChainedItems->set(index) == false) { /* Occupy the position first. Need not to roll back. */ 
-                            result = false; /* Fail due to bitmap set error. */
-                        } else {
-                            itemsChained[index].indexNext = 0; /* Next item does not exist. */
-                            itemsChained[index].indexMeta = indexMeta; /* Assign specific meta index. */
-                            itemsChained[index].isDirectory = isDirectory; /* Assign state of directory. */
-                            UniqueHash hashUnique;
-                            HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
-                            itemsChained[index].hashUnique = hashUnique; /* Assign unique hash of specific path. */
-                            itemsChained[indexBeforeCurrent].indexNext = index; /* Finally fill the chained item into current last chained item. */
-                            result = true;  /* Succeed. Created chained item. */
-                        }
-                    }
-                }
-            }
-        }
-        mutexBitmapChainedItems.unlock(); /* Unlock hash table bitmap. */
-        return result;                  /* Return specific result. */
+        UniqueHash hashUnique;
+        HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
+        return put(&hashUnique, indexMeta, isDirectory);
     }
 }
 
-/* Put a chained item by hash. If item has already existed, old meta index will be replaced by the new one. 
+/* Put an item by hash. If item has already existed, old meta index will be replaced by the new one. 
+   A new item takes an empty slot only while full and deleted slots are under HASH_LOAD_MAX, so
+   lookups always end at an empty slot. Table is rebuilt once if deleted slots take the room left.
    @param   hashUnique  Unique hash.
    @param   indexMeta   Meta index to put in. 
    @param   isDirectory Judge if item is directory.
@@ -247,89 +350,54 @@ bool HashTable::put(UniqueHash *hashUnique, uint64_t indexMeta, bool isDirectory
 {
     if (hashUnique == NULL) {
         return false;                   /* Fail due to null unique hash. */
-    } else {
-        AddressHash hashAddress = HashTable::getAddressHash(hashUnique); /* Get address hash by unique hash. */
-        // getAddressHash(path, strlen(path), &hashAddress); /* Get address hash. */
-        bool result;
-        mutexBitmapChainedItems.lock(); /* Lock hash table bitmap. */
-        {
-            uint64_t indexHead = itemsHash[hashAddress].indexHead;
-            // Debug::debugItem("put hashAddress = %d, indexHead = %d", hashAddress, indexHead);
-            if (indexHead == 0) {       /* If there is no item currently. */
-                uint64_t index;
-                // if (bitmapChainedItems->findFree(&index) == false) { /* Method of bitmap search.
-                if (headFreeBit == NULL) { /* Method of free bit chain. */
-                    result = false;     /* Fail due to no free bit in bitmap. */
-                } else {
-                    index = headFreeBit->position; /* Get free bit index. */
-                    FreeBit *currentFreeBit = headFreeBit; /* Get current free bit. */
-                    headFreeBit = (FreeBit *)(headFreeBit->nextFreeBit); /* Move current free bit out of free bit chain. */
-                    free(currentFreeBit); /* Release current free bit as used. */
-                    if (bitmapChainedItems->set(index) == false) { /* Occupy the position first. Need not to roll back. */ 
-                        result = false; /* Fail due to bitmap set error. */
-                    } else {
-                        // Debug::debugItem("Index = %d", index);
-                        itemsChained[index].indexNext = 0; /* Next item does not exist. */
-                        itemsChained[index].indexMeta = indexMeta; /* Assign specific meta index. */
-                        itemsChained[index].isDirectory = isDirectory; /* Assign state of directory. */
-                        // UniqueHash hashUnique;
-                        // getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
-                        itemsChained[index].hashUnique = *hashUnique; /* Assign unique hash of specific path. */
-                        itemsHash[hashAddress].indexHead = index; /* Finally fill the chained item into hash table. */
-                        result = true;  /* Succeed. */
-                    }
-                }
-            } else {                    /* If there is already a chain here. */
-                // UniqueHash hashUnique;
-                // getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
-                uint64_t indexCurrent = indexHead; /* Index of current chained item. */
-                uint64_t indexBeforeCurrent = 0; /* Index of item before current chained item. Initial value 0. */
-                bool found = false;
-                do {                    /* Traverse every chained item. */
-                    if (memcmp(&(itemsChained[indexCurrent].hashUnique), hashUnique, sizeof(UniqueHash)) == 0) {
-                        itemsChained[indexCurrent].indexMeta = indexMeta; /* Update meta index. */
-                        itemsChained[indexCurrent].isDirectory = isDirectory; /* Update state of directory. */
-                        found = true;   /* Found one matched. */
-                        break;          /* Jump out. */
-                    } else {
-                        indexBeforeCurrent = indexCurrent; /* Must be assigned at least once. */
-                        indexCurrent = itemsChained[indexCurrent].indexNext; /* Move to next chained item. */
-                    }
-                } while (indexCurrent != 0); /* If current item is over last chained item then jump out (indexBeforeCurrent will point to last chained item). */
-                if (found == true) {    /* If chained item has been found and updated. */
-                    result = true;      /* Succeed. Updated meta index. */
-                } else {                /* If there is no matched chained item, a new one need to be created. */
-                    uint64_t index;
-                    // if (bitmapChainedItems->findFree(&index) == false) { /* Method of bitmap search. */
-                    if (headFreeBit == NULL) { /* Method of free bit chain. */
-                        result = false; /* Fail due to no free bit in bitmap. */
-                    } else {
-                        index = headFreeBit->position; /* Get free bit index. */
-                        FreeBit *currentFreeBit = headFreeBit; /* Get current free bit. */
-                        headFreeBit = (FreeBit *)(headFreeBit->nextFreeBit); /* Move current free bit out of free bit chain. */
-                        free(currentFreeBit); /* Release current free bit as used. */
-                        if (bitmapChainedItems->set(index) == false) { /* Occupy the position first. Need not to roll back. */ 
-                            result = false; /* Fail due to bitmap set error. */
-                        } else {
-                            itemsChained[index].indexNext = 0; /* Next item does not exist. */
-                            itemsChained[index].indexMeta = indexMeta; /* Assign specific meta index. */
-                            itemsChained[index].isDirectory = isDirectory; /* Assign state of directory. */
-                            // UniqueHash hashUnique;
-                            // getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
-                            itemsChained[index].hashUnique = *hashUnique; /* Assign unique hash of specific path. */
-                            itemsChained[indexBeforeCurrent].indexNext = index; /* Finally fill the chained item into current last chained item. */
-                            result = true;  /* Succeed. Created chained item. */
+    }
+    uint64_t countLoadMax = countGroup * HASH_GROUP_SIZE * HASH_LOAD_MAX / 100;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        uint64_t meta = indexMeta | (isDirectory ? HASH_META_DIRECTORY : 0);
+        uint64_t group = getGroup(hashUnique);
+        bool result = false;
+        HashStripe *stripe = lockStripe(group); /* Lock stripe of key. */
+        uint64_t slot;
+        uint64_t countUsed = __atomic_load_n(&countSaved, __ATOMIC_RELAXED) + __atomic_load_n(&countDeleted, __ATOMIC_RELAXED);
+        if (find(hashUnique, &slot) == true) {
+            __atomic_store_n(&(entries[slot].meta), meta, __ATOMIC_RELAXED); /* Update meta index and state of directory. */
+            result = true;
+        } else if (countUsed < countLoadMax) {
+            for (uint64_t i = 0; (i < countGroup) && (result == false); i++) {
+                uint8_t *control = controls + group * HASH_GROUP_SIZE;
+                uint32_t mask = matchControl(control, HASH_CONTROL_EMPTY) | matchControl(control, HASH_CONTROL_DELETED);
+                while (mask != 0) {
+                    uint64_t index = group * HASH_GROUP_SIZE + __builtin_ctz(mask);
+                    uint8_t expected = controls[index];
+                    if (((expected == HASH_CONTROL_EMPTY) || (expected == HASH_CONTROL_DELETED)) &&
+                        __atomic_compare_exchange_n(&controls[index], &expected, (uint8_t)HASH_CONTROL_BUSY, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                        entries[index].fingerprint[0] = hashUnique->value[1];
+                        entries[index].fingerprint[1] = hashUnique->value[2];
+                        entries[index].fingerprint[2] = hashUnique->value[3];
+                        entries[index].meta = meta;
+                        __atomic_store_n(&controls[index], getTag(hashUnique), __ATOMIC_RELEASE); /* Publish entry. */
+                        __atomic_fetch_add(&countSaved, 1, __ATOMIC_RELAXED);
+                        if (expected == HASH_CONTROL_DELETED) {
+                            __atomic_fetch_sub(&countDeleted, 1, __ATOMIC_RELAXED);
                         }
+                        result = true;
+                        break;
                     }
+                    mask &= mask - 1;   /* Taken by writer of another stripe. */
                 }
+                group = (group + 1 == countGroup) ? 0 : group + 1; /* Probe next group. */
             }
         }
-        mutexBitmapChainedItems.unlock(); /* Unlock hash table bitmap. */
-        return result;                  /* Return specific result. */
+        unlockStripe(stripe);           /* Unlock stripe of key. */
+        if ((result == true) || (__atomic_load_n(&countSaved, __ATOMIC_RELAXED) >= countLoadMax)) {
+            return result;              /* Table is full of items, rebuilding does not help. */
+        }
+        rebuild();                      /* Deleted slots take the room left. */
     }
+    return false;
 }
 
-/* Delete a hash item.
+/* Delete an item.
    @param   path    Path.
    @return          If error occurs return false, otherwise return true. */
 bool HashTable::del(const char *path)
@@ -337,185 +405,140 @@ bool HashTable::del(const char *path)
     if (path == NULL) {
         return false;                   /* Fail due to null path. */
     } else {
-        AddressHash hashAddress;
-        HashTable::getAddressHash(path, strlen(path), &hashAddress); /* Get address hash. */
-        bool result;
-        mutexBitmapChainedItems.lock(); /* Lock hash table bitmap. */
-        {
-            uint64_t indexHead = itemsHash[hashAddress].indexHead;
-            if (indexHead == 0) {
-                result = false;         /* Fail due to no hash item. */
-            } else {
-                UniqueHash hashUnique;
-                HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
-                if (memcmp(&(itemsChained[indexHead].hashUnique), &hashUnique, sizeof(UniqueHash)) == 0) { /* If head chained item is matched. */
-                    if (bitmapChainedItems->clear(indexHead) == false) {
-                        result = false; /* Fail due to bitmap clear error. */
-                    } else {            /* Remove chained item. Currently do not clear data of chained item. Data will be renew in put operation. */
-                        FreeBit *currentFreeBit = (FreeBit *)malloc(sizeof(FreeBit)); /* New free bit. */
-                        currentFreeBit->nextFreeBit = headFreeBit; /* Add current free bit to free bit chain. */
-                        currentFreeBit->position = indexHead; /* Head index of chained items. */
-                        headFreeBit = currentFreeBit; /* Update head free bit. */
-                        itemsHash[hashAddress].indexHead = itemsChained[indexHead].indexNext; /* Might be 0 if head is the last. */
-                        result = true;  /* Succeed. Removed head chained item. */
-                    }
-                } else {                /* If not head chained item. */
-                    uint64_t indexBeforeCurrent = indexHead;
-                    uint64_t indexCurrent = itemsChained[indexHead].indexNext;
-                    bool found = false;
-                    while (indexCurrent != 0) { /* indexCurrent might be 0 because head chained index has been examined. */
-                        if (memcmp(&(itemsChained[indexCurrent].hashUnique), &hashUnique, sizeof(UniqueHash)) == 0) {
-                            found = true;
-                            break;
-                        } else {
-                            indexBeforeCurrent = indexCurrent; /* Assign indexBeforeCurrent. */
-                            indexCurrent = itemsChained[indexCurrent].indexNext; /* Move to next chained item. */
-                        }
-                    }
-                    if (found == false) {
-                        result = true;  /* Succeed. No matched item is found. Here indexCurrent equals 0. */
-                    } else {
-                        if (bitmapChainedItems->clear(indexCurrent) == false) {
-                            result = false; /* Fail due to bitmap clear error. */
-                        } else {
-                            FreeBit *currentFreeBit = (FreeBit *)malloc(sizeof(FreeBit)); /* New free bit. */
-                            currentFreeBit->nextFreeBit = headFreeBit; /* Add current free bit to free bit chain. */
-                            currentFreeBit->position = indexCurrent; /* Current index of chained items. */
-                            headFreeBit = currentFreeBit; /* Update head free bit. */
-                            itemsChained[indexBeforeCurrent].indexNext = itemsChained[indexCurrent].indexNext;
-                            result = true; /* Succeed. Removed the chained item. */
-                        }
-                    }
-                }
-            }
-        }
-        mutexBitmapChainedItems.unlock(); /* Unlock hash table bitmap. */
-        return result;                  /* Return specific result. */
+        UniqueHash hashUnique;
+        HashTable::getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
+        return del(&hashUnique);
     }
 }
 
-/* Delete a hash item by hash.
+/* Delete an item by hash.
    @param   hashUnique      Unique hash.
-   @return                  If error occurs return false, otherwise return true. */
+   @return                  If item does not exist return false, otherwise return true. */
 bool HashTable::del(UniqueHash *hashUnique)
 {
     if (hashUnique == NULL) {
         return false;                   /* Fail due to null unique hash. */
     } else {
-        AddressHash hashAddress = HashTable::getAddressHash(hashUnique); /* Get address hash by unique hash. */
-        // getAddressHash(path, strlen(path), &hashAddress); /* Get address hash. */
         bool result;
-        mutexBitmapChainedItems.lock(); /* Lock hash table bitmap. */
-        {
-            uint64_t indexHead = itemsHash[hashAddress].indexHead;
-            if (indexHead == 0) {
-                result = false;         /* Fail due to no hash item. */
-            } else {
-                // UniqueHash hashUnique;
-                // getUniqueHash(path, strlen(path), &hashUnique); /* Get unique hash. */
-                if (memcmp(&(itemsChained[indexHead].hashUnique), hashUnique, sizeof(UniqueHash)) == 0) { /* If head chained item is matched. */
-                    if (bitmapChainedItems->clear(indexHead) == false) {
-                        result = false; /* Fail due to bitmap clear error. */
-                    } else {            /* Remove chained item. Currently do not clear data of chained item. Data will be renew in put operation. */
-                        FreeBit *currentFreeBit = (FreeBit *)malloc(sizeof(FreeBit)); /* New free bit. */
-                        currentFreeBit->nextFreeBit = headFreeBit; /* Add current free bit to free bit chain. */
-                        currentFreeBit->position = indexHead; /* Head index of chained items. */
-                        headFreeBit = currentFreeBit; /* Update head free bit. */
-                        itemsHash[hashAddress].indexHead = itemsChained[indexHead].indexNext; /* Might be 0 if head is the last. */
-                        result = true;  /* Succeed. Removed head chained item. */
-                    }
-                } else {                /* If not head chained item. */
-                    uint64_t indexBeforeCurrent = indexHead;
-                    uint64_t indexCurrent = itemsChained[indexHead].indexNext;
-                    bool found = false;
-                    while (indexCurrent != 0) { /* indexCurrent might be 0 because head chained index has been examined. */
-                        if (memcmp(&(itemsChained[indexCurrent].hashUnique), hashUnique, sizeof(UniqueHash)) == 0) {
-                            found = true;
-                            break;
-                        } else {
-                            indexBeforeCurrent = indexCurrent; /* Assign indexBeforeCurrent. */
-                            indexCurrent = itemsChained[indexCurrent].indexNext; /* Move to next chained item. */
-                        }
-                    }
-                    if (found == false) {
-                        result = true;  /* Succeed. No matched item is found. Here indexCurrent equals 0. */
-                    } else {
-                        if (bitmapChainedItems->clear(indexCurrent) == false) {
-                            result = false; /* Fail due to bitmap clear error. */
-                        } else {
-                            FreeBit *currentFreeBit = (FreeBit *)malloc(sizeof(FreeBit)); /* New free bit. */
-                            currentFreeBit->nextFreeBit = headFreeBit; /* Add current free bit to free bit chain. */
-                            currentFreeBit->position = indexCurrent; /* Current index of chained items. */
-                            headFreeBit = currentFreeBit; /* Update head free bit. */
-                            itemsChained[indexBeforeCurrent].indexNext = itemsChained[indexCurrent].indexNext;
-                            result = true; /* Succeed. Removed the chained item. */
-                        }
-                    }
-                }
-            }
+        HashStripe *stripe = lockStripe(getGroup(hashUnique)); /* Lock stripe of key. */
+        uint64_t slot;
+        if (find(hashUnique, &slot) == false) {
+            result = false;             /* Fail due to no item. */
+        } else {
+            __atomic_store_n(&controls[slot], (uint8_t)HASH_CONTROL_DELETED, __ATOMIC_RELEASE); /* Entry is left, it is renewed in put operation. */
+            __atomic_fetch_sub(&countSaved, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&countDeleted, 1, __ATOMIC_RELAXED);
+            result = true;
+        }
+        unlockStripe(stripe);           /* Unlock stripe of key. */
+        if (__atomic_load_n(&countDeleted, __ATOMIC_RELAXED) > countGroup * HASH_GROUP_SIZE * HASH_DELETED_MAX / 100) {
+            rebuild();                  /* Not holding a stripe, rebuild locks them all. */
         }
-        mutexBitmapChainedItems.unlock(); /* Unlock hash table bitmap. */
         return result;                  /* Return specific result. */
     }
 }
 
-/* Get saved hash items count.
-   @return      Return count of saved hash items. */
-uint64_t HashTable::getSavedHashItemsCount()
+/* Rebuild table in place. All stripes are locked, so no writer runs and readers retry until it is
+   done. Full entries are copied out, every slot is made empty, and entries are put again into the
+   first empty slot from their home group, so no deleted slot is left and probes are short again.
+   Copy buffer is allocated before stripes are locked, to keep the pause to the pass itself.
+   Caller must not hold a stripe. */
+void HashTable::rebuild()
 {
-    uint64_t count = 0;                 /* Initialize counter. */
-    for (uint64_t i = 0; i < HASH_ITEMS_COUNT; i++) {
-        if (itemsHash[i].indexHead != 0) { /* If hash item exists. */
-            count++;                    /* Increment. */
+    std::lock_guard<std::mutex> lockRebuild(mutexRebuild);
+    if (__atomic_load_n(&countDeleted, __ATOMIC_RELAXED) == 0) {
+        return;                         /* Rebuilt by another writer meanwhile. */
+    }
+    std::vector<std::pair<uint8_t, HashEntry> > saved;
+    saved.reserve(__atomic_load_n(&countSaved, __ATOMIC_RELAXED) + HASH_LOCK_STRIPES); /* Slack for puts before stripes are locked. */
+    for (uint64_t i = 0; i < HASH_LOCK_STRIPES; i++) {
+        lockStripe(i);                  /* Stripe i is the one of group i. */
+    }
+    for (uint64_t i = 0; i < countGroup * HASH_GROUP_SIZE; i++) {
+        if ((controls[i] & HASH_CONTROL_FULL) != 0) {
+            saved.push_back(std::make_pair(controls[i], entries[i]));
+        }
+    }
+    memset(controls, HASH_CONTROL_EMPTY, countGroup * HASH_GROUP_SIZE);
+    for (size_t k = 0; k < saved.size(); k++) {
+        UniqueHash hashUnique;
+        hashUnique.value[1] = saved[k].second.fingerprint[0]; /* Home group depends on value[1] only. */
+        uint64_t group = getGroup(&hashUnique);
+        uint32_t mask;
+        while ((mask = matchControl(controls + group * HASH_GROUP_SIZE, HASH_CONTROL_EMPTY)) == 0) {
+            group = (group + 1 == countGroup) ? 0 : group + 1;
         }
+        uint64_t index = group * HASH_GROUP_SIZE + __builtin_ctz(mask);
+        entries[index] = saved[k].second;
+        controls[index] = saved[k].first;
+    }
+    Debug::debugItem("HashTable: rebuilt, %lu deleted slots dropped", (unsigned long)countDeleted);
+    __atomic_store_n(&countDeleted, 0, __ATOMIC_RELAXED);
+    for (uint64_t i = 0; i < HASH_LOCK_STRIPES; i++) {
+        unlockStripe(&stripes[i]);      /* Release makes slots visible before readers check sequence. */
     }
-    return count;                       /* Return count of saved hash items. */
 }
 
-/* Get saved chained items count.
-   @return      Return count of saved chained items. */
-uint64_t HashTable::getSavedChainedItemsCount()
+/* Get saved items count.
+   @return      Return count of saved items. */
+uint64_t HashTable::getSavedItemsCount()
 {
-    return (bitmapChainedItems->countTotal() - bitmapChainedItems->countFree() - 1); /* Return count of saved chained items. Reserved chained item 0 is set so there is an -1. */
+    return __atomic_load_n(&countSaved, __ATOMIC_RELAXED);
 }
 
-/* Get total hash items count.
-   @return      Return count of total hash items. */
-uint64_t HashTable::getTotalHashItemsCount()
+/* Get deleted slots count.
+   @return      Return count of deleted slots. */
+uint64_t HashTable::getDeletedItemsCount()
 {
-    return HASH_ITEMS_COUNT; /* Return count of total hash items. */
+    return __atomic_load_n(&countDeleted, __ATOMIC_RELAXED);
 }
 
-/* Get total chained items count.
-   @return      Return count of total chained items. */
-uint64_t HashTable::getTotalChainedItemsCount()
+/* Get total slots count.
+   @return      Return count of total slots. */
+uint64_t HashTable::getTotalItemsCount()
 {
-    return (bitmapChainedItems->countTotal() - 1); /* Return count of total chained items. The chained item 0 is reserved so there is an -1. */
+    return countGroup * HASH_GROUP_SIZE;
 }
 
-/* Get max length of chain.
-   @return      Return max length of chain. */
-uint64_t HashTable::getMaxLengthOfChain()
+/* Get max count of groups probed to find a saved item. Not synchronized with writers.
+   @return      Return max probe length. */
+uint64_t HashTable::getMaxProbeLength()
 {
-    uint64_t max = 0, length;
-    for (uint64_t i = 0; i < HASH_ITEMS_COUNT; i++) { /* Traverse all hash items. */
-        length = 0;
-        if (itemsHash[i].indexHead != 0) { /* If there is at least one chained item. */
-            uint64_t indexCurrent = itemsHash[i].indexHead; /* Initialize current index to head. */
-            do {
-                length++;               /* First chained item exists. */
-                indexCurrent = itemsChained[indexCurrent].indexNext; /* Move to next. */
-            } while (indexCurrent != 0);
+    uint64_t max = 0;
+    for (uint64_t i = 0; i < countGroup * HASH_GROUP_SIZE; i++) { /* Traverse all slots. */
+        if ((controls[i] & HASH_CONTROL_FULL) != 0) {
+            UniqueHash hashUnique;
+            hashUnique.value[1] = entries[i].fingerprint[0]; /* Home group depends on value[1] only. */
+            uint64_t length = (i / HASH_GROUP_SIZE + countGroup - getGroup(&hashUnique)) % countGroup + 1;
             if (length > max)
                 max = length;           /* Assign current max length. */
         }
     }
-    return max;                         /* Return max length of chain. */
+    return max;                         /* Return max probe length. */
 }
 
-/* Constructor of hash table. 
-   @param   buffer          Buffer of whole table.
-   @param   count           Max count of chained items. Can be divided by 8. No check here. */
+/* Get count of groups probed to look up a key, until it is found or a group has an empty slot. Not
+   synchronized with writers.
+   @param   hashUnique  Unique hash.
+   @return              Count of groups probed. */
+uint64_t HashTable::getProbeLength(UniqueHash *hashUnique)
+{
+    uint64_t slot;
+    uint64_t group = getGroup(hashUnique);
+    if (find(hashUnique, &slot) == true) {
+        return (slot / HASH_GROUP_SIZE + countGroup - group) % countGroup + 1;
+    }
+    uint64_t length = 1;
+    while ((length < countGroup) && (matchControl(controls + group * HASH_GROUP_SIZE, HASH_CONTROL_EMPTY) == 0)) {
+        group = (group + 1 == countGroup) ? 0 : group + 1;
+        length++;
+    }
+    return length;
+}
+
+/* Constructor of hash table. A zeroed buffer is an empty table, a reattached one keeps its items.
+   @param   buffer          Buffer of whole table, aligned to 64 bytes.
+   @param   count           Max count of items. */
 HashTable::HashTable(char *buffer, uint64_t count)
 {
     if (buffer == NULL) {
@@ -523,23 +546,37 @@ HashTable::HashTable(char *buffer, uint64_t count)
         exit(EXIT_FAILURE);
     } else {
         itemsHash = (HashItem *)buffer; /* Hash items pointer. */
-        bitmapChainedItems = new Bitmap( /* Bitmap for chained items. */
-            count, buffer + HASH_ITEMS_SIZE /* Need to be divided by 8 in bitmap class. */
-        );
-        itemsChained = (ChainedItem *)(buffer + HASH_ITEMS_SIZE + count / 8); /* Chained items pointer. Size of bitmap is count / 8. */
-        if (bitmapChainedItems->set(0) == false) { /* Disable position 0 in bitmap due to reserved use. */
-            fprintf(stderr, "HashTable: bitmap set error.\n");
-            exit(EXIT_FAILURE);
+        countGroup = count * 100 / HASH_LOAD_MAX / HASH_GROUP_SIZE + 1; /* Load stays under HASH_LOAD_MAX when count items are saved. */
+        controls = (uint8_t *)(buffer + HASH_ITEMS_SIZE);
+        uint64_t sizeControls = (countGroup * HASH_GROUP_SIZE + 63) / 64 * 64; /* Entries start on a cache line. */
+        entries = (HashEntry *)(buffer + HASH_ITEMS_SIZE + sizeControls);
+        sizeBufferUsed = HASH_ITEMS_SIZE + sizeControls + sizeof(HashEntry) * countGroup * HASH_GROUP_SIZE; /* Calculate size of used bytes in buffer. */
+        countSaved = 0;
+        countDeleted = 0;
+        for (uint64_t i = 0; i < countGroup * HASH_GROUP_SIZE; i++) {
+            if ((controls[i] & HASH_CONTROL_FULL) != 0) {
+                countSaved++;           /* Kept from reattached buffer. */
+            } else if (controls[i] == HASH_CONTROL_DELETED) {
+                countDeleted++;
+            }
         }
-        sizeBufferUsed = HASH_ITEMS_SIZE + count / 8 + sizeof(ChainedItem) * count; /* Calculate size of used bytes in buffer. */
-        // Debug::debugItem("itemsChainedAddress = %lx, sizeBufferUsed = %x", itemsChained, sizeBufferUsed);
-        headFreeBit = NULL;
-        FreeBit *currentFreeBit;
-        for (uint64_t i = 1; i < bitmapChainedItems->countTotal(); i++) { /* Traverse all chained items to initialize free bits. Start from 1. */
-            currentFreeBit = (FreeBit *)malloc(sizeof(FreeBit));
-            currentFreeBit->position = i; /* Assign position. */
-            currentFreeBit->nextFreeBit = headFreeBit; /* Push current free bit before head. */
-            headFreeBit = currentFreeBit; /* Update head free bit. */
+        for (uint64_t i = 0; i < HASH_LOCK_STRIPES; i++) {
+            stripes[i].sequence = 0;
+        }
+    }
+}
+
+/* Release all hash item locks and slots claimed by writers. Both are left in a reattached buffer
+   by a stopped server. */
+void HashTable::recover()
+{
+    for (uint64_t i = 0; i < HASH_ITEMS_COUNT; i++) {
+        itemsHash[i].key = 0;
+    }
+    for (uint64_t i = 0; i < countGroup * HASH_GROUP_SIZE; i++) {
+        if (controls[i] == HASH_CONTROL_BUSY) {
+            controls[i] = HASH_CONTROL_DELETED; /* Entry might be incomplete. */
+            countDeleted++;
         }
     }
 }
@@ -547,11 +584,4 @@ HashTable::HashTable(char *buffer, uint64_t count)
 /* Destructor of hash table. */
 HashTable::~HashTable()
 {
-    FreeBit *currentFreeBit;
-    while (headFreeBit != NULL) {
-        currentFreeBit = headFreeBit;
-        headFreeBit = (FreeBit *)(headFreeBit->nextFreeBit); /* Move to next. */
-        free(currentFreeBit);           /* Release free bit. */
-    }
-    delete bitmapChainedItems;          /* Release hash table bitmap. */
 }
@@ -0,0 +1,73 @@
+/*** Block placement policy. ***/
+
+/** Included files. **/
+#include <string.h>                     /* String operations. E.g. strcmp() */
+#include "placement.hpp"
+
+/** Implemented functions. **/
+/* Create policy by name.
+   @param   name    Name of policy, "local" or "heat".
+   @return          Policy instance, or NULL if name is unknown. */
+PlacementPolicy *PlacementPolicy::create(const char *name)
+{
+    if (name == NULL) {
+        return NULL;
+    } else if (strcmp(name, "local") == 0) {
+        return new LocalPlacementPolicy();
+    } else if (strcmp(name, "heat") == 0) {
+        return new HeatPlacementPolicy();
+    } else {
+        return NULL;
+    }
+}
+
+/* Place block on local node in SSD tier, which is the original behavior.
+   @param   context Placement context.
+   @param   nodeID  Buffer of node ID.
+   @param   tier    Buffer of tier. */
+void LocalPlacementPolicy::place(PlacementContext *context, uint16_t *nodeID, uint16_t *tier)
+{
+    *nodeID = context->nodeLocal;
+    *tier = 1;
+}
+
+const char *LocalPlacementPolicy::name()
+{
+    return "local";
+}
+
+/* Place block by memory tier capacity, hint, size and write heat of file.
+   Memory tier is used only while more than PLACEMENT_MEMORY_RESERVE percent is free. Hot hinted
+   files always get it then, small or hot files get it unless memory is under pressure. Blocks of
+   files larger than PLACEMENT_STRIPE_FILE are striped round robin over nodes starting from the
+   local node, so the first blocks stay local.
+   @param   context Placement context.
+   @param   nodeID  Buffer of node ID.
+   @param   tier    Buffer of tier. */
+void HeatPlacementPolicy::place(PlacementContext *context, uint16_t *nodeID, uint16_t *tier)
+{
+    if ((context->hint == PLACEMENT_HINT_LOCAL) || (context->sizeFile <= PLACEMENT_STRIPE_FILE)) {
+        *nodeID = context->nodeLocal;
+    } else {
+        *nodeID = (uint16_t)((context->nodeLocal - 1 + context->BlockID) % context->countNode + 1);
+    }
+
+    uint64_t percentFree = (context->countMemoryTotal == 0) ? 0 :
+        (context->countMemoryFree * 100 / context->countMemoryTotal);
+    bool hot = (context->heatWrite >= PLACEMENT_HOT_HEAT);
+    bool small = (context->sizeFile <= PLACEMENT_SMALL_FILE);
+    if ((context->hint == PLACEMENT_HINT_COLD) || (percentFree <= PLACEMENT_MEMORY_RESERVE)) {
+        *tier = 1;
+    } else if (context->hint == PLACEMENT_HINT_HOT) {
+        *tier = 0;
+    } else if (percentFree > PLACEMENT_MEMORY_PRESSURE) {
+        *tier = (small || hot) ? 0 : 1;
+    } else {
+        *tier = hot ? 0 : 1;
+    }
+}
+
+const char *HeatPlacementPolicy::name()
+{
+    return "heat";
+}
@@ -54,15 +54,19 @@ NodeHash Storage::getNodeHash(UniqueHash *hashUnique)
    @param   countFile       Max count of files.
    @param   countDirectory  Max count of directories.
    @param   countBlock      Max count of blocks.
-   @param   countNode       Count of nodes. */
-Storage::Storage(char *buffer, char* bufferBlock, char *extraBlock, uint64_t countFile, uint64_t countDirectory, uint64_t countBlock, uint64_t countNode)
+   @param   countNode       Count of nodes.
+   @param   recover         Buffers are reattached from last run, keep their content and stores. */
+Storage::Storage(char *buffer, char* bufferBlock, char *extraBlock, uint64_t countFile, uint64_t countDirectory, uint64_t countBlock, uint64_t countNode, bool recover)
 {
     if ((buffer == NULL) || (bufferBlock == NULL) || (countFile == 0) || (countDirectory == 0) ||
         (countBlock == 0) || (countNode == 0)) {
         fprintf(stderr, "Storage::Storage: parameter error.\n");
         exit(EXIT_FAILURE);             /* Exit due to parameter error. */
     } else {
-        hashtable = new HashTable(buffer, countDirectory + countFile); /* Initialize hash table. */
+        hashtable = new HashTable(buffer, (countDirectory + countFile) * 2); /* Initialize hash table. Paths and directory entries. */
+        if (recover) {
+            hashtable->recover();       /* Holders of locks and slots are gone. */
+        }
         Debug::notifyInfo("sizeof Hash Table = %d bytes", hashtable->sizeBufferUsed);
 	Debug::notifyInfo("HashTable address : %ld",(long) buffer);
 
@@ -74,27 +78,48 @@ Storage::Storage(char *buffer, char* bufferBlock, char *extraBlock, uint64_t cou
         Debug::notifyInfo("sizeof Directory Meta Size = %d bytes", tableDirectoryMeta->sizeBufferUsed);
 	Debug::notifyInfo("Directory Meta address : %ld", (long)(buffer + hashtable->sizeBufferUsed + tableFileMeta->sizeBufferUsed));
 
+        /* One page per file on average, a page holds 512 blocks (8 GB). */
+        tableExtentPage = new Table<ExtentPage>(buffer + hashtable->sizeBufferUsed + tableFileMeta->sizeBufferUsed + tableDirectoryMeta->sizeBufferUsed, countFile);
+        Debug::notifyInfo("sizeof Extent Page Size = %d bytes", tableExtentPage->sizeBufferUsed);
+
+        /* Pages half full on average, plus a partly used last page per directory. */
+        tableDirectoryPage = new Table<DirectoryPage>(buffer + hashtable->sizeBufferUsed + tableFileMeta->sizeBufferUsed + tableDirectoryMeta->sizeBufferUsed + tableExtentPage->sizeBufferUsed,
+                                                      countDirectory + (countDirectory + countFile) * 2 / DIRECTORY_PAGE_ENTRY_COUNT);
+        Debug::notifyInfo("sizeof Directory Page Size = %d bytes", tableDirectoryPage->sizeBufferUsed);
+
 	uint64_t RdmaBlockCount = RDMA_DATASIZE * 1024 * 1024 / BLOCK_SIZE; /* 1536 is set in mempool.cpp*/
-        tableBlock = new Table<Block>(bufferBlock, RdmaBlockCount); /* Initialize block table. */
+        bitmapBlock = (char *)calloc(RdmaBlockCount / 8, 1); /* RDMA cache starts empty, its bitmap is not kept. */
+        tableBlock = new Table<Block>(bufferBlock, bitmapBlock, RdmaBlockCount); /* Initialize block table. */
         Debug::notifyInfo("Debug-Storage.cpp: tableBlock done, address : %ld", (long)bufferBlock);
 
 	extraTableBlock = new Table<Block>(extraBlock, countBlock);
 	Debug::notifyInfo("Extra data address : %ld", (long) extraBlock);
+	MemBlockStore *memory = new MemBlockStore(extraTableBlock, extraBlock);
+	if (recover) {
+	    memory->recover();
+	}
+	tierMemory = memory;
 
         this->countNode = countNode;    /* Assign count of nodes. */
 	printf("Debug-Storage.cpp: size init\n");
-        sizeBufferUsed = hashtable->sizeBufferUsed + tableFileMeta->sizeBufferUsed + tableDirectoryMeta->sizeBufferUsed + tableBlock->sizeBufferUsed; /* Size of used bytes in buffer. */
+        sizeBufferUsed = hashtable->sizeBufferUsed + tableFileMeta->sizeBufferUsed + tableDirectoryMeta->sizeBufferUsed + tableExtentPage->sizeBufferUsed + tableDirectoryPage->sizeBufferUsed + tableBlock->sizeBufferUsed; /* Size of used bytes in buffer. */
         printf("Debug-Storage.cpp: size done\n");
 
         BlockManager = new cache::lru_cache<uint64_t, BlockInfo>(RdmaBlockCount);
         Debug::notifyInfo("LRU BlockManager is created");
 
-	if (!db.open(DB_PATH, kyotocabinet::DirDB::OWRITER | kyotocabinet::DirDB::OCREATE | kyotocabinet::DirDB::OTRUNCATE)) {
-          printf("DB open failed\n");
-          std::cerr << "open error: " << db.error().name() << std::endl;
+	const char *pathSSD = (strcmp(SSD_ENGINE, "dir") == 0) ? DB_PATH : ((strcmp(SSD_ENGINE, "log") == 0) ? SSD_LOG_PATH : SSD_POSIX_PATH);
+	tierSSD = BlockStore::create(SSD_ENGINE, pathSSD, (uint64_t)SSD_CAPACITY * 1024 * 1024, recover);
+	if (tierSSD == NULL) {
+          printf("SSD tier open failed\n");
           exit(-1);
         } else {
-   	  printf("kyotocabinet Done\n");
+   	  printf("SSD tier %s Done\n", SSD_ENGINE);
+        }
+	tierSpill = BlockStore::create("posix", SPILL_PATH, 0, recover);
+	if (tierSpill == NULL) {
+          printf("Spill tier open failed\n");
+          exit(-1);
         }
     }
 }
@@ -105,6 +130,268 @@ Storage::~Storage()
     delete hashtable;                   /* Release memory for hash table. */
     delete tableFileMeta;               /* Release memory for file meta table. */
     delete tableDirectoryMeta;          /* Release memory for directory meta table. */
+    delete tableExtentPage;
+    delete tableDirectoryPage;
     delete tableBlock;                  /* Release memory for block table. */
-    db.close();				/* Close database */
+    free(bitmapBlock);
+    delete tierSSD;			/* Close SSD tier */
+    delete tierMemory;
+    delete tierSpill;
+}
+
+/* Constructor of memory tier store for compressed blocks.
+   @param   table   Memory tier block table, blocks are taken from it on demand.
+   @param   base    Address of memory tier block 0. */
+MemBlockStore::MemBlockStore(Table<Block> *table, char *base)
+{
+    this->table = table;
+    this->base = base;
+    sequence = 1;
+    slotsByRun.resize(MEM_CHUNK_COUNT);
+}
+
+/* Header in chunk 0 of a memory tier block. */
+MemSlotHeader *MemBlockStore::getHeader(uint64_t slot)
+{
+    return (MemSlotHeader *)(base + slot * BLOCK_SIZE);
+}
+
+/* Longest run of clear bits in a chunk bitmap. */
+static uint16_t getLongestRun(uint64_t used)
+{
+    uint16_t longest = 0;
+    uint16_t run = 0;
+    for (uint64_t chunk = 1; chunk < MEM_CHUNK_COUNT; chunk++) {
+        run = ((used >> chunk) & 1ULL) ? 0 : (run + 1);
+        longest = (run > longest) ? run : longest;
+    }
+    return longest;
+}
+
+/* Refile a block after its bitmap changed. Called with mutexIndex held.
+   @param   slot    Memory tier block.
+   @param   state   Its state, run is updated. */
+void MemBlockStore::classify(uint64_t slot, MemSlot *state)
+{
+    uint16_t run = getLongestRun(state->used);
+    if (run != state->run) {
+        slotsByRun[state->run].erase(slot);
+        state->run = run;
+        if (run != 0) {
+            slotsByRun[run].insert(slot);
+        }
+    }
+}
+
+/* Take countChunk contiguous free chunks from a block of the smallest fitting size class, or take
+   a new block. Called with mutexIndex held.
+   @param   countChunk  Count of chunks needed.
+   @param   entry       Buffer of location, slot and chunk are filled.
+   @return              If succeed return true, otherwise return false. */
+bool MemBlockStore::allocate(uint64_t countChunk, MemIndexEntry *entry)
+{
+    uint64_t mask = (1ULL << countChunk) - 1;
+    for (uint64_t run = countChunk; run < MEM_CHUNK_COUNT; run++) {
+        if (slotsByRun[run].empty()) {
+            continue;
+        }
+        uint64_t slot = *slotsByRun[run].begin();
+        MemSlot *state = &slots[slot];
+        for (uint64_t chunk = 1; chunk + countChunk <= MEM_CHUNK_COUNT; chunk++) {
+            if ((state->used & (mask << chunk)) == 0) {
+                state->used |= (mask << chunk);
+                classify(slot, state);
+                entry->slot = slot;
+                entry->chunk = chunk;
+                return true;
+            }
+        }
+    }
+    uint64_t slot;
+    if (table->create(&slot) == false) {
+        return false;
+    }
+    MemSlotHeader *header = getHeader(slot);
+    memset(header, 0, sizeof(MemSlotHeader));
+    header->slot = slot;
+    header->magic = MEM_SLOT_MAGIC;
+    MemSlot *state = &slots[slot];
+    state->used = 1ULL | (mask << 1); /* Chunk 0 holds header. */
+    state->freeing = 0;
+    state->countReader = 0;
+    state->run = 0;
+    classify(slot, state);
+    entry->slot = slot;
+    entry->chunk = 1;
+    return true;
+}
+
+/* Clear chunks of a block, and return the block to table once only header is left. Called with
+   mutexIndex held. */
+void MemBlockStore::freeChunks(uint64_t slot, uint64_t chunks)
+{
+    auto it = slots.find(slot);
+    it->second.used &= ~chunks;
+    if (it->second.used == 1ULL) {
+        getHeader(slot)->magic = 0;
+        slotsByRun[it->second.run].erase(slot);
+        table->remove(slot);
+        slots.erase(it);
+    } else {
+        classify(slot, &it->second);
+    }
+}
+
+/* Free chunks of a block. Chunks of a block being read are freed after the last read. Called with
+   mutexIndex held. */
+void MemBlockStore::release(MemIndexEntry *entry)
+{
+    uint64_t chunks = ((1ULL << entry->countChunk) - 1) << entry->chunk;
+    getHeader(entry->slot)->records[entry->chunk].length = 0;
+    MemSlot *state = &slots[entry->slot];
+    if (state->countReader != 0) {
+        state->freeing |= chunks;
+    } else {
+        freeChunks(entry->slot, chunks);
+    }
+}
+
+/* Rebuild index from headers of memory tier blocks in a reattached buffer. Blocks without a valid
+   header are raw memory tier blocks and are skipped. If a crash left two copies of a key, the
+   later one is kept. */
+void MemBlockStore::recover()
+{
+    std::lock_guard<std::mutex> lockIndex(mutexIndex);
+    for (uint64_t slot = 0; slot < table->countTotalItems(); slot++) {
+        MemSlotHeader *header = getHeader(slot);
+        if ((table->exists(slot) == false) || (header->magic != MEM_SLOT_MAGIC) || (header->slot != slot)) {
+            continue;
+        }
+        MemSlot *state = &slots[slot];
+        state->used = 1ULL;
+        state->freeing = 0;
+        state->countReader = 0;
+        state->run = 0;
+        for (uint64_t chunk = 1; chunk < MEM_CHUNK_COUNT; chunk++) {
+            MemSlotRecord *record = &header->records[chunk];
+            if ((record->length == 0) || (record->length > (MEM_CHUNK_COUNT - chunk) * MEM_CHUNK_SIZE)) {
+                continue;
+            }
+            MemIndexEntry entry;
+            entry.slot = slot;
+            entry.chunk = chunk;
+            entry.countChunk = (record->length + MEM_CHUNK_SIZE - 1) / MEM_CHUNK_SIZE;
+            entry.length = record->length;
+            entry.sequence = record->sequence;
+            state->used |= ((1ULL << entry.countChunk) - 1) << chunk;
+            if (record->sequence >= sequence) {
+                sequence = record->sequence + 1;
+            }
+            auto it = index.find(record->key);
+            if (it == index.end()) {
+                index[record->key] = entry;
+            } else if (it->second.sequence < entry.sequence) {
+                release(&it->second);
+                it->second = entry;
+            } else {
+                release(&entry);
+            }
+        }
+        auto it = slots.find(slot);
+        if ((it != slots.end()) && (it->second.used == 1ULL)) { /* Header only, left by a crash. */
+            header->magic = 0;
+            slotsByRun[it->second.run].erase(slot);
+            table->remove(slot);
+            slots.erase(it);
+        } else if (it != slots.end()) {
+            classify(slot, &it->second);
+        }
+    }
+    Debug::notifyInfo("Memory tier: %lu compressed blocks in %lu blocks recovered", (unsigned long)index.size(), (unsigned long)slots.size());
+}
+
+/* Read a block. At most size bytes are read. Data is copied without lock, its chunks are kept
+   from reuse meanwhile.
+   @return  Length of data, -1 if key is not found. */
+int64_t MemBlockStore::get(uint64_t key, char *buffer, uint64_t size)
+{
+    MemIndexEntry entry;
+    {
+        std::lock_guard<std::mutex> lockIndex(mutexIndex);
+        auto it = index.find(key);
+        if (it == index.end()) {
+            return -1;
+        }
+        entry = it->second;
+        slots[entry.slot].countReader++;
+    }
+    uint64_t length = (entry.length < size) ? entry.length : size;
+    memcpy(buffer, base + entry.slot * BLOCK_SIZE + entry.chunk * MEM_CHUNK_SIZE, length);
+    std::lock_guard<std::mutex> lockIndex(mutexIndex);
+    MemSlot *state = &slots[entry.slot];
+    if ((--state->countReader == 0) && (state->freeing != 0)) {
+        uint64_t chunks = state->freeing;
+        state->freeing = 0;
+        freeChunks(entry.slot, chunks);
+    }
+    return length;
+}
+
+/* Write a block. New data goes to new chunks first, so old data is intact if there is no room.
+   Chunks are reserved under lock and data is copied without it. The copy is published unless a
+   newer write of the key was published or the key was removed meanwhile. A copy dropped so is not
+   a failure, only a block with no room returns false. Chunk 0 of every block holds the header, so
+   a block takes at most MEM_CHUNK_COUNT - 1 chunks. */
+bool MemBlockStore::set(uint64_t key, const char *buffer, uint64_t size)
+{
+    if ((size == 0) || (size > (MEM_CHUNK_COUNT - 1) * MEM_CHUNK_SIZE)) {
+        return false;
+    }
+    MemIndexEntry entry;
+    entry.countChunk = (size + MEM_CHUNK_SIZE - 1) / MEM_CHUNK_SIZE;
+    entry.length = size;
+    {
+        std::lock_guard<std::mutex> lockIndex(mutexIndex);
+        if (allocate(entry.countChunk, &entry) == false) {
+            return false;
+        }
+        entry.sequence = sequence++;
+        pending[key] = entry.sequence;
+    }
+    memcpy(base + entry.slot * BLOCK_SIZE + entry.chunk * MEM_CHUNK_SIZE, buffer, size);
+    std::lock_guard<std::mutex> lockIndex(mutexIndex);
+    auto write = pending.find(key);
+    auto it = index.find(key);
+    /* Pending is gone once key is removed, or once a newer write is published and took it. */
+    bool publish = (write != pending.end()) && ((it == index.end()) || (it->second.sequence < entry.sequence));
+    if ((write != pending.end()) && (write->second == entry.sequence)) {
+        pending.erase(write);
+    }
+    if (publish == false) {
+        release(&entry);
+        return true;                    /* Superseded or removed, data is obsolete either way. */
+    }
+    MemSlotRecord *record = &getHeader(entry.slot)->records[entry.chunk];
+    record->key = key;
+    record->sequence = entry.sequence;
+    record->length = size;              /* Set last, record is valid from now on. */
+    if (it != index.end()) {
+        release(&it->second);
+    }
+    index[key] = entry;
+    return true;
+}
+
+/* Remove a block. A write of it being copied is dropped. */
+bool MemBlockStore::remove(uint64_t key)
+{
+    std::lock_guard<std::mutex> lockIndex(mutexIndex);
+    bool pended = (pending.erase(key) > 0);
+    auto it = index.find(key);
+    if (it == index.end()) {
+        return pended;
+    }
+    release(&it->second);
+    index.erase(it);
+    return true;
 }
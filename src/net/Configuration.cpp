@@ -13,9 +13,18 @@ using namespace std;
 Configuration::Configuration() {
 	ServerCount = 0;
 	read_xml("/BIGDATA/nsccgz_pcheng_1/src/octopus/conf.xml", pt);
+	/* <drain><path>/tmp/DRAIN</path><bandwidth>1024</bandwidth></drain>, bandwidth in MB/s per server. */
+	drainPath = pt.get<string>("address.drain.path", "/tmp/DRAIN");
+	drainBandwidth = pt.get<uint64_t>("address.drain.bandwidth", 0);
 	ptree child = pt.get_child("address");
 	for(BOOST_AUTO(pos,child.begin()); pos != child.end(); ++pos) 
     {  
+        if (pos->first == "colocate") { /* <colocate><path>/job</path><spread>1</spread></colocate> */
+            colocation.push_back(make_pair(pos->second.get<string>("path"), (uint16_t)pos->second.get<int>("spread", 1)));
+            continue;
+        } else if (pos->first != "node") {
+            continue;                   /* E.g. comments. */
+        }
         id2ip[(uint16_t)(pos->second.get<int>("id"))] = pos->second.get<string>("ip");
         ip2id[pos->second.get<string>("ip")] = pos->second.get<int>("id");
         ServerCount += 1;
@@ -42,3 +51,15 @@ unordered_map<uint16_t, string> Configuration::getInstance() {
 int Configuration::getServerCount() {
 	return ServerCount;
 }
+
+vector<pair<string, uint16_t> > Configuration::getColocation() {
+	return colocation;
+}
+
+string Configuration::getDrainPath() {
+	return drainPath;
+}
+
+uint64_t Configuration::getDrainBandwidth() {
+	return drainBandwidth;
+}
@@ -1,5 +1,6 @@
 #include "RPCClient.hpp"
 #include "TxManager.hpp"
+#include "hashtable.hpp"
 
 RPCClient::RPCClient(Configuration *_conf, RdmaSocket *_socket, MemoryManager *_mem, uint64_t _mm)
 :conf(_conf), socket(_socket), mem(_mem), mm(_mm) {
@@ -12,6 +13,7 @@ RPCClient::RPCClient() {
 	taskID = 1;
 	mm = (uint64_t)malloc(sizeof(char) * (1024 * 4 + 1024 * 1024 * 4));
 	conf = new Configuration();
+	HashTable::setColocation(conf->getColocation()); /* Paths are located as servers do. */
 	socket = new RdmaSocket(1, mm, (1024 * 4 + 1024 * 1024 * 4), conf, false, 0);
 	socket->RdmaConnect();
 }
@@ -34,7 +36,7 @@ Configuration* RPCClient::getConfInstance() {
 	return conf;
 }
 
-bool RPCClient::RdmaCall(uint16_t DesNodeID, char *bufferSend, uint64_t lengthSend, char *bufferReceive, uint64_t lengthReceive) {
+bool RPCClient::RdmaCall(uint16_t DesNodeID, char *bufferSend, uint64_t lengthSend, char *bufferReceive, uint64_t lengthReceive, UniqueHash *hashPath) {
 	uint32_t ID = __sync_fetch_and_add( &taskID, 1 ), temp;
 	uint64_t sendBuffer, receiveBuffer, remoteRecvBuffer;
 	uint16_t offset = 0;
@@ -46,6 +48,9 @@ bool RPCClient::RdmaCall(uint16_t DesNodeID, char *bufferSend, uint64_t lengthSe
 	send->taskID = ID;
 	send->sourceNodeID = socket->getNodeID();
 	send->sizeReceiveBuffer = lengthReceive;
+	send->hasHashPath = (hashPath != NULL); /* Hash of path, so that server need not compute it again. */
+	if (hashPath != NULL)
+		send->hashPath = *hashPath;
 	if (isServer) {
 		offset = mem->getServerSendAddress(DesNodeID, &sendBuffer);
 		// printf("offset = %d\n", offset);
@@ -19,15 +19,20 @@ RPCServer::RPCServer(int _cqSize, int argc, char** argv) :cqSize(_cqSize) {
 	ReplytoClient = false;
 	mm = 0;
 	UnlockWait = false;
+	stopping = false;
 	conf = new Configuration();
+	HashTable::setColocation(conf->getColocation()); /* Before any path is hashed. */
 	mem = new MemoryManager(mm, conf->getServerCount(), RDMA_DATASIZE);
 	mm = mem->getDmfsBaseAddress();
 	Debug::notifyInfo("DmfsBaseAddress = %lx, DmfsTotalSize = %ld",
 		mem->getDmfsBaseAddress(), (long) mem->getDmfsTotalSize());
 	ServerCount = conf->getServerCount();
-	socket = new RdmaSocket(cqSize, mm, mem->getDmfsTotalSize(), conf, true, 0);
+	socket = new RdmaSocket(cqSize, mm, mem->getRegisteredSize(), conf, true, 0);
 	client = new RPCClient(conf, socket, mem, (uint64_t)mm);
 	tx = new TxManager(mem->getLocalLogAddress(), mem->getDistributedLogAddress());
+	if (mem->isWarm()) {
+		tx->recover();              /* Before metadata is used. */
+	}
 	socket->RdmaListen();
         printf("Debug-RPCServer.cpp: countNode = %ld, NodeHash = %ld \n", (long)conf->getServerCount(), (long)socket->getNodeID());
 	uint64_t maxBlockCount = (uint64_t)EXTRADATASIZE * 1024 * 1024 / BLOCK_SIZE;
@@ -38,7 +43,9 @@ RPCServer::RPCServer(int _cqSize, int argc, char** argv) :cqSize(_cqSize) {
               1024,
               maxBlockCount,
               conf->getServerCount(),    
-              socket->getNodeID());
+              socket->getNodeID(),
+              mem->isWarm());
+	fs->setDrainTarget(conf->getDrainPath().c_str(), conf->getDrainBandwidth());
 	printf("Debug-RPCServer.cpp: ready to rootInitialize ");
         printf("Current nodeid is %d\n", (int)socket->getNodeID());
 	fs->rootInitialize(socket->getNodeID());
@@ -48,12 +55,19 @@ RPCServer::RPCServer(int _cqSize, int argc, char** argv) :cqSize(_cqSize) {
 }
 RPCServer::~RPCServer() {
 	Debug::notifyInfo("Stop RPCServer.");
-	delete conf;
+	stopping = true;                    /* Workers use mem and fs, so they are stopped first. */
 	for (int i = 0; i < cqSize; i++) {
-		wk[i].detach();
+		wk[i].join();
+	}
+	for (auto task = tasks.begin(); task != tasks.end(); task++) {
+		free(*task);                    /* Requesters are gone with the cluster. */
 	}
+#if WARM_RESTART
+	fs->flushCache();                   /* Memory is kept for next run, RDMA region is not. */
+#endif
+	delete conf;
 	delete mem;
-	delete wk;
+	delete[] wk;
 	delete socket;
 	delete tx;
 	Debug::notifyInfo("RPCServer is closed successfully.");
@@ -99,9 +113,10 @@ void RPCServer::Worker(int id) {
 	th2id[tid] = id;
 	mem->setID(id);
 	printf("Debug-RPCServer.cpp: Ready to poll request\n");
-	while (true) {
+	while (!stopping) {
 		//sleep(1);
 		RequestPoller(id);
+		ProcessQueueRequest();
 	}
 }
 
@@ -149,14 +164,31 @@ void RPCServer::RequestPoller(int id) {
 
 }
 
+/* Retry requests put off by ProcessRequest() whose time has come. Requester waits for the reply, so
+   its request buffer is kept meanwhile. */
 void RPCServer::ProcessQueueRequest() {
-	for (auto task = tasks.begin(); task != tasks.end(); ) {
-		// printf("1\n");
+	vector<RPCTask*> ready;
+	{
+		lock_guard<mutex> lockTasks(mutexTasks);
+		if (tasks.empty()) {
+			return;
+		}
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		uint64_t timeNow = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+		for (auto task = tasks.begin(); task != tasks.end(); ) {
+			if ((*task)->timeReady <= timeNow) {
+				ready.push_back(*task);
+				task = tasks.erase(task);
+			} else {
+				task++;
+			}
+		}
+	}
+	for (auto task = ready.begin(); task != ready.end(); task++) {
 		ProcessRequest((GeneralSendBuffer *)(*task)->send, (*task)->NodeID, (*task)->offset);
 		free(*task);
-		task = tasks.erase(task);
 	}
-	// printf("2\n");
 }
 
 void RPCServer::ProcessRequest(GeneralSendBuffer *send, uint16_t NodeID, uint16_t offset) {
@@ -179,7 +211,20 @@ void RPCServer::ProcessRequest(GeneralSendBuffer *send, uint16_t NodeID, uint16_
     	// fs->unlockReadHashItem(bufferSend->key, NodeID, bufferSend->offset);
     	  return;
 	} else {
-     	  fs->parseMessage((char*)send, receiveBuffer);
+     	  uint64_t wait = fs->parseMessage((char*)send, receiveBuffer);
+	  if (wait != 0) {
+		/* Request waits (for leases of other clients or for staging), worker serves other requests meanwhile. */
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		RPCTask *task = (RPCTask *)malloc(sizeof(RPCTask));
+		task->send = (uint64_t)send;
+		task->NodeID = NodeID;
+		task->offset = offset;
+		task->timeReady = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000 + wait;
+		lock_guard<mutex> lockTasks(mutexTasks);
+		tasks.push_back(task);
+		return;
+	  }
 	  Debug::debugItem("Debug-RPCServer.cpp: message has been processed");
     	// fs->recursivereaddir("/", 0);
 	  Debug::debugItem("Contract Receive Buffer, size = %d.", size);
@@ -233,17 +278,6 @@ int RPCServer::getIDbyTID() {
 uint64_t RPCServer::ContractReceiveBuffer(GeneralSendBuffer *send, GeneralReceiveBuffer *recv) {
 	uint64_t length;
 	switch (send->message) {
-		case MESSAGE_GETATTR: {
-			GetAttributeReceiveBuffer *bufferRecv = 
-			(GetAttributeReceiveBuffer *)recv;
-			
- 			if (bufferRecv->attribute.count >= 0 && bufferRecv->attribute.count < MAX_FILE_EXTENT_COUNT)
-				length = (MAX_FILE_EXTENT_COUNT - bufferRecv->attribute.count) * sizeof(BlockInfo);
-			else 
-				length = sizeof(BlockInfo) * MAX_FILE_EXTENT_COUNT;
-			
-			break;
-		}
 		case MESSAGE_READDIR: {
 			ReadDirectoryReceiveBuffer *bufferRecv = 
 			(ReadDirectoryReceiveBuffer *)recv;
@@ -273,15 +307,6 @@ uint64_t RPCServer::ContractReceiveBuffer(GeneralSendBuffer *send, GeneralReceiv
 				length = MAX_MESSAGE_BLOCK_COUNT * sizeof(file_pos_tuple);
 			break;
 		}
-		case MESSAGE_READDIRECTORYMETA: {
-			ReadDirectoryMetaReceiveBuffer *bufferRecv = 
-			(ReadDirectoryMetaReceiveBuffer *)recv;
-			if (bufferRecv->meta.count >= 0 && bufferRecv->meta.count <= MAX_DIRECTORY_COUNT)
-				length = (MAX_DIRECTORY_COUNT - bufferRecv->meta.count) * sizeof(DirectoryMetaTuple);
-			else 
-				length = MAX_DIRECTORY_COUNT * sizeof(DirectoryMetaTuple);
-			break;
-		}
 		case MESSAGE_REMOVE: {
 			//GetAttributeReceiveBuffer *bufferRecv = (GetAttributeReceiveBuffer *)recv;
 			length = 0;
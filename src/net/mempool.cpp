@@ -2,7 +2,10 @@
 
 MemoryManager::MemoryManager(uint64_t _mm, uint64_t _ServerCount,  int _DataSize)
 : ServerCount(_ServerCount), MemoryBaseAddress(_mm) {
-    void *shmptr;
+    shmid = -1;
+    fdShm = -1;
+    superblock = NULL;
+    warm = false;
     if (_mm == 0) {
         /* Open Shared Memory. */
         /* Add Data Storage. */
@@ -16,22 +19,15 @@ MemoryManager::MemoryManager(uint64_t _mm, uint64_t _ServerCount,  int _DataSize
         /* Add Server Message Pool. */
         DMFSTotalSize += 2*SERVER_MASSAGE_SIZE * SERVER_MASSAGE_NUM * ServerCount;
 	printf("Debug-mempool.cpp: DMFSTotalSize is %ld\n", (long)DMFSTotalSize);
-        shmid = shmget(SHARE_MEMORY_KEY, DMFSTotalSize + LOCALLOGSIZE + DISTRIBUTEDLOGSIZE + extraDataSize, IPC_CREAT);
-        if (shmid == -1) {
-            Debug::notifyError("shmget error");
-        }
-        shmptr = shmat(shmid, 0, 0);
-        if (shmptr == (void *)(-1)) {
-            Debug::notifyError("shmat error");
-        }
-        MemoryBaseAddress = (uint64_t)shmptr;
-        memset((void *)MemoryBaseAddress, '\0', DMFSTotalSize + LOCALLOGSIZE + DISTRIBUTEDLOGSIZE + extraDataSize);
+        attach(DMFSTotalSize + LOCALLOGSIZE + DISTRIBUTEDLOGSIZE + extraDataSize + SUPERBLOCK_SIZE);
+        /* Memory tier is registered too, so its blocks are read and written by clients in place. */
+        RegisteredSize = DMFSTotalSize + LOCALLOGSIZE + DISTRIBUTEDLOGSIZE + extraDataSize;
     }
     ClientBaseAddress = MemoryBaseAddress;
     ServerSendBaseAddress = MemoryBaseAddress + CLIENT_MESSAGE_SIZE * MAX_CLIENT_NUMBER;
     ServerRecvBaseAddress = ServerSendBaseAddress + SERVER_MASSAGE_SIZE * SERVER_MASSAGE_NUM * ServerCount;
     MetadataBaseAddress = ServerRecvBaseAddress + SERVER_MASSAGE_SIZE * SERVER_MASSAGE_NUM * ServerCount;
-    DataBaseAddress = ServerRecvBaseAddress + METADATA_SIZE;
+    DataBaseAddress = MetadataBaseAddress + METADATA_SIZE;
     LocalLogAddress = _DataSize;
     LocalLogAddress *= (1024 * 1024);
     LocalLogAddress += DataBaseAddress;
@@ -39,14 +35,100 @@ MemoryManager::MemoryManager(uint64_t _mm, uint64_t _ServerCount,  int _DataSize
     DistributedLogAddress = LocalLogAddress + LOCALLOGSIZE;
     /*Extra memory pool to save data*/
     ExtraDataAddress = DistributedLogAddress + DISTRIBUTEDLOGSIZE;
+    if (warm) {
+        memset((void *)ClientBaseAddress, '\0', MetadataBaseAddress - ClientBaseAddress); /* Drop messages of last run. */
+    }
     SendPoolPointer = (uint8_t *)malloc(sizeof(uint8_t) * ServerCount);
     memset((void *)SendPoolPointer, '\0', sizeof(uint8_t) * ServerCount);
 }
 
+/* Map segment, from SHM_FILE_PATH or SysV shared memory. An existing segment of the same size is
+   reused, and with WARM_RESTART its content is kept if superblock matches current layout.
+   Otherwise it is cleared and a new superblock is written.
+   @param   size    Size of segment. */
+void MemoryManager::attach(uint64_t size) {
+    void *shmptr;
+    bool existed = false;
+    if (strlen(SHM_FILE_PATH) != 0) {
+        fdShm = open(SHM_FILE_PATH, O_RDWR | O_CREAT, 0600);
+        if (fdShm == -1) {
+            Debug::notifyError("open %s error", SHM_FILE_PATH);
+        }
+        struct stat st;
+        existed = (fstat(fdShm, &st) == 0) && ((uint64_t)st.st_size == size);
+        if ((existed == false) && (ftruncate(fdShm, size) == -1)) {
+            Debug::notifyError("ftruncate %s error", SHM_FILE_PATH);
+        }
+        shmptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fdShm, 0);
+        if (shmptr == MAP_FAILED) {
+            Debug::notifyError("mmap error");
+        }
+    } else {
+        shmid = shmget(SHARE_MEMORY_KEY, 0, 0);
+        if (shmid != -1) {
+            struct shmid_ds ds;
+            if ((shmctl(shmid, IPC_STAT, &ds) == 0) && ((uint64_t)ds.shm_segsz == size)) {
+                existed = true;
+            } else {
+                shmctl(shmid, IPC_RMID, 0); /* Layout changed, start over. */
+            }
+        }
+        if (existed == false) {
+            shmid = shmget(SHARE_MEMORY_KEY, size, IPC_CREAT);
+        }
+        if (shmid == -1) {
+            Debug::notifyError("shmget error");
+        }
+        shmptr = shmat(shmid, 0, 0);
+        if (shmptr == (void *)(-1)) {
+            Debug::notifyError("shmat error");
+        }
+    }
+    MemoryBaseAddress = (uint64_t)shmptr;
+    SegmentSize = size;
+    superblock = (SuperBlock *)(MemoryBaseAddress + size - SUPERBLOCK_SIZE);
+#if WARM_RESTART
+    warm = existed && (superblock->magic == SUPERBLOCK_MAGIC) && (superblock->version == SUPERBLOCK_VERSION) &&
+        (superblock->sizeTotal == size) && (superblock->countServer == ServerCount);
+#endif
+    if (warm) {
+        Debug::notifyInfo("Reattach segment of last run.");
+        if (superblock->clean == 0) {
+            Debug::notifyError("Segment was not detached cleanly, blocks not written back from RDMA cache are lost.");
+        }
+    } else {
+        memset((void *)MemoryBaseAddress, '\0', size);
+        superblock->magic = SUPERBLOCK_MAGIC;
+        superblock->version = SUPERBLOCK_VERSION;
+        superblock->sequenceBlock = 1;
+        superblock->sizeTotal = size;
+        superblock->countServer = ServerCount;
+    }
+    superblock->clean = 0;
+}
+
 MemoryManager::~MemoryManager() {
     Debug::notifyInfo("Stop MemoryManager.");
     free(SendPoolPointer);
-    shmctl(shmid, IPC_RMID , 0);
+    if (superblock != NULL) {
+#if WARM_RESTART
+        superblock->clean = 1;          /* Keep segment for next run. */
+        if (fdShm != -1) {
+            msync((void *)MemoryBaseAddress, SegmentSize, MS_SYNC);
+            munmap((void *)MemoryBaseAddress, SegmentSize);
+            close(fdShm);
+        } else {
+            shmdt((void *)MemoryBaseAddress);
+        }
+#else
+        if (fdShm != -1) {
+            munmap((void *)MemoryBaseAddress, SegmentSize);
+            close(fdShm);
+        } else {
+            shmctl(shmid, IPC_RMID , 0);
+        }
+#endif
+    }
     Debug::notifyInfo("MemoryManager is closed successfully.");
 }
 
@@ -58,6 +140,10 @@ uint64_t MemoryManager::getDmfsTotalSize() {
     return DMFSTotalSize;
 }
 
+uint64_t MemoryManager::getRegisteredSize() {
+    return RegisteredSize;
+}
+
 uint64_t MemoryManager::getMetadataBaseAddress() {
     return MetadataBaseAddress;
 }
@@ -101,6 +187,20 @@ uint64_t MemoryManager::getExtraDataAddress() {
     return ExtraDataAddress;
 }
 
+/* Offset of extra data (memory tier) from data region. Layout is the same on all servers. */
+uint64_t MemoryManager::getExtraDataOffset() {
+    return ExtraDataAddress - DataBaseAddress;
+}
+
+/* Whether segment of last run is reattached, so metadata and memory tier are kept. */
+bool MemoryManager::isWarm() {
+    return warm;
+}
+
+uint64_t MemoryManager::getBlockSequence() {
+    return __sync_fetch_and_add(&superblock->sequenceBlock, 1);
+}
+
 void MemoryManager::setID(int ID) {
     uint32_t tid = gettid();
     th2id[tid] = ID;
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include "asyncio.hpp"
+
+/* AsyncIO round trip. Blocks of a file are written out of order, with one and two buffers per
+   request and more requests than the depth in flight, then read back the same way, and data and
+   completion results are checked. */
+
+#define BLOCK_LENGTH 0x10000
+#define BLOCK_COUNT 256
+#define IO_DEPTH 16
+#define IO_THREADS 4
+char path[64];
+char *data;                             /* BLOCK_COUNT blocks written. */
+char *back;                             /* BLOCK_COUNT blocks read back. */
+std::atomic<int> countDone;
+std::atomic<int> countFailed;
+
+/* Submit one request per block in a shuffled order, split in two buffers for odd blocks. */
+void submitAll(AsyncIO *io, int fd, bool write, char *base)
+{
+	int order[BLOCK_COUNT];
+	for (int i = 0; i < BLOCK_COUNT; i++)
+		order[i] = i;
+	for (int i = BLOCK_COUNT - 1; i > 0; i--) {
+		int j = rand() % (i + 1);
+		int t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+	countDone = 0;
+	countFailed = 0;
+	for (int i = 0; i < BLOCK_COUNT; i++) {
+		int block = order[i];
+		AsyncIORequest *request = new AsyncIORequest;
+		request->write = write;
+		request->fd = fd;
+		request->offset = (uint64_t)block * BLOCK_LENGTH;
+		char *buffer = base + (uint64_t)block * BLOCK_LENGTH;
+		if (block % 2 == 0) {
+			request->iov[0].iov_base = buffer;
+			request->iov[0].iov_len = BLOCK_LENGTH;
+			request->countIov = 1;
+		} else {
+			request->iov[0].iov_base = buffer;
+			request->iov[0].iov_len = BLOCK_LENGTH / 4;
+			request->iov[1].iov_base = buffer + BLOCK_LENGTH / 4;
+			request->iov[1].iov_len = BLOCK_LENGTH - BLOCK_LENGTH / 4;
+			request->countIov = 2;
+		}
+		request->callback = [](int64_t result) {
+			if (result != BLOCK_LENGTH)
+				countFailed++;
+			countDone++;
+		};
+		io->submit(request);            /* Blocks while IO_DEPTH requests are in flight. */
+		if (i % 7 == 0)
+			io->flush();
+	}
+	io->flush();
+	while (countDone < BLOCK_COUNT)
+		usleep(100);
+}
+
+int main(int argc, char **argv)
+{
+	int errors = 0;
+	sprintf(path, "/tmp/asynciotest.%d", (int)getpid()); /* Unique if run in parallel. */
+	srand(1);
+	data = (char *)malloc((uint64_t)BLOCK_LENGTH * BLOCK_COUNT);
+	back = (char *)malloc((uint64_t)BLOCK_LENGTH * BLOCK_COUNT);
+	for (uint64_t i = 0; i < (uint64_t)BLOCK_LENGTH * BLOCK_COUNT; i++)
+		data[i] = (char)(rand() & 0xFF);
+	memset(back, 0, (uint64_t)BLOCK_LENGTH * BLOCK_COUNT);
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "open %s failed\n", path);
+		return 1;
+	}
+	AsyncIO *io = new AsyncIO(IO_DEPTH, IO_THREADS);
+	printf("asynciotest: %s\n", io->isRing() ? "io_uring" : "thread pool");
+	submitAll(io, fd, true, data);
+	if (countFailed != 0) {
+		fprintf(stderr, "%d writes failed\n", (int)countFailed);
+		errors++;
+	}
+	submitAll(io, fd, false, back);
+	if (countFailed != 0) {
+		fprintf(stderr, "%d reads failed\n", (int)countFailed);
+		errors++;
+	}
+	for (int i = 0; i < BLOCK_COUNT; i++) {
+		if (memcmp(data + (uint64_t)i * BLOCK_LENGTH, back + (uint64_t)i * BLOCK_LENGTH, BLOCK_LENGTH) != 0) {
+			fprintf(stderr, "block %d differs\n", i);
+			errors++;
+		}
+	}
+	delete io;
+	close(fd);
+	unlink(path);
+
+	printf("asynciotest: %s, %d errors\n", (errors == 0) ? "passed" : "FAILED", errors);
+	free(data);
+	free(back);
+	return (errors == 0) ? 0 : 1;
+}
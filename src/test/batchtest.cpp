@@ -0,0 +1,128 @@
+#include "mpi.h"
+#include "nrfs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/* Batched metadata requests. Every process creates, stats and removes names of a directory of its
+   own in batches larger than one request, mixing names that exist, names that are missing, a name
+   given twice and a name in a missing directory. Each path must get its own result, in order of
+   paths: the first of a duplicate succeeds and the second fails, and whole batch fails if any path
+   does. Batches whose paths all succeed must return success. */
+
+#define NAME_COUNT 300                  /* Over BATCH_PATH_COUNT, so batch is split. */
+#define EXISTING_EVERY 3                /* Names created one by one beforehand. */
+int myid;
+int numprocs;
+nrfs fs;
+
+/* Compare results of a batch with results expected. */
+int check(const char *stage, const std::vector<std::string> &paths, const std::vector<int> &results,
+	const std::vector<int> &expected, int result, int resultExpected)
+{
+	int errors = 0;
+	for (size_t i = 0; i < paths.size(); i++) {
+		if (results[i] != expected[i]) {
+			if (errors++ < 4)
+				fprintf(stderr, "[%d] %s: %s gives %d, %d expected\n", myid, stage, paths[i].c_str(), results[i], expected[i]);
+		}
+	}
+	if (result != resultExpected) {
+		fprintf(stderr, "[%d] %s: batch gives %d, %d expected\n", myid, stage, result, resultExpected);
+		errors++;
+	}
+	return errors;
+}
+
+std::vector<const char *> getPointers(const std::vector<std::string> &paths)
+{
+	std::vector<const char *> pointers;
+	for (size_t i = 0; i < paths.size(); i++)
+		pointers.push_back(paths[i].c_str());
+	return pointers;
+}
+
+int main(int argc, char **argv)
+{
+	int errors = 0;
+	int result;
+	char directory[255];
+	char path[255];
+	MPI_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &myid);
+	MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
+	MPI_Barrier(MPI_COMM_WORLD);
+	fs = nrfsConnect("default", 0, 0);
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	sprintf(directory, "/batchtest.%d", myid);
+	if (nrfsCreateDirectory(fs, directory) != 0) {
+		fprintf(stderr, "[%d] mkdir %s fails\n", myid, directory);
+		errors++;
+	}
+	std::vector<std::string> paths;
+	for (int i = 0; i < NAME_COUNT; i++) {
+		sprintf(path, "%s/f%d", directory, i);
+		paths.push_back(path);
+		if ((i % EXISTING_EVERY == 0) && (nrfsMknod(fs, path) != 0))
+			errors++;
+	}
+	paths.push_back(paths[1]);          /* Duplicate of a missing name. */
+	sprintf(path, "/batchtest.missing.%d/f0", myid);
+	paths.push_back(path);              /* Parent does not exist. */
+	std::vector<const char *> pointers = getPointers(paths);
+	std::vector<int> results(paths.size(), 1);
+	std::vector<int> expected(paths.size(), -1);
+
+	for (int i = 0; i < NAME_COUNT; i++)
+		expected[i] = (i % EXISTING_EVERY == 0) ? -1 : 0;
+	result = nrfsMknodBatch(fs, pointers.data(), (int)pointers.size(), results.data());
+	errors += check("mknod", paths, results, expected, result, -1);
+
+	std::vector<FileMeta> attrs(paths.size());
+	for (int i = 0; i < NAME_COUNT; i++)
+		expected[i] = 0;
+	expected[NAME_COUNT] = 0;           /* Stat of a duplicate succeeds twice. */
+	result = nrfsStatBatch(fs, pointers.data(), (int)pointers.size(), attrs.data(), results.data());
+	errors += check("stat", paths, results, expected, result, -1);
+	for (int i = 0; i <= NAME_COUNT; i++) {
+		if ((results[i] == 0) && ((attrs[i].size != 0) || (attrs[i].count != 0))) {
+			fprintf(stderr, "[%d] stat: %s has size %lu\n", myid, paths[i].c_str(), (unsigned long)attrs[i].size);
+			errors++;
+		}
+	}
+
+	expected[NAME_COUNT] = -1;          /* Removed by its first occurrence. */
+	result = nrfsDeleteBatch(fs, pointers.data(), (int)pointers.size(), results.data());
+	errors += check("delete", paths, results, expected, result, -1);
+
+	for (int i = 0; i < NAME_COUNT; i++)
+		expected[i] = -1;
+	result = nrfsStatBatch(fs, pointers.data(), (int)pointers.size(), attrs.data(), results.data());
+	errors += check("stat removed", paths, results, expected, result, -1);
+
+	paths.resize(NAME_COUNT);           /* Every path succeeds now. */
+	pointers = getPointers(paths);
+	results.assign(paths.size(), 1);
+	expected.assign(paths.size(), 0);
+	result = nrfsMknodBatch(fs, pointers.data(), (int)pointers.size(), results.data());
+	errors += check("mknod all", paths, results, expected, result, 0);
+	result = nrfsStatBatch(fs, pointers.data(), (int)pointers.size(), attrs.data(), results.data());
+	errors += check("stat all", paths, results, expected, result, 0);
+	result = nrfsDeleteBatch(fs, pointers.data(), (int)pointers.size(), results.data());
+	errors += check("delete all", paths, results, expected, result, 0);
+	if (nrfsDelete(fs, directory) != 0) {
+		fprintf(stderr, "[%d] rmdir %s fails\n", myid, directory);
+		errors++;
+	}
+
+	int total;
+	MPI_Reduce(&errors, &total, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+	if (myid == 0)
+		printf("batchtest: %s, %d errors\n", (total == 0) ? "passed" : "FAILED", total);
+	nrfsDisconnect(fs);
+	MPI_Finalize();
+	return (errors == 0) ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "bitmap.hpp"
+
+/* Bitmap with summary levels. Random bits of bitmaps of several sizes are set and cleared, around
+   word and summary level boundaries, and each result is checked against a plain array of bits:
+   status, count of free bits and first free bit. Bits must stay most significant bit first in the
+   buffer, and a bitmap built again on the same buffer must give the same results. */
+
+#define OPERATION_COUNT 200000
+
+/* Check bitmap against reference bits, bit by bit and through first free bit. */
+int check(Bitmap *bitmap, const char *buffer, const std::vector<bool> &bits, uint64_t count, const char *stage)
+{
+	int errors = 0;
+	uint64_t countFree = 0;
+	uint64_t first = count;
+	for (uint64_t pos = 0; pos < count; pos++) {
+		bool status;
+		bool layout = ((buffer[pos / 8] & (0x80 >> (pos % 8))) != 0);
+		if ((bitmap->get(pos, &status) == false) || (status != bits[pos]) || (layout != bits[pos])) {
+			if (errors++ < 4)
+				fprintf(stderr, "%s: bit %lu of %lu is wrong\n", stage, (unsigned long)pos, (unsigned long)count);
+		}
+		if (bits[pos] == false) {
+			countFree++;
+			if (first == count)
+				first = pos;
+		}
+	}
+	uint64_t pos;
+	bool found = bitmap->findFree(&pos);
+	if ((bitmap->countFree() != countFree) || (bitmap->countTotal() != count) ||
+		(found != (first != count)) || (found && (pos != first))) {
+		fprintf(stderr, "%s: %lu bits, %lu free, first free %lu, bitmap says %lu free, first free %lu\n", stage,
+			(unsigned long)count, (unsigned long)countFree, (unsigned long)first,
+			(unsigned long)bitmap->countFree(), found ? (unsigned long)pos : (unsigned long)count);
+		errors++;
+	}
+	return errors;
+}
+
+int run(uint64_t count, unsigned *seed)
+{
+	int errors = 0;
+	char *buffer = (char *)calloc(1, count / 8 + 1);
+	std::vector<bool> bits(count, false);
+	Bitmap *bitmap = new Bitmap(count, buffer);
+	errors += check(bitmap, buffer, bits, count, "empty");
+	uint64_t operations = (count < OPERATION_COUNT / 4) ? OPERATION_COUNT / 4 : count * 2;
+	for (uint64_t i = 0; (i < operations) && (errors == 0); i++) {
+		int action = rand_r(seed) % 8;
+		if (action < 4) {
+			/* Allocate as tables do: take first free bit. */
+			uint64_t pos;
+			if (bitmap->findFree(&pos)) {
+				if ((pos >= count) || bits[pos]) {
+					fprintf(stderr, "first free bit %lu of %lu is not free\n", (unsigned long)pos, (unsigned long)count);
+					errors++;
+					break;
+				}
+				bitmap->set(pos);
+				bits[pos] = true;
+			}
+		} else if (action < 7) {
+			uint64_t pos = rand_r(seed) % count;
+			bitmap->clear(pos);
+			bits[pos] = false;
+		} else {
+			uint64_t pos = rand_r(seed) % count;
+			bitmap->set(pos);               /* Setting a set bit changes nothing. */
+			bits[pos] = true;
+		}
+		if (i % 997 == 0)
+			errors += check(bitmap, buffer, bits, count, "churn");
+	}
+	errors += check(bitmap, buffer, bits, count, "after churn");
+	for (uint64_t pos = 0; pos < count; pos++) {
+		bitmap->set(pos);
+		bits[pos] = true;
+	}
+	errors += check(bitmap, buffer, bits, count, "full");
+	if ((bitmap->set(count) == true) || (bitmap->clear(count) == true)) {
+		fprintf(stderr, "bit %lu past end is accepted\n", (unsigned long)count);
+		errors++;
+	}
+	for (uint64_t pos = 0; pos < count; pos += 3) {
+		bitmap->clear(pos);
+		bits[pos] = false;
+	}
+	delete bitmap;
+	bitmap = new Bitmap(count, buffer);     /* Summary is rebuilt from persisted buffer. */
+	errors += check(bitmap, buffer, bits, count, "rebuilt");
+	delete bitmap;
+	free(buffer);
+	return errors;
+}
+
+int main(int argc, char **argv)
+{
+	int errors = 0;
+	unsigned seed = 1;
+	uint64_t counts[] = {8, 56, 64, 72, 4096, 4104, 64 * 64 * 3 + 8, 64 * 64 * 64 + 8};
+	for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+		errors += run(counts[i], &seed);
+
+	printf("bitmaptest: %s, %d errors\n", (errors == 0) ? "passed" : "FAILED", errors);
+	return (errors == 0) ? 0 : 1;
+}
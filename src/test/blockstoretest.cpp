@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include "blockstore.hpp"
+
+/* Log block store compaction and recovery. A log file is churned: blocks are rewritten until old
+   segments are recycled, half of them are removed, and the rest are rewritten. Once the log has
+   turned over, no removed key has an older record left and all tombstones must have been dropped.
+   The store is then reopened from the log and every block is checked again. The posix engine gets
+   the same round trip with asynchronous writes. */
+
+#define BLOCK_LENGTH (1024 * 1024 + 512)   /* Not aligned, so records take the copy path too. */
+#define KEY_COUNT 96
+#define ROUND_CHURN 8
+#define ROUND_AFTER_REMOVE 64        /* Log of 8 segments turns over several times. */
+#define POSIX_KEY_COUNT 16
+char path[64];
+char pathPosix[64];
+char *buffer;
+char *expected;
+
+void fill(char *data, uint64_t key, int round)
+{
+	for (int i = 0; i < BLOCK_LENGTH; i += sizeof(uint64_t))
+		*(uint64_t *)(data + i) = (key << 32) ^ ((uint64_t)round << 16) ^ (uint64_t)i;
+}
+
+bool writeRound(BlockStore *store, int round, uint64_t step)
+{
+	for (uint64_t key = 0; key < KEY_COUNT; key += step) {
+		fill(buffer, key, round);
+		if (store->set(key + 1, buffer, BLOCK_LENGTH) == false) {
+			fprintf(stderr, "set key %lu round %d failed\n", (unsigned long)key, round);
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Kept keys (even) hold data of round, removed keys (odd) are gone. */
+int check(BlockStore *store, int round, const char *stage)
+{
+	int errors = 0;
+	for (uint64_t key = 0; key < KEY_COUNT; key++) {
+		int64_t length = store->get(key + 1, buffer, BLOCK_LENGTH);
+		if (key % 2 == 1) {
+			if (length != -1) {
+				fprintf(stderr, "%s: removed key %lu is back\n", stage, (unsigned long)key);
+				errors++;
+			}
+			continue;
+		}
+		fill(expected, key, round);
+		if ((length != BLOCK_LENGTH) || (memcmp(buffer, expected, BLOCK_LENGTH) != 0)) {
+			fprintf(stderr, "%s: key %lu has wrong data, length %ld\n", stage, (unsigned long)key, (long)length);
+			errors++;
+		}
+	}
+	return errors;
+}
+
+/* Write blocks asynchronously, remove odd keys, then reopen the directory and check what is left. */
+int checkPosix()
+{
+	int errors = 0;
+	char *data = (char *)malloc((uint64_t)BLOCK_LENGTH * POSIX_KEY_COUNT);
+	std::atomic<int> countDone(0);
+	std::atomic<int> countFailed(0);
+	BlockStore *store = BlockStore::create("posix", pathPosix, 0, false);
+	if (store == NULL) {
+		fprintf(stderr, "open %s failed\n", pathPosix);
+		free(data);
+		return 1;
+	}
+	for (uint64_t key = 0; key < POSIX_KEY_COUNT; key++) {
+		fill(data + key * BLOCK_LENGTH, key, 1);
+		store->setAsync(key + 1, data + key * BLOCK_LENGTH, BLOCK_LENGTH, [&countDone, &countFailed](int64_t result) {
+			if (result != BLOCK_LENGTH)
+				countFailed++;
+			countDone++;
+		});
+	}
+	store->flush();
+	while (countDone < POSIX_KEY_COUNT)
+		usleep(100);
+	if (countFailed != 0) {
+		fprintf(stderr, "posix: %d writes failed\n", (int)countFailed);
+		errors++;
+	}
+	for (uint64_t key = 1; key < POSIX_KEY_COUNT; key += 2)
+		store->remove(key + 1);
+	delete store;
+
+	store = BlockStore::create("posix", pathPosix, 0, true);
+	if (store == NULL) {
+		fprintf(stderr, "recover %s failed\n", pathPosix);
+		free(data);
+		return errors + 1;
+	}
+	for (uint64_t key = 0; key < POSIX_KEY_COUNT; key++) {
+		int64_t length = store->get(key + 1, buffer, BLOCK_LENGTH);
+		if ((key % 2 == 1) ? (length != -1) :
+			((length != BLOCK_LENGTH) || (memcmp(buffer, data + key * BLOCK_LENGTH, BLOCK_LENGTH) != 0))) {
+			fprintf(stderr, "posix: key %lu is wrong after recovery, length %ld\n", (unsigned long)key, (long)length);
+			errors++;
+		}
+		store->remove(key + 1);
+	}
+	delete store;
+	rmdir(pathPosix);
+	free(data);
+	return errors;
+}
+
+int main(int argc, char **argv)
+{
+	int errors = 0;
+	sprintf(path, "/tmp/blockstoretest.%d.log", (int)getpid()); /* Unique if run in parallel. */
+	sprintf(pathPosix, "/tmp/blockstoretest.%d.posix", (int)getpid());
+	buffer = (char *)malloc(BLOCK_LENGTH);
+	expected = (char *)malloc(BLOCK_LENGTH);
+	uint64_t capacity = (LOG_COMPACT_FREE + 4) * LOG_SEGMENT_SIZE;
+
+	LogBlockStore *store = (LogBlockStore *)BlockStore::create("log", path, capacity, false);
+	if (store == NULL) {
+		fprintf(stderr, "open %s failed\n", path);
+		return 1;
+	}
+	int round;
+	for (round = 0; round < ROUND_CHURN; round++) {
+		if (writeRound(store, round, 1) == false)
+			errors++;
+	}
+	for (uint64_t key = 1; key < KEY_COUNT; key += 2) {
+		if (store->remove(key + 1) == false) {
+			fprintf(stderr, "remove key %lu failed\n", (unsigned long)key);
+			errors++;
+		}
+	}
+	round--;
+	errors += check(store, round, "after remove");
+	for (int i = 0; (i < ROUND_AFTER_REMOVE) && (store->countTombstones() != 0); i++) {
+		if (writeRound(store, ++round, 2) == false)
+			errors++;
+	}
+	/* Compactor looks for nearly empty segments about once a second. */
+	for (int i = 0; (i < 10) && (store->countTombstones() != 0); i++)
+		sleep(1);
+	if (store->countTombstones() != 0) {
+		fprintf(stderr, "%lu tombstones are never dropped\n", (unsigned long)store->countTombstones());
+		errors++;
+	}
+	errors += check(store, round, "after compaction");
+	delete store;
+
+	store = (LogBlockStore *)BlockStore::create("log", path, capacity, true);
+	if (store == NULL) {
+		fprintf(stderr, "recover %s failed\n", path);
+		return 1;
+	}
+	errors += check(store, round, "after recovery");
+	if (store->countTombstones() != 0) {
+		fprintf(stderr, "%lu tombstones after recovery\n", (unsigned long)store->countTombstones());
+		errors++;
+	}
+	delete store;
+	unlink(path);
+	errors += checkPosix();
+
+	printf("blockstoretest: %s, %d errors\n", (errors == 0) ? "passed" : "FAILED", errors);
+	free(buffer);
+	free(expected);
+	return (errors == 0) ? 0 : 1;
+}
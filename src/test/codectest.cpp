@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "codec.hpp"
+#include "storage.hpp"
+
+/* Block codecs and memory tier packing of compressed blocks. Round trips of the codecs built in are
+   checked first, then several threads write, read and remove blocks of random chunk counts in one
+   MemBlockStore. Blocks are checked after the churn and after rebuilding the index from the same
+   buffer, and removing everything must return all memory tier blocks to the table. */
+
+#define TABLE_BLOCKS 16
+#define THREAD_COUNT 4
+#define KEYS_PER_THREAD 64
+#define ROUNDS 2000
+char *bufferTable;
+
+/* Data of a key written in a round, length is a function of both too. */
+uint64_t fill(char *data, uint64_t key, uint64_t round)
+{
+	uint64_t length = ((key * 7 + round * 13) % (MEM_CHUNK_COUNT - 1) + 1) * MEM_CHUNK_SIZE - (round % 97);
+	for (uint64_t i = 0; i < length; i += sizeof(uint64_t)) /* Buffers have room for the tail. */
+		*(uint64_t *)(data + i) = (key << 40) ^ (round << 20) ^ i;
+	return length;
+}
+
+int checkCodecs()
+{
+	int errors = 0;
+	uint64_t size = BLOCK_SIZE / 4;
+	char *src = (char *)malloc(size);
+	char *packed = (char *)malloc(size);
+	char *back = (char *)malloc(size);
+	uint16_t codecs[3] = {CODEC_NONE, CODEC_LZ4, CODEC_ZSTD};
+	for (int c = 0; c < 3; c++) {
+		uint16_t codec = codecs[c];
+		for (uint64_t i = 0; i < size; i++)
+			src[i] = (char)((i / 64) % 251); /* Compressible. */
+		if (codec == CODEC_NONE) {
+			if ((Codec::decompress(codec, src, size, back, size) == false) || (memcmp(src, back, size) != 0)) {
+				fprintf(stderr, "codec none does not copy\n");
+				errors++;
+			}
+			continue;
+		}
+		uint64_t length = Codec::compress(codec, src, size, packed, size);
+		if (Codec::available(codec) == false) {
+			if (length != 0) {
+				fprintf(stderr, "codec %s is not built in but compresses\n", Codec::name(codec));
+				errors++;
+			}
+			continue;
+		}
+		if ((length == 0) || (length >= size) ||
+			(Codec::decompress(codec, packed, length, back, size) == false) || (memcmp(src, back, size) != 0)) {
+			fprintf(stderr, "codec %s round trip failed, length %lu\n", Codec::name(codec), (unsigned long)length);
+			errors++;
+		}
+		for (uint64_t i = 0; i < size; i++)
+			src[i] = (char)(rand() & 0xFF); /* Incompressible, must not fit in a smaller buffer. */
+		if (Codec::compress(codec, src, size, packed, size / 2) != 0) {
+			fprintf(stderr, "codec %s overflows its buffer\n", Codec::name(codec));
+			errors++;
+		}
+		printf("codectest: codec %s checked\n", Codec::name(codec));
+	}
+	free(src);
+	free(packed);
+	free(back);
+	return errors;
+}
+
+/* Each thread owns its keys and remembers the round each one was last written in, 0 if removed. */
+void churn(MemBlockStore *store, int id, uint64_t *rounds, int *errors)
+{
+	char *data = (char *)malloc(MEM_CHUNK_COUNT * MEM_CHUNK_SIZE);
+	char *back = (char *)malloc(MEM_CHUNK_COUNT * MEM_CHUNK_SIZE);
+	unsigned seed = id + 1;
+	for (uint64_t round = 1; round <= ROUNDS; round++) {
+		int slot = rand_r(&seed) % KEYS_PER_THREAD;
+		uint64_t key = (uint64_t)id * KEYS_PER_THREAD + slot + 1;
+		int action = rand_r(&seed) % 4;
+		if (action == 0) {
+			if (store->remove(key) != (rounds[slot] != 0))
+				(*errors)++;
+			rounds[slot] = 0;
+		} else if (action == 1) {
+			int64_t length = store->get(key, back, MEM_CHUNK_COUNT * MEM_CHUNK_SIZE);
+			if (rounds[slot] == 0) {
+				if (length != -1)
+					(*errors)++;
+			} else {
+				uint64_t expected = fill(data, key, rounds[slot]);
+				if ((length != (int64_t)expected) || (memcmp(data, back, expected) != 0))
+					(*errors)++;
+			}
+		} else {
+			uint64_t length = fill(data, key, round);
+			if (store->set(key, data, length))
+				rounds[slot] = round;
+			/* Memory tier full keeps old data. */
+		}
+	}
+	free(data);
+	free(back);
+}
+
+int checkAll(MemBlockStore *store, uint64_t rounds[][KEYS_PER_THREAD], const char *stage)
+{
+	int errors = 0;
+	char *data = (char *)malloc(MEM_CHUNK_COUNT * MEM_CHUNK_SIZE);
+	char *back = (char *)malloc(MEM_CHUNK_COUNT * MEM_CHUNK_SIZE);
+	for (int id = 0; id < THREAD_COUNT; id++) {
+		for (int slot = 0; slot < KEYS_PER_THREAD; slot++) {
+			uint64_t key = (uint64_t)id * KEYS_PER_THREAD + slot + 1;
+			int64_t length = store->get(key, back, MEM_CHUNK_COUNT * MEM_CHUNK_SIZE);
+			if (rounds[id][slot] == 0) {
+				if (length != -1) {
+					fprintf(stderr, "%s: removed key %lu is found\n", stage, (unsigned long)key);
+					errors++;
+				}
+				continue;
+			}
+			uint64_t expected = fill(data, key, rounds[id][slot]);
+			if ((length != (int64_t)expected) || (memcmp(data, back, expected) != 0)) {
+				fprintf(stderr, "%s: key %lu has wrong data\n", stage, (unsigned long)key);
+				errors++;
+			}
+		}
+	}
+	free(data);
+	free(back);
+	return errors;
+}
+
+int main(int argc, char **argv)
+{
+	int errors = 0;
+	srand(1);
+	errors += checkCodecs();
+
+	uint64_t sizeTable = (uint64_t)TABLE_BLOCKS * BLOCK_SIZE + TABLE_BLOCKS / 8;
+	bufferTable = (char *)calloc(1, sizeTable);
+	Table<Block> *table = new Table<Block>(bufferTable, TABLE_BLOCKS);
+	MemBlockStore *store = new MemBlockStore(table, bufferTable);
+	static uint64_t rounds[THREAD_COUNT][KEYS_PER_THREAD];
+	int errorsThread[THREAD_COUNT] = {0};
+	std::vector<std::thread> threads;
+	for (int id = 0; id < THREAD_COUNT; id++)
+		threads.push_back(std::thread(churn, store, id, rounds[id], &errorsThread[id]));
+	for (int id = 0; id < THREAD_COUNT; id++) {
+		threads[id].join();
+		if (errorsThread[id] != 0) {
+			fprintf(stderr, "thread %d saw %d wrong results\n", id, errorsThread[id]);
+			errors += errorsThread[id];
+		}
+	}
+	errors += checkAll(store, rounds, "after churn");
+
+	delete store;                       /* Buffer is kept, as on warm restart. */
+	store = new MemBlockStore(table, bufferTable);
+	store->recover();
+	errors += checkAll(store, rounds, "after recovery");
+	for (int id = 0; id < THREAD_COUNT; id++) {
+		for (int slot = 0; slot < KEYS_PER_THREAD; slot++) {
+			if (rounds[id][slot] != 0)
+				store->remove((uint64_t)id * KEYS_PER_THREAD + slot + 1);
+		}
+	}
+	if (table->countSavedItems() != 0) {
+		fprintf(stderr, "%lu memory tier blocks are not returned\n", (unsigned long)table->countSavedItems());
+		errors++;
+	}
+	delete store;
+	delete table;
+	free(bufferTable);
+
+	printf("codectest: %s, %d errors\n", (errors == 0) ? "passed" : "FAILED", errors);
+	return (errors == 0) ? 0 : 1;
+}
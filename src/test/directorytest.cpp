@@ -0,0 +1,265 @@
+#include "mpi.h"
+#include "nrfs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+/* Directory pages. Every process fills a directory of its own over several pages, then removes and
+   creates names at random, so removal moves last name of a page into the freed slot and empty pages
+   are released and taken again. Listing through cursors must return every name once and nothing
+   else all along, a removed name must be gone and creating an existing name must fail.
+   Then all processes add and remove names in one directory fast enough to split it by load, and
+   between rounds every process lists it: each name must be found once, whichever shard has it.
+   Last, all processes fill a directory past DIRECTORY_SPLIT_COUNT while one of them keeps trying to
+   remove it. Removal must fail and return while splits run, succeed once names are gone, and
+   leave no shard behind for a directory made again at the same path. */
+
+#define NAME_COUNT 150                  /* About 3 directory pages. */
+#define ROUNDS 1000
+#define CHECK_EVERY 100
+#define SHARED_NAME_COUNT 300           /* Names of each process in shared directory, over DIRECTORY_SPLIT_LOAD_COUNT. */
+#define SHARED_ROUNDS 8
+#define SHARED_CHURN 5000               /* Adds and removes of each process in a round. */
+#define SPLIT_WAIT 200000               /* us to wait for splits queued in a round. */
+#define RMDIR_NAME_COUNT 1200           /* Names of each process in directory removed while it splits. */
+#define RMDIR_EVERY 50                  /* Names created between tries to remove it. */
+int myid;
+int numprocs;
+nrfs fs;
+
+void getPath(char *path, const char *directory, int i)
+{
+	sprintf(path, "%s/f%d", directory, i);
+}
+
+/* List directory through cursors and check names against the ones expected. */
+int check(const char *directory, const std::vector<bool> &exists, const char *stage)
+{
+	int errors = 0;
+	std::vector<int> seen(exists.size(), 0);
+	uint64_t cursor = 0;
+	nrfsfilelist list;
+	do {
+		if (nrfsListDirectoryNext(fs, directory, &cursor, &list) != 0) {
+			fprintf(stderr, "[%d] %s: listing %s fails\n", myid, stage, directory);
+			return errors + 1;
+		}
+		for (uint64_t i = 0; i < list.count; i++) {
+			int name;
+			if ((sscanf(list.tuple[i].names, "f%d", &name) != 1) || (name < 0) || (name >= (int)exists.size())) {
+				fprintf(stderr, "[%d] %s: unknown name %s\n", myid, stage, list.tuple[i].names);
+				errors++;
+			} else {
+				seen[name]++;
+			}
+		}
+	} while (cursor != 0);
+	for (size_t i = 0; i < exists.size(); i++) {
+		if (seen[i] != (exists[i] ? 1 : 0)) {
+			if (errors++ < 4)
+				fprintf(stderr, "[%d] %s: f%d listed %d times\n", myid, stage, (int)i, seen[i]);
+		}
+	}
+	return errors;
+}
+
+/* List shared directory and check names of all processes, gathered from each of them. */
+int checkShared(const char *directory, const std::vector<char> &exists, int round)
+{
+	int errors = 0;
+	std::vector<char> existsAll(SHARED_NAME_COUNT * numprocs);
+	MPI_Allgather((void *)exists.data(), SHARED_NAME_COUNT, MPI_CHAR, existsAll.data(), SHARED_NAME_COUNT, MPI_CHAR, MPI_COMM_WORLD);
+	std::vector<int> seen(existsAll.size(), 0);
+	uint64_t cursor = 0;
+	nrfsfilelist list;
+	do {
+		if (nrfsListDirectoryNext(fs, directory, &cursor, &list) != 0) {
+			fprintf(stderr, "[%d] round %d: listing %s fails\n", myid, round, directory);
+			return errors + 1;
+		}
+		for (uint64_t i = 0; i < list.count; i++) {
+			int id, name;
+			if ((sscanf(list.tuple[i].names, "r%d.%d", &id, &name) != 2) || (id < 0) || (id >= numprocs) ||
+				(name < 0) || (name >= SHARED_NAME_COUNT)) {
+				fprintf(stderr, "[%d] round %d: unknown name %s\n", myid, round, list.tuple[i].names);
+				errors++;
+			} else {
+				seen[id * SHARED_NAME_COUNT + name]++;
+			}
+		}
+	} while (cursor != 0);
+	for (size_t i = 0; i < existsAll.size(); i++) {
+		if (seen[i] != (existsAll[i] ? 1 : 0)) {
+			if (errors++ < 4)
+				fprintf(stderr, "[%d] round %d: r%d.%d listed %d times\n", myid, round,
+					(int)(i / SHARED_NAME_COUNT), (int)(i % SHARED_NAME_COUNT), seen[i]);
+		}
+	}
+	return errors;
+}
+
+int main(int argc, char **argv)
+{
+	int errors = 0;
+	char directory[255];
+	char path[255];
+	MPI_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &myid);
+	MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
+	MPI_Barrier(MPI_COMM_WORLD);
+	fs = nrfsConnect("default", 0, 0);
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	sprintf(directory, "/dirtest.%d", myid);
+	if (nrfsCreateDirectory(fs, directory) != 0) {
+		fprintf(stderr, "[%d] mkdir %s fails\n", myid, directory);
+		errors++;
+	}
+	std::vector<bool> exists(NAME_COUNT, false);
+	errors += check(directory, exists, "empty");
+	for (int i = 0; i < NAME_COUNT; i++) {
+		getPath(path, directory, i);
+		if (nrfsMknod(fs, path) != 0)
+			errors++;
+		exists[i] = true;
+	}
+	errors += check(directory, exists, "filled");
+
+	unsigned seed = myid + 1;
+	for (int round = 1; round <= ROUNDS; round++) {
+		int i = rand_r(&seed) % NAME_COUNT;
+		getPath(path, directory, i);
+		if (exists[i]) {
+			if ((nrfsMknod(fs, path) == 0) || (nrfsDelete(fs, path) != 0)) {
+				fprintf(stderr, "[%d] round %d: f%d is created again or is not removed\n", myid, round, i);
+				errors++;
+			}
+			exists[i] = false;
+			if (nrfsAccess(fs, path) == 0) {
+				fprintf(stderr, "[%d] round %d: f%d is found after removal\n", myid, round, i);
+				errors++;
+			}
+		} else {
+			if (nrfsMknod(fs, path) != 0) {
+				fprintf(stderr, "[%d] round %d: f%d is not created\n", myid, round, i);
+				errors++;
+			}
+			exists[i] = true;
+		}
+		if (round % CHECK_EVERY == 0)
+			errors += check(directory, exists, "churn");
+	}
+
+	for (int i = 0; i < NAME_COUNT; i++) {
+		if (exists[i]) {
+			getPath(path, directory, i);
+			if (nrfsDelete(fs, path) != 0)
+				errors++;
+			exists[i] = false;
+		}
+	}
+	errors += check(directory, exists, "emptied");
+	if (nrfsDelete(fs, directory) != 0) {
+		fprintf(stderr, "[%d] rmdir %s fails\n", myid, directory);
+		errors++;
+	}
+
+	strcpy(directory, "/splittest");
+	if ((myid == 0) && (nrfsCreateDirectory(fs, directory) != 0)) {
+		fprintf(stderr, "[%d] mkdir %s fails\n", myid, directory);
+		errors++;
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+	std::vector<char> existsShared(SHARED_NAME_COUNT, 0);
+	for (int i = 0; i < SHARED_NAME_COUNT; i++) {
+		sprintf(path, "%s/r%d.%d", directory, myid, i);
+		if (nrfsMknod(fs, path) != 0)
+			errors++;
+		existsShared[i] = 1;
+	}
+	for (int round = 0; round < SHARED_ROUNDS; round++) {
+		for (int j = 0; j < SHARED_CHURN; j++) {
+			int i = rand_r(&seed) % SHARED_NAME_COUNT;
+			sprintf(path, "%s/r%d.%d", directory, myid, i);
+			if (existsShared[i]) {
+				if (nrfsDelete(fs, path) != 0)
+					errors++;
+				existsShared[i] = 0;
+			} else {
+				if (nrfsMknod(fs, path) != 0)
+					errors++;
+				existsShared[i] = 1;
+			}
+		}
+		usleep(SPLIT_WAIT);
+		MPI_Barrier(MPI_COMM_WORLD);
+		errors += checkShared(directory, existsShared, round);
+		MPI_Barrier(MPI_COMM_WORLD);
+	}
+	for (int i = 0; i < SHARED_NAME_COUNT; i++) {
+		if (existsShared[i]) {
+			sprintf(path, "%s/r%d.%d", directory, myid, i);
+			if (nrfsDelete(fs, path) != 0)
+				errors++;
+			existsShared[i] = 0;
+		}
+	}
+	errors += checkShared(directory, existsShared, SHARED_ROUNDS);
+	MPI_Barrier(MPI_COMM_WORLD);
+	if ((myid == 0) && (nrfsDelete(fs, directory) != 0)) {
+		fprintf(stderr, "[%d] rmdir %s fails\n", myid, directory);
+		errors++;
+	}
+
+	strcpy(directory, "/rmdirtest");
+	if ((myid == 0) && (nrfsCreateDirectory(fs, directory) != 0)) {
+		fprintf(stderr, "[%d] mkdir %s fails\n", myid, directory);
+		errors++;
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+	for (int i = 0; i < RMDIR_NAME_COUNT; i++) {
+		sprintf(path, "%s/r%d.%d", directory, myid, i);
+		if (nrfsMknod(fs, path) != 0)
+			errors++;
+		if ((myid == 0) && (i % RMDIR_EVERY == 0) && (nrfsDelete(fs, directory) == 0)) {
+			fprintf(stderr, "[%d] %s is removed with %d names in it\n", myid, directory, i + 1);
+			errors++;
+		}
+	}
+	usleep(SPLIT_WAIT);
+	MPI_Barrier(MPI_COMM_WORLD);
+	for (int i = 0; i < RMDIR_NAME_COUNT; i++) {
+		sprintf(path, "%s/r%d.%d", directory, myid, i);
+		if (nrfsDelete(fs, path) != 0)
+			errors++;
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+	if (myid == 0) {
+		if (nrfsDelete(fs, directory) != 0) {
+			fprintf(stderr, "[%d] rmdir %s fails once it is empty\n", myid, directory);
+			errors++;
+		}
+		if (nrfsCreateDirectory(fs, directory) != 0) {
+			fprintf(stderr, "[%d] mkdir %s again fails\n", myid, directory);
+			errors++;
+		}
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+	std::vector<char> existsNone(SHARED_NAME_COUNT, 0);
+	errors += checkShared(directory, existsNone, -1); /* Names of old shards must be gone. */
+	MPI_Barrier(MPI_COMM_WORLD);
+	if ((myid == 0) && (nrfsDelete(fs, directory) != 0)) {
+		fprintf(stderr, "[%d] rmdir %s fails\n", myid, directory);
+		errors++;
+	}
+
+	int total;
+	MPI_Reduce(&errors, &total, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+	if (myid == 0)
+		printf("directorytest: %s, %d errors\n", (total == 0) ? "passed" : "FAILED", total);
+	nrfsDisconnect(fs);
+	MPI_Finalize();
+	return (errors == 0) ? 0 : 1;
+}
@@ -63,17 +63,32 @@ static int fuse_access(const char *path, int mask)
 static int fuse_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 		       off_t offset, struct fuse_file_info *fi)
 {
-	nrfsfilelist list;
+	nrfsfilelistplus *list = (nrfsfilelistplus *)malloc(sizeof(nrfsfilelistplus));
 	uint32_t i;
 	struct stat st;
-	nrfsListDirectory(fs, path, &list);
-	for(i = 0; i < list.count; i++)
-	{
-		memset(&st, 0, sizeof(st));
-		st.st_mode = (list.tuple[i].isDirectories == 1) ? S_IFDIR : S_IFMT;
-		if (filler(buf, list.tuple[i].names, &st, 0))
+	uint64_t cursor = 0;
+	do {
+		/* Attributes come along and are cached, so following getattr calls need no request. */
+		if (nrfsListDirectoryPlus(fs, path, &cursor, list))
 			break;
-	}
+		for(i = 0; i < list->count; i++)
+		{
+			memset(&st, 0, sizeof(st));
+			st.st_mode = (list->entry[i].tuple.isDirectories == 1) ? S_IFDIR : S_IFMT;
+			if (list->entry[i].valid && (list->entry[i].count != MAX_FILE_EXTENT_COUNT))
+			{
+				st.st_mode = S_IFREG;
+				st.st_size = list->entry[i].size;
+				st.st_mtime = list->entry[i].timeLastModified;
+			}
+			if (filler(buf, list->entry[i].tuple.names, &st, 0))
+			{
+				free(list);
+				return 0;
+			}
+		}
+	} while (cursor != 0);
+	free(list);
 	return 0;
 }
 
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "hashtable.hpp"
+
+/* Hash table under churn. A table is kept near its load limit while several threads put new paths
+   and delete old ones, many times more than the table has slots, and check their own paths are
+   found with the right meta all along. Deleted slots must be reclaimed meanwhile: in the end misses
+   still stop after a few groups instead of probing the whole table. */
+
+#define TABLE_COUNT 4096
+#define THREAD_COUNT 4
+#define KEYS_PER_THREAD 700             /* About 70% of the items table is sized for. */
+#define ROUNDS 20000
+#define MISS_COUNT 10000
+#define MISS_PROBE_MAX 16               /* Max groups probed by a miss. */
+#define MISS_PROBE_AVERAGE 2            /* Max average groups probed by a miss. */
+
+void getPath(char *path, int id, uint64_t key, uint64_t round)
+{
+	sprintf(path, "/churn/%d/%lu/%lu", id, (unsigned long)key, (unsigned long)round);
+}
+
+/* Each thread owns its keys and remembers the round each one was last put in. */
+void churn(HashTable *table, int id, int *errors)
+{
+	uint64_t rounds[KEYS_PER_THREAD];
+	char path[MAX_PATH_LENGTH];
+	unsigned seed = id + 1;
+	for (uint64_t key = 0; key < KEYS_PER_THREAD; key++) {
+		rounds[key] = 0;
+		getPath(path, id, key, 0);
+		if (table->put(path, key, (key % 2 == 1)) == false)
+			(*errors)++;
+	}
+	for (uint64_t round = 1; round <= ROUNDS; round++) {
+		uint64_t key = rand_r(&seed) % KEYS_PER_THREAD;
+		uint64_t indexMeta;
+		bool isDirectory;
+		getPath(path, id, key, rounds[key]);
+		if ((table->get(path, &indexMeta, &isDirectory) == false) || (indexMeta != key) || (isDirectory != (key % 2 == 1)))
+			(*errors)++;
+		if (table->del(path) == false)
+			(*errors)++;
+		if (table->get(path, &indexMeta, &isDirectory) == true)
+			(*errors)++;
+		rounds[key] = round;
+		getPath(path, id, key, round);
+		if (table->put(path, key, (key % 2 == 1)) == false)
+			(*errors)++;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int errors = 0;
+
+	uint64_t sizeBuffer = HASH_ITEMS_SIZE + 2 * TABLE_COUNT * sizeof(HashEntry); /* More than the table uses. */
+	char *buffer = (char *)aligned_alloc(64, sizeBuffer);
+	memset(buffer, 0, sizeBuffer);
+	HashTable *table = new HashTable(buffer, TABLE_COUNT);
+	if (table->sizeBufferUsed > sizeBuffer) {
+		fprintf(stderr, "table needs %lu bytes\n", (unsigned long)table->sizeBufferUsed);
+		return 1;
+	}
+	int errorsThread[THREAD_COUNT] = {0};
+	std::vector<std::thread> threads;
+	for (int id = 0; id < THREAD_COUNT; id++)
+		threads.push_back(std::thread(churn, table, id, &errorsThread[id]));
+	for (int id = 0; id < THREAD_COUNT; id++) {
+		threads[id].join();
+		if (errorsThread[id] != 0) {
+			fprintf(stderr, "thread %d saw %d wrong results\n", id, errorsThread[id]);
+			errors += errorsThread[id];
+		}
+	}
+	if (table->getSavedItemsCount() != THREAD_COUNT * KEYS_PER_THREAD) {
+		fprintf(stderr, "%lu items saved\n", (unsigned long)table->getSavedItemsCount());
+		errors++;
+	}
+
+	uint64_t total = 0, max = 0;
+	for (uint64_t i = 0; i < MISS_COUNT; i++) {
+		char path[MAX_PATH_LENGTH];
+		UniqueHash hashUnique;
+		sprintf(path, "/missing/%lu", (unsigned long)i);
+		HashTable::getUniqueHash(path, strlen(path), &hashUnique);
+		uint64_t length = table->getProbeLength(&hashUnique);
+		total += length;
+		if (length > max)
+			max = length;
+	}
+	if ((max > MISS_PROBE_MAX) || (total > MISS_COUNT * MISS_PROBE_AVERAGE)) {
+		fprintf(stderr, "misses probe %lu groups at most, %.2f on average, %lu deleted slots\n",
+			(unsigned long)max, (double)total / MISS_COUNT, (unsigned long)table->getDeletedItemsCount());
+		errors++;
+	}
+	printf("hashtabletest: misses probe %lu groups at most, %.2f on average\n", (unsigned long)max, (double)total / MISS_COUNT);
+	delete table;
+	free(buffer);
+
+	printf("hashtabletest: %s, %d errors\n", (errors == 0) ? "passed" : "FAILED", errors);
+	return (errors == 0) ? 0 : 1;
+}
@@ -176,14 +176,18 @@ void do_ls()
 	    }
 	    return;
 	}
-	nrfsListDirectory(fs, path, &list);
-	for(i = 0; i < list.count; i++)
-	{
-		if(list.tuple[i].isDirectories == 0) /* file */
-			printf("%s\t", list.tuple[i].names);
-		else
-			printf("\033[0;34m%s\t\033[0m", list.tuple[i].names);
-	}
+	uint64_t cursor = 0;
+	do {
+		if (nrfsListDirectoryNext(fs, path, &cursor, &list))
+			break;
+		for(i = 0; i < list.count; i++)
+		{
+			if(list.tuple[i].isDirectories == 0) /* file */
+				printf("%s\t", list.tuple[i].names);
+			else
+				printf("\033[0;34m%s\t\033[0m", list.tuple[i].names);
+		}
+	} while (cursor != 0);
 	printf("\n");
 }
 void do_touch()
@@ -0,0 +1,152 @@
+#include "mpi.h"
+#include "nrfs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+/* Open with create. Every process opens a file of its own without and with O_CREAT, then opens it
+   again once written; attributes cached by open must carry size and last modified time of file.
+   Then all processes open one shared missing path with O_CREAT at once: every open must succeed
+   and the directory must list the shared name exactly once. */
+
+#define DATA_SIZE 4096
+#define TIME_SLACK 60                   /* Seconds, clocks of servers and clients may differ. */
+int myid;
+int numprocs;
+nrfs fs;
+
+/* Check attributes cached by open against size expected and time of test. */
+int checkAttribute(const char *path, uint64_t size, time_t timeStart, const char *stage)
+{
+	FileMeta attr;
+	if (nrfsGetAttribute(fs, (nrfsFile)path, &attr) != 0) {
+		fprintf(stderr, "[%d] %s: getattr of %s fails\n", myid, stage, path);
+		return 1;
+	}
+	int errors = 0;
+	if (attr.size != size) {
+		fprintf(stderr, "[%d] %s: %s has size %lu, %lu expected\n", myid, stage, path,
+			(unsigned long)attr.size, (unsigned long)size);
+		errors++;
+	}
+	if ((attr.timeLastModified < timeStart - TIME_SLACK) || (attr.timeLastModified > time(NULL) + TIME_SLACK)) {
+		fprintf(stderr, "[%d] %s: %s has last modified time %ld\n", myid, stage, path, (long)attr.timeLastModified);
+		errors++;
+	}
+	return errors;
+}
+
+int main(int argc, char **argv)
+{
+	int errors = 0;
+	char path[255];
+	const char *directory = "/opentest";
+	const char *pathShared = "/opentest/shared";
+	MPI_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &myid);
+	MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
+	MPI_Barrier(MPI_COMM_WORLD);
+	fs = nrfsConnect("default", 0, 0);
+	MPI_Barrier(MPI_COMM_WORLD);
+	time_t timeStart = time(NULL);
+
+	if ((myid == 0) && (nrfsCreateDirectory(fs, directory) != 0)) {
+		fprintf(stderr, "[%d] mkdir %s fails\n", myid, directory);
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	sprintf(path, "%s/p%d", directory, myid);
+	nrfsFile file = nrfsOpenFile(fs, path, O_RDWR);
+	if (file != NULL) {
+		fprintf(stderr, "[%d] %s is opened before it is created\n", myid, path);
+		nrfsCloseFile(fs, file);
+		errors++;
+	}
+	file = nrfsOpenFile(fs, path, O_CREAT | O_RDWR);
+	if (file == NULL) {
+		fprintf(stderr, "[%d] create %s fails\n", myid, path);
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+	if (nrfsAccess(fs, path) != 0) {
+		fprintf(stderr, "[%d] %s is not found after create\n", myid, path);
+		errors++;
+	}
+	errors += checkAttribute(path, 0, timeStart, "created");
+	char *buffer = (char *)malloc(DATA_SIZE);
+	memset(buffer, myid + 1, DATA_SIZE);
+	if (nrfsWrite(fs, file, buffer, DATA_SIZE, 0) != DATA_SIZE)
+		errors++;
+	nrfsCloseFile(fs, file);
+	file = nrfsOpenFile(fs, path, O_CREAT | O_RDWR); /* Existing file is opened, not created again. */
+	if (file == NULL) {
+		fprintf(stderr, "[%d] open %s again fails\n", myid, path);
+		errors++;
+	} else {
+		errors += checkAttribute(path, DATA_SIZE, timeStart, "reopened");
+		nrfsCloseFile(fs, file);
+	}
+	free(buffer);
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	file = nrfsOpenFile(fs, pathShared, O_CREAT | O_RDWR);
+	if (file == NULL) {
+		fprintf(stderr, "[%d] open %s with create fails\n", myid, pathShared);
+		errors++;
+	} else {
+		errors += checkAttribute(pathShared, 0, timeStart, "shared");
+		nrfsCloseFile(fs, file);
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	if (myid == 0) {
+		std::vector<int> seen(numprocs + 1, 0); /* Last one is shared name. */
+		uint64_t cursor = 0;
+		nrfsfilelist list;
+		do {
+			if (nrfsListDirectoryNext(fs, directory, &cursor, &list) != 0) {
+				fprintf(stderr, "[%d] listing %s fails\n", myid, directory);
+				errors++;
+				break;
+			}
+			for (uint64_t i = 0; i < list.count; i++) {
+				int id;
+				if (strcmp(list.tuple[i].names, "shared") == 0) {
+					seen[numprocs]++;
+				} else if ((sscanf(list.tuple[i].names, "p%d", &id) == 1) && (id >= 0) && (id < numprocs)) {
+					seen[id]++;
+				} else {
+					fprintf(stderr, "[%d] unknown name %s\n", myid, list.tuple[i].names);
+					errors++;
+				}
+			}
+		} while (cursor != 0);
+		for (int i = 0; i <= numprocs; i++) {
+			if (seen[i] != 1) {
+				fprintf(stderr, "[%d] name %d listed %d times\n", myid, i, seen[i]);
+				errors++;
+			}
+		}
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	if (nrfsDelete(fs, path) != 0)
+		errors++;
+	MPI_Barrier(MPI_COMM_WORLD);
+	if (myid == 0) {
+		if (nrfsDelete(fs, pathShared) != 0)
+			errors++;
+		if (nrfsDelete(fs, directory) != 0)
+			errors++;
+	}
+
+	int total;
+	MPI_Reduce(&errors, &total, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+	if (myid == 0)
+		printf("opentest: %s, %d errors\n", (total == 0) ? "passed" : "FAILED", total);
+	nrfsDisconnect(fs);
+	MPI_Finalize();
+	return (errors == 0) ? 0 : 1;
+}
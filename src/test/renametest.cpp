@@ -0,0 +1,104 @@
+#include "mpi.h"
+#include "nrfs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Rename of files with blocks beyond inline ones. Every process writes a file with blocks in
+   extent pages, then renames it along a chain of names, so it moves within a node and between
+   nodes by turns. After each rename old path must be gone, and size and every block must be
+   read back unchanged from new path. */
+
+#define BLOCK_COUNT (FILE_INLINE_BLOCK_COUNT + 2) /* Last blocks are kept in an extent page. */
+#define RENAME_COUNT 8
+int myid;
+int numprocs;
+nrfs fs;
+
+void fillBlock(char *buffer, int block)
+{
+	for (uint64_t i = 0; i < BLOCK_SIZE; i += 8)
+		*(uint64_t *)(buffer + i) = ((uint64_t)myid << 48) | ((uint64_t)block << 32) | (i >> 3);
+}
+
+/* Read file back and compare every block with what was written. */
+int check(const char *path, char *buffer, char *expected, const char *stage)
+{
+	int errors = 0;
+	FileMeta attr;
+	if ((nrfsGetAttribute(fs, (nrfsFile)path, &attr) != 0) || (attr.size != (uint64_t)BLOCK_COUNT * BLOCK_SIZE)) {
+		fprintf(stderr, "[%d] %s: %s has wrong size\n", myid, stage, path);
+		return 1;
+	}
+	nrfsFile file = nrfsOpenFile(fs, path, O_RDONLY);
+	if (file == NULL) {
+		fprintf(stderr, "[%d] %s: %s cannot be opened\n", myid, stage, path);
+		return 1;
+	}
+	for (int block = 0; block < BLOCK_COUNT; block++) {
+		fillBlock(expected, block);
+		if ((nrfsRead(fs, file, buffer, BLOCK_SIZE, (uint64_t)block * BLOCK_SIZE) != BLOCK_SIZE) ||
+			(memcmp(buffer, expected, BLOCK_SIZE) != 0)) {
+			fprintf(stderr, "[%d] %s: block %d of %s is wrong\n", myid, stage, block, path);
+			errors++;
+		}
+	}
+	nrfsCloseFile(fs, file);
+	return errors;
+}
+
+int main(int argc, char **argv)
+{
+	int errors = 0;
+	char path[255];
+	char pathNew[255];
+	MPI_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &myid);
+	MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
+	MPI_Barrier(MPI_COMM_WORLD);
+	fs = nrfsConnect("default", 0, 0);
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	char *buffer = (char *)malloc(BLOCK_SIZE);
+	char *expected = (char *)malloc(BLOCK_SIZE);
+	sprintf(path, "/renametest.%d.0", myid);
+	nrfsFile file = nrfsOpenFile(fs, path, O_CREAT | O_RDWR);
+	if (file == NULL) {
+		fprintf(stderr, "[%d] create %s fails\n", myid, path);
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+	for (int block = 0; block < BLOCK_COUNT; block++) {
+		fillBlock(buffer, block);
+		if (nrfsWrite(fs, file, buffer, BLOCK_SIZE, (uint64_t)block * BLOCK_SIZE) != BLOCK_SIZE)
+			errors++;
+	}
+	nrfsCloseFile(fs, file);
+	errors += check(path, buffer, expected, "written");
+
+	for (int i = 1; i <= RENAME_COUNT; i++) {
+		sprintf(pathNew, "/renametest.%d.%d", myid, i);
+		if (nrfsRename(fs, path, pathNew) != 0) {
+			fprintf(stderr, "[%d] rename %s to %s fails\n", myid, path, pathNew);
+			errors++;
+			break;
+		}
+		if (nrfsAccess(fs, path) == 0) {
+			fprintf(stderr, "[%d] %s is found after rename\n", myid, path);
+			errors++;
+		}
+		strcpy(path, pathNew);
+		errors += check(path, buffer, expected, "renamed");
+	}
+	if (nrfsDelete(fs, path) != 0)
+		errors++;
+	free(buffer);
+	free(expected);
+
+	int total;
+	MPI_Reduce(&errors, &total, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+	if (myid == 0)
+		printf("renametest: %s, %d errors\n", (total == 0) ? "passed" : "FAILED", total);
+	nrfsDisconnect(fs);
+	MPI_Finalize();
+	return (errors == 0) ? 0 : 1;
+}